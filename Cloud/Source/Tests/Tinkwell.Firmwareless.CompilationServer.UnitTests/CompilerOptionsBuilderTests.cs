@@ -99,6 +99,23 @@ public class CompilerOptionsBuilderTests
         string.Join(' ', args).Should().Contain("-o \"output.aot\" \"input.wasm\"");
     }
 
+    [Fact]
+    public void Build_ByDefault_ShouldEnableStackBoundsChecks()
+    {
+        // Arrange
+        var target = CompilationTarget.Parse("test_linux");
+        var builder = new CompilerOptionsBuilder(target);
+        builder.UseMetaArchitectures(TestMetaArchFile);
+        builder.UseValidation(TestValidationFile);
+        builder.UseCompilerConfiguration(TestOptionsFile);
+
+        // Act
+        var args = builder.Build();
+
+        // Assert
+        args.Should().Contain("--stack-bounds-checks=1");
+    }
+
     private const string MetaArchYaml = @"
 schema: 1
 normalize:
@@ -0,0 +1,36 @@
+using FluentAssertions;
+using Tinkwell.Firmwareless.CompilationServer.Services;
+using Xunit;
+
+namespace Tinkwell.Firmwareless.CompilationServer.UnitTests;
+
+public class StackUsageSummaryTests
+{
+    [Fact]
+    public void Parse_WithValidLines_ShouldReturnMaxAndTotal()
+    {
+        // Arrange
+        string[] lines = ["aot_func#0\t32\tstatic", "aot_func#1\t128\tstatic", "aot_func#2\t16\tdynamic"];
+
+        // Act
+        var summary = StackUsageSummary.Parse(lines);
+
+        // Assert
+        summary.MaxFrameSize.Should().Be(128);
+        summary.TotalFrameSize.Should().Be(176);
+    }
+
+    [Fact]
+    public void Parse_WithInvalidLines_ShouldIgnoreThem()
+    {
+        // Arrange
+        string[] lines = ["", "aot_func#0", "aot_func#1\tlarge\tstatic", "aot_func#2\t-8\tstatic", "aot_func#3\t64\tstatic"];
+
+        // Act
+        var summary = StackUsageSummary.Parse(lines);
+
+        // Assert
+        summary.MaxFrameSize.Should().Be(64);
+        summary.TotalFrameSize.Should().Be(64);
+    }
+}
@@ -25,6 +25,7 @@ public sealed class CompilationService : ICompilationService
             var parameters = new Compiler.Request(job.Id, job.WorkingDirectoryPath, request.Architecture)
             { 
                 GetOutputFileName = GetOutputFileName,
+                GetStackUsageFileName = GetStackUsageFileName,
                 Manifest = manifest,
                 Metadata = metadata,
             };
@@ -46,4 +47,7 @@ public sealed class CompilationService : ICompilationService
 
     private static string GetOutputFileName(string inputFileName)
         => Path.ChangeExtension(Path.GetFileName(inputFileName), ".aot");
+
+    private static string GetStackUsageFileName(string inputFileName)
+        => Path.ChangeExtension(Path.GetFileName(inputFileName), ".su");
 }
@@ -1,5 +1,6 @@
 ﻿using Docker.DotNet;
 using Docker.DotNet.Models;
+using System.Globalization;
 using System.Text.Json;
 
 namespace Tinkwell.Firmwareless.CompilationServer.Services;
@@ -11,7 +12,9 @@ public sealed class Compiler
         public required CompilationManifest Manifest { get; set; }
         public Dictionary<string, string> Metadata { get; set; } = new();
         public required Func<string, string> GetOutputFileName { get; set; }
-        public string? StackUsageFile { get; set; }
+        // When set wamrc writes the stack usage of each function of the compilation unit in this file,
+        // the result is summarized in the package manifest (see AddStackUsageMetadataAsync()).
+        public Func<string, string>? GetStackUsageFileName { get; set; }
         public bool VerboseLog { get; set; }
     };
 
@@ -41,6 +44,10 @@ public sealed class Compiler
 
         request.Metadata.Add("compiler_name", "wamrc");
         request.Metadata.Add("compiler_success", success.ToString().ToLowerInvariant());
+
+        if (success)
+            await AddStackUsageMetadataAsync(request, cancellationToken);
+
         var metadata = JsonSerializer.Serialize(request.Metadata, JsonDefaults.Options);
         await File.WriteAllTextAsync(Path.Combine(request.WorkingDirectory, Names.CompiledFirmwareManifestEntryName), metadata, cancellationToken);
 
@@ -70,7 +77,7 @@ public sealed class Compiler
 
         var options = new CompilerOptionsBuilderOptions
         {
-            StackUsageFile = request.StackUsageFile,
+            StackUsageFile = request.GetStackUsageFileName is null ? null : $"{ContainerWorkingDirectory}/{request.GetStackUsageFileName(input)}",
             EnableMultiThread = request.Manifest.EnableMultiThread,
             EnableTailCall = request.Manifest.EnableTailCall,
             EnableGarbageCollection = request.Manifest.EnableGarbageCollection,
@@ -80,6 +87,28 @@ public sealed class Compiler
         return builder.Build(options);
     }
 
+    // The host uses these values to size the native stack of each module instance (AOT frames are on the native stack).
+    private async Task AddStackUsageMetadataAsync(Request request, CancellationToken cancellationToken)
+    {
+        if (request.GetStackUsageFileName is null)
+            return;
+
+        foreach (var unit in request.Manifest.CompilationUnits)
+        {
+            var path = Path.Combine(request.WorkingDirectory, request.GetStackUsageFileName(unit));
+            if (!File.Exists(path))
+            {
+                _logger.LogWarning("Stack usage file for {Unit} has not been generated", unit);
+                continue;
+            }
+
+            var summary = StackUsageSummary.Parse(await File.ReadAllLinesAsync(path, cancellationToken));
+            var moduleName = request.GetOutputFileName(unit);
+            request.Metadata[$"stack_frame_max:{moduleName}"] = summary.MaxFrameSize.ToString(CultureInfo.InvariantCulture);
+            request.Metadata[$"stack_frame_total:{moduleName}"] = summary.TotalFrameSize.ToString(CultureInfo.InvariantCulture);
+        }
+    }
+
     private async Task<(bool success, string stdout, string stderr)> RunCompilerContainerAsync(string hostPath, CancellationToken cancellationToken)
     {
         // Check that the compiler image exists locally
@@ -5,6 +5,9 @@ sealed class CompilerOptionsBuilderOptions
     public string? StackUsageFile { get; set; }
     public bool EnableMultiThread { get; set; }
     public bool EnableTailCall { get; set; } = true;
+    // The host limits how much native stack each module can use (see stack_frame_max and stack_frame_total in the
+    // package metadata), with these checks AOT code stops at that boundary instead of overflowing the thread
+    public bool EnableStackBoundsChecks { get; set; } = true;
     public bool EnableGarbageCollection { get; set; }
     public bool VerboseLog { get; set; }
 }
@@ -81,6 +84,8 @@ sealed partial class CompilerOptionsBuilder
             _basicParameters.Add("--enable-multi-thread");
         if (options.EnableTailCall)
             _basicParameters.Add("--enable-tail-call");
+        if (options.EnableStackBoundsChecks)
+            _basicParameters.Add("--stack-bounds-checks=1");
         if (!string.IsNullOrWhiteSpace(options.StackUsageFile))
             _basicParameters.Add($"--stack-usage=\"{options.StackUsageFile}\"");
         if (options.VerboseLog)
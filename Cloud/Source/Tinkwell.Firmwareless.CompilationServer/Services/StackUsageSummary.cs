@@ -0,0 +1,24 @@
+namespace Tinkwell.Firmwareless.CompilationServer.Services;
+
+// Summary of the stack usage file generated by wamrc for a compilation unit. The sum of all the frames is
+// an upper bound of the stack needed by the module when there is no recursion.
+sealed record StackUsageSummary(long MaxFrameSize, long TotalFrameSize)
+{
+    // Each line is "<function>\t<size>\t<qualifiers>", lines we do not understand are ignored.
+    public static StackUsageSummary Parse(IEnumerable<string> lines)
+    {
+        long maxFrameSize = 0;
+        long totalFrameSize = 0;
+        foreach (var line in lines)
+        {
+            var fields = line.Split('\t');
+            if (fields.Length < 2 || !long.TryParse(fields[1], out var frameSize) || frameSize < 0)
+                continue;
+
+            maxFrameSize = Math.Max(maxFrameSize, frameSize);
+            totalFrameSize += frameSize;
+        }
+
+        return new(maxFrameSize, totalFrameSize);
+    }
+}
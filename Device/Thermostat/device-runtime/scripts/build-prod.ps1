@@ -0,0 +1,6 @@
+if (-not $env:IDF_PATH) {
+    . "../esp-idf/export.ps1"
+}
+
+Set-Location ./src
+idf.py --preset prod build
\ No newline at end of file
@@ -0,0 +1,35 @@
+# Creates a delta update (detools patch, heatshrink compressed) from the image currently
+# running on the device to a new build. Requires "pip install detools".
+# Usage: ./scripts/create-delta.ps1 <base.bin> [new.bin] [patch.bin]
+param(
+    [Parameter(Mandatory = $true)][string]$BaseBin,
+    [string]$NewBin = "./build/tw-therm-dr.bin",
+    [string]$PatchFile = "./build/tw-therm-dr.patch"
+)
+
+# Ensure we're in the project root
+if (-Not ((Test-Path "./CMakeLists.txt") -and (Test-Path "./sdkconfig"))) {
+    Set-Location ./src
+}
+
+if (-Not (Test-Path $BaseBin)) {
+    throw "Base image '$BaseBin' not found, it must be the exact binary running on the device"
+}
+
+if (-Not (Test-Path $NewBin)) {
+    throw "New image '$NewBin' not found, build the project first"
+}
+
+Write-Host "`e[34mCreating patch`e[0m"
+detools create_patch --compression heatshrink $BaseBin $NewBin $PatchFile
+if ($LASTEXITCODE -ne 0) {
+    throw "detools failed with exit code $LASTEXITCODE"
+}
+
+$newSize = (Get-Item $NewBin).Length
+$patchSize = (Get-Item $PatchFile).Length
+$digest = (Get-FileHash -Algorithm SHA256 $NewBin).Hash.ToLowerInvariant()
+
+Write-Host "Image size: $newSize bytes"
+Write-Host "Patch size: $patchSize bytes ($("{0:P1}" -f ($patchSize / $newSize)))"
+Write-Host "SHA-256 of the new image (expected by the device): $digest"
@@ -57,14 +57,20 @@ function Get-PartitionLength($name) {
 }
 
 Write-Host "`e[34mReading partition table`e[0m"
-$factoryOffset = Get-PartitionOffset "factory"
+$appOffset = Get-PartitionOffset "ota_0"
 $configOffset = Get-PartitionOffset "config"
 $configLength = Get-PartitionLength "config"
 $configEnd = $configOffset + $configLength
+$certsOffset = Get-PartitionOffset "certs"
+$certsLength = Get-PartitionLength "certs"
+$spoolOffset = Get-PartitionOffset "mqtt_spool"
+$spoolLength = Get-PartitionLength "mqtt_spool"
 
-Write-Host "Factory offset: 0x$("{0:X}" -f $factoryOffset)"
+Write-Host "Application (ota_0) offset: 0x$("{0:X}" -f $appOffset)"
 Write-Host "Config offset at: 0x$("{0:X}" -f $configOffset)"
 Write-Host "Config ends at: 0x$("{0:X}" -f $configEnd)"
+Write-Host "Certificates offset at: 0x$("{0:X}" -f $certsOffset)"
+Write-Host "MQTT spool offset at: 0x$("{0:X}" -f $spoolOffset)"
 
 # Build the project
 Write-Host "`e[34mBuilding project`e[0m"
@@ -83,7 +89,7 @@ $mergeArgs = @(
     "--flash_size", "4MB",
     "0x1000", "./build/bootloader/bootloader.bin",
     "0x8000", "./build/partition_table/partition-table.bin",
-    ("0x{0:x}" -f $factoryOffset), $appBin
+    ("0x{0:x}" -f $appOffset), $appBin
 )
 
 
@@ -95,6 +101,8 @@ if (Test-Path $patchSource) {
     $baseBytes = [System.IO.File]::ReadAllBytes((Resolve-Path $baseFlash).Path)
     $patchBytes = [System.IO.File]::ReadAllBytes((Resolve-Path $patchSource).Path)
     [Array]::Copy($patchBytes, $configOffset, $baseBytes, $configOffset, $configLength)
+    [Array]::Copy($patchBytes, $certsOffset, $baseBytes, $certsOffset, $certsLength)
+    [Array]::Copy($patchBytes, $spoolOffset, $baseBytes, $spoolOffset, $spoolLength)
     [System.IO.File]::WriteAllBytes((Resolve-Path $patchedFlash).Path, $baseBytes)
 } else {
     Write-Host "`e[34mCopying merged binary`e[0m"
@@ -0,0 +1,9 @@
+# Builds and runs the host (Linux) tests in test/host, Unity is taken from ESP-IDF
+if (-not $env:IDF_PATH) {
+    . "../esp-idf/export.ps1"
+}
+
+Set-Location ./test/host
+cmake -S . -B build
+cmake --build build
+ctest --test-dir build --output-on-failure
@@ -0,0 +1,94 @@
+# Runs the QEMU test of the delta update (test/qemu/ota_delta). The test application is built twice
+# (version 1 and 2), a patch from 1 to 2 is created and version 1 runs in QEMU from ota_0: it
+# downloads the patch from the host (the first download is cut, it must be resumed with a range
+# request), applies it and restarts with version 2 from ota_1.
+# Requires "pip install detools" and qemu-system-xtensa (idf_tools.py install qemu-xtensa).
+param(
+    [int]$Port = 8070,
+    [int]$TimeoutSeconds = 300
+)
+
+if (-not $env:IDF_PATH) {
+    . "../esp-idf/export.ps1"
+}
+
+Set-Location ./test/qemu/ota_delta
+$ErrorActionPreference = "Stop"
+
+$tempDir = "./temp"
+$newBuild = "$tempDir/build_new"
+$baseBuild = "$tempDir/build_base"
+$patchFile = "$tempDir/update.patch"
+$flashFile = "$tempDir/qemu_flash.bin"
+$qemuLog = "$tempDir/qemu.log"
+$serverLog = "$tempDir/server.log"
+
+if (Test-Path $tempDir) {
+    Remove-Item -Recurse -Force $tempDir
+}
+New-Item -ItemType Directory -Path $tempDir | Out-Null
+
+Write-Host "`e[34mBuilding version 2`e[0m"
+idf.py -B $newBuild -D SDKCONFIG="$newBuild/sdkconfig" -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;sdkconfig.new" build
+if ($LASTEXITCODE -ne 0) { throw "Build of version 2 failed" }
+$newBin = "$newBuild/ota-delta-test.bin"
+$digest = (Get-FileHash -Algorithm SHA256 $newBin).Hash.ToLowerInvariant()
+
+# Version 1 must know the digest of version 2, it's given to it with its configuration
+Write-Host "`e[34mBuilding version 1`e[0m"
+New-Item -ItemType Directory -Path $baseBuild | Out-Null
+Set-Content -Path "$baseBuild/sdkconfig.digest" -Value "CONFIG_TW_OTA_TEST_SHA256=`"$digest`""
+idf.py -B $baseBuild -D SDKCONFIG="$baseBuild/sdkconfig" -D SDKCONFIG_DEFAULTS="sdkconfig.defaults;$baseBuild/sdkconfig.digest" build
+if ($LASTEXITCODE -ne 0) { throw "Build of version 1 failed" }
+$baseBin = "$baseBuild/ota-delta-test.bin"
+
+Write-Host "`e[34mCreating patch`e[0m"
+detools create_patch --compression heatshrink $baseBin $newBin $patchFile
+if ($LASTEXITCODE -ne 0) { throw "detools failed with exit code $LASTEXITCODE" }
+Write-Host "Image size: $((Get-Item $newBin).Length) bytes, patch size: $((Get-Item $patchFile).Length) bytes"
+
+# Empty otadata: the bootloader starts ota_0
+Write-Host "`e[34mCreating flash binary`e[0m"
+esptool.py --chip esp32 merge_bin --output $flashFile --fill-flash-size 4MB --flash_mode dio --flash_freq 40m `
+    --flash_size 4MB 0x1000 "$baseBuild/bootloader/bootloader.bin" 0x8000 "$baseBuild/partition_table/partition-table.bin" `
+    0x10000 $baseBin
+if ($LASTEXITCODE -ne 0) { throw "esptool failed with exit code $LASTEXITCODE" }
+
+Write-Host "`e[34mRunning the test`e[0m"
+$server = Start-Process -PassThru -NoNewWindow -RedirectStandardOutput $serverLog -FilePath "python" `
+    -ArgumentList "serve_patch.py", $patchFile, "--port", $Port
+$qemu = Start-Process -PassThru -NoNewWindow -FilePath "qemu-system-xtensa" -ArgumentList `
+    "-machine", "esp32", "-display", "none", "-drive", "file=$flashFile,if=mtd,format=raw", `
+    "-nic", "user,model=open_eth", "-serial", "file:$qemuLog"
+
+$result = $null
+$deadline = (Get-Date).AddSeconds($TimeoutSeconds)
+try {
+    while ($null -eq $result -and (Get-Date) -lt $deadline) {
+        Start-Sleep -Seconds 1
+        if (Test-Path $qemuLog) {
+            $result = Select-String -Path $qemuLog -Pattern "^OTA_DELTA_TEST: (PASS|FAIL)" | Select-Object -First 1
+        }
+    }
+}
+finally {
+    Stop-Process -Id $qemu.Id -ErrorAction SilentlyContinue
+    Stop-Process -Id $server.Id -ErrorAction SilentlyContinue
+}
+
+Select-String -Path $qemuLog -Pattern "^OTA_DELTA_TEST:|ota:" | ForEach-Object { Write-Host $_.Line }
+Get-Content $serverLog | ForEach-Object { Write-Host $_ }
+
+if ($null -eq $result) {
+    throw "The test did not complete within $TimeoutSeconds seconds, see $qemuLog"
+}
+
+if ($result.Line -notmatch "PASS") {
+    throw "Test failed: $($result.Line)"
+}
+
+if (-not (Select-String -Path $serverLog -Pattern " 206 " -Quiet)) {
+    throw "The interrupted download has not been resumed with a range request"
+}
+
+Write-Host "`e[32mDelta update test passed`e[0m"
@@ -0,0 +1,127 @@
+# Runs the QEMU benchmark of the TLS handshake (test/qemu/tls_handshake) with the development and the
+# production configuration. For each one it prints the time and the peak heap of mbedTLS of a full
+# and of a resumed handshake, with an ECDSA (broker) and an RSA (OTA servers) certificate.
+# QEMU does not emulate the timing of the chip: compare the two profiles, not the absolute figures.
+# Requires openssl and qemu-system-xtensa (idf_tools.py install qemu-xtensa).
+param(
+    [int]$EcdsaPort = 8443,
+    [int]$RsaPort = 8444,
+    [int]$TimeoutSeconds = 300
+)
+
+if (-not $env:IDF_PATH) {
+    . "../esp-idf/export.ps1"
+}
+
+Set-Location ./test/qemu/tls_handshake
+$ErrorActionPreference = "Stop"
+
+$tempDir = "./temp"
+$certsDir = "$tempDir/certs"
+$serverLog = "$tempDir/server.log"
+
+if (Test-Path $tempDir) {
+    Remove-Item -Recurse -Force $tempDir
+}
+New-Item -ItemType Directory -Path $certsDir | Out-Null
+
+# The CA is embedded in the application, the servers use a certificate for "localhost" signed by it
+Write-Host "`e[34mCreating certificates`e[0m"
+Set-Content -Path "$certsDir/san.ext" -Value "subjectAltName=DNS:localhost"
+openssl ecparam -name prime256v1 -genkey -noout -out "$certsDir/ca.key"
+openssl req -x509 -new -key "$certsDir/ca.key" -subj "/CN=Thermostat benchmark CA" -days 30 -out "$certsDir/ca.pem"
+openssl ecparam -name prime256v1 -genkey -noout -out "$certsDir/ecdsa.key"
+openssl genrsa -out "$certsDir/rsa.key" 2048
+foreach ($name in "ecdsa", "rsa") {
+    openssl req -new -key "$certsDir/$name.key" -subj "/CN=localhost" -out "$certsDir/$name.csr"
+    openssl x509 -req -in "$certsDir/$name.csr" -CA "$certsDir/ca.pem" -CAkey "$certsDir/ca.key" -CAcreateserial `
+        -days 30 -extfile "$certsDir/san.ext" -out "$certsDir/$name.pem"
+}
+if ($LASTEXITCODE -ne 0) { throw "openssl failed with exit code $LASTEXITCODE" }
+
+# Same configuration files as the presets in src/CMakePresets.json
+$profiles = [ordered]@{
+    "development" = "../../../src/sdkconfig;sdkconfig.defaults"
+    "production"  = "../../../src/sdkconfig;../../../src/sdkconfig.defaults.prod;sdkconfig.defaults"
+}
+
+$server = Start-Process -PassThru -NoNewWindow -RedirectStandardOutput $serverLog -FilePath "python" `
+    -ArgumentList "tls_server.py", $certsDir, "--ecdsa-port", $EcdsaPort, "--rsa-port", $RsaPort
+
+$results = @()
+try {
+    foreach ($name in $profiles.Keys) {
+        $build = "$tempDir/build_$name"
+        $flashFile = "$build/qemu_flash.bin"
+        $qemuLog = "$tempDir/qemu_$name.log"
+
+        Write-Host "`e[34mBuilding the $name profile`e[0m"
+        idf.py -B $build -D SDKCONFIG="$build/sdkconfig" -D SDKCONFIG_DEFAULTS="$($profiles[$name])" build
+        if ($LASTEXITCODE -ne 0) { throw "Build of the $name profile failed" }
+
+        esptool.py --chip esp32 merge_bin --output $flashFile --fill-flash-size 4MB --flash_mode dio --flash_freq 40m `
+            --flash_size 4MB 0x1000 "$build/bootloader/bootloader.bin" 0x8000 "$build/partition_table/partition-table.bin" `
+            0x10000 "$build/tls-handshake-bench.bin"
+        if ($LASTEXITCODE -ne 0) { throw "esptool failed with exit code $LASTEXITCODE" }
+
+        Write-Host "`e[34mRunning the $name profile`e[0m"
+        $qemu = Start-Process -PassThru -NoNewWindow -FilePath "qemu-system-xtensa" -ArgumentList `
+            "-machine", "esp32", "-display", "none", "-drive", "file=$flashFile,if=mtd,format=raw", `
+            "-nic", "user,model=open_eth", "-serial", "file:$qemuLog"
+
+        $result = $null
+        $deadline = (Get-Date).AddSeconds($TimeoutSeconds)
+        try {
+            while ($null -eq $result -and (Get-Date) -lt $deadline) {
+                Start-Sleep -Seconds 1
+                if (Test-Path $qemuLog) {
+                    $result = Select-String -Path $qemuLog -Pattern "^TLS_BENCH: (DONE|FAIL)" | Select-Object -First 1
+                }
+            }
+        }
+        finally {
+            Stop-Process -Id $qemu.Id -ErrorAction SilentlyContinue
+        }
+
+        if ($null -eq $result) {
+            throw "The $name profile did not complete within $TimeoutSeconds seconds, see $qemuLog"
+        }
+        if ($result.Line -notmatch "DONE") {
+            throw "Handshake failed with the $name profile, see $qemuLog"
+        }
+
+        foreach ($line in Select-String -Path $qemuLog -Pattern "^TLS_BENCH: (\w+) (full|resumed) (.*)$") {
+            $fields = @{}
+            foreach ($pair in $line.Matches[0].Groups[3].Value.Split(" ")) {
+                $key, $value = $pair.Split("=")
+                $fields[$key] = $value
+            }
+
+            $results += [pscustomobject]@{
+                Profile          = $name
+                Certificate      = $line.Matches[0].Groups[1].Value
+                Handshake        = $line.Matches[0].Groups[2].Value
+                "Avg (ms)"       = [double]$fields["avg_ms"]
+                "Min (ms)"       = [double]$fields["min_ms"]
+                "Max (ms)"       = [double]$fields["max_ms"]
+                "Peak heap (B)"  = [int]$fields["peak_bytes"]
+            }
+        }
+
+        Select-String -Path $qemuLog -Pattern "^TLS_BENCH: minimum_free_heap" | ForEach-Object {
+            Write-Host "$($name): $($_.Line)"
+        }
+    }
+}
+finally {
+    Stop-Process -Id $server.Id -ErrorAction SilentlyContinue
+}
+
+$results | Format-Table -AutoSize
+
+# The device cannot tell a resumed handshake from a full one, the server can
+$resumed = (Select-String -Path $serverLog -Pattern " resumed$").Count
+if ($resumed -eq 0) {
+    throw "No session has been resumed, see $serverLog"
+}
+Write-Host "Resumed sessions seen by the server: $resumed"
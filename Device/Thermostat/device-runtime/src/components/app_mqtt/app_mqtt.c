@@ -0,0 +1,487 @@
+#include "app_mqtt.h"
+#include "app_certificates.h"
+#include "app_settings.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "mqtt_client.h"
+#include "mqtt_spool.h"
+#include "mqtt_tls_transport.h"
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* LOG_TAG = "mqtt";
+
+#define MAX_MESSAGES CONFIG_TW_MQTT_QUEUE_MAX_MESSAGES
+#define QUEUE_BUDGET CONFIG_TW_MQTT_QUEUE_BUDGET
+#define MAX_TOPICS CONFIG_TW_MQTT_MAX_TOPICS
+#define MAX_URI_LENGTH 80
+#define NO_TOPIC -1
+
+struct message_t {
+    char* topic;
+    void* data;
+    size_t length;
+    int qos;
+    int topic_index;
+    int64_t enqueued_at;
+};
+
+// Messages sent with QoS > 0 waiting for the broker acknowledge (to measure their latency)
+struct in_flight_t {
+    int msg_id;
+    int topic_index;
+    int64_t enqueued_at;
+};
+
+static esp_mqtt_client_handle_t g_client;
+static struct app_certificate_view_t g_certificates[APP_CERTIFICATE_COUNT];
+static char g_uri[MAX_URI_LENGTH];
+static volatile bool g_connected;
+static scheduler_job_id_t g_flush_job = SCHEDULER_INVALID_JOB;
+
+// Everything below is protected by g_lock
+static SemaphoreHandle_t g_lock;
+static struct message_t g_queue[MAX_MESSAGES];
+static size_t g_queue_head;
+static struct app_mqtt_queue_stats_t g_queue_stats;
+static struct app_mqtt_topic_stats_t g_topics[MAX_TOPICS];
+static size_t g_topic_count;
+static struct in_flight_t g_in_flight[MAX_MESSAGES];
+static struct app_mqtt_connection_stats_t g_connection_stats;
+static int64_t g_connect_started_at;
+
+static size_t message_size(const struct message_t* message) {
+    return strlen(message->topic) + 1 + message->length;
+}
+
+static struct message_t* queue_at(size_t index) {
+    return &g_queue[(g_queue_head + index) % MAX_MESSAGES];
+}
+
+static int find_topic(const char* topic) {
+    for (size_t i = 0; i < g_topic_count; ++i) {
+        if (strcmp(g_topics[i].topic, topic) == 0) return i;
+    }
+
+    if (g_topic_count == MAX_TOPICS) return NO_TOPIC;
+
+    strlcpy(g_topics[g_topic_count].topic, topic, sizeof g_topics[g_topic_count].topic);
+    return g_topic_count++;
+}
+
+static void record_latency(int topic_index, int64_t enqueued_at) {
+    if (topic_index == NO_TOPIC) return;
+
+    int64_t latency = esp_timer_get_time() - enqueued_at;
+    struct app_mqtt_topic_stats_t* stats = &g_topics[topic_index];
+    ++stats->published;
+    stats->total_latency_us += latency;
+    if (latency > stats->max_latency_us) stats->max_latency_us = latency;
+}
+
+static void free_message(struct message_t* message) {
+    free(message->topic);
+    free(message->data);
+    memset(message, 0, sizeof *message);
+}
+
+static void pop_front(struct message_t* message) {
+    *message = g_queue[g_queue_head];
+    memset(&g_queue[g_queue_head], 0, sizeof g_queue[g_queue_head]);
+    g_queue_head = (g_queue_head + 1) % MAX_MESSAGES;
+    --g_queue_stats.queued_messages;
+    g_queue_stats.queued_bytes -= message_size(message);
+}
+
+static void push_front(const struct message_t* message) {
+    g_queue_head = (g_queue_head + MAX_MESSAGES - 1) % MAX_MESSAGES;
+    g_queue[g_queue_head] = *message;
+    ++g_queue_stats.queued_messages;
+    g_queue_stats.queued_bytes += message_size(message);
+}
+
+static void push_back(const struct message_t* message) {
+    *queue_at(g_queue_stats.queued_messages) = *message;
+    ++g_queue_stats.queued_messages;
+    g_queue_stats.queued_bytes += message_size(message);
+    if (g_queue_stats.queued_bytes > g_queue_stats.max_queued_bytes)
+        g_queue_stats.max_queued_bytes = g_queue_stats.queued_bytes;
+}
+
+static void drop(struct message_t* message) {
+    ++g_queue_stats.dropped;
+    if (message->topic_index != NO_TOPIC) ++g_topics[message->topic_index].dropped;
+
+    free_message(message);
+}
+
+static bool should_spool(const struct message_t* message) {
+#if CONFIG_TW_MQTT_SPOOL_QOS0
+    return true;
+#else
+    return message->qos > 0;
+#endif
+}
+
+// Telemetry is often published again before the previous value has been sent: with
+// CONFIG_TW_MQTT_COALESCE_QOS0 we replace the queued QoS 0 payload instead of sending both.
+// Off by default, a topic which carries events (and not a state) would lose them.
+static bool should_coalesce(int qos) {
+#if CONFIG_TW_MQTT_COALESCE_QOS0
+    return qos == 0;
+#else
+    return false;
+#endif
+}
+
+static bool coalesce(int topic_index, const char* topic, const void* data, size_t length, esp_err_t* err) {
+    for (size_t i = 0; i < g_queue_stats.queued_messages; ++i) {
+        struct message_t* message = queue_at(i);
+        if (message->qos != 0 || strcmp(message->topic, topic) != 0) continue;
+
+        if (g_queue_stats.queued_bytes - message->length + length > QUEUE_BUDGET) return false;
+
+        void* new_data = realloc(message->data, length > 0 ? length : 1);
+        if (new_data == NULL) {
+            *err = ESP_ERR_NO_MEM;
+            return true;
+        }
+
+        memcpy(new_data, data, length);
+        g_queue_stats.queued_bytes = g_queue_stats.queued_bytes - message->length + length;
+        message->data = new_data;
+        message->length = length;
+        message->enqueued_at = esp_timer_get_time();
+        if (topic_index != NO_TOPIC) ++g_topics[topic_index].coalesced;
+
+        *err = ESP_OK;
+        return true;
+    }
+
+    return false;
+}
+
+static esp_err_t make_room(size_t size) {
+    while (g_queue_stats.queued_messages == MAX_MESSAGES || g_queue_stats.queued_bytes + size > QUEUE_BUDGET) {
+        struct message_t* oldest = queue_at(0);
+
+        // If we are connected then the queue is going to be flushed soon, we do not
+        // want to lose a message which needs to be delivered.
+        if (g_connected && oldest->qos > 0) return ESP_ERR_NO_MEM;
+
+        struct message_t message;
+        pop_front(&message);
+        if (!g_connected && should_spool(&message) &&
+            mqtt_spool_append(message.topic, message.data, message.length, message.qos) == ESP_OK) {
+            free_message(&message);
+            continue;
+        }
+
+        drop(&message);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t app_mqtt_publish(const char* topic, const void* data, size_t length, int qos) {
+    size_t topic_size = strlen(topic) + 1;
+    if (topic_size > APP_MQTT_MAX_TOPIC_LENGTH || topic_size + length > QUEUE_BUDGET) return ESP_ERR_INVALID_SIZE;
+
+    if (g_lock == NULL) return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    int topic_index = find_topic(topic);
+
+    esp_err_t err = ESP_OK;
+    if (!should_coalesce(qos) || !coalesce(topic_index, topic, data, length, &err)) {
+        err = make_room(topic_size + length);
+        if (err == ESP_OK) {
+            struct message_t message = {
+                .topic = strdup(topic),
+                .data = malloc(length > 0 ? length : 1),
+                .length = length,
+                .qos = qos,
+                .topic_index = topic_index,
+                .enqueued_at = esp_timer_get_time(),
+            };
+
+            if (message.topic == NULL || message.data == NULL) {
+                free_message(&message);
+                err = ESP_ERR_NO_MEM;
+            } else {
+                memcpy(message.data, data, length);
+                push_back(&message);
+            }
+        }
+    }
+
+    if (err != ESP_OK) {
+        ++g_queue_stats.dropped;
+        if (topic_index != NO_TOPIC) ++g_topics[topic_index].dropped;
+    }
+    xSemaphoreGive(g_lock);
+
+    if (err == ESP_OK && g_connected) scheduler_notify(g_flush_job);
+
+    return err;
+}
+
+static void track_in_flight(int msg_id, int topic_index, int64_t enqueued_at) {
+    for (size_t i = 0; i < MAX_MESSAGES; ++i) {
+        if (g_in_flight[i].msg_id == 0) {
+            g_in_flight[i] = (struct in_flight_t){msg_id, topic_index, enqueued_at};
+            return;
+        }
+    }
+}
+
+static void complete_in_flight(int msg_id) {
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    for (size_t i = 0; i < MAX_MESSAGES; ++i) {
+        if (g_in_flight[i].msg_id == msg_id) {
+            record_latency(g_in_flight[i].topic_index, g_in_flight[i].enqueued_at);
+            memset(&g_in_flight[i], 0, sizeof g_in_flight[i]);
+            break;
+        }
+    }
+    xSemaphoreGive(g_lock);
+}
+
+static void flush_spool(void) {
+    // The spool is written by app_mqtt_publish() (under lock) when the queue is full
+    while (g_connected) {
+        struct mqtt_spool_record_t record;
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        esp_err_t err = mqtt_spool_read(&record);
+        xSemaphoreGive(g_lock);
+        if (err != ESP_OK) break;
+
+        int msg_id = esp_mqtt_client_publish(g_client, record.topic, record.data, record.length, record.qos, 0);
+        mqtt_spool_free(&record);
+        if (msg_id < 0) break;
+
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        err = mqtt_spool_consume();
+        xSemaphoreGive(g_lock);
+        if (err != ESP_OK) break;
+    }
+}
+
+static void flush_queue(void* arg) {
+    if (!g_connected) return;
+
+    // What has been spooled while the broker was not reachable is older than what is in the queue
+    flush_spool();
+
+    // Messages are taken one by one: publishing (QoS 0) waits for the network and we do not
+    // want to keep app_mqtt_publish() waiting.
+    while (g_connected) {
+        struct message_t message;
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        if (g_queue_stats.queued_messages == 0) {
+            xSemaphoreGive(g_lock);
+            break;
+        }
+
+        pop_front(&message);
+        xSemaphoreGive(g_lock);
+
+        int msg_id = esp_mqtt_client_publish(g_client, message.topic, message.data, message.length, message.qos, 0);
+
+        xSemaphoreTake(g_lock, portMAX_DELAY);
+        if (msg_id < 0) {
+            // Try again when we are connected, if there is still room for it
+            if (g_queue_stats.queued_messages < MAX_MESSAGES &&
+                g_queue_stats.queued_bytes + message_size(&message) <= QUEUE_BUDGET)
+                push_front(&message);
+            else
+                drop(&message);
+        } else {
+            if (message.qos == 0)
+                record_latency(message.topic_index, message.enqueued_at);
+            else
+                track_in_flight(msg_id, message.topic_index, message.enqueued_at);
+
+            free_message(&message);
+        }
+        xSemaphoreGive(g_lock);
+
+        if (msg_id < 0) break;
+    }
+}
+
+static void record_connection(int64_t duration) {
+    ESP_LOGI(LOG_TAG, "Connected to %s in %lld ms", g_uri, duration / 1000);
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    ++g_connection_stats.connections;
+    g_connection_stats.last_connect_time_us = duration;
+    if (duration > g_connection_stats.max_connect_time_us) g_connection_stats.max_connect_time_us = duration;
+    xSemaphoreGive(g_lock);
+}
+
+static void mqtt_event_handler(void* arg, esp_event_base_t base, int32_t event_id, void* event_data) {
+    esp_mqtt_event_handle_t event = event_data;
+    switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        g_connect_started_at = esp_timer_get_time();
+        break;
+    case MQTT_EVENT_CONNECTED:
+        record_connection(esp_timer_get_time() - g_connect_started_at);
+        g_connected = true;
+        scheduler_notify(g_flush_job);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+        ESP_LOGI(LOG_TAG, "Disconnected from %s", g_uri);
+        g_connected = false;
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        complete_in_flight(event->msg_id);
+        break;
+    case MQTT_EVENT_ERROR:
+        ESP_LOGW(LOG_TAG, "Error %d", event->error_handle->error_type);
+        break;
+    default:
+        break;
+    }
+}
+
+static void open_certificates(void) {
+    for (int i = 0; i < APP_CERTIFICATE_COUNT; ++i) {
+        if (app_certificate_exists(i)) app_certificate_open(i, &g_certificates[i]);
+    }
+}
+
+esp_err_t app_mqtt_initialize(void) {
+    struct app_settings_t* settings = app_settings_get();
+    if (settings->mqtt_broker_address[0] == '\0') {
+        ESP_LOGW(LOG_TAG, "MQTT broker address is not configured");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    g_lock = xSemaphoreCreateMutex();
+    if (g_lock == NULL) return ESP_ERR_NO_MEM;
+
+    if (mqtt_spool_initialize() != ESP_OK) ESP_LOGW(LOG_TAG, "Spool is not available, messages will be dropped");
+
+    // Certificates are memory-mapped and they stay mapped as long as the client exists,
+    // the MQTT client uses them directly without a copy in RAM.
+    open_certificates();
+    const struct app_certificate_view_t* server = &g_certificates[APP_CERTIFICATE_MQTT_SERVER];
+    const struct app_certificate_view_t* client = &g_certificates[APP_CERTIFICATE_MQTT_CLIENT];
+    const struct app_certificate_view_t* client_key = &g_certificates[APP_CERTIFICATE_MQTT_CLIENT_KEY];
+
+    esp_transport_handle_t transport = NULL;
+    if (server->data != NULL) {
+        snprintf(g_uri, sizeof g_uri, "mqtts://%s:%d", settings->mqtt_broker_address, CONFIG_TW_MQTT_BROKER_TLS_PORT);
+
+        // Our own TLS transport, the one of esp-mqtt cannot resume the session when it reconnects
+        esp_tls_cfg_t tls_config = {
+            .cacert_buf = (const unsigned char*)server->data,
+            .cacert_bytes = server->length,
+            .clientcert_buf = (const unsigned char*)client->data,
+            .clientcert_bytes = client->length,
+            .clientkey_buf = (const unsigned char*)client_key->data,
+            .clientkey_bytes = client_key->length,
+        };
+
+        transport = mqtt_tls_transport_create(&tls_config, CONFIG_TW_MQTT_BROKER_TLS_PORT);
+        if (transport == NULL) return ESP_ERR_NO_MEM;
+    } else {
+#if CONFIG_TW_MQTT_ALLOW_PLAINTEXT
+        ESP_LOGW(LOG_TAG, "MQTT server certificate is not provisioned, the connection is not encrypted");
+        snprintf(g_uri, sizeof g_uri, "mqtt://%s:%d", settings->mqtt_broker_address, CONFIG_TW_MQTT_BROKER_PORT);
+#else
+        ESP_LOGE(LOG_TAG, "MQTT server certificate is not provisioned and plaintext connections are not allowed "
+                          "(CONFIG_TW_MQTT_ALLOW_PLAINTEXT)");
+        return ESP_ERR_INVALID_STATE;
+#endif
+    }
+
+    esp_mqtt_client_config_t config = {
+        .broker.address.uri = g_uri,
+        .credentials.client_id = settings->device_id,
+        .session.keepalive = CONFIG_TW_MQTT_KEEPALIVE,
+        .network.transport = transport,
+    };
+
+    g_client = esp_mqtt_client_init(&config);
+    if (g_client == NULL) {
+        ESP_LOGE(LOG_TAG, "Failed to create the MQTT client");
+        return ESP_FAIL;
+    }
+
+    ESP_ERROR_CHECK(esp_mqtt_client_register_event(g_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL));
+
+    g_flush_job = scheduler_add_event("mqtt_flush", flush_queue, NULL);
+    return g_flush_job == SCHEDULER_INVALID_JOB ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+esp_err_t app_mqtt_start(void) {
+    if (g_client == NULL) return ESP_ERR_INVALID_STATE;
+
+    ESP_LOGI(LOG_TAG, "Connecting to %s...", g_uri);
+    return esp_mqtt_client_start(g_client);
+}
+
+bool app_mqtt_is_connected(void) {
+    return g_connected;
+}
+
+void app_mqtt_get_queue_stats(struct app_mqtt_queue_stats_t* stats) {
+    memset(stats, 0, sizeof *stats);
+    if (g_lock == NULL) return;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    *stats = g_queue_stats;
+    stats->spooled_messages = mqtt_spool_count();
+    xSemaphoreGive(g_lock);
+}
+
+bool app_mqtt_get_topic_stats(size_t index, struct app_mqtt_topic_stats_t* stats) {
+    if (g_lock == NULL) return false;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    bool found = index < g_topic_count;
+    if (found) *stats = g_topics[index];
+    xSemaphoreGive(g_lock);
+
+    return found;
+}
+
+void app_mqtt_get_connection_stats(struct app_mqtt_connection_stats_t* stats) {
+    memset(stats, 0, sizeof *stats);
+    if (g_lock == NULL) return;
+
+    xSemaphoreTake(g_lock, portMAX_DELAY);
+    *stats = g_connection_stats;
+    xSemaphoreGive(g_lock);
+
+    stats->min_free_heap = esp_get_minimum_free_heap_size();
+}
+
+void app_mqtt_log_stats(void) {
+    struct app_mqtt_connection_stats_t connection;
+    app_mqtt_get_connection_stats(&connection);
+    ESP_LOGI(LOG_TAG, "Connections: %lu, connect time %lld ms (max %lld ms), min free heap %zu bytes",
+             (unsigned long)connection.connections, connection.last_connect_time_us / 1000,
+             connection.max_connect_time_us / 1000, connection.min_free_heap);
+
+    struct app_mqtt_queue_stats_t queue;
+    app_mqtt_get_queue_stats(&queue);
+    ESP_LOGI(LOG_TAG, "Queue: %zu messages, %zu bytes (max %zu), %zu spooled, %lu dropped", queue.queued_messages,
+             queue.queued_bytes, queue.max_queued_bytes, queue.spooled_messages, (unsigned long)queue.dropped);
+
+    struct app_mqtt_topic_stats_t topic;
+    for (size_t i = 0; app_mqtt_get_topic_stats(i, &topic); ++i) {
+        int64_t average = topic.published > 0 ? topic.total_latency_us / topic.published : 0;
+        ESP_LOGI(LOG_TAG, "%s: %lu published, %lu coalesced, %lu dropped, latency %lld us (max %lld us)", topic.topic,
+                 (unsigned long)topic.published, (unsigned long)topic.coalesced, (unsigned long)topic.dropped, average,
+                 topic.max_latency_us);
+    }
+}
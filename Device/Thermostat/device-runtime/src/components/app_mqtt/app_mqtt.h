@@ -0,0 +1,52 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define APP_MQTT_MAX_TOPIC_LENGTH 64
+
+struct app_mqtt_topic_stats_t {
+    char topic[APP_MQTT_MAX_TOPIC_LENGTH];
+    uint32_t published;
+    uint32_t dropped;
+    // QoS 0 messages replaced by a newer one before they have been sent
+    uint32_t coalesced;
+    // From app_mqtt_publish() to when the message has been sent (QoS 0) or acknowledged
+    int64_t total_latency_us;
+    int64_t max_latency_us;
+};
+
+struct app_mqtt_queue_stats_t {
+    size_t queued_messages;
+    size_t queued_bytes;
+    size_t max_queued_bytes;
+    size_t spooled_messages;
+    uint32_t dropped;
+};
+
+// Time from the start of a connection attempt (TCP connect, TLS handshake and MQTT CONNECT) to
+// the broker acknowledge. The TLS handshake is also when the heap usage peaks, min_free_heap is
+// the lowest free heap since boot.
+struct app_mqtt_connection_stats_t {
+    uint32_t connections;
+    int64_t last_connect_time_us;
+    int64_t max_connect_time_us;
+    size_t min_free_heap;
+};
+
+// Messages are queued (within CONFIG_TW_MQTT_QUEUE_BUDGET bytes) and sent in a burst by a
+// scheduler job, then the messages published by all the jobs which ran in the same wakeup are
+// sent together. When the queue is full and the broker is not reachable the oldest messages
+// are moved to the flash spool (only QoS > 0, unless CONFIG_TW_MQTT_SPOOL_QOS0) and sent first
+// when the connection is estabilished again.
+esp_err_t app_mqtt_initialize(void);
+esp_err_t app_mqtt_start(void);
+bool app_mqtt_is_connected(void);
+esp_err_t app_mqtt_publish(const char* topic, const void* data, size_t length, int qos);
+
+void app_mqtt_get_queue_stats(struct app_mqtt_queue_stats_t* stats);
+bool app_mqtt_get_topic_stats(size_t index, struct app_mqtt_topic_stats_t* stats);
+void app_mqtt_get_connection_stats(struct app_mqtt_connection_stats_t* stats);
+void app_mqtt_log_stats(void);
@@ -0,0 +1,196 @@
+#include "mqtt_spool.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* LOG_TAG = "mqtt_spool";
+
+#define SPOOL_PARTITION "mqtt_spool"
+#define RECORD_MAGIC 0x5053 // "SP"
+#define SECTOR_SIZE 4096
+#define ALIGN4(x) (((x) + 3) & ~3)
+
+// Records are appended one after the other, flash is erased only when all of them have
+// been sent. State bits are cleared in place (no erase needed): the record is written
+// with STATE_WRITING, marked STATE_READY when all its data is there and STATE_CONSUMED
+// when it has been published. An interrupted write leaves a record which is skipped.
+enum record_state_t {
+    STATE_WRITING = 0xFF,
+    STATE_READY = 0x7F,
+    STATE_CONSUMED = 0x00,
+};
+
+struct record_header_t {
+    uint16_t magic;
+    uint8_t state;
+    uint8_t qos;
+    uint16_t topic_size;
+    uint16_t length;
+};
+
+static const esp_partition_t* g_partition;
+static size_t g_read_offset;
+static size_t g_write_offset;
+static size_t g_count;
+
+static size_t record_size(const struct record_header_t* header) {
+    return ALIGN4(sizeof *header + header->topic_size + header->length);
+}
+
+static esp_err_t erase_used(void) {
+    size_t used = (g_write_offset + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    esp_err_t err = used > 0 ? esp_partition_erase_range(g_partition, 0, used) : ESP_OK;
+    if (err == ESP_OK) {
+        g_read_offset = 0;
+        g_write_offset = 0;
+        g_count = 0;
+    }
+
+    return err;
+}
+
+// Moves the read offset to the next record ready to be sent (if any)
+static void skip_unavailable(void) {
+    struct record_header_t header;
+    while (g_read_offset < g_write_offset) {
+        if (esp_partition_read(g_partition, g_read_offset, &header, sizeof header) != ESP_OK) break;
+        if (header.state == STATE_READY) break;
+
+        g_read_offset += record_size(&header);
+    }
+}
+
+esp_err_t mqtt_spool_initialize(void) {
+    g_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, SPOOL_PARTITION);
+    if (g_partition == NULL) {
+        ESP_LOGE(LOG_TAG, "Partition %s not found", SPOOL_PARTITION);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Find where the log ends and what we still have to send from a previous run
+    struct record_header_t header;
+    size_t offset = 0;
+    bool corrupted = false;
+    g_count = 0;
+    while (offset + sizeof header <= g_partition->size) {
+        esp_err_t err = esp_partition_read(g_partition, offset, &header, sizeof header);
+        if (err != ESP_OK) return err;
+
+        if (header.magic == 0xFFFF) break;
+
+        if (header.magic != RECORD_MAGIC || offset + record_size(&header) > g_partition->size) {
+            corrupted = true;
+            break;
+        }
+
+        if (header.state == STATE_READY) ++g_count;
+
+        offset += record_size(&header);
+    }
+
+    g_write_offset = offset;
+    g_read_offset = 0;
+    if (corrupted) {
+        ESP_LOGW(LOG_TAG, "Spool is corrupted at 0x%x, erasing...", offset);
+        g_write_offset = g_partition->size;
+        return erase_used();
+    }
+
+    if (g_count == 0) return erase_used();
+
+    skip_unavailable();
+    ESP_LOGI(LOG_TAG, "%zu spooled messages to send", g_count);
+    return ESP_OK;
+}
+
+esp_err_t mqtt_spool_append(const char* topic, const void* data, size_t length, int qos) {
+    if (g_partition == NULL) return ESP_ERR_INVALID_STATE;
+
+    struct record_header_t header = {
+        .magic = RECORD_MAGIC,
+        .state = STATE_WRITING,
+        .qos = qos,
+        .topic_size = strlen(topic) + 1,
+        .length = length,
+    };
+
+    if (length > UINT16_MAX || g_write_offset + record_size(&header) > g_partition->size) return ESP_ERR_NO_MEM;
+
+    size_t offset = g_write_offset;
+    g_write_offset += record_size(&header);
+
+    esp_err_t err = esp_partition_write(g_partition, offset, &header, sizeof header);
+    if (err == ESP_OK) err = esp_partition_write(g_partition, offset + sizeof header, topic, header.topic_size);
+    if (err == ESP_OK && length > 0)
+        err = esp_partition_write(g_partition, offset + sizeof header + header.topic_size, data, length);
+
+    uint8_t state = STATE_READY;
+    if (err == ESP_OK) err = esp_partition_write(g_partition, offset + offsetof(struct record_header_t, state), &state, 1);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(LOG_TAG, "Failed to spool message because 0x%x...", err);
+        return err;
+    }
+
+    ++g_count;
+    skip_unavailable();
+    return ESP_OK;
+}
+
+esp_err_t mqtt_spool_read(struct mqtt_spool_record_t* record) {
+    memset(record, 0, sizeof *record);
+    if (g_count == 0) return ESP_ERR_NOT_FOUND;
+
+    struct record_header_t header;
+    esp_err_t err = esp_partition_read(g_partition, g_read_offset, &header, sizeof header);
+    if (err != ESP_OK) return err;
+
+    record->topic = malloc(header.topic_size);
+    record->data = malloc(header.length > 0 ? header.length : 1);
+    if (record->topic == NULL || record->data == NULL) {
+        mqtt_spool_free(record);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = esp_partition_read(g_partition, g_read_offset + sizeof header, record->topic, header.topic_size);
+    if (err == ESP_OK && header.length > 0)
+        err = esp_partition_read(g_partition, g_read_offset + sizeof header + header.topic_size, record->data,
+                                 header.length);
+
+    if (err != ESP_OK) {
+        mqtt_spool_free(record);
+        return err;
+    }
+
+    record->topic[header.topic_size - 1] = '\0';
+    record->length = header.length;
+    record->qos = header.qos;
+    return ESP_OK;
+}
+
+esp_err_t mqtt_spool_consume(void) {
+    if (g_count == 0) return ESP_ERR_NOT_FOUND;
+
+    uint8_t state = STATE_CONSUMED;
+    esp_err_t err =
+        esp_partition_write(g_partition, g_read_offset + offsetof(struct record_header_t, state), &state, 1);
+    if (err != ESP_OK) return err;
+
+    --g_count;
+    if (g_count == 0) return erase_used();
+
+    skip_unavailable();
+    return ESP_OK;
+}
+
+void mqtt_spool_free(struct mqtt_spool_record_t* record) {
+    free(record->topic);
+    free(record->data);
+    memset(record, 0, sizeof *record);
+}
+
+size_t mqtt_spool_count(void) {
+    return g_count;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stddef.h>
+
+// A message read back from the spool, topic and data are allocated by mqtt_spool_read()
+// and released with mqtt_spool_free().
+struct mqtt_spool_record_t {
+    char* topic;
+    void* data;
+    size_t length;
+    int qos;
+};
+
+esp_err_t mqtt_spool_initialize(void);
+esp_err_t mqtt_spool_append(const char* topic, const void* data, size_t length, int qos);
+esp_err_t mqtt_spool_read(struct mqtt_spool_record_t* record);
+esp_err_t mqtt_spool_consume(void);
+void mqtt_spool_free(struct mqtt_spool_record_t* record);
+size_t mqtt_spool_count(void);
@@ -0,0 +1,157 @@
+#include "mqtt_tls_transport.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+static const char* LOG_TAG = "mqtt_tls";
+
+struct tls_transport_t {
+    esp_tls_cfg_t config;
+    esp_tls_t* tls;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t* session;
+#endif
+};
+
+static struct tls_transport_t* get_context(esp_transport_handle_t transport) {
+    return esp_transport_get_context_data(transport);
+}
+
+// Returns > 0 when the socket is ready, 0 after the timeout and -1 on error (as the other transports)
+static int poll_socket(struct tls_transport_t* context, bool write, int timeout_ms) {
+    int sock;
+    if (context->tls == NULL || esp_tls_get_conn_sockfd(context->tls, &sock) != ESP_OK) return -1;
+
+    fd_set fds;
+    fd_set error_fds;
+    FD_ZERO(&fds);
+    FD_ZERO(&error_fds);
+    FD_SET(sock, &fds);
+    FD_SET(sock, &error_fds);
+
+    struct timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+    int ready = select(sock + 1, write ? NULL : &fds, write ? &fds : NULL, &error_fds,
+                       timeout_ms < 0 ? NULL : &timeout);
+    if (ready > 0 && FD_ISSET(sock, &error_fds)) return -1;
+
+    return ready;
+}
+
+static int tls_poll_read(esp_transport_handle_t transport, int timeout_ms) {
+    struct tls_transport_t* context = get_context(transport);
+
+    // mbedTLS could have already read (and decrypted) what we are waiting for
+    if (context->tls != NULL && esp_tls_get_bytes_avail(context->tls) > 0) return 1;
+
+    return poll_socket(context, false, timeout_ms);
+}
+
+static int tls_poll_write(esp_transport_handle_t transport, int timeout_ms) {
+    return poll_socket(get_context(transport), true, timeout_ms);
+}
+
+static int tls_close(esp_transport_handle_t transport) {
+    struct tls_transport_t* context = get_context(transport);
+    if (context->tls == NULL) return 0;
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    // With TLS 1.3 the ticket arrives after the handshake, we take it when the connection ends
+    esp_tls_client_session_t* session = esp_tls_get_client_session(context->tls);
+    if (session != NULL) {
+        if (context->session != NULL) esp_tls_free_client_session(context->session);
+        context->session = session;
+    }
+#endif
+
+    int result = esp_tls_conn_destroy(context->tls);
+    context->tls = NULL;
+    return result;
+}
+
+static int tls_connect(esp_transport_handle_t transport, const char* host, int port, int timeout_ms) {
+    struct tls_transport_t* context = get_context(transport);
+    tls_close(transport);
+
+    context->tls = esp_tls_init();
+    if (context->tls == NULL) return -1;
+
+    esp_tls_cfg_t config = context->config;
+    config.timeout_ms = timeout_ms;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    config.client_session = context->session;
+#endif
+
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &config, context->tls) <= 0) {
+        ESP_LOGW(LOG_TAG, "Failed to connect to %s:%d", host, port);
+        esp_tls_conn_destroy(context->tls);
+        context->tls = NULL;
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // The broker could have failed the handshake because of the ticket, next time we start over
+        if (context->session != NULL) esp_tls_free_client_session(context->session);
+        context->session = NULL;
+#endif
+        return -1;
+    }
+
+    return 0;
+}
+
+static int tls_read(esp_transport_handle_t transport, char* buffer, int length, int timeout_ms) {
+    struct tls_transport_t* context = get_context(transport);
+
+    int ready = tls_poll_read(transport, timeout_ms);
+    if (ready <= 0) return ready == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+
+    ssize_t received = esp_tls_conn_read(context->tls, buffer, length);
+    if (received == 0) return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    if (received == ESP_TLS_ERR_SSL_WANT_READ || received == ESP_TLS_ERR_SSL_WANT_WRITE)
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+
+    return received < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : (int)received;
+}
+
+static int tls_write(esp_transport_handle_t transport, const char* buffer, int length, int timeout_ms) {
+    struct tls_transport_t* context = get_context(transport);
+
+    int ready = tls_poll_write(transport, timeout_ms);
+    if (ready <= 0) return ready == 0 ? ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+
+    ssize_t sent = esp_tls_conn_write(context->tls, buffer, length);
+    if (sent == ESP_TLS_ERR_SSL_WANT_READ || sent == ESP_TLS_ERR_SSL_WANT_WRITE)
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+
+    return sent < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : (int)sent;
+}
+
+static int tls_destroy(esp_transport_handle_t transport) {
+    struct tls_transport_t* context = get_context(transport);
+    tls_close(transport);
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (context->session != NULL) esp_tls_free_client_session(context->session);
+#endif
+
+    free(context);
+    return 0;
+}
+
+esp_transport_handle_t mqtt_tls_transport_create(const esp_tls_cfg_t* config, int default_port) {
+    struct tls_transport_t* context = calloc(1, sizeof *context);
+    if (context == NULL) return NULL;
+
+    context->config = *config;
+
+    esp_transport_handle_t transport = esp_transport_init();
+    if (transport == NULL) {
+        free(context);
+        return NULL;
+    }
+
+    esp_transport_set_context_data(transport, context);
+    esp_transport_set_default_port(transport, default_port);
+    esp_transport_set_func(transport, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write,
+                           tls_destroy);
+    return transport;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "esp_tls.h"
+#include "esp_transport.h"
+
+// TLS transport for the MQTT client which resumes the previous session when it reconnects.
+// The SSL transport of esp-mqtt never passes a client session to esp-tls: every reconnection
+// is a full handshake. This one keeps the session (ticket) of the last connection and offers
+// it to the broker, which falls back to a full handshake if it does not accept it.
+// Configuration (and the certificates it points to) must outlive the transport. Sessions
+// are kept only with CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS. The default port is used when the
+// URI of the broker has none.
+esp_transport_handle_t mqtt_tls_transport_create(const esp_tls_cfg_t* config, int default_port);
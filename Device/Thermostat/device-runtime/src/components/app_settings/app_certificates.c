@@ -0,0 +1,194 @@
+#include "app_certificates.h"
+#include "esp_log.h"
+#include <assert.h>
+#include <string.h>
+
+static const char* LOG_TAG = "certs";
+
+#define CERTS_PARTITION "certs"
+#define SLOT_SIZE (8 * 1024)
+#define SLOTS_PER_CERTIFICATE 2
+#define SLOT_MAGIC 0x32545243 // "CRT2"
+
+// Each certificate has two slots, aligned to the flash sector size then they can be erased
+// independently. A new certificate is written to the slot not in use and its header is written
+// last: until then (or if the write is interrupted or aborted) the previous certificate stays
+// valid. When both slots are valid the one with the higher sequence number is the current one.
+struct slot_header_t
+{
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t length;
+};
+
+static const esp_partition_t* g_partition;
+
+static const esp_partition_t* get_partition(void)
+{
+    if (g_partition == NULL)
+    {
+        g_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CERTS_PARTITION);
+        if (g_partition == NULL)
+            ESP_LOGE(LOG_TAG, "Partition %s not found", CERTS_PARTITION);
+    }
+
+    return g_partition;
+}
+
+static size_t slot_offset(enum app_certificate_t certificate, int slot)
+{
+    assert(certificate < APP_CERTIFICATE_COUNT && slot < SLOTS_PER_CERTIFICATE);
+    return (certificate * SLOTS_PER_CERTIFICATE + slot) * SLOT_SIZE;
+}
+
+static esp_err_t read_slot_header(enum app_certificate_t certificate, int slot, struct slot_header_t* header)
+{
+    const esp_partition_t* partition = get_partition();
+    if (partition == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    esp_err_t err = esp_partition_read(partition, slot_offset(certificate, slot), header, sizeof *header);
+    if (err != ESP_OK)
+        return err;
+
+    if (header->magic != SLOT_MAGIC || header->length == 0 || header->length > SLOT_SIZE - sizeof *header)
+        return ESP_ERR_NOT_FOUND;
+
+    return ESP_OK;
+}
+
+// Finds the slot with the current certificate, ESP_ERR_NOT_FOUND if there is none
+static esp_err_t read_header(enum app_certificate_t certificate, int* slot, struct slot_header_t* header)
+{
+    esp_err_t result = ESP_ERR_NOT_FOUND;
+    for (int i = 0; i < SLOTS_PER_CERTIFICATE; ++i)
+    {
+        struct slot_header_t candidate;
+        esp_err_t err = read_slot_header(certificate, i, &candidate);
+        if (err == ESP_ERR_NOT_FOUND)
+            continue;
+
+        if (err != ESP_OK)
+            return err;
+
+        // The sequence number wraps around
+        if (result != ESP_OK || (int32_t)(candidate.sequence - header->sequence) > 0)
+        {
+            *slot = i;
+            *header = candidate;
+            result = ESP_OK;
+        }
+    }
+
+    return result;
+}
+
+size_t app_certificate_max_length(enum app_certificate_t certificate)
+{
+    // Minus the terminator we append when the certificate is complete
+    return SLOT_SIZE - sizeof(struct slot_header_t) - 1;
+}
+
+bool app_certificate_exists(enum app_certificate_t certificate)
+{
+    int slot;
+    struct slot_header_t header;
+    return read_header(certificate, &slot, &header) == ESP_OK;
+}
+
+esp_err_t app_certificate_open(enum app_certificate_t certificate, struct app_certificate_view_t* view)
+{
+    memset(view, 0, sizeof *view);
+
+    int slot;
+    struct slot_header_t header;
+    esp_err_t err = read_header(certificate, &slot, &header);
+    if (err != ESP_OK)
+        return err;
+
+    const void* data;
+    err = esp_partition_mmap(get_partition(), slot_offset(certificate, slot) + sizeof header, header.length,
+                             ESP_PARTITION_MMAP_DATA, &data, &view->mmap_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Failed to map certificate %d because 0x%x...", certificate, err);
+        return err;
+    }
+
+    view->data = data;
+    view->length = header.length;
+    return ESP_OK;
+}
+
+void app_certificate_close(struct app_certificate_view_t* view)
+{
+    if (view->data != NULL)
+        esp_partition_munmap(view->mmap_handle);
+
+    memset(view, 0, sizeof *view);
+}
+
+esp_err_t app_certificate_write_begin(enum app_certificate_t certificate, struct app_certificate_writer_t* writer)
+{
+    const esp_partition_t* partition = get_partition();
+    if (partition == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    // The current certificate (if any) is left untouched, we write to the other slot
+    int current_slot;
+    struct slot_header_t current;
+    esp_err_t err = read_header(certificate, &current_slot, &current);
+    if (err != ESP_OK && err != ESP_ERR_NOT_FOUND)
+        return err;
+
+    writer->certificate = certificate;
+    writer->slot = err == ESP_OK ? (current_slot + 1) % SLOTS_PER_CERTIFICATE : 0;
+    writer->sequence = err == ESP_OK ? current.sequence + 1 : 1;
+    writer->position = 0;
+
+    ESP_LOGD(LOG_TAG, "Erasing slot %d for certificate %d", writer->slot, certificate);
+    return esp_partition_erase_range(partition, slot_offset(certificate, writer->slot), SLOT_SIZE);
+}
+
+static esp_err_t write_data(struct app_certificate_writer_t* writer, const void* data, size_t size)
+{
+    size_t offset = slot_offset(writer->certificate, writer->slot) + sizeof(struct slot_header_t) + writer->position;
+    esp_err_t err = esp_partition_write(get_partition(), offset, data, size);
+    if (err == ESP_OK)
+        writer->position += size;
+
+    return err;
+}
+
+esp_err_t app_certificate_write(struct app_certificate_writer_t* writer, const void* data, size_t size)
+{
+    if (writer->position + size > app_certificate_max_length(writer->certificate))
+        return ESP_ERR_INVALID_SIZE;
+
+    return write_data(writer, data, size);
+}
+
+esp_err_t app_certificate_write_end(struct app_certificate_writer_t* writer)
+{
+    if (writer->position == 0)
+        return ESP_ERR_INVALID_SIZE;
+
+    esp_err_t err = write_data(writer, "", 1);
+    if (err != ESP_OK)
+        return err;
+
+    struct slot_header_t header = {.magic = SLOT_MAGIC, .sequence = writer->sequence, .length = writer->position};
+    err = esp_partition_write(get_partition(), slot_offset(writer->certificate, writer->slot), &header, sizeof header);
+    if (err == ESP_OK)
+        ESP_LOGI(LOG_TAG, "Certificate %d written (%zu bytes)", writer->certificate, writer->position);
+
+    return err;
+}
+
+void app_certificate_write_abort(struct app_certificate_writer_t* writer)
+{
+    // Without its header the slot is not valid, the next write erases it
+    ESP_LOGW(LOG_TAG, "Write of certificate %d aborted after %zu bytes, the previous one is kept",
+             writer->certificate, writer->position);
+    writer->position = 0;
+}
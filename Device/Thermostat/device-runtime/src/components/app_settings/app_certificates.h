@@ -0,0 +1,44 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_partition.h"
+#include <stddef.h>
+#include <stdint.h>
+
+enum app_certificate_t
+{
+    APP_CERTIFICATE_MQTT_SERVER,
+    APP_CERTIFICATE_MQTT_CLIENT,
+    APP_CERTIFICATE_MQTT_CLIENT_KEY,
+    APP_CERTIFICATE_COUNT,
+};
+
+// Read-only view of a certificate memory-mapped from the certs partition.
+// data is NUL terminated and length includes the terminator (what mbedTLS
+// expects for PEM), it's valid until app_certificate_close().
+struct app_certificate_view_t
+{
+    const char* data;
+    size_t length;
+    esp_partition_mmap_handle_t mmap_handle;
+};
+
+struct app_certificate_writer_t
+{
+    enum app_certificate_t certificate;
+    int slot;
+    uint32_t sequence;
+    size_t position;
+};
+
+size_t app_certificate_max_length(enum app_certificate_t certificate);
+bool app_certificate_exists(enum app_certificate_t certificate);
+esp_err_t app_certificate_open(enum app_certificate_t certificate, struct app_certificate_view_t* view);
+void app_certificate_close(struct app_certificate_view_t* view);
+
+esp_err_t app_certificate_write_begin(enum app_certificate_t certificate, struct app_certificate_writer_t* writer);
+esp_err_t app_certificate_write(struct app_certificate_writer_t* writer, const void* data, size_t size);
+// The new certificate replaces the previous one only when app_certificate_write_end() succeeds,
+// a write which fails or which is aborted leaves the previous certificate in place.
+esp_err_t app_certificate_write_end(struct app_certificate_writer_t* writer);
+void app_certificate_write_abort(struct app_certificate_writer_t* writer);
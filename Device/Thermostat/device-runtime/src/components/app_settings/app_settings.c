@@ -1,9 +1,14 @@
 #include "app_settings.h"
+#include "app_settings_legacy.h"
+#include "esp_log.h"
 #include <string.h>
 
 #define SCHEMA_VERSION 1
 
+static const char* LOG_TAG = "settings";
+
 static struct app_settings_t g_settings;
+static struct app_settings_t g_snapshot;
 
 void set_defaults(struct settings_t* settings)
 {
@@ -18,23 +23,92 @@ void set_defaults(struct settings_t* settings)
 #endif
 }
 
-struct app_settings_t* app_settings_get(void)
+static void migrate_legacy_certificate(enum app_certificate_t certificate, const char* data, size_t size)
 {
-    if (g_settings.schema.version != SCHEMA_VERSION)
+    // A certificate provisioned after the update is newer than the one in the old settings
+    size_t length = strnlen(data, size);
+    if (length == 0 || app_certificate_exists(certificate))
+        return;
+
+    struct app_certificate_writer_t writer;
+    esp_err_t err = app_certificate_write_begin(certificate, &writer);
+    if (err != ESP_OK)
     {
-        ESP_ERROR_CHECK(settings_load(
-            "app",
-            set_defaults,
-            (struct settings_t*)&g_settings,
-            sizeof g_settings,
-            SCHEMA_VERSION
-        ));
+        ESP_LOGE(LOG_TAG, "Cannot migrate certificate %d because 0x%x", certificate, err);
+        return;
     }
 
+    err = app_certificate_write(&writer, data, length);
+    if (err == ESP_OK)
+        err = app_certificate_write_end(&writer);
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Cannot migrate certificate %d because 0x%x", certificate, err);
+        app_certificate_write_abort(&writer);
+    }
+}
+
+static esp_err_t convert_legacy(struct settings_t* settings, const void* blob, size_t size)
+{
+    const struct legacy_app_settings_v1_t* legacy = blob;
+    if (size != sizeof *legacy || legacy->schema.version != LEGACY_APP_SETTINGS_V1_VERSION)
+        return ESP_ERR_INVALID_VERSION;
+
+    struct app_settings_t* app = (struct app_settings_t*)settings;
+    app->connection = (enum network_connection)legacy->connection;
+    strlcpy(app->device_id, legacy->device_id, sizeof app->device_id);
+    strlcpy(app->mqtt_broker_address, legacy->mqtt_broker_address, sizeof app->mqtt_broker_address);
+    strlcpy(app->wifi_ssid, legacy->wifi_ssid, sizeof app->wifi_ssid);
+    strlcpy(app->wifi_password, legacy->wifi_password, sizeof app->wifi_password);
+
+    // The certificates now live in their own partition, we move them there
+    migrate_legacy_certificate(APP_CERTIFICATE_MQTT_SERVER, legacy->mqtt_server_certificate,
+                               sizeof legacy->mqtt_server_certificate);
+    migrate_legacy_certificate(APP_CERTIFICATE_MQTT_CLIENT, legacy->mqtt_client_certificate,
+                               sizeof legacy->mqtt_client_certificate);
+    migrate_legacy_certificate(APP_CERTIFICATE_MQTT_CLIENT_KEY, legacy->mqtt_client_key_certificate,
+                               sizeof legacy->mqtt_client_key_certificate);
+
+    return ESP_OK;
+}
+
+static const struct settings_field_t g_fields[] = {
+    SETTINGS_FIELD(SETTINGS_FIELD_INT32, struct app_settings_t, connection, "connection"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_settings_t, device_id, "device_id"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_settings_t, mqtt_broker_address, "broker_address"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_settings_t, wifi_ssid, "wifi_ssid"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_settings_t, wifi_password, "wifi_password"),
+};
+
+static struct settings_record_t g_record = {
+    .key = "app",
+    .fields = g_fields,
+    .field_count = sizeof(g_fields) / sizeof(g_fields[0]),
+    .settings = (struct settings_t*)&g_settings,
+    .snapshot = (struct settings_t*)&g_snapshot,
+    .settings_size = sizeof g_settings,
+    .schema_version = SCHEMA_VERSION,
+    .set_defaults = set_defaults,
+    .legacy_size = sizeof(struct legacy_app_settings_v1_t),
+    .convert_legacy = convert_legacy,
+};
+
+struct settings_record_t* app_settings_record(void)
+{
+    return &g_record;
+}
+
+struct app_settings_t* app_settings_get(void)
+{
+    // Normally loaded at boot together with the other records (see provisioning_initialize())
+    if (!g_record.loaded)
+        ESP_ERROR_CHECK(settings_record_load(&g_record));
+
     return &g_settings;
 }
 
 esp_err_t app_settings_save(void)
 {
-    return settings_save("app", (struct settings_t*)&g_settings, sizeof g_settings);
+    return settings_record_save(&g_record);
 }
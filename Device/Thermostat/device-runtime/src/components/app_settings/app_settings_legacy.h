@@ -0,0 +1,24 @@
+#pragma once
+
+#include "settings.h"
+#include <stdint.h>
+
+#define LEGACY_APP_SETTINGS_V1_VERSION 1
+
+// Layout of app_settings_t saved as a single blob (in the "default" namespace) by the firmwares
+// before field-level storage, when the certificates were part of the settings. It's used only
+// to read that blob: it must never change.
+struct legacy_app_settings_v1_t
+{
+    struct settings_t schema;
+    int32_t connection;
+    char device_id[40];
+    char mqtt_broker_address[46];
+    char mqtt_server_certificate[4 * 1024];
+    char mqtt_client_certificate[4 * 1024];
+    char mqtt_client_key_certificate[2 * 1024];
+    char wifi_ssid[33];
+    char wifi_password[64];
+};
+
+_Static_assert(sizeof(struct legacy_app_settings_v1_t) == 10432, "The layout of legacy settings must not change");
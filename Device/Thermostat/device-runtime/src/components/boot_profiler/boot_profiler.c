@@ -0,0 +1,198 @@
+#include "boot_profiler.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* LOG_TAG = "boot";
+
+#if CONFIG_TW_BOOT_PROFILER
+
+#define MAX_SPANS CONFIG_TW_BOOT_PROFILER_MAX_SPANS
+#define DUMP_HEADER_SIZE 8
+#define DUMP_ENTRY_SIZE 10
+#define MAX_NAME_LENGTH 255
+
+// Ring buffer: span N lives in slot N % MAX_SPANS until it's overwritten, we keep
+// its id in the slot to ignore boot_profiler_end() for a span which has been overwritten.
+static struct boot_span_t g_spans[MAX_SPANS];
+static uint32_t g_next_id;
+static uint8_t g_depth;
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static boot_span_id_t add_span(const char* name, const char* detail, uint8_t depth, int64_t start, int64_t end) {
+    taskENTER_CRITICAL(&g_lock);
+    uint32_t id = g_next_id++;
+    struct boot_span_t* span = &g_spans[id % MAX_SPANS];
+    span->name = name;
+    span->detail = detail;
+    span->id = id;
+    span->depth = depth;
+    span->start = start;
+    span->end = end;
+    taskEXIT_CRITICAL(&g_lock);
+
+    return (boot_span_id_t)(id & INT32_MAX);
+}
+
+boot_span_id_t boot_profiler_begin(const char* name, const char* detail) {
+    int64_t now = esp_timer_get_time();
+    uint8_t depth = g_depth;
+    if (g_depth < UINT8_MAX)
+        ++g_depth;
+
+    return add_span(name, detail, depth, now, 0);
+}
+
+void boot_profiler_end(boot_span_id_t span) {
+    if (span == BOOT_SPAN_INVALID)
+        return;
+
+    int64_t now = esp_timer_get_time();
+    if (g_depth > 0)
+        --g_depth;
+
+    taskENTER_CRITICAL(&g_lock);
+    struct boot_span_t* slot = &g_spans[(uint32_t)span % MAX_SPANS];
+    if ((slot->id & INT32_MAX) == (uint32_t)span)
+        slot->end = now;
+    taskEXIT_CRITICAL(&g_lock);
+}
+
+void boot_profiler_record(const char* name, const char* detail, int64_t start, int64_t end) {
+    add_span(name, detail, g_depth, start, end);
+}
+
+size_t boot_profiler_count(void) {
+    return g_next_id < MAX_SPANS ? g_next_id : MAX_SPANS;
+}
+
+bool boot_profiler_get(size_t index, struct boot_span_t* span) {
+    bool found = false;
+    taskENTER_CRITICAL(&g_lock);
+    size_t count = boot_profiler_count();
+    if (index < count) {
+        *span = g_spans[(g_next_id - count + index) % MAX_SPANS];
+        found = true;
+    }
+    taskEXIT_CRITICAL(&g_lock);
+
+    return found;
+}
+
+static size_t name_length(const struct boot_span_t* span) {
+    size_t length = strlen(span->name);
+    if (span->detail != NULL)
+        length += 1 + strlen(span->detail);
+
+    return length > MAX_NAME_LENGTH ? MAX_NAME_LENGTH : length;
+}
+
+static uint8_t* write_u32(uint8_t* p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+    return p + 4;
+}
+
+static uint32_t duration_of(const struct boot_span_t* span) {
+    if (span->end == 0)
+        return UINT32_MAX;
+
+    int64_t duration = span->end - span->start;
+    return duration >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)duration;
+}
+
+static uint8_t* write_name(uint8_t* p, const struct boot_span_t* span, size_t length) {
+    char name[MAX_NAME_LENGTH + 1];
+    if (span->detail != NULL)
+        snprintf(name, sizeof(name), "%s:%s", span->name, span->detail);
+    else
+        snprintf(name, sizeof(name), "%s", span->name);
+
+    memcpy(p, name, length);
+    return p + length;
+}
+
+size_t boot_profiler_dump(void* buffer, size_t size) {
+    size_t count = boot_profiler_count();
+    struct boot_span_t span;
+
+    size_t required = DUMP_HEADER_SIZE;
+    for (size_t i = 0; i < count && boot_profiler_get(i, &span); ++i)
+        required += DUMP_ENTRY_SIZE + name_length(&span);
+
+    if (buffer == NULL || size < required)
+        return required;
+
+    // Spans can be added (and overwritten) while we write, we stop when the next one does not fit
+    uint8_t* header = buffer;
+    uint8_t* end = header + size;
+    uint8_t* p = header + DUMP_HEADER_SIZE;
+    size_t written = 0;
+    for (; written < count && boot_profiler_get(written, &span); ++written) {
+        size_t length = name_length(&span);
+        if (p + DUMP_ENTRY_SIZE + length > end)
+            break;
+
+        p = write_u32(p, (uint32_t)span.start);
+        p = write_u32(p, duration_of(&span));
+        *p++ = span.depth;
+        *p++ = (uint8_t)length;
+        p = write_name(p, &span, length);
+    }
+
+    write_u32(header, BOOT_PROFILER_DUMP_MAGIC);
+    header[4] = BOOT_PROFILER_DUMP_VERSION;
+    header[5] = (uint8_t)written;
+    header[6] = 0;
+    header[7] = 0;
+
+    return p - header;
+}
+
+void boot_profiler_log(void) {
+    struct boot_span_t span;
+    for (size_t i = 0; boot_profiler_get(i, &span); ++i) {
+        uint32_t duration = duration_of(&span);
+        if (duration == UINT32_MAX) {
+            ESP_LOGI(LOG_TAG, "%*s%s%s%s @%lld us (open)", span.depth * 2, "", span.name, span.detail ? ":" : "",
+                     span.detail ? span.detail : "", span.start);
+        } else {
+            ESP_LOGI(LOG_TAG, "%*s%s%s%s @%lld us, %lu us", span.depth * 2, "", span.name, span.detail ? ":" : "",
+                     span.detail ? span.detail : "", span.start, (unsigned long)duration);
+        }
+    }
+}
+
+#else
+
+boot_span_id_t boot_profiler_begin(const char* name, const char* detail) {
+    return BOOT_SPAN_INVALID;
+}
+
+void boot_profiler_end(boot_span_id_t span) {
+}
+
+void boot_profiler_record(const char* name, const char* detail, int64_t start, int64_t end) {
+}
+
+size_t boot_profiler_count(void) {
+    return 0;
+}
+
+bool boot_profiler_get(size_t index, struct boot_span_t* span) {
+    return false;
+}
+
+size_t boot_profiler_dump(void* buffer, size_t size) {
+    return 0;
+}
+
+void boot_profiler_log(void) {
+    ESP_LOGD(LOG_TAG, "Boot profiler is disabled");
+}
+
+#endif
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BOOT_PROFILER_DUMP_MAGIC 0x544F4F42 // "BOOT"
+#define BOOT_PROFILER_DUMP_VERSION 1
+
+// A span measured with esp_timer_get_time(), times are in microseconds since boot.
+// Name and detail must be static strings (or at least outlive the profiler), detail
+// is optional and it's used to tell apart spans with the same name (for example the
+// key of the settings record or the interface).
+struct boot_span_t {
+    const char* name;
+    const char* detail;
+    uint32_t id;
+    uint8_t depth;
+    int64_t start;
+    int64_t end;
+};
+
+typedef int32_t boot_span_id_t;
+
+#define BOOT_SPAN_INVALID ((boot_span_id_t)-1)
+
+// Spans opened with boot_profiler_begin() nest (depth is the number of spans still
+// open when it starts) and they must be closed in order from the same task.
+// Spans completed elsewhere (for example in an event handler) are added with boot_profiler_record().
+boot_span_id_t boot_profiler_begin(const char* name, const char* detail);
+void boot_profiler_end(boot_span_id_t span);
+void boot_profiler_record(const char* name, const char* detail, int64_t start, int64_t end);
+
+// Spans currently in the ring buffer, index 0 is the oldest one
+size_t boot_profiler_count(void);
+bool boot_profiler_get(size_t index, struct boot_span_t* span);
+
+// Compact binary dump (little endian): header { u32 magic, u8 version, u8 count, u16 reserved }
+// followed by count entries { u32 start, u32 duration, u8 depth, u8 name length, name }.
+// Name is "name:detail" when there is a detail, duration is UINT32_MAX for spans still open.
+// Returns the size of the dump, nothing is written if buffer is smaller than that.
+size_t boot_profiler_dump(void* buffer, size_t size);
+
+void boot_profiler_log(void);
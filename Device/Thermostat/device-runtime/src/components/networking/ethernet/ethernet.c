@@ -1,7 +1,9 @@
 #include "ethernet_init.h"
+#include "boot_profiler.h"
 #include "esp_err.h"
 #include "esp_eth.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "ethernet.h"
 
 static const char* LOG_TAG = "net_eth";
@@ -22,16 +24,26 @@ esp_err_t ethernet_init(struct ethernet_interface* interfaces[], size_t* interfa
 
 #if CONFIG_TW_USE_OPENETH
     ESP_LOGI(LOG_TAG, "Initializing OpenCores card...");
+    int64_t start_time = esp_timer_get_time();
+    boot_span_id_t span = boot_profiler_begin("eth_init", "OPC_ETH1");
     *interfaces[0] = ethernet_init_openeth();
+    boot_profiler_end(span);
+    ESP_LOGI(LOG_TAG, "OpenCores card initialized in %lld ms", (esp_timer_get_time() - start_time) / 1000);
 #elif CONFIG_TW_USE_INTERNAL_ETHERNET || CONFIG_TW_USE_SPI_ETHERNET
 #if CONFIG_TW_USE_INTERNAL_ETHERNET
     ESP_LOGI(LOG_TAG, "Initializing internal card...");
+    int64_t start_time = esp_timer_get_time();
+    boot_span_id_t span = boot_profiler_begin("eth_init", "INT_ETH1");
     *interfaces[0] = ethernet_init_internal();
+    boot_profiler_end(span);
+    ESP_LOGI(LOG_TAG, "Internal card initialized in %lld ms", (esp_timer_get_time() - start_time) / 1000);
 #endif
 
 #if CONFIG_TW_USE_SPI_ETHERNET
     ESP_LOGI(LOG_TAG, "Initializing SPI card(s)...");
+    int64_t spi_start_time = esp_timer_get_time();
     ethernet_init_spi(interfaces, INTERNAL_ETHERNETS_NUM);
+    ESP_LOGI(LOG_TAG, "SPI card(s) initialized in %lld ms", (esp_timer_get_time() - spi_start_time) / 1000);
 #endif
 #else
     ESP_LOGD(LOG_TAG, "No Ethernet device selected to init");
@@ -2,11 +2,18 @@
 #include "esp_check.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "esp_pm.h"
 #include "ethernet_init.h"
 #include <assert.h>
 
 static const char* LOG_TAG = "net_eth";
 
+#if CONFIG_PM_ENABLE
+// The EMAC (and the RMII clock of the PHY) stops in light sleep, frames would be lost while the
+// scheduler sleeps. The interface is never stopped then we hold the lock for the whole run.
+static esp_pm_lock_handle_t g_no_light_sleep_lock;
+#endif
+
 struct ethernet_interface ethernet_init_internal(void) {
     ESP_LOGI(LOG_TAG, "Creating interface INT_ETH1...");
     esp_netif_inherent_config_t esp_netif_config = ESP_NETIF_INHERENT_DEFAULT_ETH();
@@ -47,6 +54,11 @@ struct ethernet_interface ethernet_init_internal(void) {
 #elif CONFIG_TW_ETH_PHY_KSZ80XX
     esp_eth_phy_t* phy = esp_eth_phy_new_ksz80xx(&phy_config);
 #endif
+#if CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "emac", &g_no_light_sleep_lock));
+    ESP_ERROR_CHECK(esp_pm_lock_acquire(g_no_light_sleep_lock));
+#endif
+
     ESP_LOGI(LOG_TAG, "Installing Ethernet driver...");
     esp_eth_handle_t eth_handle = NULL;
     esp_eth_config_t config = ETH_DEFAULT_CONFIG(mac, phy);
@@ -1,3 +1,4 @@
+#include "boot_profiler.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include "esp_check.h"
@@ -136,7 +137,10 @@ void ethernet_init_spi(esp_netif_t* netifs[], size_t start_index) {
     spi_eth_module_config[1].mac_addr = local_mac_2;
 #endif
 
+    static const char* nic_keys[] = {"SPI_ETH1", "SPI_ETH2"};
     for (int i = 0; i < CONFIG_TW_SPI_ETHERNETS_NUM; i++) {
+        boot_span_id_t span = boot_profiler_begin("eth_init", nic_keys[i]);
         nic_init(&spi_eth_module_config[i], netifs, start_index + i, i + 1);
+        boot_profiler_end(span);
     }
 }
@@ -1,4 +1,5 @@
 #include "include/networking.h"
+#include "boot_profiler.h"
 #include "esp_eth.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -6,17 +7,48 @@
 #include "esp_timer.h"
 #include "ethernet/ethernet.h"
 #include "lwip/ip_addr.h"
+#include "lwip/netif.h"
 #include "settings.h"
 #include <assert.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define GOT_IP_BIT BIT0
-#define DEFAULT_CONNECTION_TIMEOUT 5000
+
+// The DHCP fallback timers post this event: the state of the interfaces is changed only
+// by the handlers which run in the event loop task.
+ESP_EVENT_DEFINE_BASE(NETWORKING_EVENT);
+enum {
+    NETWORKING_EVENT_DHCP_TIMEOUT,
+};
+
+struct interface_state_t {
+    esp_netif_t* netif;
+    esp_eth_handle_t handle;
+    esp_timer_handle_t fallback_timer;
+    int64_t link_up_time;
+    int64_t got_ip_time;
+};
+
+struct provisional_ip_t {
+    esp_netif_t* netif;
+    esp_netif_ip_info_t ip;
+};
 
 static const char* LOG_TAG = "net";
-static const struct network_setup_t* g_setup;
+static struct network_setup_t g_setup;
 static bool g_setup_completed;
 static EventGroupHandle_t s_network_event_group;
+static int64_t g_setup_start_time;
+static struct interface_state_t* g_interfaces;
+static size_t g_interface_count;
+static struct interface_state_t* g_preferred;
+static struct interface_state_t* g_primary;
+static struct interface_state_t* g_static_ip_owner;
+static esp_event_handler_instance_t g_instance_any_id;
+static esp_event_handler_instance_t g_instance_got_ip;
+static esp_event_handler_instance_t g_instance_dhcp_timeout;
 
 static const char* network_nic_to_key(enum network_nic nic) {
     switch (nic) {
@@ -56,42 +88,190 @@ static const char* network_nic_to_key(enum network_nic nic) {
     return NULL;
 }
 
+static void get_static_ip(esp_netif_ip_info_t* ip) {
+    memset(ip, 0, sizeof(esp_netif_ip_info_t));
+    ip->ip.addr = ipaddr_addr(g_setup.static_ip_address);
+    ip->netmask.addr = ipaddr_addr(g_setup.static_ip_netmask);
+    ip->gw.addr = ipaddr_addr(g_setup.static_ip_gw_address);
+}
+
 static bool ethernet_set_static_ip(esp_netif_t* netif) {
     ESP_LOGI(LOG_TAG, "Stopping DHCP client...");
-    if (esp_netif_dhcpc_stop(netif) != ESP_OK) {
+    esp_err_t err = esp_netif_dhcpc_stop(netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
         ESP_LOGE(LOG_TAG, "Failed to stop DHCP client");
         return false;
     }
 
     ESP_LOGI(LOG_TAG, "Setting up static IP address...");
     esp_netif_ip_info_t ip;
-    memset(&ip, 0, sizeof(esp_netif_ip_info_t));
-    ip.ip.addr = ipaddr_addr(g_setup->static_ip_address);
-    ip.netmask.addr = ipaddr_addr(g_setup->static_ip_netmask);
-    ip.gw.addr = ipaddr_addr(g_setup->static_ip_gw_address);
+    get_static_ip(&ip);
     if (esp_netif_set_ip_info(netif, &ip) != ESP_OK) {
         ESP_LOGE(LOG_TAG, "Failed to set IP info");
         return false;
     }
 
-    ESP_LOGD(LOG_TAG, "Success to set static IP: %s (%s)", g_setup->static_ip_address, g_setup->static_ip_netmask);
-    ESP_LOGD(LOG_TAG, "Success to set gateway: %s", g_setup->static_ip_gw_address);
+    ESP_LOGD(LOG_TAG, "Success to set static IP: %s (%s)", g_setup.static_ip_address, g_setup.static_ip_netmask);
+    ESP_LOGD(LOG_TAG, "Success to set gateway: %s", g_setup.static_ip_gw_address);
 
     return true;
 }
 
+// Runs in the TCP/IP task
+static esp_err_t set_lwip_address(void* context) {
+    struct provisional_ip_t* address = context;
+    struct netif* netif = esp_netif_get_netif_impl(address->netif);
+    if (netif == NULL) return ESP_ERR_INVALID_STATE;
+
+    netif_set_addr(netif, (const ip4_addr_t*)&address->ip.ip, (const ip4_addr_t*)&address->ip.netmask,
+                   (const ip4_addr_t*)&address->ip.gw);
+    return ESP_OK;
+}
+
+// The static address is used while the DHCP client is still running. esp_netif refuses it
+// until the client is stopped, we give it to the lwIP interface directly: the client keeps
+// trying and a lease replaces it (together with the connections opened with it). When the
+// DHCP timeout expires the client is stopped and the address stays (see ethernet_set_static_ip()).
+static bool ethernet_set_provisional_ip(esp_netif_t* netif) {
+    struct provisional_ip_t address = {.netif = netif};
+    get_static_ip(&address.ip);
+    if (address.ip.ip.addr == IPADDR_NONE || address.ip.ip.addr == IPADDR_ANY) return false;
+
+    if (esp_netif_tcpip_exec(set_lwip_address, &address) != ESP_OK) {
+        ESP_LOGE(LOG_TAG, "Failed to set the static IP while DHCP is running");
+        return false;
+    }
+
+    ESP_LOGI(LOG_TAG, "Using static IP %s for %s until DHCP completes", g_setup.static_ip_address,
+             esp_netif_get_ifkey(netif));
+    return true;
+}
+
+static int64_t elapsed_ms(int64_t since) {
+    return (esp_timer_get_time() - since) / 1000;
+}
+
+static struct interface_state_t* find_interface_by_handle(esp_eth_handle_t handle) {
+    for (size_t i = 0; i < g_interface_count; ++i) {
+        if (g_interfaces[i].handle == handle) return &g_interfaces[i];
+    }
+
+    return NULL;
+}
+
+static struct interface_state_t* find_interface_by_netif(esp_netif_t* netif) {
+    for (size_t i = 0; i < g_interface_count; ++i) {
+        if (g_interfaces[i].netif == netif) return &g_interfaces[i];
+    }
+
+    return NULL;
+}
+
+static void use_address(struct interface_state_t* state) {
+    // First responder wins, unless the primary interface has been explicitly selected
+    if (g_primary == NULL && (g_preferred == NULL || g_preferred == state)) {
+        g_primary = state;
+        esp_netif_set_default_netif(state->netif);
+        ESP_LOGI(LOG_TAG, "Primary interface is %s", esp_netif_get_ifkey(state->netif));
+    }
+
+    g_setup_completed = true;
+    if (g_primary == state) xEventGroupSetBits(s_network_event_group, GOT_IP_BIT);
+}
+
+// There is only one static address: it goes to the configured primary interface or,
+// when the primary is not specified, to the first one which is ready for it (and only
+// while no other interface has an address).
+static bool can_use_static_ip(struct interface_state_t* state) {
+    if (g_static_ip_owner != NULL) return g_static_ip_owner == state;
+    if (g_primary != NULL) return false;
+
+    return g_preferred == NULL || g_preferred == state;
+}
+
+static void assign_static_ip(struct interface_state_t* state) {
+    if (!can_use_static_ip(state)) return;
+
+    if (ethernet_set_static_ip(state->netif)) g_static_ip_owner = state;
+}
+
+static void assign_provisional_ip(struct interface_state_t* state) {
+    if (state->got_ip_time != 0 || !can_use_static_ip(state)) return;
+
+    if (ethernet_set_provisional_ip(state->netif)) {
+        g_static_ip_owner = state;
+        use_address(state);
+    }
+}
+
+static void dhcp_fallback_callback(void* arg) {
+    // It runs in the esp_timer task, the fallback is applied by the event loop
+    esp_event_post(NETWORKING_EVENT, NETWORKING_EVENT_DHCP_TIMEOUT, &arg, sizeof arg, 0);
+}
+
+static void on_dhcp_timeout(struct interface_state_t* state) {
+    if (state->got_ip_time != 0) return;
+
+    ESP_LOGW(LOG_TAG, "No DHCP address for %s within %d ms", esp_netif_get_ifkey(state->netif), g_setup.dhcp_timeout);
+    assign_static_ip(state);
+}
+
+static void on_link_up(struct interface_state_t* state) {
+    state->link_up_time = esp_timer_get_time();
+    boot_profiler_record("eth_link", esp_netif_get_ifkey(state->netif), g_setup_start_time, state->link_up_time);
+    ESP_LOGI(LOG_TAG, "Interface %s connected (%lld ms)", esp_netif_get_ifkey(state->netif),
+             (state->link_up_time - g_setup_start_time) / 1000);
+
+    if (!g_setup.use_dhcp) {
+        assign_static_ip(state);
+        return;
+    }
+
+    // DHCP runs on every interface at the same time, each one falls back to the static
+    // configuration on its own schedule (counted from its link up). Meanwhile the static
+    // address is already in use, DHCP can still replace it.
+    if (state->fallback_timer == NULL) {
+        esp_timer_create_args_t timer_args = {
+            .callback = dhcp_fallback_callback,
+            .arg = state,
+            .name = "dhcp_fallback",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &state->fallback_timer));
+    }
+
+    esp_timer_stop(state->fallback_timer);
+    esp_timer_start_once(state->fallback_timer, (uint64_t)g_setup.dhcp_timeout * 1000);
+    assign_provisional_ip(state);
+}
+
+static void on_got_ip(struct interface_state_t* state, const ip_event_got_ip_t* event) {
+    state->got_ip_time = esp_timer_get_time();
+    int64_t got_ip_start = state->link_up_time != 0 ? state->link_up_time : g_setup_start_time;
+    boot_profiler_record("got_ip", esp_netif_get_ifkey(state->netif), got_ip_start, state->got_ip_time);
+    if (state->fallback_timer != NULL) esp_timer_stop(state->fallback_timer);
+
+    ESP_LOGI(LOG_TAG, "IP for %s is:" IPSTR " (%lld ms)", esp_netif_get_ifkey(state->netif),
+             IP2STR(&event->ip_info.ip), (state->got_ip_time - g_setup_start_time) / 1000);
+
+    use_address(state);
+}
+
 static void ethernet_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    if (event_base == ETH_EVENT && event_id == ETHERNET_EVENT_CONNECTED) {
-        ESP_LOGI(LOG_TAG, "Interface %s connected", esp_netif_get_ifkey((esp_netif_t*)arg));
-        if (!g_setup_completed) {
-            g_setup_completed = g_setup->use_dhcp || ethernet_set_static_ip(arg);
+    if (event_base == ETH_EVENT) {
+        struct interface_state_t* state = find_interface_by_handle(*(esp_eth_handle_t*)event_data);
+        if (state == NULL) return;
+
+        if (event_id == ETHERNET_EVENT_CONNECTED) {
+            on_link_up(state);
+        } else if (event_id == ETHERNET_EVENT_DISCONNECTED) {
+            ESP_LOGI(LOG_TAG, "Interface %s disconnected", esp_netif_get_ifkey(state->netif));
         }
-    } else if (event_base == ETH_EVENT && event_id == ETHERNET_EVENT_DISCONNECTED) {
-        ESP_LOGI(LOG_TAG, "Interface %s disconnected", esp_netif_get_ifkey((esp_netif_t*)arg));
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_ETH_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*)event_data;
-        ESP_LOGI(LOG_TAG, "IP for %s is:" IPSTR, esp_netif_get_ifkey((esp_netif_t*)arg), IP2STR(&event->ip_info.ip));
-        xEventGroupSetBits(s_network_event_group, GOT_IP_BIT);
+        struct interface_state_t* state = find_interface_by_netif(event->esp_netif);
+        if (state != NULL) on_got_ip(state, event);
+    } else if (event_base == NETWORKING_EVENT && event_id == NETWORKING_EVENT_DHCP_TIMEOUT) {
+        on_dhcp_timeout(*(struct interface_state_t**)event_data);
     }
 }
 
@@ -106,7 +286,15 @@ esp_err_t networking_initialize(void) {
 }
 
 esp_err_t networking_setup(const struct network_setup_t* setup) {
-    g_setup = setup;
+    // The drivers and the event handlers are installed once, they stay until the device restarts
+    if (g_interfaces != NULL) {
+        ESP_LOGE(LOG_TAG, "Network already set up");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Event handlers run after this function returns, we need our own copy
+    g_setup = *setup;
+    g_setup_start_time = esp_timer_get_time();
 
     struct ethernet_interface* interfaces = NULL;
     size_t interface_count;
@@ -117,45 +305,64 @@ esp_err_t networking_setup(const struct network_setup_t* setup) {
         return ESP_ERR_NOT_SUPPORTED;
     }
 
-    esp_netif_t* primary_nic = NULL;
-    const char* primary_nic_key = network_nic_to_key(setup->primary_nic);
-    esp_event_handler_instance_t instance_any_id;
-    esp_event_handler_instance_t instance_got_ip;
+    int64_t init_time = esp_timer_get_time();
+
+    g_interfaces = calloc(interface_count, sizeof(struct interface_state_t));
+    if (g_interfaces == NULL) {
+        ESP_LOGE(LOG_TAG, "Not enough memory for %u interfaces", (unsigned)interface_count);
+        free(interfaces);
+        return ESP_ERR_NO_MEM;
+    }
+
+    g_interface_count = interface_count;
     for (size_t i = 0; i < interface_count; ++i) {
-        const char* interface_key = esp_netif_get_ifkey(interfaces[i].interface);
-        if (strcmp(primary_nic_key, interface_key) == 0) {
-            primary_nic = interfaces[i].interface;
-            ESP_ERROR_CHECK(esp_event_handler_instance_register(ETH_EVENT, ESP_EVENT_ANY_ID, &ethernet_event_handler,
-                                                                primary_nic, &instance_any_id));
-            assert(instance_any_id);
-            ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &ethernet_event_handler,
-                                                                primary_nic, &instance_got_ip));
-            assert(instance_got_ip);
+        g_interfaces[i].netif = interfaces[i].interface;
+        g_interfaces[i].handle = interfaces[i].handle;
+    }
+
+    // An explicit primary NIC is the only one which can get the static IP and become the default
+    // interface, otherwise the first interface to get an IP address wins.
+    if (setup->primary_nic != NETWORK_NIC_DEFAULT) {
+        const char* primary_nic_key = network_nic_to_key(setup->primary_nic);
+        for (size_t i = 0; i < interface_count; ++i) {
+            if (strcmp(primary_nic_key, esp_netif_get_ifkey(g_interfaces[i].netif)) == 0)
+                g_preferred = &g_interfaces[i];
         }
+    }
+
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(ETH_EVENT, ESP_EVENT_ANY_ID, &ethernet_event_handler, NULL,
+                                                        &g_instance_any_id));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &ethernet_event_handler, NULL,
+                                                        &g_instance_got_ip));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(NETWORKING_EVENT, NETWORKING_EVENT_DHCP_TIMEOUT,
+                                                        &ethernet_event_handler, NULL, &g_instance_dhcp_timeout));
 
-        ESP_LOGI(LOG_TAG, "Starting %s...", interface_key);
-        ESP_ERROR_CHECK(esp_eth_start(interfaces[i].handle));
+    // All the interfaces are started before waiting: link negotiation and DHCP proceed in parallel
+    boot_span_id_t span = boot_profiler_begin("eth_start", NULL);
+    for (size_t i = 0; i < interface_count; ++i) {
+        ESP_LOGI(LOG_TAG, "Starting %s...", esp_netif_get_ifkey(g_interfaces[i].netif));
+        ESP_ERROR_CHECK(esp_eth_start(g_interfaces[i].handle));
     }
+    boot_profiler_end(span);
+
+    free(interfaces);
+    int64_t start_time = esp_timer_get_time();
 
-    // Wait for the connection to be estabilished and an IP assigned
-    int timeout = setup->use_dhcp && setup->dhcp_timeout > 0 ? setup->dhcp_timeout : DEFAULT_CONNECTION_TIMEOUT;
+    // Wait for the connection to be estabilished and an IP assigned (fallback to static IP is done
+    // by the event handlers).
+    int timeout = CONFIG_TW_NET_GET_IP_TIMEOUT;
+    if (setup->use_dhcp && setup->dhcp_timeout > 0) timeout += setup->dhcp_timeout;
+    span = boot_profiler_begin("ip_wait", NULL);
     EventBits_t bits = xEventGroupWaitBits(s_network_event_group, GOT_IP_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout));
+    boot_profiler_end(span);
 
-    // If we have not been assigned an IP then it's an error but, if we were waiting for DHCP then we can
-    // fallback to a manual static IP configuration.
     if (!(bits & GOT_IP_BIT)) {
         ESP_LOGE(LOG_TAG, "Ethernet IP address not set within  %d ms", timeout);
-        if (setup->use_dhcp && primary_nic != NULL) {
-            ESP_LOGI(LOG_TAG, "Falling back to static IP");
-            if (ethernet_set_static_ip(primary_nic)) g_setup_completed = true;
-        }
     }
 
-    // We do not need this after the setup phase but we keep general events to log connected/disconnected events.
-    if (instance_got_ip != NULL)
-        ESP_ERROR_CHECK(esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_ETH_GOT_IP, instance_got_ip));
-
-    vEventGroupDelete(s_network_event_group);
+    ESP_LOGI(LOG_TAG, "Network setup: init %lld ms, start %lld ms, first IP %lld ms (%lld ms since boot)",
+             (init_time - g_setup_start_time) / 1000, (start_time - init_time) / 1000, elapsed_ms(g_setup_start_time),
+             esp_timer_get_time() / 1000);
 
     return ESP_OK;
 }
\ No newline at end of file
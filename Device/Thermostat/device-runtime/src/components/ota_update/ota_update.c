@@ -0,0 +1,260 @@
+#include "ota_update.h"
+#include "esp_crt_bundle.h"
+#include "esp_delta_ota.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* LOG_TAG = "ota";
+
+#define MAX_URL_LENGTH 256
+#define TASK_STACK_SIZE 6144
+#define RETRY_DELAY_MS 2000
+
+struct update_t {
+    char url[MAX_URL_LENGTH];
+    uint8_t expected_sha256[OTA_UPDATE_DIGEST_SIZE];
+    const esp_partition_t* source;
+    const esp_partition_t* target;
+    esp_ota_handle_t ota_handle;
+    mbedtls_sha256_context sha;
+    // Bytes of the patch already fed to the decoder, a resumed download starts from here
+    size_t received;
+    // Bytes of the new image written to the target partition
+    size_t written;
+};
+
+// The delta reader callback has no user data, there is only one update at a time anyway
+static struct update_t* volatile g_update;
+
+static esp_err_t read_source(uint8_t* buffer, size_t size, int offset) {
+    return esp_partition_read(g_update->source, offset, buffer, size);
+}
+
+static esp_err_t write_target(const uint8_t* buffer, size_t size, void* user_data) {
+    struct update_t* update = user_data;
+
+    // The digest is computed while writing then the image is never read back
+    mbedtls_sha256_update(&update->sha, buffer, size);
+    update->written += size;
+    return esp_ota_write(update->ota_handle, buffer, size);
+}
+
+static esp_err_t stream_patch(struct update_t* update, esp_delta_ota_handle_t delta, esp_http_client_handle_t client,
+                              bool* can_retry) {
+    uint8_t buffer[CONFIG_TW_OTA_BUFFER_SIZE];
+
+    while (true) {
+        int size = esp_http_client_read(client, (char*)buffer, sizeof buffer);
+        if (size < 0) {
+            *can_retry = true;
+            return ESP_FAIL;
+        }
+
+        if (size == 0) {
+            if (esp_http_client_is_complete_data_received(client))
+                return ESP_OK;
+
+            *can_retry = true;
+            return ESP_ERR_TIMEOUT;
+        }
+
+        // Once a chunk has been fed it cannot be fed again: a failure here means a corrupted
+        // patch (or a patch for a different base image) and there is nothing to retry.
+        esp_err_t err = esp_delta_ota_feed_patch(delta, buffer, size);
+        if (err != ESP_OK) {
+            ESP_LOGE(LOG_TAG, "Failed to apply the patch at offset %zu because 0x%x...", update->received, err);
+            return err;
+        }
+
+        update->received += size;
+    }
+}
+
+static esp_err_t download_once(struct update_t* update, esp_delta_ota_handle_t delta, bool* can_retry) {
+    esp_http_client_config_t config = {
+        .url = update->url,
+        .timeout_ms = CONFIG_TW_OTA_HTTP_TIMEOUT_MS,
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .keep_alive_enable = true,
+    };
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL)
+        return ESP_ERR_NO_MEM;
+
+    // The decoder keeps its state in RAM, to resume we only need the rest of the patch
+    bool resuming = update->received > 0;
+    if (resuming) {
+        char range[32];
+        snprintf(range, sizeof range, "bytes=%zu-", update->received);
+        esp_http_client_set_header(client, "Range", range);
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        *can_retry = true;
+    } else if (esp_http_client_fetch_headers(client) < 0) {
+        *can_retry = true;
+        err = ESP_FAIL;
+    } else {
+        int status = esp_http_client_get_status_code(client);
+        if (status == (resuming ? 206 : 200)) {
+            err = stream_patch(update, delta, client, can_retry);
+        } else {
+            // A server which does not support range requests sends the whole patch again
+            // with 200, we cannot feed it twice.
+            ESP_LOGE(LOG_TAG, "Unexpected HTTP status %d", status);
+            *can_retry = status >= 500;
+            err = ESP_ERR_INVALID_RESPONSE;
+        }
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+static esp_err_t download(struct update_t* update, esp_delta_ota_handle_t delta) {
+    for (int attempt = 0;; ++attempt) {
+        bool can_retry = false;
+        esp_err_t err = download_once(update, delta, &can_retry);
+        if (err == ESP_OK || !can_retry)
+            return err;
+
+        if (attempt == CONFIG_TW_OTA_MAX_RETRIES) {
+            ESP_LOGE(LOG_TAG, "Download failed after %d attempts", attempt + 1);
+            return err;
+        }
+
+        ESP_LOGW(LOG_TAG, "Download interrupted at %zu bytes because 0x%x, retrying...", update->received, err);
+        vTaskDelay(pdMS_TO_TICKS(RETRY_DELAY_MS));
+    }
+}
+
+static esp_err_t apply(struct update_t* update) {
+    update->source = esp_ota_get_running_partition();
+    update->target = esp_ota_get_next_update_partition(NULL);
+    if (update->target == NULL) {
+        ESP_LOGE(LOG_TAG, "There is no OTA partition to update");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGI(LOG_TAG, "Updating %s from %s with %s", update->target->label, update->source->label, update->url);
+
+    // Sequential writes: each sector is erased only when reached, without erasing the whole
+    // partition in advance.
+    esp_err_t err = esp_ota_begin(update->target, OTA_WITH_SEQUENTIAL_WRITES, &update->ota_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(LOG_TAG, "Failed to begin the update because 0x%x...", err);
+        return err;
+    }
+
+    mbedtls_sha256_init(&update->sha);
+    mbedtls_sha256_starts(&update->sha, 0);
+
+    esp_delta_ota_cfg_t config = {
+        .read_cb = read_source,
+        .write_cb_with_user_data = write_target,
+        .user_data = update,
+    };
+
+    esp_delta_ota_handle_t delta = esp_delta_ota_init(&config);
+    if (delta == NULL) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        err = download(update, delta);
+        if (err == ESP_OK)
+            err = esp_delta_ota_finalize(delta);
+
+        esp_delta_ota_deinit(delta);
+    }
+
+    uint8_t digest[OTA_UPDATE_DIGEST_SIZE];
+    mbedtls_sha256_finish(&update->sha, digest);
+    mbedtls_sha256_free(&update->sha);
+
+    if (err == ESP_OK && memcmp(digest, update->expected_sha256, sizeof digest) != 0) {
+        ESP_LOGE(LOG_TAG, "The digest of the new image does not match");
+        err = ESP_ERR_INVALID_CRC;
+    }
+
+    if (err != ESP_OK) {
+        esp_ota_abort(update->ota_handle);
+        return err;
+    }
+
+    // esp_ota_end() validates the image (header, segments and its own checksum)
+    err = esp_ota_end(update->ota_handle);
+    if (err == ESP_OK)
+        err = esp_ota_set_boot_partition(update->target);
+
+    if (err != ESP_OK)
+        ESP_LOGE(LOG_TAG, "Failed to activate the new image because 0x%x...", err);
+
+    return err;
+}
+
+static void update_task(void* arg) {
+    struct update_t* update = arg;
+
+    esp_err_t err = apply(update);
+    if (err == ESP_OK) {
+        ESP_LOGI(LOG_TAG, "Update completed (%zu bytes downloaded, %zu written), restarting...", update->received,
+                 update->written);
+        esp_restart();
+    }
+
+    ESP_LOGE(LOG_TAG, "Update failed because 0x%x", err);
+    g_update = NULL;
+    free(update);
+    vTaskDelete(NULL);
+}
+
+esp_err_t ota_update_start(const char* url, const uint8_t expected_sha256[OTA_UPDATE_DIGEST_SIZE]) {
+    if (strlen(url) >= MAX_URL_LENGTH)
+        return ESP_ERR_INVALID_ARG;
+
+    if (g_update != NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    struct update_t* update = calloc(1, sizeof *update);
+    if (update == NULL)
+        return ESP_ERR_NO_MEM;
+
+    strcpy(update->url, url);
+    memcpy(update->expected_sha256, expected_sha256, OTA_UPDATE_DIGEST_SIZE);
+    g_update = update;
+
+    if (xTaskCreate(update_task, "ota", TASK_STACK_SIZE + CONFIG_TW_OTA_BUFFER_SIZE, update, tskIDLE_PRIORITY + 1,
+                    NULL) != pdPASS) {
+        g_update = NULL;
+        free(update);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+bool ota_update_in_progress(void) {
+    return g_update != NULL;
+}
+
+esp_err_t ota_update_confirm(void) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK || state != ESP_OTA_IMG_PENDING_VERIFY)
+        return ESP_OK;
+
+    ESP_LOGI(LOG_TAG, "Confirming the new image in %s", running->label);
+    return esp_ota_mark_app_valid_cancel_rollback();
+}
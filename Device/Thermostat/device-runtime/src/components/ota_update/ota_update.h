@@ -0,0 +1,19 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OTA_UPDATE_DIGEST_SIZE 32
+
+// Downloads a delta update from url and applies it, against the running image, directly to the
+// inactive OTA partition. The delta is a detools patch with heatshrink compression (see
+// scripts/create-delta.ps1) and expected_sha256 is the digest of the resulting image: it's
+// computed while writing and the new image is selected for boot only if it matches.
+// The update runs in its own task, when successful the device restarts with the new image.
+esp_err_t ota_update_start(const char* url, const uint8_t expected_sha256[OTA_UPDATE_DIGEST_SIZE]);
+bool ota_update_in_progress(void);
+
+// After an update the new image is in a pending state until it's confirmed, if the device
+// restarts before that then the bootloader rolls back to the previous image.
+esp_err_t ota_update_confirm(void);
@@ -0,0 +1,100 @@
+#include "certificate_stream.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char* LOG_TAG = "prov";
+
+static int hex_to_nibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool certificate_stream_parse_digest(const char* hex, uint8_t digest[CERTIFICATE_STREAM_DIGEST_SIZE]) {
+    if (hex == NULL || strlen(hex) != CERTIFICATE_STREAM_DIGEST_SIZE * 2) return false;
+
+    for (size_t i = 0; i < CERTIFICATE_STREAM_DIGEST_SIZE; ++i) {
+        int high = hex_to_nibble(hex[i * 2]);
+        int low = hex_to_nibble(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) return false;
+        digest[i] = (uint8_t)((high << 4) | low);
+    }
+
+    return true;
+}
+
+static esp_err_t write_payload(void* context, const uint8_t* data, size_t size) {
+    struct certificate_stream_t* stream = context;
+    mbedtls_sha256_update(&stream->sha, data, size);
+    return app_certificate_write(&stream->writer, data, size);
+}
+
+static esp_err_t discard_payload(void* context, const uint8_t* data, size_t size) {
+    return ESP_OK;
+}
+
+static void init_stream(struct certificate_stream_t* stream) {
+    memset(stream, 0, sizeof *stream);
+    frame_parser_init(&stream->parser, write_payload, stream);
+    mbedtls_sha256_init(&stream->sha);
+    mbedtls_sha256_starts(&stream->sha, 0);
+}
+
+void certificate_stream_begin(struct certificate_stream_t* stream, enum app_certificate_t certificate,
+                              const uint8_t expected_digest[CERTIFICATE_STREAM_DIGEST_SIZE]) {
+    init_stream(stream);
+    memcpy(stream->expected_digest, expected_digest, sizeof stream->expected_digest);
+
+    // When the slot cannot be written we still have to read the frames, the error is reported at the end
+    stream->parser.error = app_certificate_write_begin(certificate, &stream->writer);
+    stream->writing = stream->parser.error == ESP_OK;
+}
+
+void certificate_stream_skip(struct certificate_stream_t* stream) {
+    init_stream(stream);
+    stream->parser.on_payload = discard_payload;
+    stream->skipping = true;
+}
+
+bool certificate_stream_feed(struct certificate_stream_t* stream, struct connection_t* connection) {
+    // Frames are parsed straight from the connection buffer. After an error (for example because
+    // the certificate is too big) we still read all the frames, the connection stays in sync.
+    const uint8_t* data;
+    size_t available = connection_peek(connection, &data);
+    connection_consume(connection, frame_parser_feed(&stream->parser, data, available));
+
+    return frame_parser_is_done(&stream->parser);
+}
+
+esp_err_t certificate_stream_end(struct certificate_stream_t* stream) {
+    uint8_t digest[CERTIFICATE_STREAM_DIGEST_SIZE];
+    mbedtls_sha256_finish(&stream->sha, digest);
+    mbedtls_sha256_free(&stream->sha);
+    if (stream->skipping) return ESP_OK;
+
+    esp_err_t err = stream->parser.error;
+    if (err != ESP_OK) {
+        ESP_LOGE(LOG_TAG, "Certificate upload failed after %zu bytes because 0x%x", stream->parser.payload_size, err);
+    } else if (memcmp(digest, stream->expected_digest, sizeof digest) != 0) {
+        ESP_LOGE(LOG_TAG, "Certificate digest mismatch after %zu bytes", stream->parser.payload_size);
+        err = ESP_ERR_INVALID_CRC;
+    }
+
+    if (!stream->writing) return err;
+
+    stream->writing = false;
+    if (err != ESP_OK) {
+        app_certificate_write_abort(&stream->writer);
+        return err;
+    }
+
+    return app_certificate_write_end(&stream->writer);
+}
+
+void certificate_stream_abort(struct certificate_stream_t* stream) {
+    mbedtls_sha256_free(&stream->sha);
+    if (stream->writing) app_certificate_write_abort(&stream->writer);
+
+    stream->writing = false;
+}
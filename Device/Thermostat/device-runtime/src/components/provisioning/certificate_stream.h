@@ -0,0 +1,37 @@
+#pragma once
+
+#include "app_certificates.h"
+#include "connection.h"
+#include "esp_err.h"
+#include "frame_parser.h"
+#include "mbedtls/sha256.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CERTIFICATE_STREAM_DIGEST_SIZE 32
+
+// Binary certificate upload: after the command line (which carries the expected SHA-256)
+// the client sends a sequence of frames (see frame_parser.h). Frames are hashed and written
+// to the certificate slot as they arrive, the slot is validated only if the digest matches.
+// The upload is fed with whatever the connection received, it never waits for more data.
+struct certificate_stream_t {
+    struct app_certificate_writer_t writer;
+    bool writing;
+    bool skipping;
+    mbedtls_sha256_context sha;
+    struct frame_parser_t parser;
+    uint8_t expected_digest[CERTIFICATE_STREAM_DIGEST_SIZE];
+};
+
+bool certificate_stream_parse_digest(const char* hex, uint8_t digest[CERTIFICATE_STREAM_DIGEST_SIZE]);
+
+void certificate_stream_begin(struct certificate_stream_t* stream, enum app_certificate_t certificate,
+                              const uint8_t expected_digest[CERTIFICATE_STREAM_DIGEST_SIZE]);
+// Reads (and discards) an upload we are not going to store, the connection stays in sync.
+// certificate_stream_end() then returns ESP_OK: the caller already knows why it skipped it.
+void certificate_stream_skip(struct certificate_stream_t* stream);
+// Consumes the frames already received, true when the whole upload has been read (what follows
+// it is left in the connection).
+bool certificate_stream_feed(struct certificate_stream_t* stream, struct connection_t* connection);
+esp_err_t certificate_stream_end(struct certificate_stream_t* stream);
+void certificate_stream_abort(struct certificate_stream_t* stream);
@@ -0,0 +1,37 @@
+#include "command_index.h"
+#include <string.h>
+
+static uint32_t hash_key(const char* key) {
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash ^= (uint8_t)*key++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+void command_index_build(struct command_index_t* index, const char* const* keys, int count) {
+    memset(index->slots, 0, sizeof index->slots);
+    index->keys = keys;
+
+    for (int i = 0; i < count; ++i) {
+        uint32_t slot = hash_key(keys[i]) & (COMMAND_INDEX_SIZE - 1);
+        while (index->slots[slot] != 0)
+            slot = (slot + 1) & (COMMAND_INDEX_SIZE - 1);
+
+        index->slots[slot] = i + 1;
+    }
+}
+
+int command_index_find(const struct command_index_t* index, const char* key) {
+    uint32_t slot = hash_key(key) & (COMMAND_INDEX_SIZE - 1);
+    while (index->slots[slot] != 0) {
+        int position = index->slots[slot] - 1;
+        if (strcmp(index->keys[position], key) == 0) return position;
+
+        slot = (slot + 1) & (COMMAND_INDEX_SIZE - 1);
+    }
+
+    return -1;
+}
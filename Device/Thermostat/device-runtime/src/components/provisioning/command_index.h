@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// Open addressing hash index (FNV-1a, linear probing) over a constant array of distinct keys.
+// Slots hold the position of the key + 1, 0 for an empty slot. It must be a power of two and
+// at least twice the number of keys to keep the probe sequences short.
+#define COMMAND_INDEX_SIZE 64
+
+struct command_index_t {
+    const char* const* keys;
+    uint8_t slots[COMMAND_INDEX_SIZE];
+};
+
+// Keys must outlive the index, count must not exceed COMMAND_INDEX_SIZE / 2
+void command_index_build(struct command_index_t* index, const char* const* keys, int count);
+
+// Returns the position of the key in the array, -1 if it is not there
+int command_index_find(const struct command_index_t* index, const char* key);
@@ -0,0 +1,87 @@
+#include "connection.h"
+#include "sys/socket.h"
+#include <errno.h>
+#include <string.h>
+
+void connection_init(struct connection_t* connection, int sock) {
+    memset(connection, 0, sizeof *connection);
+    connection->sock = sock;
+}
+
+static void discard_consumed(struct connection_t* connection) {
+    if (connection->consumed == 0) return;
+
+    connection->length -= connection->consumed;
+    memmove(connection->buffer, connection->buffer + connection->consumed, connection->length);
+    connection->consumed = 0;
+}
+
+static void trim_end(char* string) {
+    char* end = string + strlen(string) - 1;
+    while (end >= string && (*end == '\n' || *end == '\r')) {
+        *end-- = '\0';
+    }
+}
+
+ssize_t connection_receive(struct connection_t* connection) {
+    discard_consumed(connection);
+
+    size_t available = sizeof(connection->buffer) - 1 - connection->length;
+    if (available == 0) return 0;
+
+    ssize_t len = recv(connection->sock, connection->buffer + connection->length, available, MSG_DONTWAIT);
+    if (len == 0) return -1;
+    if (len < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    connection->length += len;
+    return len;
+}
+
+// Returns the next line already in the buffer (without line terminator), NULL if we need
+// to receive more data. The returned pointer is valid until the next read. Lines longer than
+// the buffer are split.
+char* connection_pop_line(struct connection_t* connection) {
+    discard_consumed(connection);
+
+    char* newline = memchr(connection->buffer, '\n', connection->length);
+    if (newline != NULL) {
+        *newline = '\0';
+        connection->consumed = newline - connection->buffer + 1;
+        trim_end(connection->buffer);
+        return connection->buffer;
+    }
+
+    if (connection->length == sizeof(connection->buffer) - 1) {
+        connection->buffer[connection->length] = '\0';
+        connection->consumed = connection->length;
+        return connection->buffer;
+    }
+
+    return NULL;
+}
+
+size_t connection_peek(struct connection_t* connection, const uint8_t** data) {
+    discard_consumed(connection);
+
+    *data = (const uint8_t*)connection->buffer;
+    return connection->length;
+}
+
+void connection_consume(struct connection_t* connection, size_t size) {
+    connection->consumed += size;
+}
+
+void connection_send(struct connection_t* connection, const char* text) {
+    send(connection->sock, text, strlen(text), 0);
+}
+
+void connection_send_bytes(struct connection_t* connection, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t sent = send(connection->sock, p, size, 0);
+        if (sent <= 0) return;
+
+        p += sent;
+        size -= sent;
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CONNECTION_BUFFER_SIZE 512
+
+// State of a provisioning client connection. Input is buffered: a single recv() may contain
+// many commands (or only part of one), lines are split here and any byte we received but did
+// not consume yet is returned first by the following reads (for example when a command is
+// immediately followed by binary data). Nothing here waits for data: connection_receive() is
+// called when select() reports the socket as readable and it takes only what already arrived.
+struct connection_t {
+    int sock;
+    char buffer[CONNECTION_BUFFER_SIZE];
+    size_t length;
+    size_t consumed;
+};
+
+void connection_init(struct connection_t* connection, int sock);
+// Number of bytes received, 0 if there was nothing to read (or no room for it), -1 when the
+// connection has been closed or it failed.
+ssize_t connection_receive(struct connection_t* connection);
+char* connection_pop_line(struct connection_t* connection);
+// Bytes received and not consumed yet, they're valid until the next receive
+size_t connection_peek(struct connection_t* connection, const uint8_t** data);
+void connection_consume(struct connection_t* connection, size_t size);
+void connection_send(struct connection_t* connection, const char* text);
+void connection_send_bytes(struct connection_t* connection, const void* data, size_t size);
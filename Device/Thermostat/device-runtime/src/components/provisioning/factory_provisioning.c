@@ -1,10 +1,19 @@
 #include "app_settings.h"
+#include "boot_profiler.h"
+#include "certificate_stream.h"
+#include "command_index.h"
+#include "connection.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
 #include "netinet/in.h"
 #include "networking.h"
+#include "provisioning_commands.h"
 #include "provisioning_config.h"
 #include "sys/socket.h"
+#include <stdlib.h>
 #include <string.h>
 
 static const char* LOG_TAG = "prov";
@@ -13,149 +22,695 @@ static struct app_provisioning_t* g_provisioning;
 static struct app_manifest_t* g_manifest;
 static struct app_settings_t* g_app_settings;
 static bool g_pending_changes;
-static char g_rx_buffer[128];
 
-typedef void (*tcp_command_handler_t)(int sock, const char* value);
+// Replied as "OK" or "E<n>" (or "OK <count>"/"E<n> <index>" at the end of a batch)
+enum command_result_t {
+    COMMAND_OK = 0,
+    COMMAND_ERROR_UNKNOWN = 1,
+    COMMAND_ERROR_TOO_BIG = 2,
+    COMMAND_ERROR_STORAGE = 3,
+    COMMAND_ERROR_DIGEST = 4,
+    COMMAND_ERROR_ARGUMENT = 5,
+    COMMAND_ERROR_BUSY = 6,
+    COMMAND_ERROR_INCOMPLETE = 7,
+    // Not a reply: the command reads more input (a certificate upload), its result is sent
+    // when the upload has been received.
+    COMMAND_PENDING = -1,
+};
+
+// Commands between "begin" and "end" are executed without sending a reply for each one,
+// a single status line is sent at the end. After the first error the remaining commands
+// of the batch are skipped. A "save" within the batch is deferred to its end.
+struct batch_t {
+    bool active;
+    int count;
+    enum command_result_t error;
+    int error_index;
+    bool save;
+};
+
+// Certificate uploaded as PEM text: lines are written to the certificate slot up to the one
+// starting with the delimiter (given with the command). Longer delimiters are truncated, a line
+// of the certificate would have to start with the same characters to be mistaken for it.
+#define PEM_DELIMITER_MAX_LENGTH 64
+
+struct pem_upload_t {
+    struct app_certificate_writer_t writer;
+    bool writing;
+    char delimiter[PEM_DELIMITER_MAX_LENGTH];
+};
+
+// Commands are read line by line, an upload changes how the input of the session is
+// interpreted until it has been received completely.
+enum session_state_t {
+    SESSION_STATE_COMMANDS,
+    SESSION_STATE_PEM_UPLOAD,
+    SESSION_STATE_BINARY_UPLOAD,
+};
+
+// A connected client. Connection must be the first field: handlers receive a pointer
+// to it and we get the session back with a cast. Sessions are never blocked waiting for
+// their input: the server task reads what select() reports as available and each session
+// continues from where it stopped. After an error (or when the upload command is not executed)
+// upload_result is set and we keep reading, and ignoring, the rest of the upload: it must
+// not be interpreted as commands.
+struct session_t {
+    struct connection_t connection;
+    struct batch_t batch;
+    enum session_state_t state;
+    union {
+        struct pem_upload_t pem;
+        struct certificate_stream_t binary;
+    } upload;
+    enum command_result_t upload_result;
+    TickType_t last_activity;
+    bool in_use;
+};
+
+typedef enum command_result_t (*tcp_command_handler_t)(struct connection_t* connection, const char* value);
+
+enum command_value_t {
+    COMMAND_VALUE_NONE,
+    COMMAND_VALUE_TEXT,
+    COMMAND_VALUE_INT,
+    COMMAND_VALUE_DIGEST,
+    COMMAND_VALUE_CHOICE,
+    COMMAND_VALUE_DELIMITER,
+};
 
 struct command_entry_t {
-    const char* key;
     tcp_command_handler_t handler;
+    enum command_value_t value_type;
+    const char* choices;
 };
 
-static void trim_end(char* string) {
-    char* end = string + strlen(string) - 1;
-    while (end >= string && (*end == '\n' || *end == '\r')) {
-        *end-- = '\0';
-    }
+#define DECLARE_COMMAND_HANDLER(key, handler, value_type, choices)                                                     \
+    static enum command_result_t handler(struct connection_t* connection, const char* value);
+#define COMMAND_ENTRY(key, handler, value_type, choices) [PROVISIONING_COMMAND_##key] = {handler, value_type, choices},
+#define COMMAND_KEY(key, handler, value_type, choices) [PROVISIONING_COMMAND_##key] = #key,
+
+PROVISIONING_COMMANDS(DECLARE_COMMAND_HANDLER)
+
+static const struct command_entry_t g_commands[] = {PROVISIONING_COMMANDS(COMMAND_ENTRY)};
+static const char* const g_command_keys[] = {PROVISIONING_COMMANDS(COMMAND_KEY)};
+
+// Keys are distinct (see provisioning_commands.h) and they fit: building the index cannot fail
+_Static_assert(PROVISIONING_COMMAND_COUNT * 2 <= COMMAND_INDEX_SIZE, "COMMAND_INDEX_SIZE is too small");
+static struct command_index_t g_command_index;
+
+#define SELECT_TIMEOUT_MS 1000
+
+// Replies are small, a client which does not read them must not stall the others for long
+#define SEND_TIMEOUT_MS 5000
+
+// Set when the server task has finished, see provisioning_wait_if_needed()
+#define FACTORY_PROVISIONING_DONE_BIT BIT0
+
+static struct session_t g_sessions[CONFIG_TW_FPROV_MAX_CLIENTS];
+static EventGroupHandle_t g_events;
+
+static struct session_t* get_session(struct connection_t* connection) {
+    return (struct session_t*)connection;
 }
 
-static void handle_save(int sock, const char*) {
+static enum command_result_t handle_save(struct connection_t* connection, const char*) {
+    struct batch_t* batch = &get_session(connection)->batch;
+    if (batch->active) {
+        batch->save = true;
+        return COMMAND_OK;
+    }
+
     provisioning_save_all_settings();
     g_pending_changes = false;
+    return COMMAND_OK;
 }
 
-static void handle_complete(int sock, const char* mode) {
+static enum command_result_t handle_complete(struct connection_t* connection, const char* mode) {
     g_provisioning->provisioning_mode = strcmp(mode, "ble") == 0 ? PROVISIONING_MODE_BLE : PROVISIONING_MODE_ETHERNET;
     g_provisioning->provisioning_status = PROVISIONING_CONFIGURED;
+    return COMMAND_OK;
 }
 
-static void handle_help(int sock, const char* mode);
-
-static void handle_vendor(int sock, const char* value) {
-    strlcpy(g_manifest->product_name, value, sizeof g_manifest->product_name);
+static enum command_result_t handle_vendor(struct connection_t* connection, const char* value) {
+    strlcpy(g_manifest->vendor, value, sizeof g_manifest->vendor);
+    return COMMAND_OK;
 }
 
-static void handle_product(int sock, const char* value) {
+static enum command_result_t handle_product(struct connection_t* connection, const char* value) {
     strlcpy(g_manifest->product_name, value, sizeof g_manifest->product_name);
+    return COMMAND_OK;
 }
 
-static void handle_model(int sock, const char* value) {
-    strlcpy(g_manifest->product_name, value, sizeof g_manifest->product_name);
+static enum command_result_t handle_model(struct connection_t* connection, const char* value) {
+    strlcpy(g_manifest->model_name, value, sizeof g_manifest->model_name);
+    return COMMAND_OK;
 }
 
-static void handle_model_id(int sock, const char* value) {
-    strlcpy(g_manifest->product_name, value, sizeof g_manifest->product_name);
+static enum command_result_t handle_model_id(struct connection_t* connection, const char* value) {
+    g_manifest->model_id = strtol(value, NULL, 10);
+    return COMMAND_OK;
 }
 
-static void handle_serial_number(int sock, const char* value) {
-    strlcpy(g_manifest->product_name, value, sizeof g_manifest->product_name);
+static enum command_result_t handle_serial_number(struct connection_t* connection, const char* value) {
+    strlcpy(g_manifest->serial_number, value, sizeof g_manifest->serial_number);
+    return COMMAND_OK;
 }
 
-static void handle_device_id(int sock, const char* value) {
+static enum command_result_t handle_device_id(struct connection_t* connection, const char* value) {
     strlcpy(g_app_settings->device_id, value, sizeof g_app_settings->device_id);
+    return COMMAND_OK;
 }
 
-static void handle_broker_address(int sock, const char* value) {
+static enum command_result_t handle_broker_address(struct connection_t* connection, const char* value) {
     strlcpy(g_app_settings->mqtt_broker_address, value, sizeof g_app_settings->mqtt_broker_address);
+    return COMMAND_OK;
 }
 
-static void handle_connection(int sock, const char* value) {
+static enum command_result_t handle_connection(struct connection_t* connection, const char* value) {
     g_app_settings->connection = strcmp(value, "wifi") == 0 ? NETWORK_CONNECTION_WIFI : NETWORK_CONNECTION_ETHERNET;
+    return COMMAND_OK;
 }
 
-static void handle_framed_input(int sock, const char* delimiter, char* target, size_t target_size) {
-    size_t position = 0;
-    memset(target, 0, target_size);
-    while (true)
-    {
-        memset(g_rx_buffer, 0, sizeof g_rx_buffer);
-        ssize_t len = recv(sock, g_rx_buffer, sizeof(g_rx_buffer) - 1, 0);
-        if (len <= 0 || strncmp(g_rx_buffer, delimiter, strlen(delimiter)) == 0) break;
+// Uploads of different sessions are received at the same time, only one at a time can write a certificate
+static bool is_certificate_busy(enum app_certificate_t certificate) {
+    for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS; ++i) {
+        const struct session_t* session = &g_sessions[i];
+        if (!session->in_use) continue;
 
-        trim_end(g_rx_buffer);
-        size_t length = strlen(g_rx_buffer);
+        if (session->state == SESSION_STATE_PEM_UPLOAD && session->upload.pem.writing &&
+            session->upload.pem.writer.certificate == certificate)
+            return true;
 
-        if (position + length >= target_size) {
-            send(sock, "E2\n", 3, 0);
-            return;
-        }
+        if (session->state == SESSION_STATE_BINARY_UPLOAD && session->upload.binary.writing &&
+            session->upload.binary.writer.certificate == certificate)
+            return true;
+    }
+
+    return false;
+}
 
-        ESP_LOGD(LOG_TAG, "Writing %d bytes starting at %d", length, position);
-        memcpy(target + position, g_rx_buffer, length);
-        position += length;
+static void begin_pem_upload(struct session_t* session, const char* delimiter, enum command_result_t result) {
+    struct pem_upload_t* upload = &session->upload.pem;
+    memset(upload, 0, sizeof *upload);
+    strlcpy(upload->delimiter, delimiter, sizeof upload->delimiter);
+    session->upload_result = result;
+    session->state = SESSION_STATE_PEM_UPLOAD;
+}
+
+static enum command_result_t handle_framed_input(struct connection_t* connection, const char* delimiter,
+                                                 enum app_certificate_t certificate) {
+    // Lines are written straight to the certificate slot in flash, we never hold
+    // the whole certificate in RAM.
+    struct session_t* session = get_session(connection);
+    if (is_certificate_busy(certificate)) {
+        begin_pem_upload(session, delimiter, COMMAND_ERROR_BUSY);
+        return COMMAND_PENDING;
     }
+
+    begin_pem_upload(session, delimiter, COMMAND_OK);
+    if (app_certificate_write_begin(certificate, &session->upload.pem.writer) == ESP_OK)
+        session->upload.pem.writing = true;
+    else
+        session->upload_result = COMMAND_ERROR_STORAGE;
+
+    return COMMAND_PENDING;
+}
+
+static enum command_result_t handle_mqtt_server_certificate(struct connection_t* connection, const char* value) {
+    return handle_framed_input(connection, value, APP_CERTIFICATE_MQTT_SERVER);
 }
 
-static void handle_mqtt_server_certificate(int sock, const char* value) {
-    handle_framed_input(sock, value, g_app_settings->mqtt_server_certificate, sizeof g_app_settings->mqtt_server_certificate);
+static enum command_result_t handle_mqtt_client_certificate(struct connection_t* connection, const char* value) {
+    return handle_framed_input(connection, value, APP_CERTIFICATE_MQTT_CLIENT);
 }
 
-static void handle_mqtt_client_certificate(int sock, const char* value) {
-    handle_framed_input(sock, value, g_app_settings->mqtt_client_certificate, sizeof g_app_settings->mqtt_client_certificate);
+static enum command_result_t handle_mqtt_client_key_certificate(struct connection_t* connection, const char* value) {
+    return handle_framed_input(connection, value, APP_CERTIFICATE_MQTT_CLIENT_KEY);
 }
 
-static void handle_mqtt_client_key_certificate(int sock, const char* value) {
-    handle_framed_input(sock, value, g_app_settings->mqtt_client_key_certificate, sizeof g_app_settings->mqtt_client_key_certificate);
+static enum command_result_t handle_streamed_input(struct connection_t* connection, const char* value,
+                                                   enum app_certificate_t certificate) {
+    uint8_t digest[CERTIFICATE_STREAM_DIGEST_SIZE];
+    if (!certificate_stream_parse_digest(value, digest)) return COMMAND_ERROR_ARGUMENT;
+
+    struct session_t* session = get_session(connection);
+    session->upload_result = is_certificate_busy(certificate) ? COMMAND_ERROR_BUSY : COMMAND_OK;
+    if (session->upload_result == COMMAND_OK)
+        certificate_stream_begin(&session->upload.binary, certificate, digest);
+    else
+        certificate_stream_skip(&session->upload.binary);
+
+    session->state = SESSION_STATE_BINARY_UPLOAD;
+
+    return COMMAND_PENDING;
 }
 
-static void handle_wifi_ssid(int sock, const char* value) {
+static enum command_result_t handle_mqtt_server_certificate_bin(struct connection_t* connection, const char* value) {
+    return handle_streamed_input(connection, value, APP_CERTIFICATE_MQTT_SERVER);
+}
+
+static enum command_result_t handle_mqtt_client_certificate_bin(struct connection_t* connection, const char* value) {
+    return handle_streamed_input(connection, value, APP_CERTIFICATE_MQTT_CLIENT);
+}
+
+static enum command_result_t handle_mqtt_client_key_certificate_bin(struct connection_t* connection,
+                                                                    const char* value) {
+    return handle_streamed_input(connection, value, APP_CERTIFICATE_MQTT_CLIENT_KEY);
+}
+
+static enum command_result_t handle_wifi_ssid(struct connection_t* connection, const char* value) {
     strlcpy(g_app_settings->wifi_ssid, value, sizeof g_app_settings->wifi_ssid);
+    return COMMAND_OK;
 }
 
-static void handle_wifi_password(int sock, const char* value) {
+static enum command_result_t handle_wifi_password(struct connection_t* connection, const char* value) {
     strlcpy(g_app_settings->wifi_password, value, sizeof g_app_settings->wifi_password);
+    return COMMAND_OK;
 }
 
-static struct command_entry_t g_commands[] = {
-    {"help", handle_help},
-    {"save", handle_save},
-    {"complete", handle_complete},
-    {"vendor", handle_vendor},
-    {"product", handle_product},
-    {"model", handle_model},
-    {"model_id", handle_model_id},
-    {"serial_number", handle_serial_number},
-    {"device_id", handle_device_id},
-    {"broker_address", handle_broker_address},
-    {"connection", handle_connection},
-    {"mqtt_server_cert", handle_mqtt_server_certificate},
-    {"mqtt_client_cert", handle_mqtt_client_certificate},
-    {"mqtt_client_key_cert", handle_mqtt_client_key_certificate},
-    {"wifi_ssid", handle_wifi_ssid},
-    {"wifi_password", handle_wifi_password},
-};
+static enum command_result_t handle_boot_profile(struct connection_t* connection, const char*) {
+    // One line for each span: <depth> <name>[:<detail>] <start us> <duration us or - if still open>
+    struct boot_span_t span;
+    for (size_t i = 0; boot_profiler_get(i, &span); ++i) {
+        char line[128];
+        if (span.end == 0) {
+            snprintf(line, sizeof(line), "%d %s%s%s %lld -\n", span.depth, span.name, span.detail ? ":" : "",
+                     span.detail ? span.detail : "", span.start);
+        } else {
+            snprintf(line, sizeof(line), "%d %s%s%s %lld %lld\n", span.depth, span.name, span.detail ? ":" : "",
+                     span.detail ? span.detail : "", span.start, span.end - span.start);
+        }
+        connection_send(connection, line);
+    }
+
+    return COMMAND_OK;
+}
+
+static enum command_result_t handle_boot_profile_bin(struct connection_t* connection, const char*) {
+    // The size of the dump on its own line, followed by the dump (see boot_profiler_dump())
+    size_t size = boot_profiler_dump(NULL, 0);
+    uint8_t* dump = malloc(size);
+    if (dump == NULL) return COMMAND_ERROR_TOO_BIG;
+
+    size = boot_profiler_dump(dump, size);
+
+    char header[16];
+    snprintf(header, sizeof(header), "%zu\n", size);
+    connection_send(connection, header);
+    connection_send_bytes(connection, dump, size);
+    free(dump);
+
+    return COMMAND_OK;
+}
+
+static enum command_result_t handle_help(struct connection_t* connection, const char* value) {
+    for (int i = 0; i < PROVISIONING_COMMAND_COUNT; ++i) {
+        const struct command_entry_t* command = &g_commands[i];
+        connection_send(connection, g_command_keys[i]);
+        switch (command->value_type) {
+        case COMMAND_VALUE_TEXT:
+            connection_send(connection, "=<text>");
+            break;
+        case COMMAND_VALUE_INT:
+            connection_send(connection, "=<int>");
+            break;
+        case COMMAND_VALUE_DIGEST:
+            connection_send(connection, "=<sha256>");
+            break;
+        case COMMAND_VALUE_CHOICE:
+            connection_send(connection, "=");
+            connection_send(connection, command->choices);
+            break;
+        case COMMAND_VALUE_DELIMITER:
+            connection_send(connection, "=<delimiter>");
+            break;
+        default:
+            break;
+        }
+        connection_send(connection, "\n");
+    }
+
+    return COMMAND_OK;
+}
+
+static const struct command_entry_t* find_command(const char* key) {
+    int position = command_index_find(&g_command_index, key);
+    return position < 0 ? NULL : &g_commands[position];
+}
+
+static bool is_choice(const char* choices, const char* value) {
+    size_t length = strlen(value);
+    const char* choice = choices;
+    while (choice != NULL) {
+        const char* separator = strchr(choice, '|');
+        size_t choice_length = separator ? (size_t)(separator - choice) : strlen(choice);
+        if (choice_length == length && strncmp(choice, value, length) == 0) return true;
+
+        choice = separator ? separator + 1 : NULL;
+    }
+
+    return false;
+}
 
-static void handle_help(int sock, const char* mode) {
-    for (int i = 0; i < sizeof(g_commands) / sizeof(g_commands[0]); ++i) {
-        send(sock, g_commands[i].key, strlen(g_commands[i].key), 0);
-        send(sock, "\n", 1, 0);
+static bool is_valid_value(const struct command_entry_t* command, const char* value) {
+    if (command->value_type == COMMAND_VALUE_NONE) return true;
+    if (value == NULL) return false;
+
+    switch (command->value_type) {
+    case COMMAND_VALUE_INT: {
+        char* end;
+        strtol(value, &end, 10);
+        return *value != '\0' && *end == '\0';
+    }
+    case COMMAND_VALUE_DIGEST:
+        return strlen(value) == CERTIFICATE_STREAM_DIGEST_SIZE * 2 &&
+               strspn(value, "0123456789abcdefABCDEF") == CERTIFICATE_STREAM_DIGEST_SIZE * 2;
+    case COMMAND_VALUE_CHOICE:
+        return is_choice(command->choices, value);
+    case COMMAND_VALUE_DELIMITER:
+        return *value != '\0';
+    default:
+        return true;
+    }
+}
+
+static void send_result(struct connection_t* connection, enum command_result_t result) {
+    char reply[8];
+    if (result == COMMAND_OK)
+        strlcpy(reply, "OK\n", sizeof reply);
+    else
+        snprintf(reply, sizeof reply, "E%d\n", result);
+
+    connection_send(connection, reply);
+}
+
+// An upload command which is not executed (because its batch already failed or because its value is
+// not valid) must still read its data. Its result is reported when the upload has been read.
+static enum command_result_t skip_command(struct session_t* session, const struct command_entry_t* entry,
+                                          const char* value, enum command_result_t result) {
+    if (entry->value_type == COMMAND_VALUE_DIGEST) {
+        certificate_stream_skip(&session->upload.binary);
+        session->upload_result = result;
+        session->state = SESSION_STATE_BINARY_UPLOAD;
+        return COMMAND_PENDING;
+    }
+
+    // Without a delimiter we cannot know where the certificate ends
+    if (entry->value_type == COMMAND_VALUE_DELIMITER && value != NULL && *value != '\0') {
+        begin_pem_upload(session, value, result);
+        return COMMAND_PENDING;
     }
+
+    return result;
 }
 
-static void execute_tcp_command(int sock, const char* command, const char* value) {
+static enum command_result_t execute_tcp_command(struct session_t* session, const char* command,
+                                                 const char* value) {
     ESP_LOGI(LOG_TAG, "Executing command %s", command);
-    for (int i = 0; i < sizeof(g_commands) / sizeof(g_commands[0]); ++i) {
-        if (strcmp(command, g_commands[i].key) == 0) {
-            g_pending_changes = true;
-            g_commands[i].handler(sock, value);
-            send(sock, "OK\n", 3, 0);
-            return;
+    const struct command_entry_t* entry = find_command(command);
+    if (entry == NULL) return COMMAND_ERROR_UNKNOWN;
+    if (!is_valid_value(entry, value)) return skip_command(session, entry, value, COMMAND_ERROR_ARGUMENT);
+
+    g_pending_changes = true;
+    return entry->handler(&session->connection, value);
+}
+
+static void begin_batch(struct session_t* session) {
+    memset(&session->batch, 0, sizeof session->batch);
+    session->batch.active = true;
+}
+
+static void end_batch(struct session_t* session) {
+    struct batch_t* batch = &session->batch;
+    if (batch->save && batch->error == COMMAND_OK) {
+        // All the changes of the batch are written at once, and only the fields that changed
+        provisioning_save_all_settings();
+        g_pending_changes = false;
+    }
+
+    char reply[24];
+    if (batch->error == COMMAND_OK)
+        snprintf(reply, sizeof reply, "OK %d\n", batch->count);
+    else
+        snprintf(reply, sizeof reply, "E%d %d\n", batch->error, batch->error_index);
+
+    connection_send(&session->connection, reply);
+    memset(batch, 0, sizeof *batch);
+}
+
+// Called when a command has been executed, for an upload when all its data has been read
+static void complete_command(struct session_t* session, enum command_result_t result) {
+    struct batch_t* batch = &session->batch;
+    if (!batch->active) {
+        send_result(&session->connection, result);
+        return;
+    }
+
+    if (result != COMMAND_OK && batch->error == COMMAND_OK) {
+        batch->error = result;
+        batch->error_index = batch->count;
+    }
+}
+
+static void execute_line(struct session_t* session, char* line) {
+    if (strcmp(line, "begin") == 0) {
+        begin_batch(session);
+        return;
+    }
+
+    if (strcmp(line, "end") == 0) {
+        end_batch(session);
+        return;
+    }
+
+    const char* value = NULL;
+    char* equal = strchr(line, '=');
+    if (equal) {
+        *equal = 0;
+        value = equal + 1;
+    }
+
+    struct batch_t* batch = &session->batch;
+    if (batch->active) ++batch->count;
+
+    enum command_result_t result;
+    if (batch->active && batch->error != COMMAND_OK) {
+        const struct command_entry_t* entry = find_command(line);
+        result = entry ? skip_command(session, entry, value, batch->error) : batch->error;
+    } else {
+        result = execute_tcp_command(session, line, value);
+    }
+
+    if (result != COMMAND_PENDING) complete_command(session, result);
+}
+
+static void receive_pem_line(struct session_t* session, const char* line) {
+    struct pem_upload_t* upload = &session->upload.pem;
+    if (strncmp(line, upload->delimiter, strlen(upload->delimiter)) == 0) {
+        if (upload->writing) {
+            if (session->upload_result != COMMAND_OK)
+                app_certificate_write_abort(&upload->writer);
+            else if (app_certificate_write_end(&upload->writer) != ESP_OK)
+                session->upload_result = COMMAND_ERROR_STORAGE;
         }
+
+        session->state = SESSION_STATE_COMMANDS;
+        complete_command(session, session->upload_result);
+        return;
+    }
+
+    if (session->upload_result != COMMAND_OK) return;
+
+    // PEM parsing in mbedTLS needs the line breaks we just trimmed
+    size_t length = strlen(line);
+    ESP_LOGD(LOG_TAG, "Writing %zu bytes starting at %zu", length, upload->writer.position);
+    esp_err_t err = app_certificate_write(&upload->writer, line, length);
+    if (err == ESP_OK)
+        err = app_certificate_write(&upload->writer, "\n", 1);
+
+    if (err != ESP_OK) session->upload_result = COMMAND_ERROR_TOO_BIG;
+}
+
+// Returns false if the upload needs more data
+static bool receive_binary_upload(struct session_t* session) {
+    struct certificate_stream_t* upload = &session->upload.binary;
+    if (!certificate_stream_feed(upload, &session->connection)) return false;
+
+    esp_err_t err = certificate_stream_end(upload);
+    if (session->upload_result == COMMAND_OK) {
+        if (err == ESP_ERR_INVALID_CRC)
+            session->upload_result = COMMAND_ERROR_DIGEST;
+        else if (err == ESP_ERR_INVALID_SIZE)
+            session->upload_result = COMMAND_ERROR_TOO_BIG;
+        else if (err != ESP_OK)
+            session->upload_result = COMMAND_ERROR_STORAGE;
     }
-    send(sock, "E1\n", 3, 0);
+
+    session->state = SESSION_STATE_COMMANDS;
+    complete_command(session, session->upload_result);
+    return true;
 }
 
-void start_factory_privisioning(void) {
+// What we received of an upload which did not complete must not replace the current certificate
+static void abort_upload(struct session_t* session) {
+    if (session->state == SESSION_STATE_PEM_UPLOAD && session->upload.pem.writing)
+        app_certificate_write_abort(&session->upload.pem.writer);
+    else if (session->state == SESSION_STATE_BINARY_UPLOAD)
+        certificate_stream_abort(&session->upload.binary);
+
+    session->state = SESSION_STATE_COMMANDS;
+}
+
+static void open_session(int listen_sock) {
+    struct sockaddr_in source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    int sock = accept(listen_sock, (struct sockaddr*)&source_addr, &addr_len);
+    if (sock < 0) return;
+
+    char address[16];
+    inet_ntoa_r(((struct sockaddr_in*)&source_addr)->sin_addr.s_addr, address, sizeof(address) - 1);
+
+    struct session_t* session = NULL;
+    for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS && session == NULL; ++i) {
+        if (!g_sessions[i].in_use) session = &g_sessions[i];
+    }
+
+    if (session == NULL) {
+        ESP_LOGW(LOG_TAG, "Connection from %s refused, too many clients", address);
+        send(sock, "E6\n", 3, 0);
+        close(sock);
+        return;
+    }
+
+    // Reads never wait (see connection_receive()) but replies are sent synchronously
+    struct timeval timeout = {.tv_sec = SEND_TIMEOUT_MS / 1000, .tv_usec = (SEND_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+    memset(session, 0, sizeof *session);
+    connection_init(&session->connection, sock);
+    session->last_activity = xTaskGetTickCount();
+    session->in_use = true;
+
+    ESP_LOGI(LOG_TAG, "Connection from %s", address);
+}
+
+static void close_session(struct session_t* session) {
+    abort_upload(session);
+    close(session->connection.sock);
+    session->in_use = false;
+    ESP_LOGI(LOG_TAG, "Client disconnected");
+}
+
+// Returns false when the client asked to terminate the provisioning
+static bool process_session_input(struct session_t* session) {
+    ssize_t received = connection_receive(&session->connection);
+    if (received < 0) {
+        close_session(session);
+        return true;
+    }
+
+    if (received == 0) return true;
+
+    session->last_activity = xTaskGetTickCount();
+
+    // Commands are line based, we do not make any assumption about how they are split
+    // in TCP segments (a station may send many of them at once, or a command together
+    // with the beginning of an upload).
+    while (true) {
+        if (session->state == SESSION_STATE_BINARY_UPLOAD) {
+            if (!receive_binary_upload(session)) break;
+            continue;
+        }
+
+        char* line = connection_pop_line(&session->connection);
+        if (line == NULL) break;
+
+        if (session->state == SESSION_STATE_PEM_UPLOAD) {
+            receive_pem_line(session, line);
+            continue;
+        }
+
+        ESP_LOGD(LOG_TAG, "Received: %s", line);
+
+        if (strcmp(line, "exit") == 0) return false;
+
+        execute_line(session, line);
+    }
+
+    return true;
+}
+
+static void close_idle_sessions(void) {
+    TickType_t now = xTaskGetTickCount();
+    for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS; ++i) {
+        struct session_t* session = &g_sessions[i];
+        if (!session->in_use || now - session->last_activity <= pdMS_TO_TICKS(CONFIG_TW_FPROV_IDLE_TIMEOUT_MS))
+            continue;
+
+        ESP_LOGW(LOG_TAG, "Closing idle client");
+        if (session->state != SESSION_STATE_COMMANDS) send_result(&session->connection, COMMAND_ERROR_INCOMPLETE);
+
+        close_session(session);
+    }
+}
+
+static void run_server(int listen_sock) {
+    bool provisioning_in_progress = true;
+    while (provisioning_in_progress) {
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(listen_sock, &read_set);
+        int max_sock = listen_sock;
+        for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS; ++i) {
+            if (!g_sessions[i].in_use) continue;
+
+            FD_SET(g_sessions[i].connection.sock, &read_set);
+            if (g_sessions[i].connection.sock > max_sock) max_sock = g_sessions[i].connection.sock;
+        }
+
+        struct timeval timeout = {.tv_sec = SELECT_TIMEOUT_MS / 1000, .tv_usec = (SELECT_TIMEOUT_MS % 1000) * 1000};
+        int ready = select(max_sock + 1, &read_set, NULL, NULL, &timeout);
+        if (ready < 0) {
+            ESP_LOGE(LOG_TAG, "select() failed: %d", ready);
+            break;
+        }
+
+        for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS && provisioning_in_progress; ++i) {
+            struct session_t* session = &g_sessions[i];
+            if (session->in_use && FD_ISSET(session->connection.sock, &read_set))
+                provisioning_in_progress = process_session_input(session);
+        }
+
+        if (provisioning_in_progress && FD_ISSET(listen_sock, &read_set)) open_session(listen_sock);
+
+        close_idle_sessions();
+    }
+
+    for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS; ++i) {
+        if (g_sessions[i].in_use) close_session(&g_sessions[i]);
+    }
+
+    close(listen_sock);
+}
+
+static void factory_provisioning_task(void* arg) {
+    int listen_sock = (intptr_t)arg;
+    run_server(listen_sock);
+
+    // What's left of the stack in the worst case we have seen, see CONFIG_TW_FPROV_TASK_STACK_SIZE
+    ESP_LOGI(LOG_TAG, "Factory provisioning task stack: %u bytes never used of %d",
+             (unsigned)uxTaskGetStackHighWaterMark(NULL), CONFIG_TW_FPROV_TASK_STACK_SIZE);
+
+    if (g_provisioning->provisioning_status == PROVISIONING_CONFIGURED && !g_pending_changes) {
+        ESP_LOGI(LOG_TAG, "Factory provisioning completed, restarting.");
+        esp_restart();
+    }
+
+    xEventGroupSetBits(g_events, FACTORY_PROVISIONING_DONE_BIT);
+    vTaskDelete(NULL);
+}
+
+esp_err_t start_factory_privisioning(void) {
     ESP_LOGI(LOG_TAG, "Preparing for factory provisioning...");
 
     g_app_settings = app_settings_get();
@@ -194,48 +749,33 @@ void start_factory_privisioning(void) {
         ESP_ERROR_CHECK(ESP_FAIL);
     }
 
+    // The server can be started again (after "exit") while the connections it closed are in TIME_WAIT
+    int reuse = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+
     ESP_ERROR_CHECK(bind(listen_sock, (struct sockaddr*)&dest_addr, sizeof(dest_addr)));
-    ESP_ERROR_CHECK(listen(listen_sock, 1));
+    ESP_ERROR_CHECK(listen(listen_sock, CONFIG_TW_FPROV_MAX_CLIENTS));
 
     ESP_LOGI(LOG_TAG, "Server listening on port %d", CONFIG_TW_FPROV_TCP_PORT);
 
-    bool provisioning_in_progress = true;
-    while (provisioning_in_progress) {
-        struct sockaddr_in source_addr;
-        socklen_t addr_len = sizeof(source_addr);
-        int sock = accept(listen_sock, (struct sockaddr*)&source_addr, &addr_len);
-        inet_ntoa_r(((struct sockaddr_in*)&source_addr)->sin_addr.s_addr, g_rx_buffer, sizeof(g_rx_buffer) - 1);
-        ESP_LOGI(LOG_TAG, "Connection from %s", g_rx_buffer);
-
-        while (true) {
-            memset(g_rx_buffer, 0, sizeof g_rx_buffer);
-            ssize_t len = recv(sock, g_rx_buffer, sizeof(g_rx_buffer) - 1, 0);
-            if (len <= 0) break;
-
-            g_rx_buffer[len] = 0;
-            trim_end(g_rx_buffer);
-            ESP_LOGD(LOG_TAG, "Received: %s", g_rx_buffer);
-
-            if (strcmp(g_rx_buffer, "exit") == 0) {
-                provisioning_in_progress = false;
-                break;
-            }
-
-            char* equal = strchr(g_rx_buffer, '=');
-            if (equal) {
-                *equal = 0;
-                execute_tcp_command(sock,  g_rx_buffer, equal + 1);
-            } else {
-                execute_tcp_command(sock, g_rx_buffer, NULL);
-            }
-        }
+    command_index_build(&g_command_index, g_command_keys, PROVISIONING_COMMAND_COUNT);
 
-        close(sock);
-        ESP_LOGI(LOG_TAG, "Client disconnected");
+    // The server runs in its own task (its stack is sized for the server alone, not for app_main)
+    g_events = xEventGroupCreate();
+    ESP_ERROR_CHECK(g_events == NULL ? ESP_ERR_NO_MEM : ESP_OK);
+    if (xTaskCreate(factory_provisioning_task, "fprov", CONFIG_TW_FPROV_TASK_STACK_SIZE, (void*)(intptr_t)listen_sock, 5,
+                    NULL) != pdPASS) {
+        ESP_LOGE(LOG_TAG, "Cannot create the factory provisioning task");
+        close(listen_sock);
+        return ESP_ERR_NO_MEM;
     }
 
-    if (g_provisioning->provisioning_status == PROVISIONING_CONFIGURED && !g_pending_changes) {
-        ESP_LOGI(LOG_TAG, "Factory provisioning completed, restarting.");
-        esp_restart();
-    }
+    return ESP_OK;
+}
+
+void wait_factory_provisioning(void) {
+    // The device restarts when the provisioning is completed, if we're here the station
+    // terminated it (with "exit") before that.
+    xEventGroupWaitBits(g_events, FACTORY_PROVISIONING_DONE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    ESP_LOGW(LOG_TAG, "Factory provisioning terminated before its completion");
 }
@@ -0,0 +1,47 @@
+#include "frame_parser.h"
+#include <string.h>
+
+void frame_parser_init(struct frame_parser_t* parser, frame_parser_payload_fn_t on_payload, void* context) {
+    memset(parser, 0, sizeof *parser);
+    parser->on_payload = on_payload;
+    parser->context = context;
+}
+
+static size_t feed_payload(struct frame_parser_t* parser, const uint8_t* data, size_t size) {
+    size_t chunk = size < parser->remaining ? size : parser->remaining;
+    if (parser->error == ESP_OK) parser->error = parser->on_payload(parser->context, data, chunk);
+
+    parser->payload_size += chunk;
+    parser->remaining -= chunk;
+    if (parser->remaining == 0) parser->state = FRAME_PARSER_LENGTH_HIGH;
+
+    return chunk;
+}
+
+size_t frame_parser_feed(struct frame_parser_t* parser, const uint8_t* data, size_t size) {
+    size_t consumed = 0;
+    while (consumed < size && parser->state != FRAME_PARSER_DONE) {
+        switch (parser->state) {
+        case FRAME_PARSER_LENGTH_HIGH:
+            parser->length_high = data[consumed++];
+            parser->state = FRAME_PARSER_LENGTH_LOW;
+            break;
+        case FRAME_PARSER_LENGTH_LOW:
+            parser->remaining = (parser->length_high << 8) | data[consumed++];
+            parser->state = parser->remaining == 0 ? FRAME_PARSER_DONE : FRAME_PARSER_PAYLOAD;
+            if (parser->remaining != 0) ++parser->frame_count;
+            break;
+        case FRAME_PARSER_PAYLOAD:
+            consumed += feed_payload(parser, data + consumed, size - consumed);
+            break;
+        default:
+            break;
+        }
+    }
+
+    return consumed;
+}
+
+bool frame_parser_is_done(const struct frame_parser_t* parser) {
+    return parser->state == FRAME_PARSER_DONE;
+}
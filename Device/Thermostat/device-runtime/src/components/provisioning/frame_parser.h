@@ -0,0 +1,39 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Parser of the binary certificate upload: a sequence of frames, each one a 16 bit big endian
+// length followed by that many bytes, a zero length frame ends the upload. Data is fed as it
+// arrives, split at any point. The payload is passed to a callback; after the first error it
+// returns the parser keeps reading (and discarding) frames up to the terminator, then what
+// follows the upload is never mistaken for its data or vice versa.
+enum frame_parser_state_t {
+    FRAME_PARSER_LENGTH_HIGH,
+    FRAME_PARSER_LENGTH_LOW,
+    FRAME_PARSER_PAYLOAD,
+    FRAME_PARSER_DONE,
+};
+
+typedef esp_err_t (*frame_parser_payload_fn_t)(void* context, const uint8_t* data, size_t size);
+
+struct frame_parser_t {
+    enum frame_parser_state_t state;
+    uint8_t length_high;
+    size_t remaining;
+    size_t frame_count;
+    size_t payload_size;
+    esp_err_t error;
+    frame_parser_payload_fn_t on_payload;
+    void* context;
+};
+
+void frame_parser_init(struct frame_parser_t* parser, frame_parser_payload_fn_t on_payload, void* context);
+
+// Returns the number of bytes consumed, less than size only when the terminator has been found
+// (the bytes after it are not part of the upload).
+size_t frame_parser_feed(struct frame_parser_t* parser, const uint8_t* data, size_t size);
+
+bool frame_parser_is_done(const struct frame_parser_t* parser);
@@ -11,7 +11,9 @@
 static const char* LOG_TAG = "prov";
 
 static struct app_provisioning_t g_provisioning;
+static struct app_provisioning_t g_provisioning_snapshot;
 static struct app_manifest_t g_manifest;
+static struct app_manifest_t g_manifest_snapshot;
 static struct app_settings_t* g_app_settings;
 
 void set_manifest_defaults(struct settings_t* settings) {
@@ -40,6 +42,41 @@ void set_provisioning_defaults(struct settings_t* settings) {
 #endif
 }
 
+static const struct settings_field_t g_manifest_fields[] = {
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_manifest_t, vendor, "vendor"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_manifest_t, product_name, "product_name"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_manifest_t, model_name, "model_name"),
+    SETTINGS_FIELD(SETTINGS_FIELD_INT32, struct app_manifest_t, model_id, "model_id"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct app_manifest_t, serial_number, "serial_number"),
+};
+
+static const struct settings_field_t g_provisioning_fields[] = {
+    SETTINGS_FIELD(SETTINGS_FIELD_INT32, struct app_provisioning_t, provisioning_status, "status"),
+    SETTINGS_FIELD(SETTINGS_FIELD_INT32, struct app_provisioning_t, provisioning_mode, "mode"),
+};
+
+static struct settings_record_t g_manifest_record = {
+    .key = "manifest",
+    .fields = g_manifest_fields,
+    .field_count = sizeof(g_manifest_fields) / sizeof(g_manifest_fields[0]),
+    .settings = (struct settings_t*)&g_manifest,
+    .snapshot = (struct settings_t*)&g_manifest_snapshot,
+    .settings_size = sizeof g_manifest,
+    .schema_version = SCHEMA_VERSION,
+    .set_defaults = set_manifest_defaults,
+};
+
+static struct settings_record_t g_provisioning_record = {
+    .key = "provisioning",
+    .fields = g_provisioning_fields,
+    .field_count = sizeof(g_provisioning_fields) / sizeof(g_provisioning_fields[0]),
+    .settings = (struct settings_t*)&g_provisioning,
+    .snapshot = (struct settings_t*)&g_provisioning_snapshot,
+    .settings_size = sizeof g_provisioning,
+    .schema_version = SCHEMA_VERSION,
+    .set_defaults = set_provisioning_defaults,
+};
+
 struct app_manifest_t* provisioning_get_manifest(void) {
     return &g_manifest;
 }
@@ -48,12 +85,26 @@ struct app_provisioning_t* provisioning_get_settings(void) {
     return &g_provisioning;
 }
 
-esp_err_t provisioning_initialize(void) {
-    ESP_ERROR_CHECK(settings_load("manifest", set_manifest_defaults, (struct settings_t*)&g_manifest, sizeof g_manifest,
-                                  SCHEMA_VERSION));
+static size_t get_all_records(struct settings_record_t* records[]) {
+    records[0] = &g_manifest_record;
+    records[1] = &g_provisioning_record;
+    records[2] = app_settings_record();
+    return 3;
+}
 
-    ESP_ERROR_CHECK(settings_load("provisioning", set_provisioning_defaults, (struct settings_t*)&g_provisioning,
-                                  sizeof g_provisioning, SCHEMA_VERSION));
+esp_err_t provisioning_initialize(void) {
+    // All the records are loaded in a single session, the session is committed to store
+    // the result of any schema migration (and the defaults for the records never saved or
+    // which could not be loaded). If the commit fails we still run with the loaded settings.
+    struct settings_record_t* records[SETTINGS_MAX_SESSION_RECORDS];
+    size_t record_count = get_all_records(records);
+
+    struct settings_session_t session;
+    ESP_ERROR_CHECK(settings_session_open(&session, records, record_count));
+    ESP_ERROR_CHECK(settings_session_load(&session));
+    esp_err_t err = settings_session_close(&session, true);
+    if (err != ESP_OK)
+        ESP_LOGW(LOG_TAG, "Failed to save the settings because 0x%x, they will be loaded again at the next boot", err);
 
     g_app_settings = app_settings_get();
 
@@ -67,9 +118,13 @@ esp_err_t provisioning_initialize(void) {
 }
 
 void provisioning_save_all_settings(void) {
-    ESP_ERROR_CHECK(app_settings_save());
-    ESP_ERROR_CHECK(settings_save("manifest", (struct settings_t*)&g_manifest, sizeof g_manifest));
-    ESP_ERROR_CHECK(settings_save("provisioning", (struct settings_t*)&g_provisioning, sizeof g_provisioning));
+    // Each record writes only the fields that changed since they were loaded (or saved)
+    struct settings_record_t* records[SETTINGS_MAX_SESSION_RECORDS];
+    size_t record_count = get_all_records(records);
+
+    struct settings_session_t session;
+    ESP_ERROR_CHECK(settings_session_open(&session, records, record_count));
+    ESP_ERROR_CHECK(settings_session_close(&session, true));
 }
 
 esp_err_t start_operational_privisioning(void) {
@@ -85,8 +140,14 @@ esp_err_t provisioning_wait_if_needed(void) {
         return ESP_OK;
     case PROVISIONING_CONFIGURED:
         return start_operational_privisioning();
-    default:
-        start_factory_privisioning();
+    default: {
+        // The server runs in its own task but nothing else can start until the device is provisioned
+        esp_err_t err = start_factory_privisioning();
+        if (err != ESP_OK)
+            return err;
+
+        wait_factory_provisioning();
         return ESP_OK;
     }
+    }
 }
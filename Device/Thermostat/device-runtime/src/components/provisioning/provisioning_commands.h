@@ -0,0 +1,34 @@
+#pragma once
+
+// Commands accepted by the factory provisioning server, X(key, handler, value type, choices).
+// This list generates the handler declarations, the command table (and its lookup index), the
+// validation of the values and the output of "help". Choices are used only with COMMAND_VALUE_CHOICE.
+// Keys are identifiers (stringified for the table): they also name the values of
+// enum provisioning_command_t, then a duplicated key does not compile.
+#define PROVISIONING_COMMANDS(X)                                                                                       \
+    X(help, handle_help, COMMAND_VALUE_NONE, NULL)                                                                     \
+    X(save, handle_save, COMMAND_VALUE_NONE, NULL)                                                                     \
+    X(complete, handle_complete, COMMAND_VALUE_CHOICE, "ethernet|ble")                                                 \
+    X(vendor, handle_vendor, COMMAND_VALUE_TEXT, NULL)                                                                 \
+    X(product, handle_product, COMMAND_VALUE_TEXT, NULL)                                                               \
+    X(model, handle_model, COMMAND_VALUE_TEXT, NULL)                                                                   \
+    X(model_id, handle_model_id, COMMAND_VALUE_INT, NULL)                                                              \
+    X(serial_number, handle_serial_number, COMMAND_VALUE_TEXT, NULL)                                                   \
+    X(device_id, handle_device_id, COMMAND_VALUE_TEXT, NULL)                                                           \
+    X(broker_address, handle_broker_address, COMMAND_VALUE_TEXT, NULL)                                                 \
+    X(connection, handle_connection, COMMAND_VALUE_CHOICE, "ethernet|wifi")                                            \
+    X(mqtt_server_cert, handle_mqtt_server_certificate, COMMAND_VALUE_DELIMITER, NULL)                                 \
+    X(mqtt_client_cert, handle_mqtt_client_certificate, COMMAND_VALUE_DELIMITER, NULL)                                 \
+    X(mqtt_client_key_cert, handle_mqtt_client_key_certificate, COMMAND_VALUE_DELIMITER, NULL)                         \
+    X(mqtt_server_cert_bin, handle_mqtt_server_certificate_bin, COMMAND_VALUE_DIGEST, NULL)                            \
+    X(mqtt_client_cert_bin, handle_mqtt_client_certificate_bin, COMMAND_VALUE_DIGEST, NULL)                            \
+    X(mqtt_client_key_cert_bin, handle_mqtt_client_key_certificate_bin, COMMAND_VALUE_DIGEST, NULL)                    \
+    X(wifi_ssid, handle_wifi_ssid, COMMAND_VALUE_TEXT, NULL)                                                           \
+    X(wifi_password, handle_wifi_password, COMMAND_VALUE_TEXT, NULL)                                                   \
+    X(boot_profile, handle_boot_profile, COMMAND_VALUE_NONE, NULL)                                                     \
+    X(boot_profile_bin, handle_boot_profile_bin, COMMAND_VALUE_NONE, NULL)
+
+#define PROVISIONING_COMMAND_ID(key, handler, value_type, choices) PROVISIONING_COMMAND_##key,
+
+// Position of each command in the table
+enum provisioning_command_t { PROVISIONING_COMMANDS(PROVISIONING_COMMAND_ID) PROVISIONING_COMMAND_COUNT };
@@ -35,4 +35,5 @@ struct app_manifest_t
 struct app_manifest_t* provisioning_get_manifest(void);
 struct app_provisioning_t* provisioning_get_settings(void);
 void provisioning_save_all_settings(void);
-void start_factory_privisioning(void);
+esp_err_t start_factory_privisioning(void);
+void wait_factory_provisioning(void);
@@ -0,0 +1,248 @@
+#include "scheduler.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char* LOG_TAG = "sched";
+
+#define MAX_JOBS CONFIG_TW_SCHEDULER_MAX_JOBS
+#define NO_DEADLINE INT64_MAX
+
+struct job_t {
+    scheduler_job_fn_t fn;
+    void* arg;
+    int64_t period_us;
+    int64_t slack_us;
+    // Only for periodic jobs
+    int64_t next_due;
+    // Only for event jobs
+    bool pending;
+    struct scheduler_job_stats_t stats;
+};
+
+static struct job_t g_jobs[MAX_JOBS];
+static size_t g_job_count;
+static uint32_t g_wake_count;
+static TaskHandle_t g_task;
+static portMUX_TYPE g_lock = portMUX_INITIALIZER_UNLOCKED;
+
+esp_err_t scheduler_initialize(void) {
+#if CONFIG_TW_SCHEDULER_LIGHT_SLEEP
+    // DFS between the default CPU frequency and XTAL, light sleep (tickless idle) when nothing
+    // is ready to run. Peripherals which need a stable clock hold their own PM lock.
+    esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+        .light_sleep_enable = true,
+    };
+
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK) {
+        ESP_LOGE(LOG_TAG, "Failed to configure power management because 0x%x...", err);
+        return err;
+    }
+
+    ESP_LOGI(LOG_TAG, "Power management enabled (%d-%d MHz, light sleep)", config.min_freq_mhz,
+             config.max_freq_mhz);
+#else
+    ESP_LOGI(LOG_TAG, "Power management disabled");
+#endif
+
+    return ESP_OK;
+}
+
+static scheduler_job_id_t add_job(const char* name, int64_t period_us, int64_t slack_us, scheduler_job_fn_t fn,
+                                  void* arg) {
+    scheduler_job_id_t id = SCHEDULER_INVALID_JOB;
+
+    taskENTER_CRITICAL(&g_lock);
+    if (g_job_count < MAX_JOBS) {
+        id = g_job_count++;
+        struct job_t* job = &g_jobs[id];
+        memset(job, 0, sizeof *job);
+        job->fn = fn;
+        job->arg = arg;
+        job->period_us = period_us;
+        job->slack_us = slack_us;
+        job->next_due = period_us > 0 ? esp_timer_get_time() + period_us : NO_DEADLINE;
+        job->stats.name = name;
+    }
+    taskEXIT_CRITICAL(&g_lock);
+
+    if (id == SCHEDULER_INVALID_JOB) {
+        ESP_LOGE(LOG_TAG, "Cannot add job %s, increase CONFIG_TW_SCHEDULER_MAX_JOBS", name);
+    } else if (g_task != NULL) {
+        // The scheduler could be sleeping past the deadline of the new job
+        xTaskNotifyGive(g_task);
+    }
+
+    return id;
+}
+
+scheduler_job_id_t scheduler_add_periodic(const char* name, uint32_t period_ms, uint32_t slack_ms,
+                                          scheduler_job_fn_t fn, void* arg) {
+    if (period_ms == 0 || slack_ms > period_ms / 2) return SCHEDULER_INVALID_JOB;
+
+    return add_job(name, (int64_t)period_ms * 1000, (int64_t)slack_ms * 1000, fn, arg);
+}
+
+scheduler_job_id_t scheduler_add_event(const char* name, scheduler_job_fn_t fn, void* arg) {
+    return add_job(name, 0, 0, fn, arg);
+}
+
+void scheduler_notify(scheduler_job_id_t job) {
+    if (job < 0 || job >= (scheduler_job_id_t)g_job_count) return;
+
+    taskENTER_CRITICAL(&g_lock);
+    g_jobs[job].pending = true;
+    taskEXIT_CRITICAL(&g_lock);
+
+    if (g_task != NULL) xTaskNotifyGive(g_task);
+}
+
+void scheduler_notify_from_isr(scheduler_job_id_t job) {
+    if (job < 0 || job >= (scheduler_job_id_t)g_job_count) return;
+
+    taskENTER_CRITICAL_ISR(&g_lock);
+    g_jobs[job].pending = true;
+    taskEXIT_CRITICAL_ISR(&g_lock);
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    if (g_task != NULL) vTaskNotifyGiveFromISR(g_task, &higher_priority_task_woken);
+    if (higher_priority_task_woken) portYIELD_FROM_ISR();
+}
+
+bool scheduler_get_stats(scheduler_job_id_t job, struct scheduler_job_stats_t* stats) {
+    if (job < 0 || job >= (scheduler_job_id_t)g_job_count) return false;
+
+    taskENTER_CRITICAL(&g_lock);
+    *stats = g_jobs[job].stats;
+    taskEXIT_CRITICAL(&g_lock);
+
+    return true;
+}
+
+void scheduler_log_stats(void) {
+    ESP_LOGI(LOG_TAG, "%lu wakeups", (unsigned long)g_wake_count);
+
+    struct scheduler_job_stats_t stats;
+    for (scheduler_job_id_t i = 0; scheduler_get_stats(i, &stats); ++i) {
+        ESP_LOGI(LOG_TAG, "%s: %lu wakeups, %lu runs, %lld us (max %lld us)", stats.name,
+                 (unsigned long)stats.wake_count, (unsigned long)stats.run_count, stats.cpu_time_us,
+                 stats.max_run_time_us);
+    }
+}
+
+// The latest time we can sleep until without missing the window of any job, and the job
+// which determines it (to account for the wakeup). Returns true if an event job is already pending.
+static bool next_wakeup(int64_t* wake_at, scheduler_job_id_t* waker) {
+    *wake_at = NO_DEADLINE;
+    *waker = SCHEDULER_INVALID_JOB;
+
+    bool pending = false;
+    taskENTER_CRITICAL(&g_lock);
+    for (size_t i = 0; i < g_job_count; ++i) {
+        const struct job_t* job = &g_jobs[i];
+        pending = pending || job->pending;
+        if (job->next_due != NO_DEADLINE && job->next_due + job->slack_us < *wake_at) {
+            *wake_at = job->next_due + job->slack_us;
+            *waker = i;
+        }
+    }
+    taskEXIT_CRITICAL(&g_lock);
+
+    return pending;
+}
+
+static void count_notified_wakeup(void) {
+    taskENTER_CRITICAL(&g_lock);
+    for (size_t i = 0; i < g_job_count; ++i) {
+        if (g_jobs[i].pending) ++g_jobs[i].stats.wake_count;
+    }
+    taskEXIT_CRITICAL(&g_lock);
+}
+
+static void wait_for_work(void) {
+    int64_t wake_at;
+    scheduler_job_id_t waker;
+    if (next_wakeup(&wake_at, &waker)) return;
+
+    int64_t now = esp_timer_get_time();
+    if (wake_at <= now) return;
+
+    TickType_t timeout = portMAX_DELAY;
+    if (wake_at != NO_DEADLINE) {
+        int64_t timeout_ms = (wake_at - now + 999) / 1000;
+        timeout = pdMS_TO_TICKS(timeout_ms);
+        if (timeout == 0) timeout = 1;
+    }
+
+    // While we are blocked here (and no other task is ready) the CPU can enter light sleep
+    bool notified = ulTaskNotifyTake(pdTRUE, timeout) > 0;
+    ++g_wake_count;
+
+    if (notified) {
+        count_notified_wakeup();
+    } else if (waker != SCHEDULER_INVALID_JOB) {
+        taskENTER_CRITICAL(&g_lock);
+        ++g_jobs[waker].stats.wake_count;
+        taskEXIT_CRITICAL(&g_lock);
+    }
+}
+
+static bool take_if_ready(struct job_t* job, int64_t now) {
+    bool ready = false;
+
+    taskENTER_CRITICAL(&g_lock);
+    if (job->pending) {
+        job->pending = false;
+        ready = true;
+    } else if (job->next_due != NO_DEADLINE && job->next_due - job->slack_us <= now) {
+        // Keep the cadence unless we are so late that we would run again immediately
+        job->next_due += job->period_us;
+        if (job->next_due - job->slack_us <= now) job->next_due = now + job->period_us;
+        ready = true;
+    }
+    taskEXIT_CRITICAL(&g_lock);
+
+    return ready;
+}
+
+static void run_ready_jobs(void) {
+    int64_t now = esp_timer_get_time();
+    for (size_t i = 0; i < g_job_count; ++i) {
+        struct job_t* job = &g_jobs[i];
+        if (!take_if_ready(job, now)) continue;
+
+        int64_t start = esp_timer_get_time();
+        job->fn(job->arg);
+        int64_t elapsed = esp_timer_get_time() - start;
+
+        taskENTER_CRITICAL(&g_lock);
+        ++job->stats.run_count;
+        job->stats.cpu_time_us += elapsed;
+        if (elapsed > job->stats.max_run_time_us) job->stats.max_run_time_us = elapsed;
+        taskEXIT_CRITICAL(&g_lock);
+    }
+}
+
+static void scheduler_task(void* arg) {
+    for (;;) {
+        wait_for_work();
+        run_ready_jobs();
+    }
+}
+
+esp_err_t scheduler_start(void) {
+    if (g_task != NULL) return ESP_ERR_INVALID_STATE;
+
+    ESP_LOGI(LOG_TAG, "Starting scheduler with %zu jobs...", g_job_count);
+    if (xTaskCreate(scheduler_task, "sched", CONFIG_TW_SCHEDULER_TASK_STACK_SIZE, NULL, tskIDLE_PRIORITY + 2, &g_task) !=
+        pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    return ESP_OK;
+}
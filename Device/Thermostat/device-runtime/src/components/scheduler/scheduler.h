@@ -0,0 +1,39 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef int scheduler_job_id_t;
+typedef void (*scheduler_job_fn_t)(void* arg);
+
+#define SCHEDULER_INVALID_JOB ((scheduler_job_id_t)-1)
+
+struct scheduler_job_stats_t {
+    const char* name;
+    // Number of times the scheduler woke up because of this job (its deadline or a notification)
+    uint32_t wake_count;
+    uint32_t run_count;
+    // Time spent running the job (it includes the time the job has been preempted)
+    int64_t cpu_time_us;
+    int64_t max_run_time_us;
+};
+
+// Jobs run one after the other in the scheduler task. A periodic job can run anywhere between
+// slack milliseconds before and after its deadline: the scheduler sleeps until the latest
+// deadline it can wait for and then runs all the jobs which are within their window,
+// to wake up the CPU as few times as possible.
+// Event jobs run (once) after they have been notified, notifications received while the job
+// was already pending are coalesced.
+esp_err_t scheduler_initialize(void);
+scheduler_job_id_t scheduler_add_periodic(const char* name, uint32_t period_ms, uint32_t slack_ms,
+                                          scheduler_job_fn_t fn, void* arg);
+scheduler_job_id_t scheduler_add_event(const char* name, scheduler_job_fn_t fn, void* arg);
+void scheduler_notify(scheduler_job_id_t job);
+void scheduler_notify_from_isr(scheduler_job_id_t job);
+
+bool scheduler_get_stats(scheduler_job_id_t job, struct scheduler_job_stats_t* stats);
+void scheduler_log_stats(void);
+
+// Starts the scheduler task, jobs can be added before or after it started
+esp_err_t scheduler_start(void);
@@ -1,25 +1,34 @@
 #include "settings.h"
+#include "boot_profiler.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 static const char* SETTINGS_LOG_TAG = "settings";
 
 #define NVS_PARTITION "config"
-#define NVS_NAMESPACE "default"
+#define NVS_LEGACY_NAMESPACE "default"
+#define NVS_VERSION_KEY "_version"
+#define ALL_FIELDS_MASK(record) ((uint32_t)((1ULL << (record)->field_count) - 1))
 
 esp_err_t settings_initialize(void)
 {
+    boot_span_id_t span = boot_profiler_begin("nvs_init", NULL);
     esp_err_t err = nvs_flash_init();
-    if (err != ESP_OK)
-        return err;
+    boot_profiler_end(span);
 
-    return ESP_OK;
+    return err;
 }
 
-esp_err_t settings_load(const char* key, set_defaults_fn_t set_defaults, struct settings_t* config, size_t settings_size, int8_t schema_version)
+static bool g_partition_initialized;
+
+static esp_err_t settings_init_partition(void)
 {
-    ESP_LOGI(SETTINGS_LOG_TAG, "Loading %s config...", key);
+    if (g_partition_initialized)
+        return ESP_OK;
 
     esp_err_t err = nvs_flash_init_partition(NVS_PARTITION);
     if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND || err ==  ESP_ERR_NVS_KEYS_NOT_INITIALIZED)
@@ -30,52 +39,378 @@ esp_err_t settings_load(const char* key, set_defaults_fn_t set_defaults, struct
     }
 
     if (err != ESP_OK)
-    {
         ESP_LOGE(SETTINGS_LOG_TAG, "Failed to initialize because 0x%x...", err);
-        return err;
+    else
+        g_partition_initialized = true;
+
+    return err;
+}
+
+static void* field_ptr(const struct settings_record_t* record, const struct settings_field_t* field)
+{
+    return (uint8_t*)record->settings + field->offset;
+}
+
+// Number of bytes we actually write to flash for this field
+static size_t field_stored_size(const struct settings_record_t* record, const struct settings_field_t* field)
+{
+    if (field->type == SETTINGS_FIELD_STRING)
+        return strnlen(field_ptr(record, field), field->size) + 1;
+
+    return field->size;
+}
+
+static bool field_changed(const struct settings_record_t* record, const struct settings_field_t* field)
+{
+    const uint8_t* current = field_ptr(record, field);
+    const uint8_t* snapshot = (const uint8_t*)record->snapshot + field->offset;
+
+    // Whatever follows the terminator of a string is not stored, it does not count as a change
+    if (field->type == SETTINGS_FIELD_STRING)
+    {
+        size_t length = strnlen((const char*)current, field->size);
+        return length != strnlen((const char*)snapshot, field->size) || memcmp(current, snapshot, length) != 0;
+    }
+
+    return memcmp(current, snapshot, field->size) != 0;
+}
+
+static void take_snapshot(struct settings_record_t* record)
+{
+    memcpy(record->snapshot, record->settings, record->settings_size);
+    record->dirty_mask = 0;
+}
+
+static uint32_t dirty_fields(const struct settings_record_t* record)
+{
+    uint32_t mask = record->dirty_mask;
+    for (size_t i = 0; i < record->field_count; ++i)
+    {
+        if (field_changed(record, &record->fields[i]))
+            mask |= 1u << i;
     }
 
+    return mask;
+}
+
+static esp_err_t convert_legacy_blob(nvs_handle_t handle, struct settings_record_t* record)
+{
+    // The old layout can be much bigger than the current one, we need it only once
+    void* blob = malloc(record->legacy_size);
+    if (blob == NULL)
+        return ESP_ERR_NO_MEM;
+
+    size_t size = record->legacy_size;
+    esp_err_t err = nvs_get_blob(handle, record->key, blob, &size);
+    if (err == ESP_OK)
+        err = record->convert_legacy(record->settings, blob, size);
+
+    free(blob);
+    return err;
+}
+
+// Settings saved before we moved to field-level storage are a single blob
+// in the default namespace, we read it once and then rewrite it field by field.
+static bool load_legacy_blob(struct settings_record_t* record)
+{
     nvs_handle_t handle;
-    err = nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READONLY, &handle);
-    if (err == ESP_ERR_NVS_NOT_FOUND)
-        err = nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (nvs_open_from_partition(NVS_PARTITION, NVS_LEGACY_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return false;
 
-    if (err != ESP_OK)
+    esp_err_t err;
+    if (record->convert_legacy != NULL)
     {
-        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to open partition because 0x%x...", err);
-        return err;
+        err = convert_legacy_blob(handle, record);
+    }
+    else
+    {
+        size_t size = record->settings_size;
+        err = nvs_get_blob(handle, record->key, record->settings, &size);
+        if (err == ESP_OK && record->settings->version != record->schema_version)
+            err = ESP_ERR_INVALID_VERSION;
     }
 
-    err = nvs_get_blob(handle, key, config, &settings_size);
-    if (err == ESP_ERR_NVS_NOT_FOUND || config->version != schema_version)
+    nvs_close(handle);
+
+    if (err == ESP_OK)
     {
-        set_defaults(config);
-        err = ESP_OK;
+        ESP_LOGI(SETTINGS_LOG_TAG, "Migrated legacy %s config", record->key);
+        return true;
     }
 
-    if (err != ESP_OK)
-        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to load blob because 0x%x...", err);
+    if (err != ESP_ERR_NVS_NOT_FOUND)
+        ESP_LOGE(SETTINGS_LOG_TAG, "Cannot migrate legacy %s config because 0x%x, using defaults", record->key, err);
+
+    record->set_defaults(record->settings);
+    return false;
+}
+
+static esp_err_t load_field(nvs_handle_t handle, struct settings_record_t* record, const struct settings_field_t* field)
+{
+    void* target = field_ptr(record, field);
+    if (field->type == SETTINGS_FIELD_INT32)
+        return nvs_get_i32(handle, field->key, (int32_t*)target);
+
+    size_t size = field->size;
+    esp_err_t err = nvs_get_blob(handle, field->key, target, &size);
+    if (err == ESP_OK && field->type == SETTINGS_FIELD_STRING)
+        ((char*)target)[field->size - 1] = '\0';
 
-    nvs_close(handle);
     return err;
 }
 
-esp_err_t settings_save(const char* key, struct settings_t* settings, size_t settings_size)
+static esp_err_t save_field(nvs_handle_t handle, struct settings_record_t* record, const struct settings_field_t* field)
 {
-    nvs_handle_t handle;
-    esp_err_t err = nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &handle);
+    const void* source = field_ptr(record, field);
+    if (field->type == SETTINGS_FIELD_INT32)
+        return nvs_set_i32(handle, field->key, *(const int32_t*)source);
+
+    size_t size = field_stored_size(record, field);
+    if (size > field->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    return nvs_set_blob(handle, field->key, source, size);
+}
+
+static void load_defaults(struct settings_record_t* record)
+{
+    record->set_defaults(record->settings);
+    take_snapshot(record);
+    record->dirty_mask = ALL_FIELDS_MASK(record);
+    record->stored = false;
+}
+
+static esp_err_t load_stored_fields(nvs_handle_t handle, struct settings_record_t* record, uint32_t* missing)
+{
+    esp_err_t err = ESP_OK;
+    *missing = 0;
+    for (size_t i = 0; i < record->field_count && err == ESP_OK; ++i)
+    {
+        err = load_field(handle, record, &record->fields[i]);
+        if (err == ESP_ERR_NVS_NOT_FOUND)
+        {
+            *missing |= 1u << i;
+            err = ESP_OK;
+        }
+    }
+
+    return err;
+}
+
+static void migrate_record(struct settings_record_t* record, int8_t version)
+{
+    ESP_LOGI(SETTINGS_LOG_TAG, "Migrating %s config from version %d to %d...", record->key, version,
+             record->schema_version);
+
+    esp_err_t err = record->migrate != NULL ? record->migrate(record->settings, version) : ESP_OK;
     if (err != ESP_OK)
     {
-        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to open partition because 0x%x...", err);
+        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to migrate %s config because 0x%x, using defaults", record->key, err);
+        load_defaults(record);
+        return;
+    }
+
+    // Whatever the migration changed is now dirty (it does not match the snapshot anymore)
+    record->settings->version = record->schema_version;
+}
+
+static esp_err_t load_record(nvs_handle_t handle, struct settings_record_t* record)
+{
+    assert(record->field_count <= SETTINGS_MAX_FIELDS);
+    assert(record->snapshot != NULL);
+    ESP_LOGI(SETTINGS_LOG_TAG, "Loading %s config...", record->key);
+
+    // Defaults first: fields missing in NVS (for example because they have been added
+    // after the record was saved) keep their default value.
+    record->set_defaults(record->settings);
+    record->stored = false;
+    record->loaded = true;
+
+    int8_t version;
+    esp_err_t err = nvs_get_i8(handle, NVS_VERSION_KEY, &version);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+    {
+        bool migrated = load_legacy_blob(record);
+        take_snapshot(record);
+        record->dirty_mask = ALL_FIELDS_MASK(record);
+        if (!migrated)
+            ESP_LOGI(SETTINGS_LOG_TAG, "No stored %s config, using defaults", record->key);
+
+        return ESP_OK;
+    }
+
+    uint32_t missing = 0;
+    if (err == ESP_OK)
+        err = load_stored_fields(handle, record, &missing);
+
+    if (err != ESP_OK)
+    {
+        // Some fields could have been loaded already: back to the defaults, all of them are
+        // written again (replacing what we could not read) when the record is saved.
+        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to load %s because 0x%x, using defaults", record->key, err);
+        load_defaults(record);
         return err;
     }
 
-    err = nvs_set_blob(handle, key, settings, settings_size);
+    take_snapshot(record);
+    record->dirty_mask = missing;
+    record->stored = true;
+    record->stored_version = version;
+
+    if (version < record->schema_version)
+        migrate_record(record, version);
+    else if (version > record->schema_version)
+        ESP_LOGW(SETTINGS_LOG_TAG, "Config %s has been written with schema %d, newer than %d", record->key, version,
+                 record->schema_version);
+
+    return ESP_OK;
+}
+
+static esp_err_t save_record(nvs_handle_t handle, struct settings_record_t* record)
+{
+    // The version is written when the record is new or it has been migrated, a record
+    // written by a newer firmware keeps its version.
+    bool write_version = !record->stored || record->stored_version < record->schema_version;
+    uint32_t dirty = dirty_fields(record);
+    if (dirty == 0 && !write_version)
+    {
+        ESP_LOGD(SETTINGS_LOG_TAG, "No changes to %s config", record->key);
+        return ESP_OK;
+    }
+
+    esp_err_t err = ESP_OK;
+    size_t written_fields = 0;
+    size_t written_bytes = 0;
+    for (size_t i = 0; i < record->field_count && err == ESP_OK; ++i)
+    {
+        if ((dirty & (1u << i)) == 0)
+            continue;
+
+        err = save_field(handle, record, &record->fields[i]);
+        written_bytes += field_stored_size(record, &record->fields[i]);
+        ++written_fields;
+    }
+
+    if (err == ESP_OK && write_version)
+    {
+        err = nvs_set_i8(handle, NVS_VERSION_KEY, record->schema_version);
+        written_bytes += sizeof(int8_t);
+    }
+
     if (err == ESP_OK)
-        nvs_commit(handle);
+        err = nvs_commit(handle);
+
+    if (err == ESP_OK)
+    {
+        ESP_LOGD(SETTINGS_LOG_TAG, "Saved %zu/%zu fields of %s config (%zu bytes)", written_fields, record->field_count,
+                 record->key, written_bytes);
+        if (write_version)
+            record->stored_version = record->schema_version;
+
+        record->stored = true;
+        take_snapshot(record);
+    }
     else
-        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to save blob because 0x%x...", err);
+    {
+        ESP_LOGE(SETTINGS_LOG_TAG, "Failed to save %s because 0x%x...", record->key, err);
+    }
 
-    nvs_close(handle);
     return err;
 }
+
+esp_err_t settings_session_open(struct settings_session_t* session, struct settings_record_t* const records[],
+                                size_t record_count)
+{
+    assert(record_count <= SETTINGS_MAX_SESSION_RECORDS);
+    memset(session, 0, sizeof *session);
+
+    esp_err_t err = settings_init_partition();
+    if (err != ESP_OK)
+        return err;
+
+    for (size_t i = 0; i < record_count; ++i)
+    {
+        err = nvs_open_from_partition(NVS_PARTITION, records[i]->key, NVS_READWRITE, &session->handles[i]);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(SETTINGS_LOG_TAG, "Failed to open namespace %s because 0x%x...", records[i]->key, err);
+            settings_session_close(session, false);
+            return err;
+        }
+
+        session->records[i] = records[i];
+        session->record_count = i + 1;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t settings_session_load(struct settings_session_t* session)
+{
+    // A record which fails to load (already logged) gets its defaults, we go on with the others:
+    // a corrupted field must not stop the device from booting.
+    for (size_t i = 0; i < session->record_count; ++i)
+    {
+        struct settings_record_t* record = session->records[i];
+        boot_span_id_t span = boot_profiler_begin("settings_load", record->key);
+        load_record(session->handles[i], record);
+        boot_profiler_end(span);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t settings_session_close(struct settings_session_t* session, bool commit)
+{
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < session->record_count; ++i)
+    {
+        if (commit)
+        {
+            esp_err_t err = save_record(session->handles[i], session->records[i]);
+            if (err != ESP_OK && result == ESP_OK)
+                result = err;
+        }
+
+        nvs_close(session->handles[i]);
+    }
+
+    session->record_count = 0;
+    return result;
+}
+
+esp_err_t settings_record_load(struct settings_record_t* record)
+{
+    struct settings_session_t session;
+    esp_err_t err = settings_session_open(&session, &record, 1);
+    if (err != ESP_OK)
+        return err;
+
+    err = settings_session_load(&session);
+    settings_session_close(&session, false);
+    return err;
+}
+
+esp_err_t settings_record_save(struct settings_record_t* record)
+{
+    struct settings_session_t session;
+    esp_err_t err = settings_session_open(&session, &record, 1);
+    if (err != ESP_OK)
+        return err;
+
+    return settings_session_close(&session, true);
+}
+
+void settings_record_mark_dirty(struct settings_record_t* record, const char* field_key)
+{
+    for (size_t i = 0; i < record->field_count; ++i)
+    {
+        if (strcmp(record->fields[i].key, field_key) == 0)
+            record->dirty_mask |= 1u << i;
+    }
+}
+
+bool settings_record_is_dirty(const struct settings_record_t* record)
+{
+    return !record->stored || record->stored_version < record->schema_version || dirty_fields(record) != 0;
+}
@@ -1,6 +1,13 @@
 #pragma once
 
 #include "esp_err.h"
+#include "nvs.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SETTINGS_MAX_FIELDS 16
+#define SETTINGS_MAX_SESSION_RECORDS 8
 
 struct settings_t
 {
@@ -9,6 +16,91 @@ struct settings_t
 
 typedef void (*set_defaults_fn_t)(struct settings_t* settings);
 
+// Upgrades a record stored with an older schema. When called, the settings already contain
+// the stored fields (and the defaults for the fields which were not stored), the function
+// converts what changed meaning between from_version and the current schema. If it fails the
+// record is reset to its defaults.
+typedef esp_err_t (*settings_migrate_fn_t)(struct settings_t* settings, int8_t from_version);
+
+// Converts a record saved as a single blob by the firmwares before field-level storage. blob is
+// what we read (size bytes, at most legacy_size), the function copies its fields into settings.
+typedef esp_err_t (*settings_convert_legacy_fn_t)(struct settings_t* settings, const void* blob, size_t size);
+
+enum settings_field_type_t
+{
+    // NUL terminated string, only the used part of the buffer is written
+    SETTINGS_FIELD_STRING,
+    // 32 bit integer (or enum)
+    SETTINGS_FIELD_INT32,
+    // Raw bytes, the whole field is written
+    SETTINGS_FIELD_BLOB,
+};
+
+// Describes a single field of a settings structure. Each field is stored with its own
+// NVS key (max 15 characters) then a change to a field rewrites only that entry.
+struct settings_field_t
+{
+    const char* key;
+    enum settings_field_type_t type;
+    size_t offset;
+    size_t size;
+};
+
+#define SETTINGS_FIELD(field_type, settings_type, member, nvs_key)                                                     \
+    {                                                                                                                  \
+        .key = nvs_key, .type = field_type, .offset = offsetof(settings_type, member),                                 \
+        .size = sizeof(((settings_type*)0)->member)                                                                    \
+    }
+
+// A settings structure stored field by field in its own NVS namespace (the record key).
+// Dirty fields are detected comparing each field with snapshot, a copy of the settings taken
+// when they were last loaded or saved (it must point to a buffer of settings_size bytes, usually
+// a static variable of the same type as settings). settings_record_mark_dirty() can be used to force a write.
+// Adding or removing fields does not need a new schema version (missing fields keep their
+// default value), the version changes when a field changes meaning and then migrate is
+// called for records stored with an older version (it's optional when there is nothing to convert).
+// A record whose layout changed after it was last saved as a single blob sets legacy_size (the size
+// of the old structure, usually a frozen copy of it) and convert_legacy, without them the legacy
+// blob is read as it is into settings.
+struct settings_record_t
+{
+    const char* key;
+    const struct settings_field_t* fields;
+    size_t field_count;
+    struct settings_t* settings;
+    struct settings_t* snapshot;
+    size_t settings_size;
+    int8_t schema_version;
+    set_defaults_fn_t set_defaults;
+    settings_migrate_fn_t migrate;
+    size_t legacy_size;
+    settings_convert_legacy_fn_t convert_legacy;
+
+    // Private state
+    bool loaded;
+    bool stored;
+    int8_t stored_version;
+    uint32_t dirty_mask;
+};
+
+// A set of records read and written together: the partition is initialized and the namespace
+// of each record opened once, changes are written only when the session is closed with commit.
+struct settings_session_t
+{
+    struct settings_record_t* records[SETTINGS_MAX_SESSION_RECORDS];
+    nvs_handle_t handles[SETTINGS_MAX_SESSION_RECORDS];
+    size_t record_count;
+};
+
 esp_err_t settings_initialize(void);
-esp_err_t settings_load(const char* key, set_defaults_fn_t set_defaults, struct settings_t* settings, size_t settings_size, int8_t schema_version);
-esp_err_t settings_save(const char* key, struct settings_t* settings, size_t settings_size);
+
+esp_err_t settings_session_open(struct settings_session_t* session, struct settings_record_t* const records[],
+                                size_t record_count);
+esp_err_t settings_session_load(struct settings_session_t* session);
+esp_err_t settings_session_close(struct settings_session_t* session, bool commit);
+
+// Shortcuts for a session with a single record
+esp_err_t settings_record_load(struct settings_record_t* record);
+esp_err_t settings_record_save(struct settings_record_t* record);
+void settings_record_mark_dirty(struct settings_record_t* record, const char* field_key);
+bool settings_record_is_dirty(const struct settings_record_t* record);
@@ -1,19 +1,66 @@
 #include "settings.h"
 #include "networking.h"
 #include "provisioning.h"
+#include "app_mqtt.h"
+#include "ota_update.h"
+#include "boot_profiler.h"
+#include "scheduler.h"
 #include "esp_log.h"
 
+#define SCHEDULER_STATS_PERIOD_MS (60 * 60 * 1000)
+
 static const char* APP_LOG_TAG = "app";
 
+static void log_stats(void* arg)
+{
+    scheduler_log_stats();
+    app_mqtt_log_stats();
+}
+
 void app_main(void)
 {
+    boot_span_id_t boot_span = boot_profiler_begin("app_main", NULL);
+
     ESP_LOGI(APP_LOG_TAG, "Initializing components...");
+    boot_span_id_t span = boot_profiler_begin("settings_init", NULL);
     ESP_ERROR_CHECK(settings_initialize());
+    boot_profiler_end(span);
+
+    span = boot_profiler_begin("networking_init", NULL);
     ESP_ERROR_CHECK(networking_initialize());
+    boot_profiler_end(span);
+
+    span = boot_profiler_begin("scheduler_init", NULL);
+    ESP_ERROR_CHECK(scheduler_initialize());
+    boot_profiler_end(span);
+
+    span = boot_profiler_begin("provisioning_init", NULL);
     ESP_ERROR_CHECK(provisioning_initialize());
+    boot_profiler_end(span);
 
     ESP_LOGI(APP_LOG_TAG, "Starting...");
+    span = boot_profiler_begin("provisioning_wait", NULL);
     ESP_ERROR_CHECK(provisioning_wait_if_needed());
+    boot_profiler_end(span);
+
+    // The MQTT client connects (and reconnects) on its own as soon as the network is available
+    span = boot_profiler_begin("mqtt_init", NULL);
+    if (app_mqtt_initialize() == ESP_OK)
+        ESP_ERROR_CHECK(app_mqtt_start());
+    boot_profiler_end(span);
+
+    // From now on everything runs as a job of the scheduler, app_main() returns and the CPU
+    // sleeps between one job and the next. Settings are not flushed periodically: they are
+    // written only when a client commits them with "save".
+    scheduler_add_periodic("stats", SCHEDULER_STATS_PERIOD_MS, SCHEDULER_STATS_PERIOD_MS / 2, log_stats, NULL);
+    ESP_ERROR_CHECK(scheduler_start());
+
+    boot_profiler_end(boot_span);
+    boot_profiler_log();
+
+    // Startup completed: if this is the first boot after an update then the new image is
+    // good and it must not be rolled back.
+    ESP_ERROR_CHECK(ota_update_confirm());
 
     ESP_LOGI(APP_LOG_TAG, "Application started");
 }
@@ -0,0 +1,35 @@
+#include "capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int capture_load(const char* path, struct capture_t* capture) {
+    memset(capture, 0, sizeof *capture);
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return -1;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    capture->data = malloc(size > 0 ? size : 1);
+    capture->size = fread(capture->data, 1, size, file);
+    fclose(file);
+
+    return capture->size == (size_t)size ? 0 : -1;
+}
+
+void capture_free(struct capture_t* capture) {
+    free(capture->data);
+    memset(capture, 0, sizeof *capture);
+}
+
+size_t capture_command_length(const struct capture_t* capture) {
+    for (size_t i = 0; i < capture->size; ++i) {
+        if (capture->data[i] == '\n') return i + 1;
+        if (capture->data[i] < 0x20 || capture->data[i] > 0x7e) return 0;
+    }
+
+    return 0;
+}
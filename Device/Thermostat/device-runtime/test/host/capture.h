@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A capture of what a provisioning station sent, loaded in memory (see captures/make_captures.py)
+struct capture_t {
+    uint8_t* data;
+    size_t size;
+};
+
+int capture_load(const char* path, struct capture_t* capture);
+void capture_free(struct capture_t* capture);
+
+// Length of the command line at the start of the capture (with its terminator), 0 if there is none
+size_t capture_command_length(const struct capture_t* capture);
@@ -0,0 +1,25 @@
+# Creates the synthetic captures used by the host tests. A capture is what a provisioning station
+# sends on the TCP connection (for a real one: Wireshark, "Follow TCP Stream", show data as "Raw").
+# Usage: python make_captures.py
+import base64
+import hashlib
+import random
+
+random.seed(1)
+body = base64.encodebytes(bytes(random.getrandbits(8) for _ in range(1200))).decode("ascii")
+pem = ("-----BEGIN CERTIFICATE-----\n" + body + "-----END CERTIFICATE-----\n").encode("ascii")
+
+with open("cert_upload.pem", "wb") as f:
+    f.write(pem)
+
+# The station sends frames of 1000 bytes
+frames = b""
+for i in range(0, len(pem), 1000):
+    chunk = pem[i:i + 1000]
+    frames += len(chunk).to_bytes(2, "big") + chunk
+
+digest = hashlib.sha256(pem).hexdigest()
+with open("cert_upload.bin", "wb") as f:
+    f.write(f"mqtt_server_cert_bin={digest}\n".encode("ascii"))
+    f.write(frames + b"\x00\x00")
+    f.write(b"save\n")
@@ -0,0 +1,24 @@
+#include "boot_profiler.h"
+
+// Spans are not recorded on the host, the code under test only needs the functions to exist
+
+boot_span_id_t boot_profiler_begin(const char* name, const char* detail) {
+    return BOOT_SPAN_INVALID;
+}
+
+void boot_profiler_end(boot_span_id_t span) {
+}
+
+void boot_profiler_record(const char* name, const char* detail, int64_t start, int64_t end) {
+}
+
+bool boot_profiler_get(size_t index, struct boot_span_t* span) {
+    return false;
+}
+
+size_t boot_profiler_dump(void* buffer, size_t size) {
+    return 0;
+}
+
+void boot_profiler_log(void) {
+}
@@ -0,0 +1,184 @@
+#include "fake_freertos.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include <limits.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_TASKS 16
+#define STACK_FILL 0xa5
+
+// The stack is ours (and painted) to measure how much of it the task used. Threads cannot have
+// a stack smaller than PTHREAD_STACK_MIN, the extra bytes are the first to be painted over. The
+// C library keeps the thread descriptor and the TLS at the top of the stack: we count from
+// where the task function starts.
+struct fake_task_t {
+    pthread_t thread;
+    char name[16];
+    TaskFunction_t function;
+    void* arg;
+    uint8_t* stack;
+    uint8_t* stack_top;
+    jmp_buf deleted;
+    size_t stack_size;
+    size_t requested_stack_size;
+    bool joined;
+};
+
+struct fake_event_group_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+static struct fake_task_t g_tasks[MAX_TASKS];
+static size_t g_task_count;
+static pthread_mutex_t g_tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct fake_task_t* g_current_task;
+
+static void* run_task(void* arg) {
+    uint8_t top;
+    g_current_task = arg;
+    g_current_task->stack_top = &top;
+    if (setjmp(g_current_task->deleted) == 0) g_current_task->function(g_current_task->arg);
+
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack_size, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    pthread_mutex_lock(&g_tasks_mutex);
+    if (g_task_count == MAX_TASKS) abort();
+
+    struct fake_task_t* task = &g_tasks[g_task_count++];
+    pthread_mutex_unlock(&g_tasks_mutex);
+
+    memset(task, 0, sizeof *task);
+    strncpy(task->name, name, sizeof task->name - 1);
+    task->function = function;
+    task->arg = arg;
+    task->requested_stack_size = stack_size;
+    task->stack_size = stack_size < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : stack_size;
+    task->stack_size = (task->stack_size + 4095) & ~(size_t)4095;
+    if (posix_memalign((void**)&task->stack, 4096, task->stack_size) != 0) abort();
+    memset(task->stack, STACK_FILL, task->stack_size);
+
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstack(&attributes, task->stack, task->stack_size);
+    if (pthread_create(&task->thread, &attributes, run_task, task) != 0) abort();
+    pthread_attr_destroy(&attributes);
+
+    if (handle != NULL) *handle = task;
+    return pdPASS;
+}
+
+// Only a task can delete itself. We do not use pthread_exit(): unwinding the thread would take
+// more stack than the task itself.
+void vTaskDelete(TaskHandle_t task) {
+    if (g_current_task == NULL || (task != NULL && task != g_current_task)) abort();
+
+    longjmp(g_current_task->deleted, 1);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    struct timespec delay = {.tv_sec = ticks / 1000, .tv_nsec = (ticks % 1000) * 1000000L};
+    nanosleep(&delay, NULL);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+// Stacks grow down: the bytes still painted at the bottom have never been used
+static size_t stack_used(const struct fake_task_t* task) {
+    size_t unused = 0;
+    while (unused < task->stack_size && task->stack[unused] == STACK_FILL)
+        ++unused;
+
+    return task->stack_top - (task->stack + unused);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    if (task == NULL) task = g_current_task;
+    if (task == NULL) return 0;
+
+    size_t used = stack_used(task);
+    return used < task->requested_stack_size ? task->requested_stack_size - used : 0;
+}
+
+void fake_freertos_join_tasks(void) {
+    for (size_t i = 0; i < g_task_count; ++i) {
+        if (g_tasks[i].joined) continue;
+
+        pthread_join(g_tasks[i].thread, NULL);
+        g_tasks[i].joined = true;
+    }
+}
+
+size_t fake_freertos_stack_used(const char* name) {
+    for (size_t i = g_task_count; i > 0; --i) {
+        if (strcmp(g_tasks[i - 1].name, name) == 0) return stack_used(&g_tasks[i - 1]);
+    }
+
+    return 0;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    struct fake_event_group_t* group = calloc(1, sizeof *group);
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->changed, NULL);
+    return group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    EventBits_t result = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    pthread_mutex_lock(&group->mutex);
+    EventBits_t result = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
+
+static bool bits_set(EventBits_t value, EventBits_t bits, BaseType_t wait_for_all) {
+    return wait_for_all ? (value & bits) == bits : (value & bits) != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks_to_wait) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks_to_wait / 1000;
+    deadline.tv_nsec += (ticks_to_wait % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&group->mutex);
+    while (!bits_set(group->bits, bits, wait_for_all)) {
+        if (ticks_to_wait == portMAX_DELAY)
+            pthread_cond_wait(&group->changed, &group->mutex);
+        else if (pthread_cond_timedwait(&group->changed, &group->mutex, &deadline) != 0)
+            break;
+    }
+
+    EventBits_t result = group->bits;
+    if (clear_on_exit && bits_set(result, bits, wait_for_all)) group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return result;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+
+// Waits for every task created with xTaskCreate() to terminate
+void fake_freertos_join_tasks(void);
+
+// Peak stack usage (in bytes) of the last task created with this name, it's measured on the host
+// (x86-64, other compiler and C library): an indication of the order of magnitude, not the figure
+// we would read on the device.
+size_t fake_freertos_stack_used(const char* name);
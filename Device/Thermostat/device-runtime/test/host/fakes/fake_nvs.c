@@ -0,0 +1,223 @@
+#include "fake_nvs.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES 128
+#define MAX_HANDLES 16
+#define MAX_NAME_LENGTH 16
+
+enum entry_type_t {
+    ENTRY_I8,
+    ENTRY_I32,
+    ENTRY_BLOB,
+};
+
+struct entry_t {
+    bool in_use;
+    char namespace_name[MAX_NAME_LENGTH];
+    char key[MAX_NAME_LENGTH];
+    enum entry_type_t type;
+    void* value;
+    size_t length;
+};
+
+struct handle_t {
+    bool in_use;
+    bool writable;
+    char namespace_name[MAX_NAME_LENGTH];
+};
+
+static struct entry_t g_entries[MAX_ENTRIES];
+static struct handle_t g_handles[MAX_HANDLES];
+static struct fake_nvs_stats_t g_stats;
+
+static struct entry_t* find_entry(const char* namespace_name, const char* key) {
+    for (size_t i = 0; i < MAX_ENTRIES; ++i) {
+        struct entry_t* entry = &g_entries[i];
+        if (entry->in_use && strcmp(entry->namespace_name, namespace_name) == 0 && strcmp(entry->key, key) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static bool namespace_exists(const char* namespace_name) {
+    for (size_t i = 0; i < MAX_ENTRIES; ++i) {
+        if (g_entries[i].in_use && strcmp(g_entries[i].namespace_name, namespace_name) == 0) return true;
+    }
+
+    return false;
+}
+
+static esp_err_t put(const char* namespace_name, const char* key, enum entry_type_t type, const void* value,
+                     size_t length) {
+    if (strlen(key) >= MAX_NAME_LENGTH || strlen(namespace_name) >= MAX_NAME_LENGTH) return ESP_ERR_INVALID_ARG;
+
+    struct entry_t* entry = find_entry(namespace_name, key);
+    for (size_t i = 0; i < MAX_ENTRIES && entry == NULL; ++i) {
+        if (!g_entries[i].in_use) entry = &g_entries[i];
+    }
+
+    if (entry == NULL) return ESP_ERR_NVS_NO_FREE_PAGES;
+
+    free(entry->value);
+    entry->in_use = true;
+    strcpy(entry->namespace_name, namespace_name);
+    strcpy(entry->key, key);
+    entry->type = type;
+    entry->value = malloc(length);
+    entry->length = length;
+    memcpy(entry->value, value, length);
+
+    return ESP_OK;
+}
+
+static struct handle_t* get_handle(nvs_handle_t handle) {
+    if (handle == 0 || handle > MAX_HANDLES || !g_handles[handle - 1].in_use) abort();
+
+    return &g_handles[handle - 1];
+}
+
+static esp_err_t set_value(nvs_handle_t handle, const char* key, enum entry_type_t type, const void* value,
+                           size_t length) {
+    struct handle_t* h = get_handle(handle);
+    if (!h->writable) return ESP_ERR_INVALID_STATE;
+
+    esp_err_t err = put(h->namespace_name, key, type, value, length);
+    if (err == ESP_OK) {
+        ++g_stats.keys_written;
+        g_stats.bytes_written += length;
+    }
+
+    return err;
+}
+
+// Keys are typed, like in the real NVS reading a key with another type does not find it
+static esp_err_t get_value(nvs_handle_t handle, const char* key, enum entry_type_t type, struct entry_t** entry) {
+    *entry = find_entry(get_handle(handle)->namespace_name, key);
+    if (*entry == NULL || (*entry)->type != type) return ESP_ERR_NVS_NOT_FOUND;
+
+    return ESP_OK;
+}
+
+void fake_nvs_reset(void) {
+    for (size_t i = 0; i < MAX_ENTRIES; ++i)
+        free(g_entries[i].value);
+
+    memset(g_entries, 0, sizeof g_entries);
+    memset(g_handles, 0, sizeof g_handles);
+    fake_nvs_reset_stats();
+}
+
+void fake_nvs_reset_stats(void) {
+    memset(&g_stats, 0, sizeof g_stats);
+}
+
+const struct fake_nvs_stats_t* fake_nvs_get_stats(void) {
+    return &g_stats;
+}
+
+void fake_nvs_put_blob(const char* namespace_name, const char* key, const void* value, size_t length) {
+    ESP_ERROR_CHECK(put(namespace_name, key, ENTRY_BLOB, value, length));
+}
+
+void fake_nvs_put_i8(const char* namespace_name, const char* key, int8_t value) {
+    ESP_ERROR_CHECK(put(namespace_name, key, ENTRY_I8, &value, sizeof value));
+}
+
+void fake_nvs_put_i32(const char* namespace_name, const char* key, int32_t value) {
+    ESP_ERROR_CHECK(put(namespace_name, key, ENTRY_I32, &value, sizeof value));
+}
+
+bool fake_nvs_contains(const char* namespace_name, const char* key) {
+    return find_entry(namespace_name, key) != NULL;
+}
+
+esp_err_t nvs_flash_init(void) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init_partition(const char* partition_label) {
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase_partition(const char* partition_label) {
+    fake_nvs_reset();
+    return ESP_OK;
+}
+
+esp_err_t nvs_open_from_partition(const char* partition_name, const char* namespace_name, nvs_open_mode_t open_mode,
+                                  nvs_handle_t* out_handle) {
+    // Only one partition, the tests never use more than that
+    if (open_mode == NVS_READONLY && !namespace_exists(namespace_name)) return ESP_ERR_NVS_NOT_FOUND;
+
+    for (size_t i = 0; i < MAX_HANDLES; ++i) {
+        if (g_handles[i].in_use) continue;
+
+        g_handles[i].in_use = true;
+        g_handles[i].writable = open_mode == NVS_READWRITE;
+        snprintf(g_handles[i].namespace_name, MAX_NAME_LENGTH, "%s", namespace_name);
+        *out_handle = i + 1;
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    get_handle(handle)->in_use = false;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    get_handle(handle);
+    ++g_stats.commits;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_i8(nvs_handle_t handle, const char* key, int8_t* out_value) {
+    struct entry_t* entry;
+    esp_err_t err = get_value(handle, key, ENTRY_I8, &entry);
+    if (err == ESP_OK) memcpy(out_value, entry->value, sizeof *out_value);
+
+    return err;
+}
+
+esp_err_t nvs_set_i8(nvs_handle_t handle, const char* key, int8_t value) {
+    return set_value(handle, key, ENTRY_I8, &value, sizeof value);
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char* key, int32_t* out_value) {
+    struct entry_t* entry;
+    esp_err_t err = get_value(handle, key, ENTRY_I32, &entry);
+    if (err == ESP_OK) memcpy(out_value, entry->value, sizeof *out_value);
+
+    return err;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char* key, int32_t value) {
+    return set_value(handle, key, ENTRY_I32, &value, sizeof value);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    struct entry_t* entry;
+    esp_err_t err = get_value(handle, key, ENTRY_BLOB, &entry);
+    if (err != ESP_OK) return err;
+
+    // Same as the real NVS: a buffer too small is an error and nothing is copied
+    if (out_value != NULL && *length < entry->length) {
+        *length = entry->length;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    if (out_value != NULL) memcpy(out_value, entry->value, entry->length);
+
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    return set_value(handle, key, ENTRY_BLOB, value, length);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// In-memory NVS used by the host tests. Writes are counted the way they reach the flash: a
+// set_* call is one key written, its size is the size of the value (1 or 4 bytes for the
+// integers, the length of a blob).
+struct fake_nvs_stats_t {
+    size_t keys_written;
+    size_t bytes_written;
+    size_t commits;
+};
+
+// Removes every key and resets the counters
+void fake_nvs_reset(void);
+void fake_nvs_reset_stats(void);
+const struct fake_nvs_stats_t* fake_nvs_get_stats(void);
+
+// Stores a value as a previous firmware would have done, it's not counted as a write
+void fake_nvs_put_blob(const char* namespace_name, const char* key, const void* value, size_t length);
+void fake_nvs_put_i8(const char* namespace_name, const char* key, int8_t value);
+void fake_nvs_put_i32(const char* namespace_name, const char* key, int32_t value);
+
+bool fake_nvs_contains(const char* namespace_name, const char* key);
@@ -0,0 +1,101 @@
+#include "fake_partition.h"
+#include "esp_partition.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PARTITIONS 4
+
+struct fake_partition_t {
+    esp_partition_t partition;
+    uint8_t* data;
+};
+
+static struct fake_partition_t g_partitions[MAX_PARTITIONS];
+static size_t g_partition_count;
+static size_t g_mapped_count;
+
+static struct fake_partition_t* find(const esp_partition_t* partition) {
+    for (size_t i = 0; i < g_partition_count; ++i) {
+        if (&g_partitions[i].partition == partition) return &g_partitions[i];
+    }
+
+    abort();
+}
+
+void fake_partition_reset(void) {
+    for (size_t i = 0; i < g_partition_count; ++i)
+        free(g_partitions[i].data);
+
+    memset(g_partitions, 0, sizeof g_partitions);
+    g_partition_count = 0;
+    g_mapped_count = 0;
+}
+
+void fake_partition_add(const char* label, size_t size) {
+    if (g_partition_count == MAX_PARTITIONS) abort();
+
+    struct fake_partition_t* fake = &g_partitions[g_partition_count++];
+    fake->partition.type = ESP_PARTITION_TYPE_DATA;
+    fake->partition.size = size;
+    fake->partition.erase_size = FAKE_PARTITION_SECTOR_SIZE;
+    strlcpy(fake->partition.label, label, sizeof fake->partition.label);
+    fake->data = malloc(size);
+    memset(fake->data, 0xff, size);
+}
+
+uint8_t* fake_partition_data(const char* label) {
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, label);
+    return partition ? find(partition)->data : NULL;
+}
+
+size_t fake_partition_mapped_count(void) {
+    return g_mapped_count;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    for (size_t i = 0; i < g_partition_count; ++i) {
+        if (strcmp(g_partitions[i].partition.label, label) == 0) return &g_partitions[i].partition;
+    }
+
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    if (src_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    memcpy(dst, find(partition)->data + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    if (dst_offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    uint8_t* data = find(partition)->data + dst_offset;
+    for (size_t i = 0; i < size; ++i)
+        data[i] &= ((const uint8_t*)src)[i];
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    if (offset % FAKE_PARTITION_SECTOR_SIZE != 0 || size % FAKE_PARTITION_SECTOR_SIZE != 0) return ESP_ERR_INVALID_ARG;
+    if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    memset(find(partition)->data + offset, 0xff, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle) {
+    if (offset + size > partition->size) return ESP_ERR_INVALID_SIZE;
+
+    *out_ptr = find(partition)->data + offset;
+    *out_handle = ++g_mapped_count;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {
+    --g_mapped_count;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Data partitions kept in memory. They behave like NOR flash: erased bytes are 0xff, a write
+// can only clear bits and erasing works on whole 4 KB sectors.
+#define FAKE_PARTITION_SECTOR_SIZE 4096
+
+// Removes every partition (and the mappings still open)
+void fake_partition_reset(void);
+void fake_partition_add(const char* label, size_t size);
+uint8_t* fake_partition_data(const char* label);
+size_t fake_partition_mapped_count(void);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stddef.h>
+
+// Number of calls to esp_restart()
+size_t fake_system_restart_count(void);
@@ -0,0 +1,20 @@
+#include "host_compat.h"
+#include <arpa/inet.h>
+
+char* inet_ntoa_r(uint32_t address, char* buffer, int size) {
+    struct in_addr in = {.s_addr = address};
+    return (char*)inet_ntop(AF_INET, &in, buffer, size);
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char* destination, const char* source, size_t size) {
+    size_t length = strlen(source);
+    if (size > 0) {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(destination, source, copied);
+        destination[copied] = '\0';
+    }
+
+    return length;
+}
+#endif
@@ -0,0 +1,106 @@
+#include "fprov_client.h"
+#include "mbedtls/sha256.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+int64_t fprov_client_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int fprov_client_connect(int port, int timeout_ms) {
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // The server may still be starting
+    int64_t deadline = fprov_client_now_us() + (int64_t)timeout_ms * 1000;
+    do {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(sock, (struct sockaddr*)&address, sizeof address) == 0) {
+            int one = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            return sock;
+        }
+
+        close(sock);
+        usleep(10000);
+    } while (fprov_client_now_us() < deadline);
+
+    return -1;
+}
+
+bool fprov_client_send(int sock, const void* data, size_t size) {
+    const uint8_t* p = data;
+    while (size > 0) {
+        ssize_t sent = send(sock, p, size, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+
+        p += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+bool fprov_client_send_text(int sock, const char* text) {
+    return fprov_client_send(sock, text, strlen(text));
+}
+
+static bool wait_readable(int sock, int timeout_ms) {
+    struct pollfd descriptor = {.fd = sock, .events = POLLIN};
+    return poll(&descriptor, 1, timeout_ms) == 1;
+}
+
+bool fprov_client_read_line(int sock, char* line, size_t size, int timeout_ms) {
+    // One byte at a time: what follows the line is left for the next read
+    size_t length = 0;
+    while (length < size - 1) {
+        char c;
+        if (!wait_readable(sock, timeout_ms) || recv(sock, &c, 1, 0) != 1) return false;
+        if (c == '\n') break;
+
+        line[length++] = c;
+    }
+
+    line[length] = '\0';
+    return true;
+}
+
+bool fprov_client_wait_closed(int sock, int timeout_ms) {
+    char c;
+    return wait_readable(sock, timeout_ms) && recv(sock, &c, 1, 0) <= 0;
+}
+
+size_t fprov_client_make_binary_upload(uint8_t* buffer, const char* command, const void* payload, size_t size,
+                                       size_t frame_size) {
+    uint8_t digest[32];
+    mbedtls_sha256(payload, size, digest, 0);
+
+    size_t length = sprintf((char*)buffer, "%s=", command);
+    for (size_t i = 0; i < sizeof digest; ++i)
+        length += sprintf((char*)buffer + length, "%02x", digest[i]);
+    buffer[length++] = '\n';
+
+    const uint8_t* p = payload;
+    while (size > 0) {
+        size_t frame = size < frame_size ? size : frame_size;
+        buffer[length++] = frame >> 8;
+        buffer[length++] = frame & 0xff;
+        memcpy(buffer + length, p, frame);
+        length += frame;
+        p += frame;
+        size -= frame;
+    }
+
+    buffer[length++] = 0;
+    buffer[length++] = 0;
+    return length;
+}
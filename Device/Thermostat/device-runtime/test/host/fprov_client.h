@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A provisioning station, as seen by the host tests of the factory provisioning server
+#define FPROV_CLIENT_REPLY_TIMEOUT_MS 5000
+
+// Returns the socket, -1 if the server did not accept the connection within timeout_ms
+int fprov_client_connect(int port, int timeout_ms);
+bool fprov_client_send(int sock, const void* data, size_t size);
+bool fprov_client_send_text(int sock, const char* text);
+// Reads a line (without its terminator), false on timeout or when the server closed the connection
+bool fprov_client_read_line(int sock, char* line, size_t size, int timeout_ms);
+// True if the server closed the connection (without sending anything else) within timeout_ms
+bool fprov_client_wait_closed(int sock, int timeout_ms);
+
+// Writes the command line and the frames of a binary upload of payload, returns the size.
+// buffer must have room for the payload, 2 bytes for each frame and 100 more bytes.
+size_t fprov_client_make_binary_upload(uint8_t* buffer, const char* command, const void* payload, size_t size,
+                                       size_t frame_size);
+
+int64_t fprov_client_now_us(void);
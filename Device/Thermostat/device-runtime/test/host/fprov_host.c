@@ -0,0 +1,15 @@
+#include "fprov_host.h"
+#include "esp_err.h"
+#include "fake_nvs.h"
+#include "fake_partition.h"
+#include "include/provisioning.h"
+
+#define CERTS_PARTITION_SIZE 0xC000
+
+void fprov_host_initialize(void) {
+    fake_nvs_reset();
+    fake_partition_reset();
+    fake_partition_add("certs", CERTS_PARTITION_SIZE);
+
+    ESP_ERROR_CHECK(provisioning_initialize());
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Prepares the fakes (empty NVS and certs partition) and loads the settings, as the device does at
+// boot. provisioning_wait_if_needed() then starts the factory provisioning server on
+// CONFIG_TW_FPROV_TCP_PORT and returns when it terminates.
+void fprov_host_initialize(void);
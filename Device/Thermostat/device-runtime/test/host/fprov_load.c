@@ -0,0 +1,223 @@
+#include "fprov_client.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Load generator for the factory provisioning server: each connection is what a station sends to
+// provision a device (a batch with some settings, a binary certificate upload and "save"). It
+// reports connections/sec and the latency (from connect to the reply to "end") percentiles.
+// Stalled clients start an upload and never finish it, the others must not notice them.
+//
+// Usage: fprov_load [--server <path>] [--port <n>] [--connections <n>] [--concurrency <n>]
+//                   [--stalled <n>] [--max-p99-ms <n>]
+// With --server the server is started, and terminated with "exit" at the end.
+
+#define CERTIFICATE_SIZE 1800
+#define FRAME_SIZE 1000
+#define SEGMENT_SIZE 536
+#define MAX_STALLED 8
+
+struct options_t {
+    const char* server;
+    int port;
+    int connections;
+    int concurrency;
+    int stalled;
+    int max_p99_ms;
+};
+
+static struct options_t g_options = {NULL, 32080, 2000, 2, 1, 0};
+static int64_t* g_latencies;
+static atomic_int g_next_connection;
+static atomic_int g_failures;
+static atomic_int g_refused;
+
+static bool parse_options(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 == argc) return false;
+
+        const char* value = argv[++i];
+        if (strcmp(argv[i - 1], "--server") == 0)
+            g_options.server = value;
+        else if (strcmp(argv[i - 1], "--port") == 0)
+            g_options.port = atoi(value);
+        else if (strcmp(argv[i - 1], "--connections") == 0)
+            g_options.connections = atoi(value);
+        else if (strcmp(argv[i - 1], "--concurrency") == 0)
+            g_options.concurrency = atoi(value);
+        else if (strcmp(argv[i - 1], "--stalled") == 0)
+            g_options.stalled = atoi(value);
+        else if (strcmp(argv[i - 1], "--max-p99-ms") == 0)
+            g_options.max_p99_ms = atoi(value);
+        else
+            return false;
+    }
+
+    return g_options.connections > 0 && g_options.concurrency > 0 && g_options.stalled >= 0 &&
+           g_options.stalled <= MAX_STALLED;
+}
+
+static size_t make_session(uint8_t* buffer, int index) {
+    char certificate[CERTIFICATE_SIZE];
+    for (size_t i = 0; i < CERTIFICATE_SIZE; ++i)
+        certificate[i] = i % 65 == 64 ? '\n' : 'A' + (index + i) % 26;
+
+    size_t length = sprintf((char*)buffer, "begin\nvendor=Tinkwell\nserial_number=SN%06d\n", index);
+    length += fprov_client_make_binary_upload(buffer + length, "mqtt_client_cert_bin", certificate, CERTIFICATE_SIZE,
+                                              FRAME_SIZE);
+    length += sprintf((char*)buffer + length, "save\nend\n");
+    return length;
+}
+
+// Returns the reply to "end", NULL if the server refused the connection (all its sessions are busy)
+static bool run_session(int index, char* reply, size_t reply_size) {
+    uint8_t buffer[CERTIFICATE_SIZE + 256];
+    size_t size = make_session(buffer, index);
+
+    int sock = fprov_client_connect(g_options.port, 1000);
+    if (sock < 0) return false;
+
+    // Sent in segments, as a station on a real network would do
+    bool ok = true;
+    for (size_t sent = 0; sent < size && ok; sent += SEGMENT_SIZE)
+        ok = fprov_client_send(sock, buffer + sent, size - sent < SEGMENT_SIZE ? size - sent : SEGMENT_SIZE);
+
+    ok = fprov_client_read_line(sock, reply, reply_size, FPROV_CLIENT_REPLY_TIMEOUT_MS) && ok;
+    close(sock);
+    return ok;
+}
+
+static void* run_client(void* arg) {
+    int index;
+    while ((index = atomic_fetch_add(&g_next_connection, 1)) < g_options.connections) {
+        char reply[32];
+        int64_t start = fprov_client_now_us();
+        while (true) {
+            bool ok = run_session(index, reply, sizeof reply);
+            if (ok && strncmp(reply, "E6", 2) == 0) {
+                // The server did not see yet that our previous connection closed ("E6") or another
+                // client is uploading the same certificate ("E6 3")
+                atomic_fetch_add(&g_refused, 1);
+                usleep(1000);
+                continue;
+            }
+
+            if (!ok || strcmp(reply, "OK 4") != 0) {
+                fprintf(stderr, "Connection %d failed: %s\n", index, ok ? reply : "no reply");
+                atomic_fetch_add(&g_failures, 1);
+            }
+
+            break;
+        }
+
+        g_latencies[index] = fprov_client_now_us() - start;
+    }
+
+    return NULL;
+}
+
+static int open_stalled_client(void) {
+    uint8_t buffer[CERTIFICATE_SIZE + 256];
+    static const char payload[] = "-----BEGIN CERTIFICATE-----\n";
+    size_t size = fprov_client_make_binary_upload(buffer, "mqtt_server_cert_bin", payload, sizeof payload - 1, 100);
+
+    // Everything but the last frame and the terminator
+    int sock = fprov_client_connect(g_options.port, 5000);
+    if (sock >= 0) fprov_client_send(sock, buffer, size - 10);
+    return sock;
+}
+
+static int compare_latencies(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_ms(double percentile) {
+    size_t index = (size_t)(percentile / 100.0 * (g_options.connections - 1) + 0.5);
+    return g_latencies[index] / 1000.0;
+}
+
+static pid_t start_server(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(g_options.server, g_options.server, (char*)NULL);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+static bool stop_server(pid_t pid) {
+    int sock = fprov_client_connect(g_options.port, 1000);
+    if (sock >= 0) {
+        fprov_client_send_text(sock, "exit\n");
+        fprov_client_wait_closed(sock, FPROV_CLIENT_REPLY_TIMEOUT_MS);
+        close(sock);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid) return false;
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parse_options(argc, argv)) {
+        fprintf(stderr, "Usage: %s [--server <path>] [--port <n>] [--connections <n>] [--concurrency <n>] "
+                        "[--stalled <n>] [--max-p99-ms <n>]\n", argv[0]);
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    pid_t server = g_options.server ? start_server() : 0;
+    if (server < 0) return 2;
+
+    int stalled[MAX_STALLED];
+    for (int i = 0; i < g_options.stalled; ++i) {
+        stalled[i] = open_stalled_client();
+        if (stalled[i] < 0) {
+            fprintf(stderr, "Cannot connect to port %d\n", g_options.port);
+            return 2;
+        }
+    }
+
+    g_latencies = calloc(g_options.connections, sizeof g_latencies[0]);
+    pthread_t* clients = calloc(g_options.concurrency, sizeof clients[0]);
+
+    int64_t start = fprov_client_now_us();
+    for (int i = 0; i < g_options.concurrency; ++i)
+        pthread_create(&clients[i], NULL, run_client, NULL);
+    for (int i = 0; i < g_options.concurrency; ++i)
+        pthread_join(clients[i], NULL);
+    int64_t elapsed = fprov_client_now_us() - start;
+
+    for (int i = 0; i < g_options.stalled; ++i)
+        close(stalled[i]);
+
+    bool server_ok = server == 0 || stop_server(server);
+    free(clients);
+
+    qsort(g_latencies, g_options.connections, sizeof g_latencies[0], compare_latencies);
+    printf("Connections: %d (%d concurrent, %d stalled uploads), %d failed, %d refused and retried\n",
+           g_options.connections, g_options.concurrency, g_options.stalled, atomic_load(&g_failures),
+           atomic_load(&g_refused));
+    printf("Throughput: %.0f connections/sec\n", g_options.connections * 1e6 / elapsed);
+    printf("Latency (ms): p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n", percentile_ms(50), percentile_ms(90),
+           percentile_ms(99), percentile_ms(100));
+
+    if (g_options.max_p99_ms > 0 && percentile_ms(99) > g_options.max_p99_ms) {
+        fprintf(stderr, "p99 latency is over %d ms\n", g_options.max_p99_ms);
+        return 1;
+    }
+
+    free(g_latencies);
+    return atomic_load(&g_failures) == 0 && server_ok ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#include "fake_freertos.h"
+#include "fake_system.h"
+#include "fprov_host.h"
+#include "include/provisioning.h"
+#include <stdio.h>
+
+// The factory provisioning server of the device, built for the host: fprov_load drives it
+int main(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    fprov_host_initialize();
+    provisioning_wait_if_needed();
+    fake_freertos_join_tasks();
+
+    printf("Stack used by the server task on the host: %zu bytes (CONFIG_TW_FPROV_TASK_STACK_SIZE is %d)\n",
+           fake_freertos_stack_used("fprov"), CONFIG_TW_FPROV_TASK_STACK_SIZE);
+
+    return fake_system_restart_count() == 0 ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+#include "capture.h"
+#include "frame_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Replays a capture of a binary certificate upload against the frame parser, the same code the
+// device runs, and reports what the device would have done with it.
+// Usage: replay_frames <capture> [<file for the payload>] [<bytes per receive>]
+
+static esp_err_t write_payload(void* context, const uint8_t* data, size_t size) {
+    FILE* output = context;
+    if (output != NULL && fwrite(data, 1, size, output) != size) return ESP_FAIL;
+
+    return ESP_OK;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <capture> [<file for the payload>] [<bytes per receive>]\n", argv[0]);
+        return 2;
+    }
+
+    struct capture_t capture;
+    if (capture_load(argv[1], &capture) != 0) {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 2;
+    }
+
+    FILE* output = argc > 2 ? fopen(argv[2], "wb") : NULL;
+    size_t receive_size = argc > 3 ? strtoul(argv[3], NULL, 10) : 512;
+    if (receive_size == 0) receive_size = 1;
+
+    size_t position = capture_command_length(&capture);
+    if (position > 0) printf("Command: %.*s\n", (int)position - 1, capture.data);
+
+    struct frame_parser_t parser;
+    frame_parser_init(&parser, write_payload, output);
+    while (position < capture.size && !frame_parser_is_done(&parser)) {
+        size_t size = capture.size - position < receive_size ? capture.size - position : receive_size;
+        position += frame_parser_feed(&parser, capture.data + position, size);
+    }
+
+    if (output != NULL) fclose(output);
+
+    printf("Frames: %zu\n", parser.frame_count);
+    printf("Payload: %zu bytes\n", parser.payload_size);
+    printf("Terminator: %s\n", frame_parser_is_done(&parser) ? "found" : "missing (the upload would be aborted)");
+    printf("Bytes after the upload: %zu\n", capture.size - position);
+
+    capture_free(&capture);
+    return frame_parser_is_done(&parser) && parser.error == ESP_OK ? 0 : 1;
+}
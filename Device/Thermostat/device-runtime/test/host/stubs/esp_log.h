@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdio.h>
+
+// Debug and verbose messages are compiled (to check the format) but never printed
+#define ESP_LOGE(tag, format, ...) printf("E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) printf("W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) printf("I (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                                                                     \
+    do {                                                                                                               \
+        if (0) printf(format, ##__VA_ARGS__);                                                                          \
+    } while (0)
+#define ESP_LOGV(tag, format, ...) ESP_LOGD(tag, format, ##__VA_ARGS__)
@@ -0,0 +1,4 @@
+#pragma once
+
+// See fakes/fake_system.c, it does not return when called by a task
+void esp_restart(void);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// FreeRTOS as ESP-IDF configures it: 1 tick every millisecond and stack sizes in bytes.
+// Tasks are threads, see fakes/fake_freertos.c.
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+#define BIT0 0x00000001
+#define BIT1 0x00000002
+#define BIT2 0x00000004
+#define BIT3 0x00000008
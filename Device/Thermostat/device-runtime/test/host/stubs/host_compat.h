@@ -0,0 +1,13 @@
+#pragma once
+
+// Included in every source file: functions of the ESP-IDF C library which older glibc versions do not
+// have, and the lwIP extensions to the socket API.
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+char* inet_ntoa_r(uint32_t address, char* buffer, int size);
+
+#if defined(__GLIBC__) && (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char* destination, const char* source, size_t size);
+#endif
@@ -0,0 +1,137 @@
+#include "app_certificates.h"
+#include "fake_partition.h"
+#include "unity.h"
+#include <string.h>
+
+#define CERTS_PARTITION_SIZE 0xC000
+
+void setUp(void) {
+    fake_partition_reset();
+    fake_partition_add("certs", CERTS_PARTITION_SIZE);
+}
+
+void tearDown(void) {
+}
+
+static void write_certificate(enum app_certificate_t certificate, const char* text) {
+    struct app_certificate_writer_t writer;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_begin(certificate, &writer));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, text, strlen(text)));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_end(&writer));
+}
+
+static void assert_certificate(enum app_certificate_t certificate, const char* expected) {
+    struct app_certificate_view_t view;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_open(certificate, &view));
+    TEST_ASSERT_EQUAL(strlen(expected) + 1, view.length);
+    TEST_ASSERT_EQUAL_STRING(expected, view.data);
+    app_certificate_close(&view);
+}
+
+static void test_missing_certificate(void) {
+    struct app_certificate_view_t view;
+    TEST_ASSERT_FALSE(app_certificate_exists(APP_CERTIFICATE_MQTT_SERVER));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, app_certificate_open(APP_CERTIFICATE_MQTT_SERVER, &view));
+    TEST_ASSERT_NULL(view.data);
+}
+
+static void test_written_certificate_is_mapped_with_its_terminator(void) {
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "-----BEGIN CERTIFICATE-----\n");
+
+    TEST_ASSERT_TRUE(app_certificate_exists(APP_CERTIFICATE_MQTT_SERVER));
+    assert_certificate(APP_CERTIFICATE_MQTT_SERVER, "-----BEGIN CERTIFICATE-----\n");
+    TEST_ASSERT_EQUAL(0, fake_partition_mapped_count());
+}
+
+static void test_certificate_written_in_chunks(void) {
+    struct app_certificate_writer_t writer;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_begin(APP_CERTIFICATE_MQTT_CLIENT, &writer));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, "first\n", 6));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, "second\n", 7));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_end(&writer));
+
+    assert_certificate(APP_CERTIFICATE_MQTT_CLIENT, "first\nsecond\n");
+}
+
+static void test_new_certificate_replaces_the_previous_one(void) {
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "first");
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "second");
+    assert_certificate(APP_CERTIFICATE_MQTT_SERVER, "second");
+
+    // Back to the first slot
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "third");
+    assert_certificate(APP_CERTIFICATE_MQTT_SERVER, "third");
+}
+
+static void test_aborted_write_keeps_the_previous_certificate(void) {
+    write_certificate(APP_CERTIFICATE_MQTT_CLIENT_KEY, "previous");
+
+    struct app_certificate_writer_t writer;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_begin(APP_CERTIFICATE_MQTT_CLIENT_KEY, &writer));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, "trunc", 5));
+    app_certificate_write_abort(&writer);
+
+    assert_certificate(APP_CERTIFICATE_MQTT_CLIENT_KEY, "previous");
+}
+
+static void test_interrupted_write_keeps_the_previous_certificate(void) {
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "previous");
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "current");
+
+    // Power lost before write_end(), the slot being written has no header
+    struct app_certificate_writer_t writer;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_begin(APP_CERTIFICATE_MQTT_SERVER, &writer));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, "trunc", 5));
+
+    assert_certificate(APP_CERTIFICATE_MQTT_SERVER, "current");
+}
+
+static void test_aborted_first_write_leaves_no_certificate(void) {
+    struct app_certificate_writer_t writer;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_begin(APP_CERTIFICATE_MQTT_SERVER, &writer));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, "trunc", 5));
+    app_certificate_write_abort(&writer);
+
+    TEST_ASSERT_FALSE(app_certificate_exists(APP_CERTIFICATE_MQTT_SERVER));
+}
+
+static void test_too_big_certificate_is_rejected(void) {
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "previous");
+
+    static char big[16 * 1024];
+    memset(big, 'A', sizeof big);
+
+    struct app_certificate_writer_t writer;
+    size_t max_length = app_certificate_max_length(APP_CERTIFICATE_MQTT_SERVER);
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write_begin(APP_CERTIFICATE_MQTT_SERVER, &writer));
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_write(&writer, big, max_length));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, app_certificate_write(&writer, big, 1));
+    app_certificate_write_abort(&writer);
+
+    assert_certificate(APP_CERTIFICATE_MQTT_SERVER, "previous");
+}
+
+static void test_certificates_are_independent(void) {
+    write_certificate(APP_CERTIFICATE_MQTT_SERVER, "server");
+    write_certificate(APP_CERTIFICATE_MQTT_CLIENT, "client");
+    write_certificate(APP_CERTIFICATE_MQTT_CLIENT_KEY, "key");
+    write_certificate(APP_CERTIFICATE_MQTT_CLIENT, "client 2");
+
+    assert_certificate(APP_CERTIFICATE_MQTT_SERVER, "server");
+    assert_certificate(APP_CERTIFICATE_MQTT_CLIENT, "client 2");
+    assert_certificate(APP_CERTIFICATE_MQTT_CLIENT_KEY, "key");
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_missing_certificate);
+    RUN_TEST(test_written_certificate_is_mapped_with_its_terminator);
+    RUN_TEST(test_certificate_written_in_chunks);
+    RUN_TEST(test_new_certificate_replaces_the_previous_one);
+    RUN_TEST(test_aborted_write_keeps_the_previous_certificate);
+    RUN_TEST(test_interrupted_write_keeps_the_previous_certificate);
+    RUN_TEST(test_aborted_first_write_leaves_no_certificate);
+    RUN_TEST(test_too_big_certificate_is_rejected);
+    RUN_TEST(test_certificates_are_independent);
+    return UNITY_END();
+}
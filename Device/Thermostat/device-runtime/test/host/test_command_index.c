@@ -0,0 +1,64 @@
+#include "command_index.h"
+#include "provisioning_commands.h"
+#include "unity.h"
+#include <stdio.h>
+
+// The same key table factory_provisioning.c builds its index from
+#define COMMAND_KEY(key, handler, value_type, choices) [PROVISIONING_COMMAND_##key] = #key,
+
+static const char* const g_command_keys[] = {PROVISIONING_COMMANDS(COMMAND_KEY)};
+
+static struct command_index_t g_index;
+
+void setUp(void) {
+    command_index_build(&g_index, g_command_keys, PROVISIONING_COMMAND_COUNT);
+}
+
+void tearDown(void) {
+}
+
+static void test_every_command_is_found_at_its_position(void) {
+    for (int i = 0; i < PROVISIONING_COMMAND_COUNT; ++i)
+        TEST_ASSERT_EQUAL_MESSAGE(i, command_index_find(&g_index, g_command_keys[i]), g_command_keys[i]);
+}
+
+static void test_keys_are_compared_not_only_hashed(void) {
+    char key[32];
+    for (int i = 0; i < PROVISIONING_COMMAND_COUNT; ++i) {
+        snprintf(key, sizeof key, "%s_", g_command_keys[i]);
+        TEST_ASSERT_EQUAL_MESSAGE(-1, command_index_find(&g_index, key), key);
+    }
+}
+
+static void test_unknown_keys_are_not_found(void) {
+    TEST_ASSERT_EQUAL(-1, command_index_find(&g_index, ""));
+    TEST_ASSERT_EQUAL(-1, command_index_find(&g_index, "hel"));
+    TEST_ASSERT_EQUAL(-1, command_index_find(&g_index, "HELP"));
+    TEST_ASSERT_EQUAL(-1, command_index_find(&g_index, "mqtt_server_cert_bin2"));
+}
+
+static void test_full_index_resolves_every_key(void) {
+    // As many keys as the index accepts, some of them share a slot and are found by probing
+    static char keys[COMMAND_INDEX_SIZE / 2][8];
+    static const char* pointers[COMMAND_INDEX_SIZE / 2];
+    for (int i = 0; i < COMMAND_INDEX_SIZE / 2; ++i) {
+        snprintf(keys[i], sizeof keys[i], "k%d", i);
+        pointers[i] = keys[i];
+    }
+
+    struct command_index_t index;
+    command_index_build(&index, pointers, COMMAND_INDEX_SIZE / 2);
+    for (int i = 0; i < COMMAND_INDEX_SIZE / 2; ++i)
+        TEST_ASSERT_EQUAL(i, command_index_find(&index, keys[i]));
+
+    TEST_ASSERT_EQUAL(-1, command_index_find(&index, "k32"));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_command_is_found_at_its_position);
+    RUN_TEST(test_keys_are_compared_not_only_hashed);
+    RUN_TEST(test_unknown_keys_are_not_found);
+    RUN_TEST(test_full_index_resolves_every_key);
+    return UNITY_END();
+}
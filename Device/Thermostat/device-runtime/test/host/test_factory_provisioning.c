@@ -0,0 +1,292 @@
+#include "app_certificates.h"
+#include "fake_freertos.h"
+#include "fake_system.h"
+#include "fprov_client.h"
+#include "fprov_host.h"
+#include "include/provisioning.h"
+#include "unity.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The factory provisioning server runs, in its task, for the whole test run: each test connects
+// its own clients. The last test terminates it.
+#define PORT CONFIG_TW_FPROV_TCP_PORT
+#define CONNECT_TIMEOUT_MS 5000
+#define REPLY_TIMEOUT_MS FPROV_CLIENT_REPLY_TIMEOUT_MS
+#define PREVIOUS_CERTIFICATE "previous\n"
+
+static pthread_t g_server;
+static uint8_t g_upload[16 * 1024];
+
+static void* run_server(void* arg) {
+    provisioning_wait_if_needed();
+    return NULL;
+}
+
+static int open_client(void) {
+    int sock = fprov_client_connect(PORT, CONNECT_TIMEOUT_MS);
+    TEST_ASSERT_TRUE(sock >= 0);
+    return sock;
+}
+
+static void send_text(int sock, const char* text) {
+    TEST_ASSERT_TRUE(fprov_client_send_text(sock, text));
+}
+
+static void assert_reply(int sock, const char* expected) {
+    char line[64];
+    TEST_ASSERT_TRUE(fprov_client_read_line(sock, line, sizeof line, REPLY_TIMEOUT_MS));
+    TEST_ASSERT_EQUAL_STRING(expected, line);
+}
+
+static void assert_certificate(const char* expected) {
+    struct app_certificate_view_t view;
+    TEST_ASSERT_EQUAL(ESP_OK, app_certificate_open(APP_CERTIFICATE_MQTT_SERVER, &view));
+    TEST_ASSERT_EQUAL_STRING(expected, view.data);
+    app_certificate_close(&view);
+}
+
+static size_t make_upload(const char* payload, size_t frame_size) {
+    return fprov_client_make_binary_upload(g_upload, "mqtt_server_cert_bin", payload, strlen(payload), frame_size);
+}
+
+void setUp(void) {
+    // Every test starts with the same certificate, to check that a failed upload does not replace it
+    int sock = open_client();
+    send_text(sock, "mqtt_server_cert=EOF\n" PREVIOUS_CERTIFICATE "EOF\n");
+    assert_reply(sock, "OK");
+    close(sock);
+
+    assert_certificate(PREVIOUS_CERTIFICATE);
+}
+
+void tearDown(void) {
+}
+
+static void test_each_command_has_a_reply(void) {
+    int sock = open_client();
+    send_text(sock, "vendor=Tinkwell\nunknown\nmodel_id=abc\n");
+
+    assert_reply(sock, "OK");
+    assert_reply(sock, "E1");
+    assert_reply(sock, "E5");
+    close(sock);
+}
+
+static void test_commands_are_split_in_any_way(void) {
+    int sock = open_client();
+    const char* commands = "vendor=Tinkwell\nproduct=Thermostat\n";
+    for (const char* c = commands; *c; ++c) {
+        TEST_ASSERT_TRUE(fprov_client_send(sock, c, 1));
+        usleep(200);
+    }
+
+    assert_reply(sock, "OK");
+    assert_reply(sock, "OK");
+    close(sock);
+}
+
+static void test_pem_upload_is_stored(void) {
+    int sock = open_client();
+    send_text(sock, "mqtt_server_cert=-----END\n-----BEGIN CERTIFICATE-----\nAAAA\n-----END CERTIFICATE-----\n");
+
+    assert_reply(sock, "OK");
+    assert_certificate("-----BEGIN CERTIFICATE-----\nAAAA\n");
+    close(sock);
+}
+
+static void test_binary_upload_is_stored(void) {
+    static char payload[4000];
+    for (size_t i = 0; i < sizeof payload - 1; ++i)
+        payload[i] = 'A' + i % 26;
+    payload[sizeof payload - 1] = '\0';
+
+    int sock = open_client();
+    size_t size = make_upload(payload, 1000);
+    for (size_t sent = 0; sent < size; sent += 7)
+        TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload + sent, size - sent < 7 ? size - sent : 7));
+
+    assert_reply(sock, "OK");
+    assert_certificate(payload);
+    close(sock);
+}
+
+static void test_failed_binary_upload_keeps_the_connection_in_sync(void) {
+    // The payload contains what would be commands if it was parsed as text
+    int sock = open_client();
+    size_t size = make_upload("\nexit\nvendor=wrong\n", 5);
+    g_upload[sizeof("mqtt_server_cert_bin=") - 1] ^= 1;
+    TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload, size));
+    send_text(sock, "vendor=Tinkwell\n");
+
+    assert_reply(sock, "E4");
+    assert_reply(sock, "OK");
+    assert_certificate(PREVIOUS_CERTIFICATE);
+    close(sock);
+}
+
+static void test_upload_with_an_invalid_digest_is_read_anyway(void) {
+    int sock = open_client();
+    size_t size = make_upload("\nexit\n", 100);
+    memcpy(g_upload + sizeof("mqtt_server_cert_bin=") - 1, "xyz", 3);
+    TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload, size));
+    send_text(sock, "vendor=Tinkwell\n");
+
+    assert_reply(sock, "E5");
+    assert_reply(sock, "OK");
+    close(sock);
+}
+
+static void test_upload_in_a_failed_batch_is_read_anyway(void) {
+    int sock = open_client();
+    send_text(sock, "begin\nunknown\n");
+    TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload, make_upload("\nend\nexit\n", 100)));
+    send_text(sock, "vendor=Tinkwell\nend\n");
+
+    assert_reply(sock, "E1 1");
+    assert_certificate(PREVIOUS_CERTIFICATE);
+
+    send_text(sock, "vendor=Tinkwell\n");
+    assert_reply(sock, "OK");
+    close(sock);
+}
+
+static void test_upload_in_a_batch_is_stored(void) {
+    int sock = open_client();
+    send_text(sock, "begin\nvendor=Tinkwell\n");
+    TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload, make_upload("batch\n", 2)));
+    send_text(sock, "end\n");
+
+    assert_reply(sock, "OK 2");
+    assert_certificate("batch\n");
+    close(sock);
+}
+
+static void test_stalled_upload_does_not_block_other_clients(void) {
+    int uploader = open_client();
+    size_t size = make_upload("stalled\n", 100);
+    TEST_ASSERT_TRUE(fprov_client_send(uploader, g_upload, size - 5));
+
+    int64_t start = fprov_client_now_us();
+    int other = open_client();
+    send_text(other, "vendor=Tinkwell\n");
+    assert_reply(other, "OK");
+    TEST_ASSERT_LESS_THAN(500 * 1000, fprov_client_now_us() - start);
+
+    TEST_ASSERT_TRUE(fprov_client_send(uploader, g_upload + size - 5, 5));
+    assert_reply(uploader, "OK");
+    assert_certificate("stalled\n");
+
+    close(other);
+    close(uploader);
+}
+
+static void test_certificate_is_written_by_one_upload_at_a_time(void) {
+    int first = open_client();
+    size_t size = make_upload("first\n", 100);
+    TEST_ASSERT_TRUE(fprov_client_send(first, g_upload, size - 5));
+
+    int second = open_client();
+    send_text(second, "mqtt_server_cert=EOF\nsecond\nEOF\n");
+    assert_reply(second, "E6");
+
+    TEST_ASSERT_TRUE(fprov_client_send(first, g_upload + size - 5, 5));
+    assert_reply(first, "OK");
+    assert_certificate("first\n");
+
+    close(second);
+    close(first);
+}
+
+static void test_upload_which_does_not_complete_is_discarded(void) {
+    int sock = open_client();
+    size_t size = make_upload("incomplete\n", 100);
+    TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload, size - 5));
+
+    // Closed after the idle timeout (checked at least once each second)
+    assert_reply(sock, "E7");
+    TEST_ASSERT_TRUE(fprov_client_wait_closed(sock, REPLY_TIMEOUT_MS));
+    assert_certificate(PREVIOUS_CERTIFICATE);
+    close(sock);
+}
+
+static void test_upload_interrupted_by_the_client_is_discarded(void) {
+    int sock = open_client();
+    size_t size = make_upload("interrupted\n", 100);
+    TEST_ASSERT_TRUE(fprov_client_send(sock, g_upload, size - 5));
+    close(sock);
+
+    // The server has seen the first connection closing when it replies to the second one
+    sock = open_client();
+    send_text(sock, "vendor=Tinkwell\n");
+    assert_reply(sock, "OK");
+    assert_certificate(PREVIOUS_CERTIFICATE);
+    close(sock);
+}
+
+// The server may not have seen yet that the clients of the previous test closed their connections
+static int open_session(void) {
+    char line[64];
+    for (int attempt = 0; attempt < 50; ++attempt) {
+        int sock = open_client();
+        send_text(sock, "vendor=Tinkwell\n");
+        TEST_ASSERT_TRUE(fprov_client_read_line(sock, line, sizeof line, REPLY_TIMEOUT_MS));
+        if (strcmp(line, "OK") == 0) return sock;
+
+        close(sock);
+        usleep(20000);
+    }
+
+    TEST_FAIL_MESSAGE("Session not accepted");
+    return -1;
+}
+
+static void test_clients_over_the_limit_are_refused(void) {
+    int clients[CONFIG_TW_FPROV_MAX_CLIENTS];
+    for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS; ++i)
+        clients[i] = open_session();
+
+    int refused = open_client();
+    assert_reply(refused, "E6");
+    TEST_ASSERT_TRUE(fprov_client_wait_closed(refused, REPLY_TIMEOUT_MS));
+    close(refused);
+
+    for (int i = 0; i < CONFIG_TW_FPROV_MAX_CLIENTS; ++i)
+        close(clients[i]);
+}
+
+static void test_exit_terminates_the_provisioning(void) {
+    int sock = open_client();
+    send_text(sock, "exit\n");
+    TEST_ASSERT_TRUE(fprov_client_wait_closed(sock, REPLY_TIMEOUT_MS));
+    close(sock);
+
+    // provisioning_wait_if_needed() returns only now
+    TEST_ASSERT_EQUAL(0, pthread_join(g_server, NULL));
+    fake_freertos_join_tasks();
+    TEST_ASSERT_EQUAL(0, fake_system_restart_count());
+}
+
+int main(void) {
+    fprov_host_initialize();
+    pthread_create(&g_server, NULL, run_server, NULL);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_each_command_has_a_reply);
+    RUN_TEST(test_commands_are_split_in_any_way);
+    RUN_TEST(test_pem_upload_is_stored);
+    RUN_TEST(test_binary_upload_is_stored);
+    RUN_TEST(test_failed_binary_upload_keeps_the_connection_in_sync);
+    RUN_TEST(test_upload_with_an_invalid_digest_is_read_anyway);
+    RUN_TEST(test_upload_in_a_failed_batch_is_read_anyway);
+    RUN_TEST(test_upload_in_a_batch_is_stored);
+    RUN_TEST(test_stalled_upload_does_not_block_other_clients);
+    RUN_TEST(test_certificate_is_written_by_one_upload_at_a_time);
+    RUN_TEST(test_upload_which_does_not_complete_is_discarded);
+    RUN_TEST(test_upload_interrupted_by_the_client_is_discarded);
+    RUN_TEST(test_clients_over_the_limit_are_refused);
+    RUN_TEST(test_exit_terminates_the_provisioning);
+    return UNITY_END();
+}
@@ -0,0 +1,240 @@
+#include "capture.h"
+#include "frame_parser.h"
+#include "unity.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PAYLOAD (64 * 1024)
+#define FUZZ_ITERATIONS 2000
+
+// What the payload callback received
+struct sink_t {
+    uint8_t data[MAX_PAYLOAD];
+    size_t size;
+    size_t calls;
+    size_t fail_after;
+};
+
+static struct sink_t g_sink;
+static uint32_t g_random_state;
+
+static esp_err_t collect(void* context, const uint8_t* data, size_t size) {
+    struct sink_t* sink = context;
+    TEST_ASSERT_TRUE(sink->size + size <= MAX_PAYLOAD);
+
+    ++sink->calls;
+    if (sink->fail_after != 0 && sink->size + size > sink->fail_after) return ESP_ERR_INVALID_SIZE;
+
+    memcpy(sink->data + sink->size, data, size);
+    sink->size += size;
+    return ESP_OK;
+}
+
+// xorshift32, the fuzz tests must be repeatable
+static uint32_t next_random(void) {
+    g_random_state ^= g_random_state << 13;
+    g_random_state ^= g_random_state >> 17;
+    g_random_state ^= g_random_state << 5;
+    return g_random_state;
+}
+
+static size_t feed_in_chunks(struct frame_parser_t* parser, const uint8_t* data, size_t size, size_t chunk_size) {
+    size_t position = 0;
+    while (position < size && !frame_parser_is_done(parser)) {
+        size_t chunk = chunk_size == 0 ? 1 + next_random() % 1500 : chunk_size;
+        if (chunk > size - position) chunk = size - position;
+
+        size_t consumed = frame_parser_feed(parser, data + position, chunk);
+        TEST_ASSERT_TRUE(consumed <= chunk);
+        if (!frame_parser_is_done(parser)) TEST_ASSERT_EQUAL(chunk, consumed);
+
+        position += consumed;
+    }
+
+    return position;
+}
+
+// Encodes random frames, expected receives the concatenated payload
+static size_t make_upload(uint8_t* buffer, size_t capacity, uint8_t* expected, size_t* expected_size) {
+    size_t size = 0;
+    *expected_size = 0;
+    size_t frame_count = next_random() % 8;
+    for (size_t i = 0; i < frame_count; ++i) {
+        size_t length = 1 + next_random() % 3000;
+        if (size + 2 + length + 2 > capacity || *expected_size + length > MAX_PAYLOAD) break;
+
+        buffer[size++] = length >> 8;
+        buffer[size++] = length & 0xff;
+        for (size_t j = 0; j < length; ++j) {
+            uint8_t value = next_random();
+            buffer[size++] = value;
+            expected[(*expected_size)++] = value;
+        }
+    }
+
+    buffer[size++] = 0;
+    buffer[size++] = 0;
+    return size;
+}
+
+void setUp(void) {
+    memset(&g_sink, 0, sizeof g_sink);
+    g_random_state = 0x2545f491;
+}
+
+void tearDown(void) {
+}
+
+static void test_frames_are_joined(void) {
+    const uint8_t upload[] = {0, 3, 'a', 'b', 'c', 0, 2, 'd', 'e', 0, 0, 's'};
+
+    struct frame_parser_t parser;
+    frame_parser_init(&parser, collect, &g_sink);
+    size_t consumed = frame_parser_feed(&parser, upload, sizeof upload);
+
+    TEST_ASSERT_TRUE(frame_parser_is_done(&parser));
+    TEST_ASSERT_EQUAL(sizeof upload - 1, consumed);
+    TEST_ASSERT_EQUAL(2, parser.frame_count);
+    TEST_ASSERT_EQUAL(5, g_sink.size);
+    TEST_ASSERT_EQUAL_MEMORY("abcde", g_sink.data, 5);
+}
+
+static void test_empty_upload(void) {
+    const uint8_t upload[] = {0, 0};
+
+    struct frame_parser_t parser;
+    frame_parser_init(&parser, collect, &g_sink);
+
+    TEST_ASSERT_EQUAL(2, frame_parser_feed(&parser, upload, sizeof upload));
+    TEST_ASSERT_TRUE(frame_parser_is_done(&parser));
+    TEST_ASSERT_EQUAL(0, g_sink.calls);
+}
+
+static void test_nothing_is_consumed_after_the_terminator(void) {
+    const uint8_t upload[] = {0, 0};
+
+    struct frame_parser_t parser;
+    frame_parser_init(&parser, collect, &g_sink);
+    frame_parser_feed(&parser, upload, sizeof upload);
+
+    TEST_ASSERT_EQUAL(0, frame_parser_feed(&parser, (const uint8_t*)"save\n", 5));
+}
+
+static void test_frames_after_an_error_are_discarded_up_to_the_terminator(void) {
+    const uint8_t upload[] = {0, 3, 'a', 'b', 'c', 0, 3, 'd', 'e', 'f', 0, 2, '\n', '\n', 0, 0, 's', 'a', 'v', 'e'};
+
+    g_sink.fail_after = 4;
+    struct frame_parser_t parser;
+    frame_parser_init(&parser, collect, &g_sink);
+    size_t consumed = frame_parser_feed(&parser, upload, sizeof upload);
+
+    TEST_ASSERT_TRUE(frame_parser_is_done(&parser));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, parser.error);
+    TEST_ASSERT_EQUAL(sizeof upload - 4, consumed);
+    TEST_ASSERT_EQUAL(2, g_sink.calls);
+    TEST_ASSERT_EQUAL(8, parser.payload_size);
+}
+
+static void test_truncated_upload_is_not_done(void) {
+    const uint8_t upload[] = {0, 10, 'a', 'b', 'c'};
+
+    struct frame_parser_t parser;
+    frame_parser_init(&parser, collect, &g_sink);
+
+    TEST_ASSERT_EQUAL(sizeof upload, frame_parser_feed(&parser, upload, sizeof upload));
+    TEST_ASSERT_FALSE(frame_parser_is_done(&parser));
+}
+
+static void test_capture_is_replayed_in_any_split(void) {
+    struct capture_t capture;
+    struct capture_t expected;
+    TEST_ASSERT_EQUAL(0, capture_load(CAPTURES_DIR "/cert_upload.bin", &capture));
+    TEST_ASSERT_EQUAL(0, capture_load(CAPTURES_DIR "/cert_upload.pem", &expected));
+
+    size_t command_length = capture_command_length(&capture);
+    TEST_ASSERT_GREATER_THAN(0, command_length);
+
+    const size_t chunk_sizes[] = {1, 2, 3, 7, 64, 511, 536, 1460, 0};
+    for (size_t i = 0; i < sizeof chunk_sizes / sizeof chunk_sizes[0]; ++i) {
+        memset(&g_sink, 0, sizeof g_sink);
+
+        struct frame_parser_t parser;
+        frame_parser_init(&parser, collect, &g_sink);
+        size_t consumed = feed_in_chunks(&parser, capture.data + command_length, capture.size - command_length,
+                                         chunk_sizes[i]);
+
+        TEST_ASSERT_TRUE(frame_parser_is_done(&parser));
+        TEST_ASSERT_EQUAL(expected.size, g_sink.size);
+        TEST_ASSERT_EQUAL_MEMORY(expected.data, g_sink.data, expected.size);
+
+        // The next command is left for the command parser
+        TEST_ASSERT_EQUAL(5, capture.size - command_length - consumed);
+        TEST_ASSERT_EQUAL_MEMORY("save\n", capture.data + command_length + consumed, 5);
+    }
+
+    capture_free(&capture);
+    capture_free(&expected);
+}
+
+static void test_fuzz_random_uploads_in_random_splits(void) {
+    static uint8_t upload[MAX_PAYLOAD + 1024];
+    static uint8_t expected[MAX_PAYLOAD];
+
+    for (int i = 0; i < FUZZ_ITERATIONS; ++i) {
+        size_t expected_size;
+        size_t size = make_upload(upload, sizeof upload - 16, expected, &expected_size);
+
+        // Whatever follows the upload must be left untouched
+        size_t trailer = next_random() % 16;
+        for (size_t j = 0; j < trailer; ++j)
+            upload[size + j] = next_random();
+
+        memset(&g_sink, 0, sizeof g_sink);
+        g_sink.fail_after = next_random() % 4 == 0 ? next_random() % (expected_size + 1) : 0;
+
+        struct frame_parser_t parser;
+        frame_parser_init(&parser, collect, &g_sink);
+        size_t consumed = feed_in_chunks(&parser, upload, size + trailer, 0);
+
+        TEST_ASSERT_TRUE(frame_parser_is_done(&parser));
+        TEST_ASSERT_EQUAL(size, consumed);
+        TEST_ASSERT_EQUAL(expected_size, parser.payload_size);
+        if (g_sink.fail_after == 0 || g_sink.fail_after >= expected_size) {
+            TEST_ASSERT_EQUAL(ESP_OK, parser.error);
+            TEST_ASSERT_EQUAL(expected_size, g_sink.size);
+        }
+
+        TEST_ASSERT_EQUAL_MEMORY(expected, g_sink.data, g_sink.size);
+    }
+}
+
+static void test_fuzz_random_bytes(void) {
+    // Garbage must never make the parser read or write outside the data it has been given
+    static uint8_t data[4096];
+    for (int i = 0; i < FUZZ_ITERATIONS; ++i) {
+        size_t size = next_random() % sizeof data;
+        for (size_t j = 0; j < size; ++j)
+            data[j] = next_random();
+
+        memset(&g_sink, 0, sizeof g_sink);
+        struct frame_parser_t parser;
+        frame_parser_init(&parser, collect, &g_sink);
+        size_t consumed = feed_in_chunks(&parser, data, size, 0);
+
+        TEST_ASSERT_TRUE(consumed <= size);
+        TEST_ASSERT_EQUAL(parser.payload_size, g_sink.size);
+    }
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_frames_are_joined);
+    RUN_TEST(test_empty_upload);
+    RUN_TEST(test_nothing_is_consumed_after_the_terminator);
+    RUN_TEST(test_frames_after_an_error_are_discarded_up_to_the_terminator);
+    RUN_TEST(test_truncated_upload_is_not_done);
+    RUN_TEST(test_capture_is_replayed_in_any_split);
+    RUN_TEST(test_fuzz_random_uploads_in_random_splits);
+    RUN_TEST(test_fuzz_random_bytes);
+    return UNITY_END();
+}
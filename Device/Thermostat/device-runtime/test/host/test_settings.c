@@ -0,0 +1,264 @@
+#include "fake_nvs.h"
+#include "settings.h"
+#include "unity.h"
+#include <string.h>
+
+#define SCHEMA_VERSION 2
+
+struct test_settings_t {
+    struct settings_t schema;
+    int32_t mode;
+    char name[32];
+    char password[64];
+    uint8_t key[16];
+};
+
+static struct test_settings_t g_settings;
+static struct test_settings_t g_snapshot;
+static int g_migrated_from;
+
+static void set_defaults(struct settings_t* settings) {
+    struct test_settings_t* test = (struct test_settings_t*)settings;
+    memset(test, 0, sizeof *test);
+    test->schema.version = SCHEMA_VERSION;
+    test->mode = 1;
+    strcpy(test->name, "thermostat");
+}
+
+static esp_err_t migrate(struct settings_t* settings, int8_t from_version) {
+    g_migrated_from = from_version;
+    ((struct test_settings_t*)settings)->mode *= 10;
+    return ESP_OK;
+}
+
+static const struct settings_field_t g_fields[] = {
+    SETTINGS_FIELD(SETTINGS_FIELD_INT32, struct test_settings_t, mode, "mode"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct test_settings_t, name, "name"),
+    SETTINGS_FIELD(SETTINGS_FIELD_STRING, struct test_settings_t, password, "password"),
+    SETTINGS_FIELD(SETTINGS_FIELD_BLOB, struct test_settings_t, key, "key"),
+};
+
+static struct settings_record_t g_record;
+
+void setUp(void) {
+    fake_nvs_reset();
+    g_migrated_from = -1;
+
+    struct settings_record_t record = {
+        .key = "test",
+        .fields = g_fields,
+        .field_count = sizeof(g_fields) / sizeof(g_fields[0]),
+        .settings = (struct settings_t*)&g_settings,
+        .snapshot = (struct settings_t*)&g_snapshot,
+        .settings_size = sizeof g_settings,
+        .schema_version = SCHEMA_VERSION,
+        .set_defaults = set_defaults,
+        .migrate = migrate,
+    };
+    g_record = record;
+}
+
+void tearDown(void) {
+}
+
+static void load_and_save(void) {
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_save(&g_record));
+    fake_nvs_reset_stats();
+}
+
+static void save(void) {
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_save(&g_record));
+}
+
+static void test_new_record_writes_every_field_and_the_version(void) {
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_TRUE(settings_record_is_dirty(&g_record));
+    save();
+
+    const struct fake_nvs_stats_t* stats = fake_nvs_get_stats();
+    TEST_ASSERT_EQUAL(5, stats->keys_written);
+    TEST_ASSERT_EQUAL(4 + sizeof("thermostat") + 1 + 16 + 1, stats->bytes_written);
+    TEST_ASSERT_EQUAL(1, stats->commits);
+}
+
+static void test_save_without_changes_writes_nothing(void) {
+    load_and_save();
+
+    TEST_ASSERT_FALSE(settings_record_is_dirty(&g_record));
+    save();
+
+    TEST_ASSERT_EQUAL(0, fake_nvs_get_stats()->bytes_written);
+    TEST_ASSERT_EQUAL(0, fake_nvs_get_stats()->commits);
+}
+
+static void test_changed_string_writes_only_its_used_bytes(void) {
+    load_and_save();
+
+    strcpy(g_settings.password, "secret");
+    save();
+
+    TEST_ASSERT_EQUAL(1, fake_nvs_get_stats()->keys_written);
+    TEST_ASSERT_EQUAL(sizeof("secret"), fake_nvs_get_stats()->bytes_written);
+}
+
+static void test_changed_integer_and_blob_are_written(void) {
+    load_and_save();
+
+    g_settings.mode = 2;
+    g_settings.key[15] = 0xff;
+    save();
+
+    TEST_ASSERT_EQUAL(2, fake_nvs_get_stats()->keys_written);
+    TEST_ASSERT_EQUAL(4 + 16, fake_nvs_get_stats()->bytes_written);
+}
+
+static void test_same_value_is_not_a_change(void) {
+    load_and_save();
+
+    g_settings.mode = 1;
+    strcpy(g_settings.name, "thermostat");
+    save();
+
+    TEST_ASSERT_EQUAL(0, fake_nvs_get_stats()->keys_written);
+}
+
+static void test_bytes_after_the_terminator_are_not_a_change(void) {
+    load_and_save();
+
+    g_settings.name[4] = '\0';
+    save();
+    TEST_ASSERT_EQUAL(sizeof("ther"), fake_nvs_get_stats()->bytes_written);
+
+    fake_nvs_reset_stats();
+    g_settings.name[6] = 'X';
+    save();
+    TEST_ASSERT_EQUAL(0, fake_nvs_get_stats()->keys_written);
+}
+
+static void test_values_with_the_same_hash_are_a_change(void) {
+    // "costarring" and "liquid" have the same FNV-1a hash, only comparing the bytes sees the change
+    load_and_save();
+    strcpy(g_settings.name, "costarring");
+    save();
+    fake_nvs_reset_stats();
+
+    strcpy(g_settings.name, "liquid");
+    TEST_ASSERT_TRUE(settings_record_is_dirty(&g_record));
+    save();
+
+    TEST_ASSERT_EQUAL(1, fake_nvs_get_stats()->keys_written);
+    TEST_ASSERT_EQUAL(sizeof("liquid"), fake_nvs_get_stats()->bytes_written);
+}
+
+static void test_marked_field_is_written_even_if_unchanged(void) {
+    load_and_save();
+
+    settings_record_mark_dirty(&g_record, "key");
+    save();
+
+    TEST_ASSERT_EQUAL(1, fake_nvs_get_stats()->keys_written);
+    TEST_ASSERT_EQUAL(16, fake_nvs_get_stats()->bytes_written);
+}
+
+static void test_saved_values_are_loaded(void) {
+    load_and_save();
+
+    g_settings.mode = 7;
+    strcpy(g_settings.name, "kitchen");
+    save();
+
+    memset(&g_settings, 0, sizeof g_settings);
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+
+    TEST_ASSERT_EQUAL(7, g_settings.mode);
+    TEST_ASSERT_EQUAL_STRING("kitchen", g_settings.name);
+    TEST_ASSERT_FALSE(settings_record_is_dirty(&g_record));
+}
+
+static void test_missing_field_keeps_its_default_and_is_written(void) {
+    fake_nvs_put_i8("test", "_version", SCHEMA_VERSION);
+    fake_nvs_put_i32("test", "mode", 3);
+    fake_nvs_put_blob("test", "name", "hall", sizeof("hall"));
+    fake_nvs_put_blob("test", "password", "", 1);
+
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_EQUAL(3, g_settings.mode);
+    TEST_ASSERT_EQUAL_STRING("hall", g_settings.name);
+
+    save();
+    TEST_ASSERT_EQUAL(1, fake_nvs_get_stats()->keys_written);
+    TEST_ASSERT_TRUE(fake_nvs_contains("test", "key"));
+}
+
+static void test_older_schema_is_migrated(void) {
+    fake_nvs_put_i8("test", "_version", 1);
+    fake_nvs_put_i32("test", "mode", 3);
+
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_EQUAL(1, g_migrated_from);
+    TEST_ASSERT_EQUAL(30, g_settings.mode);
+
+    // The converted field, the missing ones and the new version
+    save();
+    TEST_ASSERT_EQUAL(5, fake_nvs_get_stats()->keys_written);
+
+    g_migrated_from = -1;
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_EQUAL(-1, g_migrated_from);
+    TEST_ASSERT_EQUAL(30, g_settings.mode);
+}
+
+static void test_legacy_blob_is_stored_field_by_field(void) {
+    struct test_settings_t legacy;
+    set_defaults((struct settings_t*)&legacy);
+    legacy.mode = 4;
+    strcpy(legacy.name, "office");
+    fake_nvs_put_blob("default", "test", &legacy, sizeof legacy);
+
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_EQUAL(4, g_settings.mode);
+    TEST_ASSERT_EQUAL_STRING("office", g_settings.name);
+
+    save();
+    TEST_ASSERT_EQUAL(5, fake_nvs_get_stats()->keys_written);
+}
+
+static void test_unreadable_record_gets_its_defaults_and_is_written(void) {
+    // The stored name does not fit in the field
+    char name[sizeof g_settings.name + 1];
+    memset(name, 'x', sizeof name);
+    fake_nvs_put_i8("test", "_version", SCHEMA_VERSION);
+    fake_nvs_put_i32("test", "mode", 3);
+    fake_nvs_put_blob("test", "name", name, sizeof name);
+
+    struct settings_record_t* records[] = {&g_record};
+    struct settings_session_t session;
+    TEST_ASSERT_EQUAL(ESP_OK, settings_session_open(&session, records, 1));
+    TEST_ASSERT_EQUAL(ESP_OK, settings_session_load(&session));
+    TEST_ASSERT_EQUAL(1, g_settings.mode);
+    TEST_ASSERT_EQUAL_STRING("thermostat", g_settings.name);
+
+    TEST_ASSERT_EQUAL(ESP_OK, settings_session_close(&session, true));
+    TEST_ASSERT_EQUAL(ESP_OK, settings_record_load(&g_record));
+    TEST_ASSERT_EQUAL_STRING("thermostat", g_settings.name);
+    TEST_ASSERT_FALSE(settings_record_is_dirty(&g_record));
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_new_record_writes_every_field_and_the_version);
+    RUN_TEST(test_save_without_changes_writes_nothing);
+    RUN_TEST(test_changed_string_writes_only_its_used_bytes);
+    RUN_TEST(test_changed_integer_and_blob_are_written);
+    RUN_TEST(test_same_value_is_not_a_change);
+    RUN_TEST(test_bytes_after_the_terminator_are_not_a_change);
+    RUN_TEST(test_values_with_the_same_hash_are_a_change);
+    RUN_TEST(test_marked_field_is_written_even_if_unchanged);
+    RUN_TEST(test_saved_values_are_loaded);
+    RUN_TEST(test_missing_field_keeps_its_default_and_is_written);
+    RUN_TEST(test_older_schema_is_migrated);
+    RUN_TEST(test_legacy_blob_is_stored_field_by_field);
+    RUN_TEST(test_unreadable_record_gets_its_defaults_and_is_written);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+#include "esp_app_desc.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "ota_update.h"
+#include "protocol_examples_common.h"
+#include <stdio.h>
+#include <string.h>
+
+// The same application is built twice (see scripts/run-qemu-tests.ps1). Version 1 runs from ota_0:
+// it applies the patch once with a wrong digest (the new image must not be activated) and then with
+// the right one, the device restarts with version 2 from ota_1 which confirms the new image.
+// The script waits for a line starting with "OTA_DELTA_TEST: PASS" or "OTA_DELTA_TEST: FAIL".
+
+static const char* LOG_TAG = "ota_test";
+
+static void report(const char* result, const char* reason) {
+    printf("OTA_DELTA_TEST: %s (%s)\n", result, reason);
+    fflush(stdout);
+}
+
+static bool parse_digest(const char* text, uint8_t digest[OTA_UPDATE_DIGEST_SIZE]) {
+    if (strlen(text) != OTA_UPDATE_DIGEST_SIZE * 2) return false;
+
+    for (int i = 0; i < OTA_UPDATE_DIGEST_SIZE; ++i) {
+        unsigned int byte;
+        if (sscanf(text + i * 2, "%2x", &byte) != 1) return false;
+        digest[i] = byte;
+    }
+
+    return true;
+}
+
+// Returns only if the update failed: when it succeeds the device restarts
+static esp_err_t run_update(const uint8_t digest[OTA_UPDATE_DIGEST_SIZE]) {
+    esp_err_t err = ota_update_start(CONFIG_TW_OTA_TEST_URL, digest);
+    if (err != ESP_OK) return err;
+
+    while (ota_update_in_progress())
+        vTaskDelay(pdMS_TO_TICKS(100));
+
+    return ESP_FAIL;
+}
+
+static void test_new_image(const esp_partition_t* running) {
+    if (strcmp(running->label, "ota_1") != 0) {
+        report("FAIL", "version 2 is not running from ota_1");
+        return;
+    }
+
+    if (ota_update_confirm() != ESP_OK) {
+        report("FAIL", "the new image cannot be confirmed");
+        return;
+    }
+
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK || state != ESP_OTA_IMG_VALID) {
+        report("FAIL", "the new image is not valid after the confirmation");
+        return;
+    }
+
+    report("PASS", "updated from version 1 to version 2 and confirmed");
+}
+
+static void test_base_image(const esp_partition_t* running) {
+    uint8_t digest[OTA_UPDATE_DIGEST_SIZE];
+    if (!parse_digest(CONFIG_TW_OTA_TEST_SHA256, digest)) {
+        report("FAIL", "CONFIG_TW_OTA_TEST_SHA256 is not a SHA-256 digest");
+        return;
+    }
+
+    ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(example_connect());
+
+    // The whole patch is applied, the new image must be discarded because of its digest
+    ESP_LOGI(LOG_TAG, "Applying the patch with a wrong digest...");
+    digest[0] ^= 0xff;
+    run_update(digest);
+    if (esp_ota_get_boot_partition() != running) {
+        report("FAIL", "an image with the wrong digest has been selected for boot");
+        return;
+    }
+
+    ESP_LOGI(LOG_TAG, "Applying the patch...");
+    digest[0] ^= 0xff;
+    esp_err_t err = run_update(digest);
+    report("FAIL", esp_err_to_name(err));
+}
+
+void app_main(void) {
+    const esp_app_desc_t* app = esp_app_get_description();
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    printf("OTA_DELTA_TEST: version %s running from %s\n", app->version, running->label);
+
+    if (strcmp(app->version, "2") == 0)
+        test_new_image(running);
+    else
+        test_base_image(running);
+}
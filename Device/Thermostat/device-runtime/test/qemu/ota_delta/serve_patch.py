@@ -0,0 +1,59 @@
+# Serves the patch to the QEMU delta update test, with range requests (to resume a download).
+# The first response is cut after --drop-after bytes: the device must resume from where it stopped.
+# Usage: python serve_patch.py <patch> [--port 8070] [--drop-after 4096]
+import argparse
+import http.server
+import re
+import socket
+
+
+class PatchHandler(http.server.BaseHTTPRequestHandler):
+    def do_GET(self):
+        patch = self.server.patch
+        match = re.fullmatch(r"bytes=(\d+)-", self.headers.get("Range", ""))
+        start = int(match.group(1)) if match else 0
+        if start >= len(patch):
+            self.send_error(416)
+            return
+
+        self.send_response(206 if match else 200)
+        if match:
+            self.send_header("Content-Range", f"bytes {start}-{len(patch) - 1}/{len(patch)}")
+        self.send_header("Content-Length", str(len(patch) - start))
+        self.end_headers()
+
+        body = patch[start:]
+        if self.server.drop_after > 0 and not self.server.dropped and len(body) > self.server.drop_after:
+            self.server.dropped = True
+            self.wfile.write(body[: self.server.drop_after])
+            self.wfile.flush()
+            self.connection.shutdown(socket.SHUT_RDWR)
+            self.close_connection = True
+            print(f"Connection dropped after {self.server.drop_after} bytes", flush=True)
+            return
+
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        print(f"{self.address_string()} Range: {self.headers.get('Range', '-')} {format % args}", flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("patch")
+    parser.add_argument("--port", type=int, default=8070)
+    parser.add_argument("--drop-after", type=int, default=4096)
+    args = parser.parse_args()
+
+    server = http.server.ThreadingHTTPServer(("", args.port), PatchHandler)
+    with open(args.patch, "rb") as file:
+        server.patch = file.read()
+    server.drop_after = args.drop_after
+    server.dropped = False
+
+    print(f"Serving {args.patch} ({len(server.patch)} bytes) on port {args.port}", flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
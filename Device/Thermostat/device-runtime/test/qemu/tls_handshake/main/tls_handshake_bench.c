@@ -0,0 +1,158 @@
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mqtt_tls_transport.h"
+#include "nvs_flash.h"
+#include "protocol_examples_common.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Handshake time and peak heap of the MQTT TLS transport (mqtt_tls_transport.c), full and resumed,
+// against a server with an ECDSA certificate (the broker) and one with an RSA certificate (the OTA
+// servers). The same application is built with each profile (see scripts/run-qemu-tls-benchmark.ps1).
+// QEMU does not emulate the timing of the chip: compare the profiles, not the absolute figures.
+// Results are lines starting with "TLS_BENCH:", the last one is "TLS_BENCH: DONE" or "TLS_BENCH: FAIL".
+
+static const char* LOG_TAG = "tls_bench";
+
+extern const char g_ca_start[] asm("_binary_ca_pem_start");
+extern const char g_ca_end[] asm("_binary_ca_pem_end");
+
+struct result_t {
+    int64_t total_us;
+    int64_t min_us;
+    int64_t max_us;
+    size_t peak_bytes;
+    int count;
+};
+
+// mbedTLS allocates through these (CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC), we keep the size before each
+// block to know how much is in use. The header keeps the alignment of heap_caps_calloc().
+#define ALLOCATION_HEADER_SIZE 8
+
+static portMUX_TYPE g_allocation_lock = portMUX_INITIALIZER_UNLOCKED;
+static size_t g_allocated_bytes;
+static size_t g_peak_bytes;
+
+void* esp_mbedtls_mem_calloc(size_t count, size_t size) {
+    if (size != 0 && count > (SIZE_MAX - ALLOCATION_HEADER_SIZE) / size) return NULL;
+
+    size_t bytes = count * size;
+    uint8_t* block = heap_caps_calloc(1, ALLOCATION_HEADER_SIZE + bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (block == NULL) return NULL;
+
+    memcpy(block, &bytes, sizeof bytes);
+    portENTER_CRITICAL(&g_allocation_lock);
+    g_allocated_bytes += bytes;
+    if (g_allocated_bytes > g_peak_bytes) g_peak_bytes = g_allocated_bytes;
+    portEXIT_CRITICAL(&g_allocation_lock);
+
+    return block + ALLOCATION_HEADER_SIZE;
+}
+
+void esp_mbedtls_mem_free(void* pointer) {
+    if (pointer == NULL) return;
+
+    uint8_t* block = (uint8_t*)pointer - ALLOCATION_HEADER_SIZE;
+    size_t bytes;
+    memcpy(&bytes, block, sizeof bytes);
+    portENTER_CRITICAL(&g_allocation_lock);
+    g_allocated_bytes -= bytes;
+    portEXIT_CRITICAL(&g_allocation_lock);
+
+    heap_caps_free(block);
+}
+
+static void reset_peak(void) {
+    portENTER_CRITICAL(&g_allocation_lock);
+    g_peak_bytes = g_allocated_bytes;
+    portEXIT_CRITICAL(&g_allocation_lock);
+}
+
+static void add_sample(struct result_t* result, int64_t elapsed_us, size_t peak_bytes) {
+    if (result->count == 0 || elapsed_us < result->min_us) result->min_us = elapsed_us;
+    if (elapsed_us > result->max_us) result->max_us = elapsed_us;
+    if (peak_bytes > result->peak_bytes) result->peak_bytes = peak_bytes;
+    result->total_us += elapsed_us;
+    ++result->count;
+}
+
+// The server answers one byte and closes: the ticket (sent at the end of the handshake with TLS 1.2,
+// after it with TLS 1.3) has been received when we read the answer
+static bool run_handshake(esp_transport_handle_t transport, int port, struct result_t* result) {
+    size_t base_bytes = g_allocated_bytes;
+    reset_peak();
+
+    int64_t start = esp_timer_get_time();
+    if (esp_transport_connect(transport, CONFIG_TW_TLS_BENCH_HOST, port, 10000) != 0) return false;
+    int64_t elapsed_us = esp_timer_get_time() - start;
+    size_t peak_bytes = g_peak_bytes - base_bytes;
+
+    char answer;
+    bool ok = esp_transport_write(transport, "?", 1, 5000) == 1 && esp_transport_read(transport, &answer, 1, 5000) == 1;
+    esp_transport_close(transport);
+
+    if (ok) add_sample(result, elapsed_us, peak_bytes);
+    return ok;
+}
+
+static void report(const char* certificate, const char* kind, const struct result_t* result) {
+    printf("TLS_BENCH: %s %s handshakes=%d avg_ms=%.1f min_ms=%.1f max_ms=%.1f peak_bytes=%u\n", certificate, kind,
+           result->count, result->total_us / 1000.0 / result->count, result->min_us / 1000.0,
+           result->max_us / 1000.0, (unsigned)result->peak_bytes);
+    fflush(stdout);
+}
+
+static bool run_benchmark(const char* certificate, int port) {
+    esp_tls_cfg_t config = {
+        .cacert_buf = (const unsigned char*)g_ca_start,
+        .cacert_bytes = g_ca_end - g_ca_start,
+        .common_name = "localhost",
+    };
+
+    // A new transport has no session: every handshake is a full one
+    struct result_t full = {0};
+    for (int i = 0; i < CONFIG_TW_TLS_BENCH_ITERATIONS; ++i) {
+        esp_transport_handle_t transport = mqtt_tls_transport_create(&config, port);
+        bool ok = transport != NULL && run_handshake(transport, port, &full);
+        if (transport != NULL) esp_transport_destroy(transport);
+        if (!ok) return false;
+    }
+
+    // The same transport offers the session of the previous connection, as when the client reconnects
+    struct result_t resumed = {0};
+    esp_transport_handle_t transport = mqtt_tls_transport_create(&config, port);
+    if (transport == NULL) return false;
+
+    bool ok = run_handshake(transport, port, &(struct result_t){0});
+    for (int i = 0; ok && i < CONFIG_TW_TLS_BENCH_ITERATIONS; ++i)
+        ok = run_handshake(transport, port, &resumed);
+    esp_transport_destroy(transport);
+
+    if (!ok) return false;
+
+    report(certificate, "full", &full);
+    report(certificate, "resumed", &resumed);
+    return true;
+}
+
+void app_main(void) {
+    ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(esp_netif_init());
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+    ESP_ERROR_CHECK(example_connect());
+
+    if (!run_benchmark("ecdsa", CONFIG_TW_TLS_BENCH_ECDSA_PORT) || !run_benchmark("rsa", CONFIG_TW_TLS_BENCH_RSA_PORT)) {
+        ESP_LOGE(LOG_TAG, "Handshake failed");
+        printf("TLS_BENCH: FAIL\n");
+        return;
+    }
+
+    printf("TLS_BENCH: minimum_free_heap=%u\n", (unsigned)esp_get_minimum_free_heap_size());
+    printf("TLS_BENCH: DONE\n");
+}
@@ -0,0 +1,50 @@
+# TLS server of the QEMU handshake benchmark: one port with the ECDSA certificate, one with the RSA one.
+# Each connection reads one byte, answers one byte and closes. It prints one line per connection,
+# "<port> full" or "<port> resumed", for the script to check that the sessions have been resumed.
+# Usage: python tls_server.py <certs dir> [--ecdsa-port 8443] [--rsa-port 8444]
+import argparse
+import os
+import socket
+import ssl
+import sys
+import threading
+
+
+def serve(context, port):
+    listener = socket.create_server(("0.0.0.0", port))
+    while True:
+        sock, _ = listener.accept()
+        try:
+            with context.wrap_socket(sock, server_side=True) as conn:
+                conn.recv(1)
+                conn.sendall(b"!")
+                print(f"{port} {'resumed' if conn.session_reused else 'full'}", flush=True)
+        except (OSError, ssl.SSLError) as e:
+            print(f"{port} error {e}", file=sys.stderr, flush=True)
+
+
+def create_context(certs, name):
+    # Both profiles negotiate TLS 1.2, the tickets are issued with the same key for the whole run
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(os.path.join(certs, f"{name}.pem"), os.path.join(certs, f"{name}.key"))
+    return context
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("certs")
+    parser.add_argument("--ecdsa-port", type=int, default=8443)
+    parser.add_argument("--rsa-port", type=int, default=8444)
+    args = parser.parse_args()
+
+    servers = [(create_context(args.certs, "ecdsa"), args.ecdsa_port), (create_context(args.certs, "rsa"), args.rsa_port)]
+    threads = [threading.Thread(target=serve, args=server, daemon=True) for server in servers]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,219 @@
+﻿using System.Diagnostics;
+using System.Globalization;
+using System.Text.RegularExpressions;
+
+namespace Tinkwell.Firmwareless.Tools.HostingBenchmark;
+
+sealed record HostingBenchmarkResult(int HostCount, double StartupMs, double HostsRssMb, double CoordinatorRssMb);
+
+sealed record RecoveryBenchmarkResult(bool StandbyHandover, double CrashToReadyMs, double ReportedMs);
+
+// Memory and startup time of the same firmlets with a given CoordinatorHostingMode. It runs the coordinator (with
+// a firmlets file which lists the same firmlet N times) and waits until all the firmlets are ready: startup is
+// the time from the launch of the coordinator, RSS is the sum of its host processes measured after they settled.
+// There are no standby hosts (CoordinatorStandbyHosts=0): each host runs the firmlets assigned to it.
+// RunRecoveryAsync() kills a host (SIGKILL, like a crash) and measures the time until the coordinator restarted it
+// and it's ready again, it fails if the host is not restarted (or not handed to the standby host, when there is one).
+sealed partial class HostingBenchmark(string hostPath, string firmletPath, string brokerAddress, int brokerPort)
+{
+    public async Task<HostingBenchmarkResult> RunAsync(string mode, int firmletCount, TimeSpan timeout)
+    {
+        var root = Directory.CreateTempSubdirectory("tw-hosting-benchmark-");
+        try
+        {
+            File.WriteAllLines(Path.Combine(root.FullName, "firmlets"),
+                Enumerable.Range(1, firmletCount).Select(x => $"{x:x32}=\"{_firmletPath}\""));
+
+            using var coordinator = StartCoordinator(root.FullName, mode, standbyHosts: 0);
+            try
+            {
+                var stopwatch = Stopwatch.StartNew();
+                await WaitForFirmletsAsync(coordinator, firmletCount, timeout);
+                double startupMs = stopwatch.Elapsed.TotalMilliseconds;
+                DiscardOutput(coordinator);
+
+                // Startup allocations (JIT, WAMR, module loading) are done, the RSS is what the hosts keep
+                await Task.Delay(SettleTime);
+                var hosts = FindChildProcesses(coordinator.Id);
+
+                return new(hosts.Length, startupMs, hosts.Sum(ReadRssKb) / 1024.0, ReadRssKb(coordinator.Id) / 1024.0);
+            }
+            finally
+            {
+                coordinator.Kill(entireProcessTree: true);
+                await coordinator.WaitForExitAsync();
+            }
+        }
+        finally
+        {
+            root.Delete(recursive: true);
+        }
+    }
+
+    public async Task<RecoveryBenchmarkResult> RunRecoveryAsync(string mode, int firmletCount, int standbyHosts, TimeSpan timeout)
+    {
+        var root = Directory.CreateTempSubdirectory("tw-hosting-benchmark-");
+        try
+        {
+            File.WriteAllLines(Path.Combine(root.FullName, "firmlets"),
+                Enumerable.Range(1, firmletCount).Select(x => $"{x:x32}=\"{_firmletPath}\""));
+
+            using var coordinator = StartCoordinator(root.FullName, mode, standbyHosts);
+            try
+            {
+                using var cts = new CancellationTokenSource(timeout);
+                var hosts = new Dictionary<string, int>();
+                int readyCount = 0, readyStandbyCount = 0;
+
+                // The PID of each host and the readiness of the standby hosts are logged at debug level (see StartCoordinator())
+                while (readyCount < firmletCount || readyStandbyCount < standbyHosts)
+                {
+                    var line = await ReadLineAsync(coordinator, cts.Token);
+                    if (HostStartedRegex().Match(line) is { Success: true } started)
+                        hosts[started.Groups[1].Value] = int.Parse(started.Groups[2].Value);
+                    else if (HostReadyRegex().Match(line) is { Success: true } ready)
+                        readyCount += int.Parse(ready.Groups[1].Value);
+                    else if (StandbyReadyRegex().IsMatch(line))
+                        ++readyStandbyCount;
+                }
+
+                var (hostId, pid) = hosts.First();
+                var stopwatch = Stopwatch.StartNew();
+                Process.GetProcessById(pid).Kill();
+
+                bool handover = false;
+                while (true)
+                {
+                    var line = await ReadLineAsync(coordinator, cts.Token);
+                    if (line.Contains($"Assigning {hostId} to the standby host"))
+                        handover = true;
+
+                    if (HostRecoveredRegex().Match(line) is { Success: true } recovered && recovered.Groups[1].Value == hostId)
+                    {
+                        double crashToReadyMs = stopwatch.Elapsed.TotalMilliseconds;
+                        DiscardOutput(coordinator);
+
+                        if (standbyHosts > 0 && !handover)
+                            throw new InvalidOperationException($"Host {hostId} has been restarted without using the standby host.");
+
+                        return new(handover, crashToReadyMs, double.Parse(recovered.Groups[2].Value, CultureInfo.InvariantCulture));
+                    }
+                }
+            }
+            catch (OperationCanceledException)
+            {
+                throw new InvalidOperationException($"The host has not been restarted (or the firmlets were not ready) within {timeout.TotalSeconds} seconds.");
+            }
+            finally
+            {
+                coordinator.Kill(entireProcessTree: true);
+                await coordinator.WaitForExitAsync();
+            }
+        }
+        finally
+        {
+            root.Delete(recursive: true);
+        }
+    }
+
+    private static readonly TimeSpan SettleTime = TimeSpan.FromSeconds(2);
+
+    private readonly string _hostPath = hostPath;
+    private readonly string _firmletPath = firmletPath;
+    private readonly string _brokerAddress = brokerAddress;
+    private readonly int _brokerPort = brokerPort;
+
+    [GeneratedRegex(@"is ready \(.+ ms, (\d+) firmlet\(s\)\)")]
+    private static partial Regex HostReadyRegex();
+
+    [GeneratedRegex(@"Started (\S+) for .*, PID (\d+)")]
+    private static partial Regex HostStartedRegex();
+
+    [GeneratedRegex(@"Standby host \S+ is ready")]
+    private static partial Regex StandbyReadyRegex();
+
+    [GeneratedRegex(@"Host (\S+) recovered ([\d.]+) ms after exiting")]
+    private static partial Regex HostRecoveredRegex();
+
+    private Process StartCoordinator(string root, string mode, int standbyHosts)
+    {
+        bool isDll = Path.GetExtension(_hostPath).Equals(".dll", StringComparison.OrdinalIgnoreCase);
+        var startInfo = new ProcessStartInfo(isDll ? "dotnet" : _hostPath)
+        {
+            UseShellExecute = false,
+            RedirectStandardOutput = true,
+            WorkingDirectory = Path.GetDirectoryName(Path.GetFullPath(_hostPath)),
+        };
+
+        if (isDll)
+            startInfo.ArgumentList.Add(_hostPath);
+
+        startInfo.ArgumentList.Add("coordinator");
+        startInfo.ArgumentList.Add($"--path={root}");
+        startInfo.ArgumentList.Add($"--mqtt-broker-address={_brokerAddress}");
+        startInfo.ArgumentList.Add($"--mqtt-broker-port={_brokerPort}");
+        startInfo.Environment["Settings__CoordinatorHostingMode"] = mode;
+        startInfo.Environment["Settings__CoordinatorStandbyHosts"] = standbyHosts.ToString();
+        startInfo.Environment["Logging__LogLevel__Tinkwell.Firmwareless.WamrAotHost.Coordinator.HostProcessesCoordinator"] = "Debug";
+        startInfo.Environment["Logging__LogLevel__Tinkwell.Firmwareless.WamrAotHost.Coordinator.CoordinatorRpc"] = "Debug";
+        startInfo.Environment["LC_ALL"] = "C"; // Times in the log are formatted with the current culture
+
+        return Process.Start(startInfo) ?? throw new InvalidOperationException($"Cannot start {_hostPath}.");
+    }
+
+    private static async Task WaitForFirmletsAsync(Process coordinator, int firmletCount, TimeSpan timeout)
+    {
+        using var cts = new CancellationTokenSource(timeout);
+        int readyCount = 0;
+
+        while (readyCount < firmletCount)
+        {
+            var line = await coordinator.StandardOutput.ReadLineAsync(cts.Token)
+                ?? throw new InvalidOperationException($"The coordinator exited before all the firmlets were ready ({readyCount} of {firmletCount}).");
+
+            var match = HostReadyRegex().Match(line);
+            if (match.Success)
+                readyCount += int.Parse(match.Groups[1].Value);
+        }
+    }
+
+    private static async Task<string> ReadLineAsync(Process coordinator, CancellationToken cancellationToken)
+        => await coordinator.StandardOutput.ReadLineAsync(cancellationToken)
+            ?? throw new InvalidOperationException("The coordinator exited unexpectedly.");
+
+    // The output is not read anymore, it must not fill the pipe and block the coordinator
+    private static void DiscardOutput(Process coordinator)
+        => _ = coordinator.StandardOutput.BaseStream.CopyToAsync(Stream.Null);
+
+    private static int[] FindChildProcesses(int parentId)
+    {
+        var children = new List<int>();
+        foreach (var directory in Directory.EnumerateDirectories("/proc"))
+        {
+            if (!int.TryParse(Path.GetFileName(directory), out int id))
+                continue;
+
+            try
+            {
+                // The name (second field) is between parentheses and can contain spaces, the parent ID is the second field after it
+                var stat = File.ReadAllText(Path.Combine(directory, "stat"));
+                var fields = stat[(stat.LastIndexOf(')') + 2)..].Split(' ');
+                if (int.Parse(fields[1]) == parentId)
+                    children.Add(id);
+            }
+            catch (IOException)
+            {
+                // Exited while we were reading it
+            }
+        }
+
+        return children.ToArray();
+    }
+
+    private static long ReadRssKb(int processId)
+    {
+        // VmRSS:     12345 kB
+        var line = File.ReadLines($"/proc/{processId}/status").First(x => x.StartsWith("VmRSS:"));
+        return long.Parse(line.Split(' ', StringSplitOptions.RemoveEmptyEntries)[1]);
+    }
+}
@@ -0,0 +1,63 @@
+﻿using Tinkwell.Firmwareless.Tools.HostingBenchmark;
+
+// Usage: Tinkwell.Firmwareless.Tools.HostingBenchmark --host=<PATH> [--firmlet=<PATH>] [--firmlets=<COUNT>]
+//     [--modes=<MODE>,...] [--mqtt-broker-address=<ADDRESS>] [--mqtt-broker-port=<PORT>] [--timeout=<SECONDS>] [--recovery]
+// --host is the WamrAotHost executable (or its .dll) to measure, better the one published for the target. The
+// coordinator needs an MQTT broker (for example Tinkwell.Firmwareless.Tools.MqttBroker). Linux only (RSS is read from /proc).
+// With --recovery it kills a host and measures the time until it's ready again, without and with a standby host:
+// the exit code is 1 if the host is not restarted (or the standby host is not used).
+var options = args
+    .Select(x => x.Split('=', 2))
+    .ToDictionary(x => x[0], x => x.Length == 2 ? x[1] : "");
+
+if (!options.TryGetValue("--host", out var hostPath))
+{
+    Console.Error.WriteLine("Error: --host=<PATH> is required.");
+    return 1;
+}
+
+string firmletPath = Path.GetFullPath(options.GetValueOrDefault("--firmlet",
+    Path.Combine(Path.GetDirectoryName(Path.GetFullPath(hostPath))!, "TestFirmwares", "Vendor", "Product")));
+int firmletCount = int.Parse(options.GetValueOrDefault("--firmlets", "16"));
+var modes = options.GetValueOrDefault("--modes", "Isolated,Pooled").Split(',', StringSplitOptions.RemoveEmptyEntries | StringSplitOptions.TrimEntries);
+var brokerAddress = options.GetValueOrDefault("--mqtt-broker-address", "localhost");
+var brokerPort = int.Parse(options.GetValueOrDefault("--mqtt-broker-port", "1883"));
+var timeout = TimeSpan.FromSeconds(int.Parse(options.GetValueOrDefault("--timeout", "120")));
+
+Console.WriteLine($"{firmletCount} firmlets, {firmletPath}");
+Console.WriteLine();
+
+if (options.ContainsKey("--recovery"))
+{
+    Console.WriteLine($"{"Mode",-10}{"Standby",9}{"Handover",10}{"Crash to ready (ms)",21}{"Reported (ms)",15}");
+    foreach (var mode in modes)
+    {
+        foreach (int standbyHosts in new[] { 0, 1 })
+        {
+            var benchmark = new HostingBenchmark(hostPath, firmletPath, brokerAddress, brokerPort);
+            try
+            {
+                var result = await benchmark.RunRecoveryAsync(mode, firmletCount, standbyHosts, timeout);
+                Console.WriteLine($"{mode,-10}{standbyHosts,9}{(result.StandbyHandover ? "yes" : "no"),10}{result.CrashToReadyMs,21:F0}{result.ReportedMs,15:F0}");
+            }
+            catch (InvalidOperationException e)
+            {
+                Console.Error.WriteLine($"Error ({mode}, {standbyHosts} standby host(s)): {e.Message}");
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+Console.WriteLine($"{"Mode",-10}{"Hosts",8}{"Startup (ms)",14}{"Hosts RSS (MB)",16}{"MB/firmlet",12}{"Coordinator (MB)",18}");
+
+foreach (var mode in modes)
+{
+    var benchmark = new HostingBenchmark(hostPath, firmletPath, brokerAddress, brokerPort);
+    var result = await benchmark.RunAsync(mode, firmletCount, timeout);
+    Console.WriteLine($"{mode,-10}{result.HostCount,8}{result.StartupMs,14:F0}{result.HostsRssMb,16:F1}{result.HostsRssMb / firmletCount,12:F2}{result.CoordinatorRssMb,18:F1}");
+}
+
+return 0;
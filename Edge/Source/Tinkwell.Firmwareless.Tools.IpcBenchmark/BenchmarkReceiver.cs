@@ -0,0 +1,43 @@
+﻿using StreamJsonRpc;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
+
+namespace Tinkwell.Firmwareless.Tools.IpcBenchmark;
+
+// Plays the role of CoordinatorRpc: it receives the messages from JSON-RPC or from the shared memory channel
+sealed class BenchmarkReceiver
+{
+    [JsonRpcMethod(CoordinatorMethods.RegisterClient)]
+    public void RegisterClient(RegisterClientRequest request)
+        => _registered.TrySetResult();
+
+    [JsonRpcMethod(CoordinatorMethods.PublishMqttMessage)]
+    public void PublishMqttMessage(MqttMessage message)
+    {
+        if (Interlocked.Decrement(ref _pending) == 0)
+            _completed.TrySetResult();
+    }
+
+    [JsonRpcMethod(CoordinatorMethods.PublishMqttMessages)]
+    public void PublishMqttMessages(PublishMqttMessagesRequest request)
+    {
+        foreach (var message in request.Messages)
+            PublishMqttMessage(message);
+    }
+
+    public Task WaitForRegistrationAsync()
+        => _registered.Task;
+
+    public void Expect(int count)
+    {
+        _completed = new(TaskCreationOptions.RunContinuationsAsynchronously);
+        Volatile.Write(ref _pending, count);
+    }
+
+    public Task WaitAsync()
+        => _completed.Task;
+
+    private readonly TaskCompletionSource _registered = new(TaskCreationOptions.RunContinuationsAsynchronously);
+    private TaskCompletionSource _completed = new(TaskCreationOptions.RunContinuationsAsynchronously);
+    private int _pending;
+}
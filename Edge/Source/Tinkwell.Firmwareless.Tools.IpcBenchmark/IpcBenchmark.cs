@@ -0,0 +1,80 @@
+﻿using Microsoft.Extensions.Logging.Abstractions;
+using System.Diagnostics;
+using Tinkwell.Firmwareless.WamrAotHost;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+using Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+namespace Tinkwell.Firmwareless.Tools.IpcBenchmark;
+
+sealed record IpcBenchmarkResult(double MessagesPerSecond, double P50Us, double P99Us, double MaxUs);
+
+// Measures the MQTT messages published by a host to the coordinator. Both ends run in this process but they use
+// the same IpcServer and IpcClient used by WamrAotHost (then the same pipe or shared memory used between processes).
+// Throughput is measured sending all the messages back to back, latency sending them one at a time (waiting for
+// each one to be received before sending the next one).
+sealed class IpcBenchmark(IpcTransport transport, int payloadSize)
+{
+    public async Task<IpcBenchmarkResult> RunAsync(int messageCount)
+    {
+        var settings = new Settings { IpcTransport = _transport };
+        var pipeName = $"tw-ipc-benchmark-{Environment.ProcessId}-{_transport}";
+        var receiver = new BenchmarkReceiver();
+
+        using var server = new IpcServer(NullLogger<IpcServer>.Instance, settings);
+        _ = server.StartAsync(pipeName, receiver);
+        var dataChannel = server.OpenDataChannel(HostId, receiver.PublishMqttMessage);
+
+        var client = new IpcClient(NullLogger<IpcClient>.Instance, settings);
+        try
+        {
+            await client.StartClientAsync(pipeName, HostId, dataChannel, new object(), _ => { }, CancellationToken.None);
+            await receiver.WaitForRegistrationAsync();
+
+            // Warm up (JIT, buffers and connection)
+            await SendAllAsync(client, receiver, WarmUpMessageCount);
+
+            var stopwatch = Stopwatch.StartNew();
+            await SendAllAsync(client, receiver, messageCount);
+            double messagesPerSecond = messageCount / stopwatch.Elapsed.TotalSeconds;
+
+            var latencies = new double[Math.Min(messageCount, MaximumLatencySamples)];
+            for (int i = 0; i < latencies.Length; ++i)
+            {
+                receiver.Expect(1);
+                long startTime = Stopwatch.GetTimestamp();
+                await client.PublishMqttMessageAsync(CreateMessage());
+                await receiver.WaitAsync();
+                latencies[i] = Stopwatch.GetElapsedTime(startTime).TotalMicroseconds;
+            }
+
+            Array.Sort(latencies);
+            return new(messagesPerSecond, Percentile(latencies, 0.50), Percentile(latencies, 0.99), latencies[^1]);
+        }
+        finally
+        {
+            await client.DisconnectAsync();
+        }
+    }
+
+    private const string HostId = "host_benchmark";
+    private const int WarmUpMessageCount = 1_000;
+    private const int MaximumLatencySamples = 10_000;
+
+    private readonly IpcTransport _transport = transport;
+    private readonly string _payload = new('x', payloadSize);
+
+    private MqttMessage CreateMessage()
+        => new("firmlet_benchmark", "benchmark/topic", _payload);
+
+    private async Task SendAllAsync(IpcClient client, BenchmarkReceiver receiver, int count)
+    {
+        receiver.Expect(count);
+        for (int i = 0; i < count; ++i)
+            await client.PublishMqttMessageAsync(CreateMessage());
+
+        await receiver.WaitAsync();
+    }
+
+    public static double Percentile(double[] sortedValues, double percentile)
+        => sortedValues[(int)Math.Min(sortedValues.Length - 1, Math.Round(percentile * (sortedValues.Length - 1)))];
+}
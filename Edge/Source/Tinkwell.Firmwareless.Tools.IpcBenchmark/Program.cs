@@ -0,0 +1,35 @@
+﻿using Tinkwell.Firmwareless.Tools.IpcBenchmark;
+using Tinkwell.Firmwareless.WamrAotHost;
+
+// Usage: Tinkwell.Firmwareless.Tools.IpcBenchmark [--messages=<COUNT>] [--payload-size=<BYTES>]
+// It measures the IPC channel and then the publishing path of a firmlet (see PublishBenchmark).
+var options = args
+    .Select(x => x.Split('=', 2))
+    .ToDictionary(x => x[0], x => x.Length == 2 ? x[1] : "");
+
+int messageCount = int.Parse(options.GetValueOrDefault("--messages", "100000"));
+int payloadSize = int.Parse(options.GetValueOrDefault("--payload-size", "64"));
+
+Console.WriteLine($"{messageCount} messages, {payloadSize} bytes of payload");
+Console.WriteLine();
+Console.WriteLine($"{"Transport",-14}{"msg/s",12}{"p50 (us)",12}{"p99 (us)",12}{"max (us)",12}");
+
+foreach (var transport in new[] { IpcTransport.JsonRpc, IpcTransport.SharedMemory })
+{
+    var benchmark = new IpcBenchmark(transport, payloadSize);
+    var result = await benchmark.RunAsync(messageCount);
+    Console.WriteLine($"{transport,-14}{result.MessagesPerSecond,12:F0}{result.P50Us,12:F1}{result.P99Us,12:F1}{result.MaxUs,12:F1}");
+}
+
+Console.WriteLine();
+Console.WriteLine($"{"Transport",-14}{"Publish",-10}{"msg/s",12}{"p99 (us)",12}{"busy",12}");
+
+foreach (var transport in new[] { IpcTransport.JsonRpc, IpcTransport.SharedMemory })
+{
+    foreach (var mode in Enum.GetValues<PublishMode>())
+    {
+        var benchmark = new PublishBenchmark(transport, mode, payloadSize);
+        var result = await benchmark.RunAsync(messageCount);
+        Console.WriteLine($"{transport,-14}{mode,-10}{result.MessagesPerSecond,12:F0}{result.P99PublishUs,12:F1}{result.BusyCount,12}");
+    }
+}
@@ -0,0 +1,114 @@
+﻿using Microsoft.Extensions.Logging.Abstractions;
+using System.Diagnostics;
+using Tinkwell.Firmwareless.WamrAotHost;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+using Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+namespace Tinkwell.Firmwareless.Tools.IpcBenchmark;
+
+enum PublishMode
+{
+    // One IPC call for each message, the firmlet waits for it (how tw_mqtt_publish worked before MqttPublishQueue)
+    Blocking,
+    // Messages are queued and sent one at a time
+    Queued,
+    // Messages are queued and sent in batches of HostMqttPublishBatchSize
+    Batched,
+}
+
+sealed record PublishBenchmarkResult(double MessagesPerSecond, double P99PublishUs, long BusyCount);
+
+// Measures a firmlet which publishes a burst of messages: the firmlet is played by a thread which calls what
+// tw_mqtt_publish calls and retries when the queue is full (counting how many times it's been told to wait).
+// Throughput is from the first publish to when the last message has been received by the coordinator; the
+// publish time is how long the thread of the firmlet has been blocked by each call.
+sealed class PublishBenchmark(IpcTransport transport, PublishMode mode, int payloadSize)
+{
+    public async Task<PublishBenchmarkResult> RunAsync(int messageCount)
+    {
+        var settings = new Settings
+        {
+            IpcTransport = _transport,
+            HostMqttPublishBatchSize = _mode == PublishMode.Batched ? new Settings().HostMqttPublishBatchSize : 1,
+        };
+
+        var pipeName = $"tw-publish-benchmark-{Environment.ProcessId}-{_transport}-{_mode}";
+        var receiver = new BenchmarkReceiver();
+
+        using var server = new IpcServer(NullLogger<IpcServer>.Instance, settings);
+        _ = server.StartAsync(pipeName, receiver);
+        var dataChannel = server.OpenDataChannel(HostId, receiver.PublishMqttMessage);
+
+        var client = new IpcClient(NullLogger<IpcClient>.Instance, settings);
+        var queue = new MqttPublishQueue(NullLogger<MqttPublishQueue>.Instance, settings, client);
+        try
+        {
+            await client.StartClientAsync(pipeName, HostId, dataChannel, new object(), _ => { }, CancellationToken.None);
+            await receiver.WaitForRegistrationAsync();
+            queue.Start();
+
+            // Warm up (JIT, buffers and connection)
+            await PublishAllAsync(client, queue, receiver, WarmUpMessageCount);
+
+            _busyCount = 0;
+            var stopwatch = Stopwatch.StartNew();
+            var publishTimes = await PublishAllAsync(client, queue, receiver, messageCount);
+            double messagesPerSecond = messageCount / stopwatch.Elapsed.TotalSeconds;
+
+            Array.Sort(publishTimes);
+            return new(messagesPerSecond, IpcBenchmark.Percentile(publishTimes, 0.99), _busyCount);
+        }
+        finally
+        {
+            await queue.StopAsync();
+            await client.DisconnectAsync();
+        }
+    }
+
+    private const string HostId = "host_benchmark";
+    private const int WarmUpMessageCount = 1_000;
+
+    private readonly IpcTransport _transport = transport;
+    private readonly PublishMode _mode = mode;
+    private readonly string _payload = new('x', payloadSize);
+    private long _busyCount;
+
+    private async Task<double[]> PublishAllAsync(IpcClient client, MqttPublishQueue queue, BenchmarkReceiver receiver, int count)
+    {
+        receiver.Expect(count);
+
+        // The firmlet has its own thread, we do not want to measure the thread pool
+        var publishTimes = new double[count];
+        var firmlet = new Thread(() =>
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                var message = new MqttMessage("firmlet_benchmark", "benchmark/topic", _payload);
+                long startTime = Stopwatch.GetTimestamp();
+                Publish(client, queue, message);
+                publishTimes[i] = Stopwatch.GetElapsedTime(startTime).TotalMicroseconds;
+            }
+        });
+
+        firmlet.Start();
+        firmlet.Join();
+        await receiver.WaitAsync();
+
+        return publishTimes;
+    }
+
+    private void Publish(IpcClient client, MqttPublishQueue queue, MqttMessage message)
+    {
+        if (_mode == PublishMode.Blocking)
+        {
+            client.PublishMqttMessageAsync(message).GetAwaiter().GetResult();
+            return;
+        }
+
+        while (!queue.TryEnqueue(message))
+        {
+            ++_busyCount;
+            Thread.Yield();
+        }
+    }
+}
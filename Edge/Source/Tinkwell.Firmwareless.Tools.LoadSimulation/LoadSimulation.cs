@@ -0,0 +1,121 @@
+﻿using Tinkwell.Firmwareless.WamrAotHost;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
+using static Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring.SystemResourcesUsageArbiter;
+
+namespace Tinkwell.Firmwareless.Tools.LoadSimulation;
+
+// A host in a synthetic trace: how much CPU it would like to use at each tick (relative to all the CPUs,
+// like ResourcesUsageMeter does) and how many messages it exchanges.
+sealed record SimulatedHost(string Id, HostPriority Priority, Func<int, double> CpuDemand, double MessagesPerSecond, double MemoryUsagePercentage = 1);
+
+sealed record LoadTrace(string Name, int Ticks, IReadOnlyList<SimulatedHost> Hosts);
+
+sealed record LoadSimulationResult(
+    int OverloadedTicks,
+    int SaturatedTicks,
+    int Actions,
+    int Reversals,
+    IReadOnlyDictionary<HostPriority, int> SuspendedTicksByPriority);
+
+// Replays a trace against LoadScheduler: at each tick the CPU used by each host is its demand limited by its
+// state and the system is saturated when the total demand exceeds the available CPUs (the excess becomes CPU
+// pressure). A suspended host gets nothing, a throttled one gets CoordinatorThrottledHostCpuPercentage of one
+// CPU with HostSuspensionMode.Cgroups (cpu.max) and only the CPU time the other hosts leave idle with
+// HostSuspensionMode.Signals (lowest priority). Averages are calculated with ResourceUsageHistory, like the
+// coordinator does.
+sealed class LoadSimulation(Settings settings, int processorCount, bool verbose)
+{
+    public LoadSimulationResult Run(LoadTrace trace)
+    {
+        var scheduler = new LoadScheduler(_settings, canSuspend: true);
+        var interval = TimeSpan.FromMilliseconds(_settings.CoordinatorMonitoringIntervalMs);
+        var states = trace.Hosts.ToDictionary(x => x.Id, _ => (State: HostSuspensionState.None, Since: 0));
+        var histories = trace.Hosts.ToDictionary(x => x.Id, _ => new ResourceUsageHistory(ResourcesUsageMeter.HistorySize));
+        var lastActionByHost = new Dictionary<string, Decision>();
+        var system = new ResourceUsageHistory(ResourcesUsageMeter.HistorySize);
+        var suspendedTicks = Enum.GetValues<HostPriority>().ToDictionary(x => x, _ => 0);
+        int overloadedTicks = 0, saturatedTicks = 0, actions = 0, reversals = 0;
+
+        if (_verbose)
+            Console.WriteLine($"{"Tick",6}{"Demand",9}{"CPU",7}{"Avg",7}{"Press.",8}  Decision");
+
+        for (int tick = 0; tick < trace.Ticks; ++tick)
+        {
+            var demands = trace.Hosts.ToDictionary(x => x.Id, x => Math.Max(0, x.CpuDemand(tick)));
+            double idle = Math.Max(0, 100 - trace.Hosts.Where(x => states[x.Id].State == HostSuspensionState.None).Sum(x => demands[x.Id]));
+            double throttledDemand = trace.Hosts.Where(x => states[x.Id].State == HostSuspensionState.Throttled).Sum(x => demands[x.Id]);
+
+            double totalDemand = 0;
+            var loads = new List<HostLoad>(trace.Hosts.Count);
+            foreach (var host in trace.Hosts)
+            {
+                var (state, since) = states[host.Id];
+                double demand = demands[host.Id];
+                double usage = state switch
+                {
+                    HostSuspensionState.Throttled when _settings.CoordinatorHostSuspensionMode == HostSuspensionMode.Signals
+                        => Math.Min(demand, idle * demand / throttledDemand),
+                    HostSuspensionState.Throttled => Math.Min(demand, (double)_settings.CoordinatorThrottledHostCpuPercentage / _processorCount),
+                    HostSuspensionState.Suspended => 0,
+                    _ => demand
+                };
+
+                totalDemand += usage;
+
+                if (state == HostSuspensionState.Suspended)
+                    ++suspendedTicks[host.Priority];
+
+                var history = histories[host.Id];
+                history.Add(usage, 0, host.MemoryUsagePercentage);
+
+                loads.Add(new HostLoad(
+                    host.Id,
+                    host.Priority,
+                    state,
+                    (tick - since) * interval,
+                    history.CpuUsageAverage ?? 0,
+                    history.MemoryUsageAverage ?? 0,
+                    state == HostSuspensionState.Suspended ? 0 : host.MessagesPerSecond));
+            }
+
+            // When the CPUs are saturated the hosts share them and the rest of the demand is waiting
+            double cpuUsage = Math.Min(100, totalDemand);
+            double pressure = totalDemand > 100 ? (totalDemand - 100) / totalDemand * 100 : 0;
+            if (totalDemand > 100)
+                ++saturatedTicks;
+
+            system.Add(cpuUsage, 0, null);
+            var decision = scheduler.Schedule(new SystemLoad(system.CpuUsageAverage, pressure, 0), loads);
+
+            if (scheduler.IsOverloaded)
+                ++overloadedTicks;
+
+            if (decision is not null)
+            {
+                ++actions;
+                var (state, _) = states[decision.Value.HostId];
+                var newState = decision.Value.Decision == Decision.Resume ? state - 1 : state + 1;
+                states[decision.Value.HostId] = (newState, tick + 1);
+
+                // Throttling again a host we just resumed is what hysteresis should prevent
+                if (lastActionByHost.TryGetValue(decision.Value.HostId, out var lastAction) && lastAction == Decision.Resume && decision.Value.Decision != Decision.Resume)
+                    ++reversals;
+
+                lastActionByHost[decision.Value.HostId] = decision.Value.Decision;
+            }
+
+            if (_verbose)
+            {
+                var description = decision is null ? "" : $"{decision.Value.Decision} {decision.Value.HostId}";
+                Console.WriteLine($"{tick,6}{totalDemand,9:F1}{cpuUsage,7:F1}{system.CpuUsageAverage,7:F1}{pressure,8:F1}  {(scheduler.IsOverloaded ? "*" : " ")} {description}");
+            }
+        }
+
+        return new(overloadedTicks, saturatedTicks, actions, reversals, suspendedTicks);
+    }
+
+    private readonly Settings _settings = settings;
+    private readonly int _processorCount = processorCount;
+    private readonly bool _verbose = verbose;
+}
@@ -0,0 +1,44 @@
+﻿using Tinkwell.Firmwareless.WamrAotHost.Coordinator;
+
+namespace Tinkwell.Firmwareless.Tools.LoadSimulation;
+
+// Synthetic load traces, CPU usage is relative to all the CPUs (then 100 means that all of them are busy)
+static class LoadTraces
+{
+    public static IEnumerable<LoadTrace> All =>
+    [
+        // A single host has a short burst: the moving average absorbs it, nobody should be throttled
+        new("spike", 60, [
+            .. Hosts(6, HostPriority.Normal, _ => 10, 1),
+            new("bursty", HostPriority.Normal, tick => tick is >= 20 and < 22 ? 70 : 10, 1)
+        ]),
+
+        // Demand exceeds the CPUs for a long time then goes back to normal: hosts are throttled (and then
+        // suspended) one at a time and resumed when the load is low again
+        new("sustained", 120, [
+            .. Hosts(6, HostPriority.Normal, tick => tick is >= 10 and < 70 ? 22 : 8, 1),
+        ]),
+
+        // The load hovers around the high threshold: we expect a few decisions, not one for each tick
+        new("oscillating", 120, [
+            .. Hosts(8, HostPriority.Normal, tick => 11 + 1.5 * Math.Sin(tick / 3.0), 1),
+        ]),
+
+        // Same overload as "sustained" but with mixed priorities and activity: low priority (and idle)
+        // hosts go first, critical ones are never touched
+        new("priorities", 120, [
+            .. Hosts(2, HostPriority.Low, tick => tick is >= 10 and < 70 ? 22 : 8, 0.1),
+            .. Hosts(2, HostPriority.Normal, tick => tick is >= 10 and < 70 ? 22 : 8, 5),
+            .. Hosts(2, HostPriority.Critical, tick => tick is >= 10 and < 70 ? 22 : 8, 5),
+        ]),
+
+        // Critical hosts alone almost saturate the CPUs: throttling the others is not enough, they're suspended
+        new("saturated", 120, [
+            .. Hosts(2, HostPriority.Critical, tick => tick is >= 10 and < 70 ? 40 : 10, 5),
+            .. Hosts(4, HostPriority.Low, _ => 8, 1),
+        ]),
+    ];
+
+    private static IEnumerable<SimulatedHost> Hosts(int count, HostPriority priority, Func<int, double> cpuDemand, double messagesPerSecond)
+        => Enumerable.Range(0, count).Select(i => new SimulatedHost($"{priority.ToString().ToLowerInvariant()}-{i}", priority, cpuDemand, messagesPerSecond));
+}
@@ -0,0 +1,30 @@
+﻿using Tinkwell.Firmwareless.Tools.LoadSimulation;
+using Tinkwell.Firmwareless.WamrAotHost;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator;
+
+// Usage: Tinkwell.Firmwareless.Tools.LoadSimulation [--scenario=<NAME>] [--cpus=<COUNT>] [--mode=Cgroups|Signals] [--verbose]
+var options = args
+    .Select(x => x.Split('=', 2))
+    .ToDictionary(x => x[0], x => x.Length == 2 ? x[1] : "");
+
+string scenario = options.GetValueOrDefault("--scenario", "all");
+int processorCount = int.Parse(options.GetValueOrDefault("--cpus", "4"));
+bool verbose = options.ContainsKey("--verbose");
+
+var settings = new Settings
+{
+    CoordinatorHostSuspensionMode = Enum.Parse<HostSuspensionMode>(options.GetValueOrDefault("--mode", "Cgroups"), ignoreCase: true),
+};
+var simulation = new LoadSimulation(settings, processorCount, verbose);
+
+Console.WriteLine($"{"Scenario",-14}{"Overloaded",12}{"Saturated",11}{"Actions",9}{"Reversals",11}{"Suspended (low/normal/critical)",34}");
+
+foreach (var trace in LoadTraces.All.Where(x => scenario == "all" || x.Name == scenario))
+{
+    if (verbose)
+        Console.WriteLine(trace.Name);
+
+    var result = simulation.Run(trace);
+    var suspended = $"{result.SuspendedTicksByPriority[HostPriority.Low]}/{result.SuspendedTicksByPriority[HostPriority.Normal]}/{result.SuspendedTicksByPriority[HostPriority.Critical]}";
+    Console.WriteLine($"{trace.Name,-14}{result.OverloadedTicks,12}{result.SaturatedTicks,11}{result.Actions,9}{result.Reversals,11}{suspended,34}");
+}
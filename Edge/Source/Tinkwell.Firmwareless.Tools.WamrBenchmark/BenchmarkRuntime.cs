@@ -0,0 +1,46 @@
+﻿using BenchmarkDotNet.Columns;
+using BenchmarkDotNet.Configs;
+using Microsoft.Extensions.Logging.Abstractions;
+using Tinkwell.Firmwareless.WamrAotHost;
+using Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+namespace Tinkwell.Firmwareless.Tools.WamrBenchmark;
+
+// Configuration shared by all the benchmarks: each operation is a call, Op/s is the number of calls per second.
+sealed class BenchmarkConfig : ManualConfig
+{
+    public BenchmarkConfig()
+    {
+        AddColumn(StatisticColumn.OperationsPerSecond);
+    }
+}
+
+// The WAMR runtime for a benchmark, instances are sized and budgeted as the host does with its default settings.
+// Test firmlets are copied to the output directory by WamrAotHost (see TestFirmwares), their imports are resolved
+// with NullHostExportedFunctions.
+static class BenchmarkRuntime
+{
+    public static readonly Settings Settings = new();
+
+    public static readonly string TestFirmwaresPath = Path.Combine(AppContext.BaseDirectory, "TestFirmwares");
+
+    public static void Initialize()
+    {
+        Wamr.Initialize();
+        new HostExportedUnsafeNativeFunctions(NullLogger<HostExportedUnsafeNativeFunctions>.Instance, new NullHostExportedFunctions()).RegisterAll();
+    }
+
+    public static WasmInstance LoadInstance(string testFirmwarePath)
+    {
+        var path = Path.Combine(TestFirmwaresPath, testFirmwarePath);
+        var limits = new WasmInstanceLimits((uint)Settings.HostDefaultStackSize, (uint)Settings.HostDefaultHeapSize, (uint)Settings.HostDefaultNativeStackSize);
+
+        var inst = Wamr.LoadInstance(Path.GetFileNameWithoutExtension(path), path, limits);
+        inst.CallBudget = TimeSpan.FromMilliseconds(Settings.HostCallbackBudgetMs);
+
+        return inst;
+    }
+
+    public static void Shutdown()
+        => Wamr.Shutdown();
+}
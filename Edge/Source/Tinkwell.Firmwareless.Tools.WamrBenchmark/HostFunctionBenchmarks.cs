@@ -0,0 +1,68 @@
+﻿using BenchmarkDotNet.Attributes;
+using Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+namespace Tinkwell.Firmwareless.Tools.WamrBenchmark;
+
+// Calls from a firmlet to the host functions (HostExportedUnsafeNativeFunctions): the firmlet calls the same function
+// in a loop, then Op/s is calls/sec of that host function. The implementation behind them does nothing: we measure
+// the transition from WASM, the marshalling of the arguments and their checks, not the logger, the publish queue or the VFS
+// (see NullHostExportedFunctions).
+[Config(typeof(BenchmarkConfig))]
+[MemoryDiagnoser]
+public class HostFunctionBenchmarks
+{
+    [GlobalSetup]
+    public void Setup()
+    {
+        BenchmarkRuntime.Initialize();
+        _instance = BenchmarkRuntime.LoadInstance("Tests/HostCalls/host_calls.wasm");
+        _callLog = LookupFunction("call_log");
+        _callMqttPublish = LookupFunction("call_mqtt_publish");
+        _callRead = LookupFunction("call_read");
+        _callWrite = LookupFunction("call_write");
+
+        // The firmlet traps if a host function fails, better to know it before measuring anything
+        foreach (var func in new[] { _callLog, _callMqttPublish, _callRead, _callWrite })
+            Wamr.CallExportIV(_instance, func, arg: 1, required: true);
+    }
+
+    [GlobalCleanup]
+    public void Cleanup()
+    {
+        _instance?.Dispose();
+        BenchmarkRuntime.Shutdown();
+    }
+
+    [Benchmark(OperationsPerInvoke = CallsPerInvoke)]
+    public void Log()
+        => Wamr.CallExportIV(_instance!, _callLog, CallsPerInvoke, required: true);
+
+    [Benchmark(OperationsPerInvoke = CallsPerInvoke)]
+    public void MqttPublish()
+        => Wamr.CallExportIV(_instance!, _callMqttPublish, CallsPerInvoke, required: true);
+
+    [Benchmark(OperationsPerInvoke = CallsPerInvoke)]
+    public void ReadFromFile()
+        => Wamr.CallExportIV(_instance!, _callRead, CallsPerInvoke, required: true);
+
+    [Benchmark(OperationsPerInvoke = CallsPerInvoke)]
+    public void WriteToFile()
+        => Wamr.CallExportIV(_instance!, _callWrite, CallsPerInvoke, required: true);
+
+    private const int CallsPerInvoke = 1000;
+
+    private WasmInstance? _instance;
+    private nint _callLog;
+    private nint _callMqttPublish;
+    private nint _callRead;
+    private nint _callWrite;
+
+    private nint LookupFunction(string name)
+    {
+        nint func = Libiwasm.wasm_runtime_lookup_function(_instance!.Instance, name, Wamr.Signature(typeof(void), typeof(int)));
+        if (func == nint.Zero)
+            throw new InvalidOperationException($"The test firmlet does not export {name}().");
+
+        return func;
+    }
+}
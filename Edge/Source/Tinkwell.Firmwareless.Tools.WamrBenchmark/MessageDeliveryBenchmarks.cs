@@ -0,0 +1,42 @@
+﻿using BenchmarkDotNet.Attributes;
+using Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+namespace Tinkwell.Firmwareless.Tools.WamrBenchmark;
+
+// Delivery of an MQTT message to a firmlet, what its thread does for each message forwarded by WamrHost.Notify():
+// topic and payload are encoded in the scratch buffer of the instance and _on_message_received() is called.
+// Op/s is messages/sec, after the first call (which allocates the scratch buffer) "Allocated" must be zero.
+[Config(typeof(BenchmarkConfig))]
+[MemoryDiagnoser]
+public class MessageDeliveryBenchmarks
+{
+    [Params(16, 256, 4096)]
+    public int PayloadSize { get; set; }
+
+    [GlobalSetup]
+    public void Setup()
+    {
+        BenchmarkRuntime.Initialize();
+        _instance = BenchmarkRuntime.LoadInstance("Tests/MessageSink/message_sink.wasm");
+        _payload = "{" + new string('x', PayloadSize - 1);
+
+        // The firmlet traps if it does not receive the payload, better to know it before measuring anything
+        Wamr.CallExportSSV(_instance, _instance.OnMessageFunc, Topic, _payload, required: true);
+    }
+
+    [GlobalCleanup]
+    public void Cleanup()
+    {
+        _instance?.Dispose();
+        BenchmarkRuntime.Shutdown();
+    }
+
+    [Benchmark]
+    public void DeliverMessage()
+        => Wamr.CallExportSSV(_instance!, _instance!.OnMessageFunc, Topic, _payload, required: true);
+
+    private const string Topic = "benchmark/telemetry";
+
+    private WasmInstance? _instance;
+    private string _payload = "";
+}
@@ -0,0 +1,17 @@
+﻿using Tinkwell.Firmwareless.Vfs;
+using Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+namespace Tinkwell.Firmwareless.Tools.WamrBenchmark;
+
+// Host functions which do nothing (and always succeed), firmlets can import them but what we measure is only the runtime.
+sealed class NullHostExportedFunctions : IHostExportedFunctions
+{
+    public void Abort(string message, string fileName, int lineNumber, int columnNumber) { }
+    public void Log(int severity, ReadOnlySpan<byte> topic, ReadOnlySpan<byte> message) { }
+    public bool PublishMqttMessage(ReadOnlySpan<byte> topic, ReadOnlySpan<byte> payload) => true;
+    public int PublishMqttMessages(ReadOnlySpan<byte> batch) => 0;
+    public int OpenFile(string path, OpenMode mode, OpenFlags flags) => 1;
+    public void CloseFile(int handle) { }
+    public int ReadFromFile(int handle, Span<byte> buffer, ReadFlags flags) => buffer.Length;
+    public int WriteToFile(int handle, Span<byte> buffer, WriteFlags flags) => buffer.Length;
+}
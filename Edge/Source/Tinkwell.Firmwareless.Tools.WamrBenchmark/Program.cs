@@ -0,0 +1,6 @@
+﻿using BenchmarkDotNet.Running;
+
+// Usage: Tinkwell.Firmwareless.Tools.WamrBenchmark [BenchmarkDotNet options, for example --filter *MessageDelivery*]
+// Benchmarks run the WAMR runtime in-process: libiwasm must be where the host finds it (as for WamrAotHost).
+// Build and run them in Release.
+BenchmarkSwitcher.FromAssembly(typeof(Program).Assembly).Run(args);
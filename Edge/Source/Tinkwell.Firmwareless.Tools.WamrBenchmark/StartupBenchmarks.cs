@@ -0,0 +1,51 @@
+﻿using BenchmarkDotNet.Attributes;
+using Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+namespace Tinkwell.Firmwareless.Tools.WamrBenchmark;
+
+// Startup of a module instance, what a host does for each module of its firmlets: Wamr.LoadInstance() (the image
+// is mapped and hashed, see WasmModuleCache) and the release of the instance. Cold: no other instance uses the module,
+// it's validated, loaded and then unloaded every time. Warm: another instance keeps the module loaded (another
+// firmlet in a pooled host, or another instance of the same firmlet), only the hash and the instantiation are left.
+// The image is in the file system cache in both cases, as for a host restarted by the coordinator. Each firmlet
+// in TestFirmwares is measured, .aot images compiled with wamrc can be copied there to measure them too.
+[Config(typeof(BenchmarkConfig))]
+[MemoryDiagnoser]
+public class StartupBenchmarks
+{
+    public static IEnumerable<string> Firmlets
+        => Directory.EnumerateFiles(BenchmarkRuntime.TestFirmwaresPath, "*.*", SearchOption.AllDirectories)
+            .Where(x => x.EndsWith(".wasm", StringComparison.OrdinalIgnoreCase) || x.EndsWith(".aot", StringComparison.OrdinalIgnoreCase))
+            .Select(x => Path.GetRelativePath(BenchmarkRuntime.TestFirmwaresPath, x))
+            .Order();
+
+    [ParamsSource(nameof(Firmlets))]
+    public string Firmlet { get; set; } = "";
+
+    [Params(false, true)]
+    public bool Warm { get; set; }
+
+    [GlobalSetup]
+    public void Setup()
+    {
+        BenchmarkRuntime.Initialize();
+
+        if (Warm)
+            _resident = BenchmarkRuntime.LoadInstance(Firmlet);
+    }
+
+    [GlobalCleanup]
+    public void Cleanup()
+    {
+        _resident?.Dispose();
+        BenchmarkRuntime.Shutdown();
+    }
+
+    [Benchmark]
+    public void LoadInstance()
+    {
+        using var inst = BenchmarkRuntime.LoadInstance(Firmlet);
+    }
+
+    private WasmInstance? _resident;
+}
@@ -40,19 +40,28 @@ enum RequiredService
 //
 // Synopsis (host):
 //
-// WamrAotHost host --path=<PATH> --id=<ID> --pipe-name=<NAME> [--transient]
+// WamrAotHost host --firmlet=<FIRMLET> [--firmlet=<FIRMLET>...] --id=<ID> --pipe-name=<NAME> [--data-channel=<PATH>] [--transient]
+// WamrAotHost host --standby --id=<ID> --pipe-name=<NAME>
 //
 // "WamrAotHost host" is called by the coordinator to instantiate each host and should never be called directly
 //
 // Where:
 //
-// --path<PATH>
-//     Required. Directory where the firmlet(s) to load are stored. Note that ALL the WASM modules (both *.wasm and *.aot)
-//     are loaded in the host: a firmlet could be composed of multiple indipendent modules!
+// --firmlet=<FIRMLET>
+//     Required. A firmlet to run in this host, repeated for each one of them. It's in the form <FIRMLET ID>=<PATH>
+//     where <PATH> is the directory where the firmlet is stored (the ID cannot contain "=", the path can contain anything).
+//     Note that ALL the WASM modules (both *.wasm and *.aot) are loaded: a firmlet could be composed of multiple
+//     indipendent modules! When there is more than one firmlet then they share the process (each one runs in its own thread).
 // --id=<ID>
 //     Required. Unique ID associated with this host. This ID might change when the system (or the process) is restarted.
 // --pipe-name=<NAME>
 //     Required. Name of the pipe used to communicate (using JSON RPC) with the coordinator.
+// --data-channel=<PATH>
+//     Optional. Path of the shared memory channel (created by the coordinator) used to exchange the MQTT messages.
+//     If omitted then they're exchanged using JSON RPC.
+// --standby
+//     Optional. Start without firmlets (--firmlet is not used): the host initializes the runtime, connects to the
+//     coordinator and waits. The coordinator assigns it the firmlets (and a new ID) when another host has to be restarted.
 // --transient
 //     Optional. Exit immediately after the initialization phase. Used only for testing.
 //
@@ -73,6 +82,7 @@ sealed class CommandLineParser
             _ => throw new HostException($"Unkown command '{args[0]}'.")
         };
 
+        _args = args;
         _options = ParseOptions(args);
     }
 
@@ -103,14 +113,18 @@ sealed class CommandLineParser
 
     public HostServiceOptions GetHostServiceOptions()
     {
+        bool standby = IsPresent("standby");
         return new(
-            Path: GetOption("path"),
+            Firmlets: standby ? new Dictionary<string, string>() : ParseFirmlets(GetAllOptions("firmlet")),
             Id: GetOption("id"),
             PipeName: GetOption("pipe-name"),
-            Transient: IsPresent("transient")
+            DataChannel: IsPresent("data-channel") ? GetOption("data-channel") : null,
+            Transient: IsPresent("transient"),
+            Standby: standby
         );
     }
 
+    private readonly string[] _args;
     private readonly IReadOnlyDictionary<string, string?> _options;
 
     private string GetOption(string optionName, bool required = true, string defaultIfMissing = "")
@@ -131,6 +145,38 @@ sealed class CommandLineParser
     private bool IsPresent(string optionName)
         => _options.ContainsKey($"--{optionName}");
 
+    // Values of an option which can be repeated, in the order they have been specified
+    private string[] GetAllOptions(string optionName)
+    {
+        var prefix = $"--{optionName}=";
+        var values = _args.Where(x => x.StartsWith(prefix, StringComparison.Ordinal)).Select(x => x[prefix.Length..]).ToArray();
+        if (values.Length == 0)
+        {
+            Console.Error.WriteLine($"Error: Required option '--{optionName}' is missing or has no value.");
+            Environment.Exit(1);
+        }
+
+        return values;
+    }
+
+    private static Dictionary<string, string> ParseFirmlets(string[] entries)
+    {
+        var firmlets = new Dictionary<string, string>(StringComparer.Ordinal);
+        foreach (var entry in entries)
+        {
+            var parts = entry.Split('=', 2);
+            if (parts.Length != 2 || string.IsNullOrWhiteSpace(parts[0]) || string.IsNullOrWhiteSpace(parts[1]))
+            {
+                Console.Error.WriteLine($"Error: Invalid firmlet '{entry}', expected <ID>=<PATH>.");
+                Environment.Exit(1);
+            }
+
+            firmlets[parts[0]] = parts[1];
+        }
+
+        return firmlets;
+    }
+
     private static Dictionary<string, string?> ParseOptions(string[] args)
     {
         var options = new Dictionary<string, string?>(StringComparer.Ordinal);
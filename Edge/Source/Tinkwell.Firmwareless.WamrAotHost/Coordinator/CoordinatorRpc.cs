@@ -5,15 +5,30 @@ using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator;
 
-sealed class CoordinatorRpc(ILogger<CoordinatorRpc> logger, FirmletsRepository repository, IMqttQueue messageQueue)
+sealed class CoordinatorRpc(ILogger<CoordinatorRpc> logger, FirmletsRepository repository, IMqttQueue messageQueue, StandbyHostsPool standby)
 {
     [JsonRpcMethod(CoordinatorMethods.RegisterClient)]
     public void RegisterClient(RegisterClientRequest request)
     {
+        if (request.Standby)
+        {
+            if (_standby.MarkReady(request.ClientName))
+                _logger.LogDebug("Standby host {HostId} is ready", request.ClientName);
+
+            return;
+        }
+
         if (_repository.TryGetByHostId(request.ClientName, out var host))
         {
-            _logger.LogInformation("Host {HostId} is ready ({Time} ms)",
-                request.ClientName, (DateTime.UtcNow - host.StartTime).TotalMilliseconds);
+            _logger.LogInformation("Host {HostId} is ready ({Time} ms, {Count} firmlet(s))",
+                request.ClientName, (DateTime.UtcNow - host.StartTime).TotalMilliseconds, host.Firmlets.Count);
+
+            // From when the previous process died, backoff included: this is how long its firmlets were offline
+            if (host.ExitTime is not null)
+            {
+                _logger.LogInformation("Host {HostId} recovered {Time} ms after exiting", request.ClientName, (DateTime.UtcNow - host.ExitTime.Value).TotalMilliseconds);
+                host.ExitTime = null;
+            }
 
             host.Ready = true;
         }
@@ -22,14 +37,22 @@ sealed class CoordinatorRpc(ILogger<CoordinatorRpc> logger, FirmletsRepository r
     [JsonRpcMethod(CoordinatorMethods.PublishMqttMessage)]
     public void PublishMqttMessage(MqttMessage request)
     {
-        _logger.LogTrace("Received message from {HostId}: {Topic}", request.HostId, request.Topic)
-;        if (!_repository.TryGetByHostId(request.HostId, out var _))
-            _logger.LogError("Received a request to send an MQTT nessage from an unknown sender {HostId}", request.HostId);
+        _logger.LogTrace("Received message from {FirmletId}: {Topic}", request.FirmletId, request.Topic);
+        if (!_repository.TryGetByFirmletId(request.FirmletId, out _, out var host))
+            _logger.LogError("Received a request to send an MQTT nessage from an unknown sender {FirmletId}", request.FirmletId);
         else
-            _messageQueue.EnqueueOutgoingMessage(request);
+            _messageQueue.EnqueueOutgoingMessage(host.Id, request);
+    }
+
+    [JsonRpcMethod(CoordinatorMethods.PublishMqttMessages)]
+    public void PublishMqttMessages(PublishMqttMessagesRequest request)
+    {
+        foreach (var message in request.Messages)
+            PublishMqttMessage(message);
     }
 
     private readonly ILogger<CoordinatorRpc> _logger = logger;
     private readonly FirmletsRepository _repository = repository;
     private readonly IMqttQueue _messageQueue = messageQueue;
+    private readonly StandbyHostsPool _standby = standby;
 }
@@ -1,4 +1,5 @@
 using System.Collections.Concurrent;
+using System.Diagnostics;
 using System.Diagnostics.CodeAnalysis;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator;
@@ -14,29 +15,56 @@ sealed class FirmletsRepository
 
     public bool IsEmpty => _hosts.IsEmpty;
 
-    public void Add(IEnumerable<FirmletEntry> hosts)
+    // Each group of firmlets is going to run in the same host process
+    public void Add(IEnumerable<IReadOnlyList<FirmletEntry>> groups)
     {
         _hosts = new ConcurrentDictionary<string, HostInfo>(
-            hosts
-                .Select(entry => new HostInfo(entry.Id, IdHelpers.CreateId("firmlet", 12), entry.Path))
+            groups
+                .Select(group => new HostInfo(
+                    IdHelpers.CreateId("host", 12),
+                    group.Select(entry => new FirmletInfo(entry.Id, IdHelpers.CreateId("firmlet", 12), entry.Path, entry.Trusted, entry.Priority)).ToArray()))
                 .ToDictionary(x => x.Id, x => x)
         );
+
+        _firmlets = new ConcurrentDictionary<string, (FirmletInfo, HostInfo)>(
+            _hosts.Values
+                .SelectMany(host => host.Firmlets.Select(firmlet => (Firmlet: firmlet, Host: host)))
+                .ToDictionary(x => x.Firmlet.Id, x => (x.Firmlet, x.Host))
+        );
+
+        // Used to route each incoming MQTT message, if the same external ID is used twice then the first one wins
+        var byExternalReferenceId = new Dictionary<string, (FirmletInfo, HostInfo)>();
+        foreach (var (firmlet, host) in _firmlets.Values)
+            byExternalReferenceId.TryAdd(firmlet.ExternalReferenceId, (firmlet, host));
+
+        _firmletsByExternalReferenceId = byExternalReferenceId;
     }
 
     public bool TryGetByHostId(string id, [NotNullWhen(true)] out HostInfo host)
         => _hosts.TryGetValue(id, out host!);
 
-    public bool TryGetByProcessId(int pid, [NotNullWhen(true)] out HostInfo host) 
+    public bool TryGetByFirmletId(string id, [NotNullWhen(true)] out FirmletInfo firmlet, [NotNullWhen(true)] out HostInfo host)
     {
-        host = _hosts?.Values.FirstOrDefault(x => x.Process is not null && !x.Process.HasExited && x.Process?.Id == pid)!;
-        return host is not null;
+        bool found = _firmlets.TryGetValue(id, out var entry);
+        (firmlet, host) = (entry.Firmlet, entry.Host);
+        return found;
     }
 
-    public bool TryGetByExternalReferenceId(string externalReferenceId, [NotNullWhen(true)] out HostInfo host)
+    // It's used also when the process exited: we match the instance (its PID could have been reused already)
+    public bool TryGetByProcess(Process process, [NotNullWhen(true)] out HostInfo host)
     {
-        host = _hosts?.Values.FirstOrDefault(x => x.ExternalReferenceId == externalReferenceId)!;
+        host = _hosts.Values.FirstOrDefault(x => ReferenceEquals(x.Process, process))!;
         return host is not null;
     }
 
+    public bool TryGetByExternalReferenceId(string externalReferenceId, [NotNullWhen(true)] out FirmletInfo firmlet, [NotNullWhen(true)] out HostInfo host)
+    {
+        bool found = _firmletsByExternalReferenceId.TryGetValue(externalReferenceId, out var entry);
+        (firmlet, host) = (entry.Firmlet, entry.Host);
+        return found;
+    }
+
     private ConcurrentDictionary<string, HostInfo> _hosts = new();
+    private ConcurrentDictionary<string, (FirmletInfo Firmlet, HostInfo Host)> _firmlets = new();
+    private IReadOnlyDictionary<string, (FirmletInfo Firmlet, HostInfo Host)> _firmletsByExternalReferenceId = new Dictionary<string, (FirmletInfo, HostInfo)>();
 }
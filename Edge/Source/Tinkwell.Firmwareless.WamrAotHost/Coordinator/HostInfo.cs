@@ -3,33 +3,56 @@ using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator;
 
+// Firmlets with a low priority are the first ones to be throttled (or suspended) when the system is
+// overloaded, critical ones are never throttled.
+enum HostPriority
+{
+    Low,
+    Normal,
+    Critical
+}
+
+enum HostSuspensionState
+{
+    None,
+    Throttled,
+    Suspended
+}
+
+// A firmlet, listed in the firmlets file, and the ID used to address it in its host.
+[DebuggerDisplay("{Id}")]
+sealed record FirmletInfo(string ExternalReferenceId, string Id, string Path, bool Trusted, HostPriority Priority);
+
+// A host process. It runs a single firmlet or, when pooled, a group of them.
 [DebuggerDisplay("{Id}")]
-sealed record HostInfo(string ExternalReferenceId, string Id, string Path)
+sealed record HostInfo(string Id, IReadOnlyList<FirmletInfo> Firmlets)
 {
     public bool Ready { get; set; }
     public bool Terminating { get; set; }
     public Process? Process { get; set; }
     public DateTime StartTime { get; set; }
+    public DateTime? ExitTime { get; set; }
     public List<DateTime> RestartTimestamps { get; } = new();
-    public HostInfoResourceUsageData UsageData { get; } = new HostInfoResourceUsageData(new(5), new(5));
+    public ResourceUsageHistory UsageData { get; } = new(ResourcesUsageMeter.HistorySize);
+    public HostSuspensionState SuspensionState { get; set; }
+    public DateTime SuspensionStateChangeTime { get; set; }
+
+    // A pooled host is as important as its most important firmlet
+    public HostPriority Priority
+        => Firmlets.Count == 0 ? HostPriority.Normal : Firmlets.Max(x => x.Priority);
 
     public override string ToString()
     {
-        return string.Format("{0}: {1}, {2}. CPU: {3}%, memory {4}%",
+        bool running = Process is not null && !Process.HasExited;
+        return string.Format("{0} ({1} firmlet(s)): {2}, {3}, {4}. CPU: {5}%, memory {6}% ({7} MB)",
             Id,
-            Process is null || Process.HasExited ? "terminated" : "active",
+            Firmlets.Count,
+            running ? "active" : "terminated",
             Ready ? "ready" : "booting",
-            UsageData.CpuUsagePercentage.Current,
-            UsageData.MemoryUsagePercentage.Current
+            SuspensionState,
+            UsageData.CpuUsagePercentage,
+            UsageData.MemoryUsagePercentage,
+            running ? UsageData.MemoryUsageBytes / (1024 * 1024) : 0
         );
     }
 }
-
-sealed record HostInfoResourceUsageData(FixedSizeValueList CpuUsagePercentage, FixedSizeValueList MemoryUsagePercentage)
-{
-    public void Clear()
-    {
-        CpuUsagePercentage.Clear();
-        MemoryUsagePercentage.Clear();
-    }
-}
@@ -0,0 +1,40 @@
+using System.Diagnostics;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator;
+
+// Starts a new instance of this executable (as host), with the same runtime when we have been launched with "dotnet".
+static class HostProcessLauncher
+{
+    public static Process? Start(string[] newArgs)
+    {
+        if (Environment.ProcessPath is null)
+            throw new InvalidOperationException("Cannot determine process' path");
+
+        bool launchedViaDotnet = Path.GetFileNameWithoutExtension(Environment.ProcessPath).Equals("dotnet");
+
+        string launchTarget;
+        string arguments = string.Join(' ', newArgs.Select(x => $"\"{x}\""));
+
+        if (launchedViaDotnet)
+        {
+            launchTarget = Environment.ProcessPath;
+            arguments = $"\"{Environment.GetCommandLineArgs()[0]}\"" + " " + arguments;
+        }
+        else
+        {
+            launchTarget = Environment.ProcessPath;
+        }
+
+        var startInfo = new ProcessStartInfo
+        {
+            FileName = launchTarget,
+            Arguments = arguments,
+            UseShellExecute = false
+        };
+
+        startInfo.EnvironmentVariables.Remove("TW_MQTT_CREDENTIALS_USERNAME");
+        startInfo.EnvironmentVariables.Remove("TW_MQTT_CREDENTIALS_PASSWORD");
+        
+        return Process.Start(startInfo);
+    }
+}
@@ -1,12 +1,13 @@
-using Microsoft.Extensions.Logging;
+﻿using Microsoft.Extensions.Logging;
 using System.Diagnostics;
 using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 using Tinkwell.Firmwareless.WamrAotHost.Ipc;
 using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator;
 
-sealed record FirmletEntry(string Id, string Path);
+sealed record FirmletEntry(string Id, string Path, bool Trusted, HostPriority Priority);
 
 sealed class HostProcessesCoordinator(
     ILogger<HostProcessesCoordinator> logger,
@@ -14,19 +15,26 @@ sealed class HostProcessesCoordinator(
     IpcServer server,
     FirmletsRepository repository,
     CoordinatorRpc rpc,
-    SystemResourcesUsageArbiter arbiter
+    SystemResourcesUsageArbiter arbiter,
+    ResourcesUsageMeter meter,
+    HostProcessControl control,
+    StandbyHostsPool standby,
+    IMqttQueue mqttQueue
 ) : IDisposable
 {
     public void Start(string pipeName, IEnumerable<FirmletEntry> entries)
     {
         _pipeName = pipeName;
         _ = _server.StartAsync(_pipeName, _rpc); // Fire and forget
+        _control.Initialize();
 
-        _repository.Add(entries);
+        _repository.Add(GroupByHost(entries));
 
         foreach (var hostInfo in _repository.Hosts)
             StartHostProcess(hostInfo, _pipeName);
 
+        _standby.Fill(_pipeName);
+
         _monitorTimer = new Timer(
             callback: MonitorProcesses,
             state: null,
@@ -37,6 +45,7 @@ sealed class HostProcessesCoordinator(
     public async Task StopAsync()
     {
         _keepAlive = false;
+        _standby.Dispose();
 
         foreach (var host in _repository.ActiveHosts)
             GentlyTerminateProcess(host, "shutting down");
@@ -56,33 +65,70 @@ sealed class HostProcessesCoordinator(
     private readonly FirmletsRepository _repository = repository;
     private readonly CoordinatorRpc _rpc = rpc;
     private readonly SystemResourcesUsageArbiter _arbiter = arbiter;
+    private readonly ResourcesUsageMeter _meter = meter;
+    private readonly HostProcessControl _control = control;
+    private readonly StandbyHostsPool _standby = standby;
+    private readonly IMqttQueue _mqttQueue = mqttQueue;
     private string? _pipeName;
     private bool _keepAlive = true;
     private Timer? _monitorTimer;
 
+    // A firmlet could break (or slow down) the others running in the same process, by default each one has
+    // its own process. Pooling saves the memory (and the startup time) of the runtime for each process.
+    private IEnumerable<IReadOnlyList<FirmletEntry>> GroupByHost(IEnumerable<FirmletEntry> entries)
+    {
+        var pooled = new List<FirmletEntry>();
+        foreach (var entry in entries)
+        {
+            bool canBePooled = _settings.CoordinatorHostingMode switch
+            {
+                HostingMode.Pooled => true,
+                HostingMode.PooledTrusted => entry.Trusted,
+                _ => false
+            };
+
+            if (canBePooled)
+                pooled.Add(entry);
+            else
+                yield return [entry];
+        }
+
+        // Firmlets with different priorities are not mixed, the host would be as important as the most important of them
+        foreach (var byPriority in pooled.GroupBy(x => x.Priority))
+        {
+            foreach (var group in byPriority.Chunk(Math.Max(1, _settings.CoordinatorMaxFirmletsPerHost)))
+                yield return group;
+        }
+    }
+
     private void StartHostProcess(HostInfo hostInfo, string pipeName)
     {
-        _logger.LogDebug("Starting host {HostId} ({Path}).", hostInfo.Id, hostInfo.Path);
+        _logger.LogDebug("Starting host {HostId} ({Count} firmlet(s)).", hostInfo.Id, hostInfo.Firmlets.Count);
 
         hostInfo.Ready = false;
         hostInfo.Terminating = false;
         hostInfo.UsageData.Clear();
 
-        var process = SpawnWithArgs([
+        // It must exist before the host starts, a restarted host gets a new (empty) one
+        var dataChannel = _server.OpenDataChannel(hostInfo.Id, _rpc.PublishMqttMessage);
+
+        var process = TryAssignToStandbyHost(hostInfo, pipeName, dataChannel) ?? HostProcessLauncher.Start([
             "host",
-            $"--path={hostInfo.Path}",
+            .. hostInfo.Firmlets.Select(x => $"--firmlet={x.Id}={x.Path}"),
             $"--id={hostInfo.Id}",
             $"--pipe-name={pipeName}",
+            .. dataChannel is null ? Array.Empty<string>() : [$"--data-channel={dataChannel}"],
         ]);
 
         if (process is null)
         {
-            _logger.LogError("Failed to start {HostId} ({Path}).", hostInfo.Id, hostInfo.Path);
+            _logger.LogError("Failed to start {HostId}.", hostInfo.Id);
             return;
         }
 
         hostInfo.Process = process;
         hostInfo.StartTime = DateTime.UtcNow;
+        _control.Attach(hostInfo);
 
         // This is a bit of a race condition: if we're slow enough (unlikely...) and the startup fails
         // then the process could exit before we started monitoring.
@@ -96,17 +142,48 @@ sealed class HostProcessesCoordinator(
         process.EnableRaisingEvents = true;
         process.Exited += OnProcessExited;
 
-        _logger.LogDebug("Started {HostId} for {Path}, PID {PID}", hostInfo.Id, hostInfo.Path, process.Id);
+        _logger.LogDebug("Started {HostId} for {Firmlets}, PID {PID}",
+            hostInfo.Id, string.Join(", ", hostInfo.Firmlets.Select(x => x.ExternalReferenceId)), process.Id);
+    }
+
+    // A standby host takes the identity (and the firmlets) of the host, it only has to load the modules
+    private Process? TryAssignToStandbyHost(HostInfo hostInfo, string pipeName, string? dataChannel)
+    {
+        if (!_standby.TryTake(out var standby))
+            return null;
+
+        _logger.LogDebug("Assigning {HostId} to the standby host {StandbyId} (PID {PID}).", hostInfo.Id, standby.Id, standby.Process.Id);
+        var assignment = _server.InvokeAsync(standby.Id, HostMethods.AssignFirmlets, new AssignFirmletsRequest
+        {
+            HostId = hostInfo.Id,
+            Firmlets = hostInfo.Firmlets.ToDictionary(x => x.Id, x => x.Path),
+            DataChannel = dataChannel,
+        });
+
+        // The standby host is already the process of this host: we kill it and the usual restart logic (see
+        // OnProcessExited()) starts a new one.
+        assignment.ContinueWith(task =>
+        {
+            _logger.LogError(task.Exception?.GetBaseException(), "Cannot assign {HostId} to the standby host {StandbyId}, starting a new host.", hostInfo.Id, standby.Id);
+            if (ReferenceEquals(hostInfo.Process, standby.Process))
+                ForcefullyTerminateProcess(hostInfo, "standby host not responding");
+        }, TaskContinuationOptions.OnlyOnFaulted);
+
+        _standby.Fill(pipeName);
+        return standby.Process;
     }
 
     private async void OnProcessExited(object? sender, EventArgs e)
     {
         var process = (Process)sender!;
 
-        if (_repository.TryGetByProcessId(process.Id, out var hostInfo) == false)
+        if (_repository.TryGetByProcess(process, out var hostInfo) == false)
             return;
 
+        hostInfo.ExitTime = DateTime.UtcNow;
+
         _logger.LogWarning("Host {HostId} (PID {PID}) exited with code: {ExitCode}.", hostInfo.Id, process.Id, process.ExitCode);
+        _mqttQueue.RemoveHostQueue(hostInfo.Id);
 
         if (_keepAlive)
             await RestartProcessWithBackoffAsync(hostInfo);
@@ -136,7 +213,10 @@ sealed class HostProcessesCoordinator(
 
         hostInfo.RestartTimestamps.Add(now);
         var recentRestartCount = hostInfo.RestartTimestamps.Count;
-        var delaySeconds = CalculateDelay();
+
+        // The backoff protects us from a host which keeps crashing, when the first restart is cheap (because we have
+        // a standby host ready for it) we do not wait at all.
+        var delaySeconds = recentRestartCount == 1 && _standby.HasReadyHost ? 0 : CalculateDelay();
 
         _logger.LogTrace("Waiting {Delay} seconds before restarting {HostId}", delaySeconds, hostInfo.Id);
         await Task.Delay(TimeSpan.FromSeconds(delaySeconds));
@@ -159,40 +239,7 @@ sealed class HostProcessesCoordinator(
         }
     }
 
-    private static Process? SpawnWithArgs(string[] newArgs)
-    {
-        if (Environment.ProcessPath is null)
-            throw new InvalidOperationException("Cannot determine process' path");
-
-        bool launchedViaDotnet = Path.GetFileNameWithoutExtension(Environment.ProcessPath).Equals("dotnet");
-
-        string launchTarget;
-        string arguments = string.Join(' ', newArgs.Select(x => $"\"{x}\""));
-
-        if (launchedViaDotnet)
-        {
-            launchTarget = Environment.ProcessPath;
-            arguments = $"\"{Environment.GetCommandLineArgs()[0]}\"" + " " + arguments;
-        }
-        else
-        {
-            launchTarget = Environment.ProcessPath;
-        }
-
-        var startInfo = new ProcessStartInfo
-        {
-            FileName = launchTarget,
-            Arguments = arguments,
-            UseShellExecute = false
-        };
-
-        startInfo.EnvironmentVariables.Remove("TW_MQTT_CREDENTIALS_USERNAME");
-        startInfo.EnvironmentVariables.Remove("TW_MQTT_CREDENTIALS_PASSWORD");
-        
-        return Process.Start(startInfo);
-    }
-
-    private async void MonitorProcesses(object? state)
+    private void MonitorProcesses(object? state)
     {
         try
         {
@@ -201,6 +248,9 @@ sealed class HostProcessesCoordinator(
 
             _logger.LogTrace("Running periodic check on {Count} host processes.", _repository.Count);
 
+            if (_keepAlive && _pipeName is not null)
+                _standby.Fill(_pipeName);
+
             var now = DateTime.UtcNow;
             var startProcessTimeout = TimeSpan.FromMilliseconds(_settings.CoordinatorStartProcessTimeoutMs);
 
@@ -221,7 +271,7 @@ sealed class HostProcessesCoordinator(
                 }
             }
             
-            await ResourcesUsageMeter.CollectAsync(_repository.Hosts);
+            _meter.Collect();
             foreach (var host in _repository.Hosts)
                 _logger.LogTrace("Host status - {HostInfo}", host.ToString());
 
@@ -234,8 +284,15 @@ sealed class HostProcessesCoordinator(
                     case SystemResourcesUsageArbiter.Decision.Terminate:
                         GentlyTerminateProcess(decision.HostInfo, "exceeding its rations");
                         break;
+                    case SystemResourcesUsageArbiter.Decision.Throttle:
+                        _control.Throttle(decision.HostInfo);
+                        break;
                     case SystemResourcesUsageArbiter.Decision.Suspend:
-                        throw new NotImplementedException();
+                        _control.Suspend(decision.HostInfo);
+                        break;
+                    case SystemResourcesUsageArbiter.Decision.Resume:
+                        _control.Resume(decision.HostInfo);
+                        break;
                 }
             }
         }
@@ -253,6 +310,7 @@ sealed class HostProcessesCoordinator(
 
         _logger.LogWarning("Marking {HostId} for termination: {Reason}", hostInfo.Id, reason);
         hostInfo.Terminating = true;
+        _control.ResumeCompletely(hostInfo); // It cannot answer otherwise
         _server.NotifyAsync(hostInfo.Id, HostMethods.Shutdown);
     }
 
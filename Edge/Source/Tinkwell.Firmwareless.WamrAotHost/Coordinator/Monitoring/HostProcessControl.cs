@@ -0,0 +1,296 @@
+using Microsoft.Extensions.Logging;
+using System.ComponentModel;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
+
+// Throttles and suspends host processes (see HostSuspensionMode). With cgroups each host has its own cgroup:
+// we throttle it with cpu.max and suspend it with the freezer. Otherwise we lower the priority of all the threads
+// of the process and suspend it with SIGSTOP (which cannot be caught or ignored). Note that a throttled process is
+// still going to get all the idle CPU time and that, without CAP_SYS_NICE (or RLIMIT_NICE), we cannot restore
+// its priority: in that case hosts are never throttled (nor suspended).
+sealed class HostProcessControl(ILogger<HostProcessControl> logger, Settings settings)
+{
+    public bool IsEnabled
+        => _mode != HostSuspensionMode.Disabled;
+
+    public bool CanSuspend
+        => _mode == HostSuspensionMode.Cgroups || (_mode == HostSuspensionMode.Signals && OperatingSystem.IsLinux());
+
+    public void Initialize()
+    {
+        if (_mode == HostSuspensionMode.Cgroups && !TryCreateCgroupHierarchy())
+        {
+            _logger.LogWarning("Cannot create a cgroup for each host, falling back to signals to suspend hosts.");
+            _mode = HostSuspensionMode.Signals;
+        }
+
+        if (_mode == HostSuspensionMode.Signals && OperatingSystem.IsLinux() && !CanRestorePriority())
+        {
+            _logger.LogWarning("Cannot restore the priority of a throttled host (it requires CAP_SYS_NICE or RLIMIT_NICE), hosts are never throttled or suspended.");
+            _mode = HostSuspensionMode.Disabled;
+        }
+    }
+
+    // Called when a host process has been started, before anything else
+    public void Attach(HostInfo hostInfo)
+    {
+        Debug.Assert(hostInfo.Process is not null);
+
+        hostInfo.SuspensionState = HostSuspensionState.None;
+        hostInfo.SuspensionStateChangeTime = DateTime.UtcNow;
+
+        if (_mode == HostSuspensionMode.Cgroups)
+        {
+            // A restarted host reuses the same cgroup, it could have been frozen when the previous process died
+            var path = GetHostCgroupPath(hostInfo);
+            try
+            {
+                Directory.CreateDirectory(path);
+            }
+            catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+            {
+                _logger.LogWarning("Cannot create the cgroup for {HostId}: {Message}", hostInfo.Id, e.Message);
+            }
+
+            TryWriteCgroupFile(path, "cgroup.freeze", "0");
+            TryWriteCgroupFile(path, "cpu.max", $"max {CpuPeriodUs}");
+            TryWriteCgroupFile(path, "cgroup.procs", hostInfo.Process.Id.ToString());
+        }
+
+        if (hostInfo.Priority == HostPriority.Low)
+            TrySetPriority(hostInfo, ProcessPriorityClass.BelowNormal);
+    }
+
+    public bool Throttle(HostInfo hostInfo)
+    {
+        Debug.Assert(hostInfo.SuspensionState == HostSuspensionState.None);
+
+        bool done = _mode switch
+        {
+            HostSuspensionMode.Cgroups => TryWriteCgroupFile(GetHostCgroupPath(hostInfo), "cpu.max", $"{CpuPeriodUs * _settings.CoordinatorThrottledHostCpuPercentage / 100} {CpuPeriodUs}"),
+            HostSuspensionMode.Signals => TrySetPriority(hostInfo, ProcessPriorityClass.Idle),
+            _ => false,
+        };
+
+        return ChangeState(hostInfo, done, HostSuspensionState.Throttled);
+    }
+
+    public bool Suspend(HostInfo hostInfo)
+    {
+        Debug.Assert(hostInfo.SuspensionState == HostSuspensionState.Throttled);
+
+        bool done = _mode == HostSuspensionMode.Cgroups
+            ? TryWriteCgroupFile(GetHostCgroupPath(hostInfo), "cgroup.freeze", "1")
+            : TrySendSignal(hostInfo, SigStop);
+
+        return ChangeState(hostInfo, done, HostSuspensionState.Suspended);
+    }
+
+    // One step back: a suspended host is resumed but it's still throttled
+    public bool Resume(HostInfo hostInfo)
+    {
+        switch (hostInfo.SuspensionState)
+        {
+            case HostSuspensionState.Suspended:
+                bool resumed = _mode == HostSuspensionMode.Cgroups
+                    ? TryWriteCgroupFile(GetHostCgroupPath(hostInfo), "cgroup.freeze", "0")
+                    : TrySendSignal(hostInfo, SigCont);
+                return ChangeState(hostInfo, resumed, HostSuspensionState.Throttled);
+
+            case HostSuspensionState.Throttled:
+                // If it fails the host is still throttled, we try again at the next decision
+                bool restored = _mode == HostSuspensionMode.Cgroups
+                    ? TryWriteCgroupFile(GetHostCgroupPath(hostInfo), "cpu.max", $"max {CpuPeriodUs}")
+                    : TrySetPriority(hostInfo, hostInfo.Priority == HostPriority.Low ? ProcessPriorityClass.BelowNormal : ProcessPriorityClass.Normal);
+
+                return ChangeState(hostInfo, restored, HostSuspensionState.None);
+
+            default:
+                return false;
+        }
+    }
+
+    // Before asking a host to quit: a suspended host cannot answer
+    public void ResumeCompletely(HostInfo hostInfo)
+    {
+        while (hostInfo.SuspensionState != HostSuspensionState.None)
+        {
+            if (!Resume(hostInfo))
+                break;
+        }
+    }
+
+    private const int CpuPeriodUs = 100_000;
+    private const int SigCont = 18;
+    private const int SigStop = 19;
+    private const int PrioProcess = 0;
+    private const int Esrch = 3;
+    private const int CapSysNice = 23;
+    private const string CgroupRootPath = "/sys/fs/cgroup";
+
+    private readonly ILogger<HostProcessControl> _logger = logger;
+    private readonly Settings _settings = settings;
+    private HostSuspensionMode _mode = settings.CoordinatorHostSuspensionMode;
+    private string _cgroupPath = "";
+
+    [DllImport("libc", SetLastError = true)]
+    private static extern int kill(int pid, int sig);
+
+    [DllImport("libc", SetLastError = true)]
+    private static extern int setpriority(int which, int who, int prio);
+
+    private bool ChangeState(HostInfo hostInfo, bool done, HostSuspensionState newState)
+    {
+        if (!done)
+            return false;
+
+        _logger.LogInformation("Host {HostId} is now {State} (it was {PreviousState}).", hostInfo.Id, newState, hostInfo.SuspensionState);
+        hostInfo.SuspensionState = newState;
+        hostInfo.SuspensionStateChangeTime = DateTime.UtcNow;
+        return true;
+    }
+
+    // In cgroup v2 a cgroup with processes cannot enable controllers for its children: we move ourselves
+    // to a child cgroup and each host (created later) goes to a sibling.
+    private bool TryCreateCgroupHierarchy()
+    {
+        if (!LinuxResourcesReader.IsCgroupV2Supported)
+            return false;
+
+        try
+        {
+            // It's "0::<PATH>" for cgroup v2
+            var line = File.ReadLines("/proc/self/cgroup").FirstOrDefault(x => x.StartsWith("0::"));
+            if (line is null)
+                return false;
+
+            _cgroupPath = Path.Join(CgroupRootPath, line[3..]);
+
+            var coordinatorPath = Path.Join(_cgroupPath, "tinkwell-coordinator");
+            Directory.CreateDirectory(coordinatorPath);
+            File.WriteAllText(Path.Join(coordinatorPath, "cgroup.procs"), Environment.ProcessId.ToString());
+            File.WriteAllText(Path.Join(_cgroupPath, "cgroup.subtree_control"), "+cpu");
+
+            return true;
+        }
+        catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+        {
+            _logger.LogDebug(e, "Cannot configure the cgroup hierarchy: {Message}", e.Message);
+            return false;
+        }
+    }
+
+    private string GetHostCgroupPath(HostInfo hostInfo)
+        => Path.Join(_cgroupPath, $"tinkwell-{hostInfo.Id}");
+
+    private bool TryWriteCgroupFile(string cgroupPath, string fileName, string value)
+    {
+        try
+        {
+            File.WriteAllText(Path.Join(cgroupPath, fileName), value);
+            return true;
+        }
+        catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+        {
+            _logger.LogWarning("Cannot write {Value} to {File}: {Message}", value, Path.Join(cgroupPath, fileName), e.Message);
+            return false;
+        }
+    }
+
+    private bool TrySetPriority(HostInfo hostInfo, ProcessPriorityClass priorityClass)
+    {
+        if (OperatingSystem.IsLinux())
+            return TrySetNiceValue(hostInfo, ToNiceValue(priorityClass));
+
+        try
+        {
+            if (hostInfo.Process is null)
+                return false;
+
+            hostInfo.Process.PriorityClass = priorityClass;
+            return true;
+        }
+        catch (Exception e) when (e is Win32Exception || e is InvalidOperationException)
+        {
+            _logger.LogWarning("Cannot change the priority of {HostId} to {Priority}: {Message}", hostInfo.Id, priorityClass, e.Message);
+            return false;
+        }
+    }
+
+    // On Linux the nice value is per thread (and Process.PriorityClass changes only the main one): we change all
+    // of them, threads created later inherit it from their creator.
+    private bool TrySetNiceValue(HostInfo hostInfo, int niceValue)
+    {
+        if (hostInfo.Process is null || hostInfo.Process.HasExited)
+            return false;
+
+        string[] threads;
+        try
+        {
+            threads = Directory.GetDirectories($"/proc/{hostInfo.Process.Id}/task");
+        }
+        catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+        {
+            _logger.LogWarning("Cannot enumerate the threads of {HostId}: {Message}", hostInfo.Id, e.Message);
+            return false;
+        }
+
+        foreach (var thread in threads)
+        {
+            // A thread could exit in the meantime
+            if (setpriority(PrioProcess, int.Parse(Path.GetFileName(thread)), niceValue) != 0 && Marshal.GetLastPInvokeError() != Esrch)
+            {
+                _logger.LogWarning("Cannot change the nice value of {HostId} to {NiceValue}: error {Error}", hostInfo.Id, niceValue, Marshal.GetLastPInvokeError());
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    private static int ToNiceValue(ProcessPriorityClass priorityClass) => priorityClass switch
+    {
+        ProcessPriorityClass.Idle => 19,
+        ProcessPriorityClass.BelowNormal => 10,
+        ProcessPriorityClass.AboveNormal => -5,
+        ProcessPriorityClass.High => -10,
+        ProcessPriorityClass.RealTime => -20,
+        _ => 0,
+    };
+
+    // Lowering the nice value (to resume a throttled host) requires CAP_SYS_NICE or a soft RLIMIT_NICE of at
+    // least 20 (the lowest value it allows is 20 - RLIMIT_NICE).
+    private bool CanRestorePriority()
+    {
+        try
+        {
+            var capabilities = File.ReadLines("/proc/self/status").FirstOrDefault(x => x.StartsWith("CapEff:"));
+            if (capabilities is not null && (Convert.ToUInt64(capabilities["CapEff:".Length..].Trim(), 16) & (1UL << CapSysNice)) != 0)
+                return true;
+
+            // "Max nice priority         <SOFT>               <HARD>"
+            var limit = File.ReadLines("/proc/self/limits").FirstOrDefault(x => x.StartsWith("Max nice priority"));
+            var softLimit = limit?["Max nice priority".Length..].Split(' ', StringSplitOptions.RemoveEmptyEntries).FirstOrDefault();
+            return softLimit == "unlimited" || (int.TryParse(softLimit, out int value) && value >= 20);
+        }
+        catch (Exception e) when (e is IOException || e is UnauthorizedAccessException || e is FormatException)
+        {
+            _logger.LogDebug(e, "Cannot read the capabilities of the process: {Message}", e.Message);
+            return false;
+        }
+    }
+
+    private bool TrySendSignal(HostInfo hostInfo, int signal)
+    {
+        if (!OperatingSystem.IsLinux() || hostInfo.Process is null || hostInfo.Process.HasExited)
+            return false;
+
+        if (kill(hostInfo.Process.Id, signal) == 0)
+            return true;
+
+        _logger.LogWarning("Cannot send signal {Signal} to {HostId}: error {Error}", signal, hostInfo.Id, Marshal.GetLastPInvokeError());
+        return false;
+    }
+}
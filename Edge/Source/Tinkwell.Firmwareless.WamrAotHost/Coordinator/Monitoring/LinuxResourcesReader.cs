@@ -0,0 +1,181 @@
+using System.Buffers.Text;
+using System.Runtime.InteropServices;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
+
+readonly record struct ProcessResourcesSample(TimeSpan CpuTime, long ResidentSetBytes);
+
+readonly record struct ContainerResourcesSample(
+    TimeSpan CpuTime,
+    double AvailableCpus,
+    long MemoryUsageBytes,
+    long? MemoryLimitBytes,
+    double? CpuPressure,
+    double? MemoryPressure);
+
+// Reads the resources used by a process (from /proc/<pid>/stat) and by the whole container (from the
+// cgroup v2 counters). These are plain text files: we read them into a stack buffer and parse the few
+// numbers we need, without the allocations (and the dozens of syscalls) of Process.Refresh().
+static class LinuxResourcesReader
+{
+    public static bool IsSupported
+        => OperatingSystem.IsLinux();
+
+    public static bool IsCgroupV2Supported
+        => _isCgroupV2Supported;
+
+    public static bool TryReadProcess(int processId, out ProcessResourcesSample sample)
+    {
+        sample = default;
+
+        Span<byte> buffer = stackalloc byte[1024];
+        if (!TryReadFile($"/proc/{processId}/stat", buffer, out var content))
+            return false;
+
+        // The name of the executable (second field) could contain spaces and parentheses, we start
+        // after the last ')': the first field there is the state (the third one in the documentation).
+        int nameEnd = content.LastIndexOf((byte)')');
+        if (nameEnd == -1 || nameEnd + 2 >= content.Length)
+            return false;
+
+        var fields = content[(nameEnd + 2)..];
+        long userTicks = 0, systemTicks = 0;
+        for (int fieldIndex = StateFieldIndex; !fields.IsEmpty; ++fieldIndex)
+        {
+            int separator = fields.IndexOf((byte)' ');
+            var field = separator == -1 ? fields : fields[..separator];
+            fields = separator == -1 ? default : fields[(separator + 1)..];
+
+            if (fieldIndex == UserTimeFieldIndex && !Utf8Parser.TryParse(field, out userTicks, out _))
+                return false;
+
+            if (fieldIndex == SystemTimeFieldIndex && !Utf8Parser.TryParse(field, out systemTicks, out _))
+                return false;
+
+            if (fieldIndex == ResidentSetFieldIndex)
+            {
+                if (!Utf8Parser.TryParse(field, out long residentPages, out _))
+                    return false;
+
+                sample = new(
+                    TimeSpan.FromSeconds((double)(userTicks + systemTicks) / _clockTicksPerSecond),
+                    residentPages * Environment.SystemPageSize);
+
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    public static bool TryReadContainer(out ContainerResourcesSample sample)
+    {
+        sample = default;
+
+        if (!_isCgroupV2Supported)
+            return false;
+
+        Span<byte> buffer = stackalloc byte[1024];
+
+        if (!TryReadFile(CgroupPath + "cpu.stat", buffer, out var content) || !TryParseKeyValue(content, "usage_usec"u8, out long cpuUsageUs))
+            return false;
+
+        if (!TryReadFile(CgroupPath + "memory.current", buffer, out content) || !Utf8Parser.TryParse(content, out long memoryUsage, out _))
+            return false;
+
+        long? memoryLimit = null;
+        if (TryReadFile(CgroupPath + "memory.max", buffer, out content) && Utf8Parser.TryParse(content, out long limit, out _))
+            memoryLimit = limit; // Otherwise it's "max"
+
+        double availableCpus = Environment.ProcessorCount;
+        if (TryReadFile(CgroupPath + "cpu.max", buffer, out content))
+        {
+            // "<quota> <period>" or "max <period>"
+            int separator = content.IndexOf((byte)' ');
+            if (separator != -1
+                && Utf8Parser.TryParse(content[..separator], out long quota, out _)
+                && Utf8Parser.TryParse(content[(separator + 1)..], out long period, out _)
+                && period > 0)
+            {
+                availableCpus = Math.Min(availableCpus, (double)quota / period);
+            }
+        }
+
+        sample = new(
+            TimeSpan.FromMicroseconds(cpuUsageUs),
+            availableCpus,
+            memoryUsage,
+            memoryLimit,
+            ReadPressure(CgroupPath + "cpu.pressure", buffer),
+            ReadPressure(CgroupPath + "memory.pressure", buffer));
+
+        return true;
+    }
+
+    private const string CgroupPath = "/sys/fs/cgroup/";
+    private const int StateFieldIndex = 3;
+    private const int UserTimeFieldIndex = 14;
+    private const int SystemTimeFieldIndex = 15;
+    private const int ResidentSetFieldIndex = 24;
+    private const int ClockTicksPerSecondName = 2; // _SC_CLK_TCK
+
+    private static readonly bool _isCgroupV2Supported = IsSupported && File.Exists(CgroupPath + "cgroup.controllers");
+    private static readonly long _clockTicksPerSecond = IsSupported ? GetClockTicksPerSecond() : 100;
+
+    [DllImport("libc", SetLastError = true)]
+    private static extern long sysconf(int name);
+
+    private static long GetClockTicksPerSecond()
+    {
+        long value = sysconf(ClockTicksPerSecondName);
+        return value > 0 ? value : 100;
+    }
+
+    private static bool TryReadFile(string path, Span<byte> buffer, out ReadOnlySpan<byte> content)
+    {
+        try
+        {
+            using var handle = File.OpenHandle(path);
+            int length = RandomAccess.Read(handle, buffer, 0);
+            content = buffer[..length].TrimEnd((byte)'\n');
+            return true;
+        }
+        catch (Exception e) when (e is IOException || e is UnauthorizedAccessException)
+        {
+            // The process exited, the controller isn't enabled for this cgroup...
+            content = default;
+            return false;
+        }
+    }
+
+    // Files like cpu.stat contain one "<key> <value>" pair for each line
+    private static bool TryParseKeyValue(ReadOnlySpan<byte> content, ReadOnlySpan<byte> key, out long value)
+    {
+        while (!content.IsEmpty)
+        {
+            int separator = content.IndexOf((byte)'\n');
+            var line = separator == -1 ? content : content[..separator];
+            content = separator == -1 ? default : content[(separator + 1)..];
+
+            if (line.Length > key.Length && line.StartsWith(key) && line[key.Length] == (byte)' ')
+                return Utf8Parser.TryParse(line[(key.Length + 1)..], out value, out _);
+        }
+
+        value = 0;
+        return false;
+    }
+
+    // Pressure stall information: "some avg10=1.23 avg60=..." is the percentage of time (over the last
+    // ten seconds) in which at least one task was waiting for the resource.
+    private static double? ReadPressure(string path, Span<byte> buffer)
+    {
+        if (!TryReadFile(path, buffer, out var content))
+            return null;
+
+        ReadOnlySpan<byte> prefix = "some avg10="u8;
+        if (!content.StartsWith(prefix))
+            return null;
+
+        return Utf8Parser.TryParse(content[prefix.Length..], out double value, out _) ? value : null;
+    }
+}
@@ -0,0 +1,147 @@
+using static Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring.SystemResourcesUsageArbiter;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
+
+readonly record struct SystemLoad(double? CpuUsagePercentage, double? CpuPressure, double? MemoryPressure);
+
+readonly record struct HostLoad(
+    string HostId,
+    HostPriority Priority,
+    HostSuspensionState State,
+    TimeSpan TimeInState,
+    double CpuUsagePercentage,
+    double MemoryUsagePercentage,
+    double MessagesPerSecond);
+
+// Decides which host to throttle, suspend or resume when the whole system is overloaded. A host moves one step
+// at a time (None -> Throttled -> Suspended and back) and, after each decision, we wait for its effect to show up
+// in the (averaged) samples. There are two thresholds (to enter and to leave the overloaded state), a host stays
+// in a state for a minimum time and it's resumed only when there is room for what it used before being throttled:
+// we do not flap when the load hovers around a limit. It does not touch any process: it's fed with samples (real
+// ones or a synthetic trace, see Tinkwell.Firmwareless.Tools.LoadSimulation) and it returns a decision.
+sealed class LoadScheduler(Settings settings, bool canSuspend)
+{
+    public bool IsOverloaded { get; private set; }
+
+    public (Decision Decision, string HostId)? Schedule(SystemLoad system, IReadOnlyList<HostLoad> hosts)
+    {
+        if (system.CpuUsagePercentage is null && system.CpuPressure is null && system.MemoryPressure is null)
+            return null;
+
+        bool isHighLoad = Exceeds(system,
+            _settings.CoordinatorSystemHighCpuUsagePercentage, _settings.CoordinatorSystemHighPressurePercentage);
+
+        bool isLowLoad = !Exceeds(system,
+            _settings.CoordinatorSystemLowCpuUsagePercentage, _settings.CoordinatorSystemLowPressurePercentage);
+
+        IsOverloaded = IsOverloaded ? !isLowLoad : isHighLoad;
+
+        if (++_ticksSinceLastDecision <= SettlingTicks)
+            return null;
+
+        if (IsOverloaded)
+        {
+            // A throttled host is still responsive, we suspend only when all the candidates are throttled already
+            var victim = SelectVictim(hosts, HostSuspensionState.None);
+            if (victim is not null)
+            {
+                _cpuUsageBeforeThrottling[victim.Value.HostId] = victim.Value.CpuUsagePercentage;
+                return Decide(Decision.Throttle, victim.Value);
+            }
+
+            if (!_canSuspend)
+                return null;
+
+            victim = SelectVictim(hosts, HostSuspensionState.Throttled);
+            if (victim is not null)
+                return Decide(Decision.Suspend, victim.Value);
+
+            return null;
+        }
+
+        // Between the two thresholds we leave things as they are, resuming a host could bring us back over the limit
+        if (!isLowLoad)
+            return null;
+
+        var candidate = SelectHostToResume(hosts, system);
+        if (candidate is not null)
+        {
+            if (candidate.Value.State == HostSuspensionState.Throttled)
+                _cpuUsageBeforeThrottling.Remove(candidate.Value.HostId);
+
+            return Decide(Decision.Resume, candidate.Value);
+        }
+
+        return null;
+    }
+
+    private readonly Settings _settings = settings;
+    private readonly bool _canSuspend = canSuspend;
+    private readonly Dictionary<string, double> _cpuUsageBeforeThrottling = new();
+    private int _ticksSinceLastDecision = SettlingTicks;
+
+    // Averages need a couple of samples to reflect a change
+    private const int SettlingTicks = 2;
+
+    private TimeSpan MinimumTimeInState
+        => TimeSpan.FromMilliseconds(2 * _settings.CoordinatorMonitoringIntervalMs);
+
+    private (Decision Decision, string HostId) Decide(Decision decision, HostLoad host)
+    {
+        _ticksSinceLastDecision = 0;
+        return (decision, host.HostId);
+    }
+
+    private static bool Exceeds(SystemLoad system, double cpuUsageLimit, double pressureLimit)
+        => system.CpuUsagePercentage > cpuUsageLimit || system.CpuPressure > pressureLimit || system.MemoryPressure > pressureLimit;
+
+    // The first victim has the lowest priority then we prefer hosts which cost the most and do the least
+    // (a firmlet exchanging many messages is probably doing something useful for someone).
+    private HostLoad? SelectVictim(IReadOnlyList<HostLoad> hosts, HostSuspensionState state)
+    {
+        HostLoad? result = null;
+        foreach (var host in hosts)
+        {
+            if (host.State != state || host.Priority == HostPriority.Critical || host.TimeInState < MinimumTimeInState)
+                continue;
+
+            if (result is null
+                || host.Priority < result.Value.Priority
+                || (host.Priority == result.Value.Priority && Cost(host) > Cost(result.Value)))
+            {
+                result = host;
+            }
+        }
+
+        return result;
+    }
+
+    // The opposite of SelectVictim: suspended hosts first (they're doing nothing at all), then the most important
+    private HostLoad? SelectHostToResume(IReadOnlyList<HostLoad> hosts, SystemLoad system)
+    {
+        HostLoad? result = null;
+        foreach (var host in hosts)
+        {
+            if (host.State == HostSuspensionState.None || host.TimeInState < MinimumTimeInState)
+                continue;
+
+            // Without CPU usage (only pressure) we cannot guess, it's going to be throttled again if needed
+            double required = _cpuUsageBeforeThrottling.GetValueOrDefault(host.HostId);
+            if (system.CpuUsagePercentage + required >= _settings.CoordinatorSystemLowCpuUsagePercentage)
+                continue;
+
+            if (result is null
+                || host.State > result.Value.State
+                || (host.State == result.Value.State && host.Priority > result.Value.Priority)
+                || (host.State == result.Value.State && host.Priority == result.Value.Priority && Cost(host) < Cost(result.Value)))
+            {
+                result = host;
+            }
+        }
+
+        return result;
+    }
+
+    private static double Cost(HostLoad host)
+        => (host.CpuUsagePercentage + host.MemoryUsagePercentage) / (1 + host.MessagesPerSecond);
+}
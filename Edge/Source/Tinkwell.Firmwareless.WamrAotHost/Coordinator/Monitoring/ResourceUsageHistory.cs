@@ -0,0 +1,96 @@
+using System.Diagnostics;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
+
+// Recent resource usage samples of a host (or of the whole container). They're kept in a ring buffer,
+// one array for each metric, and the moving averages are updated when a sample is added: the arbiter
+// reads them on every tick and they do not need to be recomputed from the whole history.
+sealed class ResourceUsageHistory
+{
+    public ResourceUsageHistory(int capacity)
+    {
+        Debug.Assert(capacity > 0);
+
+        _cpuUsagePercentage = new double[capacity];
+        _memoryUsagePercentage = new double[capacity];
+        _memoryUsageBytes = new long[capacity];
+    }
+
+    public int Count
+        => _count;
+
+    public double? CpuUsagePercentage
+        => _count == 0 ? null : _cpuUsagePercentage[LastIndex];
+
+    public double? MemoryUsagePercentage
+        => _count == 0 || double.IsNaN(_memoryUsagePercentage[LastIndex]) ? null : _memoryUsagePercentage[LastIndex];
+
+    public long? MemoryUsageBytes
+        => _count == 0 ? null : _memoryUsageBytes[LastIndex];
+
+    public double? CpuUsageAverage { get; private set; }
+
+    public double? MemoryUsageAverage { get; private set; }
+
+    public double? PeakCpuUsagePercentage
+        => Max(_cpuUsagePercentage);
+
+    public double? PeakMemoryUsagePercentage
+        => Max(_memoryUsagePercentage);
+
+    // CPU usage is the difference between two readings of the CPU time, this is the last one.
+    public CpuTimeSample? LastCpuTime { get; set; }
+
+    public void Add(double cpuUsagePercentage, long memoryUsageBytes, double? memoryUsagePercentage)
+    {
+        _cpuUsagePercentage[_next] = cpuUsagePercentage;
+        _memoryUsagePercentage[_next] = memoryUsagePercentage ?? double.NaN;
+        _memoryUsageBytes[_next] = memoryUsageBytes;
+
+        _next = (_next + 1) % _cpuUsagePercentage.Length;
+        _count = Math.Min(_count + 1, _cpuUsagePercentage.Length);
+
+        CpuUsageAverage = UpdateAverage(CpuUsageAverage, cpuUsagePercentage, CpuUsageSmoothingFactor);
+        if (memoryUsagePercentage is not null)
+            MemoryUsageAverage = UpdateAverage(MemoryUsageAverage, memoryUsagePercentage.Value, MemoryUsageSmoothingFactor);
+    }
+
+    public void Clear()
+    {
+        _count = 0;
+        _next = 0;
+        CpuUsageAverage = null;
+        MemoryUsageAverage = null;
+        LastCpuTime = null;
+    }
+
+    // CPU usage is more erratic than memory usage, a single spike should not be enough to kill a host
+    private const double CpuUsageSmoothingFactor = 0.65;
+    private const double MemoryUsageSmoothingFactor = 0.75;
+
+    private readonly double[] _cpuUsagePercentage;
+    private readonly double[] _memoryUsagePercentage;
+    private readonly long[] _memoryUsageBytes;
+    private int _next;
+    private int _count;
+
+    private int LastIndex
+        => (_next + _cpuUsagePercentage.Length - 1) % _cpuUsagePercentage.Length;
+
+    private static double UpdateAverage(double? average, double value, double alpha)
+        => average is null ? value : (1 - alpha) * average.Value + alpha * value;
+
+    private double? Max(double[] values)
+    {
+        double? result = null;
+        for (int i = 0; i < _count; ++i)
+        {
+            if (!double.IsNaN(values[i]) && (result is null || values[i] > result))
+                result = values[i];
+        }
+
+        return result;
+    }
+}
+
+readonly record struct CpuTimeSample(long Timestamp, TimeSpan CpuTime);
@@ -1,49 +1,118 @@
+using System.Diagnostics;
+using System.Diagnostics.Metrics;
+
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
 
-static class ResourcesUsageMeter
+// Samples the resources used by each host (and by the whole container) on every monitoring tick. CPU usage
+// is measured between two consecutive ticks, we never wait for a second reading. On Linux we read the
+// counters directly from procfs and cgroup v2, elsewhere we fall back to Process. The same values are
+// exported as metrics (for example "dotnet-counters monitor --counters Tinkwell.Firmwareless.Resources").
+sealed class ResourcesUsageMeter : IDisposable
 {
-    public static async Task CollectAsync(IEnumerable<HostInfo> hosts)
+    public const string MeterName = "Tinkwell.Firmwareless.Resources";
+    public const int HistorySize = 5;
+
+    public ResourcesUsageMeter(FirmletsRepository repository)
+    {
+        _repository = repository;
+        _meter = new Meter(MeterName);
+        _meter.CreateObservableGauge("tw.host.cpu_usage", () => ObserveHosts(x => x.CpuUsagePercentage), "%", "CPU usage of each host, relative to all the CPUs.");
+        _meter.CreateObservableGauge("tw.host.memory_usage", () => ObserveHosts(x => x.MemoryUsageBytes), "By", "Resident memory of each host.");
+        _meter.CreateObservableGauge("tw.container.cpu_usage", () => Observe(Container.CpuUsagePercentage), "%", "CPU usage of the container, relative to its quota.");
+        _meter.CreateObservableGauge("tw.container.memory_usage", () => Observe(Container.MemoryUsagePercentage), "%", "Memory usage of the container, relative to its limit.");
+        _meter.CreateObservableGauge("tw.container.cpu_pressure", () => Observe(CpuPressure), "%", "Time in which at least one task was waiting for a CPU (last 10 seconds).");
+        _meter.CreateObservableGauge("tw.container.memory_pressure", () => Observe(MemoryPressure), "%", "Time in which at least one task was stalled on memory (last 10 seconds).");
+    }
+
+    // Only available with cgroup v2, otherwise it's always empty
+    public ResourceUsageHistory Container { get; } = new(HistorySize);
+
+    public double? CpuPressure { get; private set; }
+
+    public double? MemoryPressure { get; private set; }
+
+    public void Collect()
     {
-        Dictionary<string, CpuUsage> cpuStats = new();
-        foreach (var hostInfo in hosts)
+        long now = Stopwatch.GetTimestamp();
+
+        foreach (var hostInfo in _repository.Hosts)
         {
             if (hostInfo.Process is null || hostInfo.Process.HasExited)
                 continue;
 
-            cpuStats.Add(hostInfo.Id, new CpuUsage(DateTime.UtcNow, hostInfo.Process.TotalProcessorTime));
+            if (TryReadProcess(hostInfo.Process, out var sample))
+                Update(hostInfo.UsageData, now, sample.CpuTime, Environment.ProcessorCount, sample.ResidentSetBytes, _totalPhysicalMemory);
         }
 
-        await Task.Delay(1000);
-
-        foreach (var hostInfo in hosts)
+        if (LinuxResourcesReader.TryReadContainer(out var container))
         {
-            if (hostInfo.Process is null || hostInfo.Process.HasExited)
-                continue;
+            Update(Container, now, container.CpuTime, container.AvailableCpus, container.MemoryUsageBytes, container.MemoryLimitBytes ?? _totalPhysicalMemory);
+            CpuPressure = container.CpuPressure;
+            MemoryPressure = container.MemoryPressure;
+        }
+    }
 
-            if (!cpuStats.TryGetValue(hostInfo.Id, out var stats))
-                continue; // New process
+    public void Dispose()
+        => _meter.Dispose();
 
-            hostInfo.Process.Refresh();
+    private readonly FirmletsRepository _repository;
+    private readonly Meter _meter;
 
-            hostInfo.UsageData.CpuUsagePercentage.Push(
-                CalculateCpuUsage(DateTime.UtcNow - stats.Timestamp, stats.TotalProcessorTime, hostInfo.Process.TotalProcessorTime));
+    private readonly static long? _totalPhysicalMemory = (long?)PlatformUtils.GetTotalPhysicalMemory();
 
-            if (_totalPhysicalMemory is not null)
-                hostInfo.UsageData.MemoryUsagePercentage.Push(CalculateMemoryUsage(hostInfo.Process.WorkingSet64));
+    private static bool TryReadProcess(Process process, out ProcessResourcesSample sample)
+    {
+        if (LinuxResourcesReader.IsSupported)
+            return LinuxResourcesReader.TryReadProcess(process.Id, out sample);
+
+        try
+        {
+            process.Refresh();
+            sample = new(process.TotalProcessorTime, process.WorkingSet64);
+            return true;
+        }
+        catch (InvalidOperationException)
+        {
+            // It exited in the meantime
+            sample = default;
+            return false;
         }
     }
 
-    private static double CalculateCpuUsage(TimeSpan interval, TimeSpan firstProcessorTime, TimeSpan secondProcessorTime)
+    private static void Update(ResourceUsageHistory history, long timestamp, TimeSpan cpuTime, double availableCpus, long memoryUsage, long? totalMemory)
     {
-        double cpuUsed = (secondProcessorTime - firstProcessorTime).TotalMilliseconds;
-        double cpuUsageTotal = cpuUsed / (interval.TotalMilliseconds * Environment.ProcessorCount) * 100;
-        return Math.Clamp(Math.Round(cpuUsageTotal, 1), 0, 100);
+        var previous = history.LastCpuTime;
+        history.LastCpuTime = new(timestamp, cpuTime);
+
+        // The first reading is only the baseline for the next one
+        if (previous is null)
+            return;
+
+        var interval = Stopwatch.GetElapsedTime(previous.Value.Timestamp, timestamp);
+        if (interval <= TimeSpan.Zero || availableCpus <= 0)
+            return;
+
+        double cpuUsage = (cpuTime - previous.Value.CpuTime).TotalMilliseconds / (interval.TotalMilliseconds * availableCpus) * 100;
+        double? memoryUsagePercentage = totalMemory is null or 0 ? null : Percentage((double)memoryUsage / totalMemory.Value * 100); // Precision for long->double isn't an issue here
+
+        history.Add(Percentage(cpuUsage), memoryUsage, memoryUsagePercentage);
     }
 
-    private static double CalculateMemoryUsage(long workingSet)
-        => Math.Round(Math.Clamp((double)workingSet / _totalPhysicalMemory!.Value, 0, 100), 1); // Precision for long->double isn't an issue here
+    private static double Percentage(double value)
+        => Math.Clamp(Math.Round(value, 1), 0, 100);
 
-    private record CpuUsage(DateTime Timestamp, TimeSpan TotalProcessorTime);
+    private IEnumerable<Measurement<double>> ObserveHosts(Func<ResourceUsageHistory, double?> selector)
+    {
+        foreach (var hostInfo in _repository.Hosts)
+        {
+            if (selector(hostInfo.UsageData) is double value)
+                yield return new(value, new KeyValuePair<string, object?>("host", hostInfo.Id));
+        }
+    }
 
-    private readonly static ulong? _totalPhysicalMemory = PlatformUtils.GetTotalPhysicalMemory();
+    private static IEnumerable<Measurement<double>> Observe(double? value)
+    {
+        if (value is not null)
+            yield return new(value.Value);
+    }
 }
@@ -1,34 +1,99 @@
+using System.Diagnostics;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Monitoring;
 
-sealed class SystemResourcesUsageArbiter(Settings settings)
+sealed class SystemResourcesUsageArbiter(Settings settings, ResourcesUsageMeter meter, IMqttQueue queue, HostProcessControl control)
 {
     public enum Decision
     {
         None,
+        Throttle,
         Suspend,
+        Resume,
         Terminate
     }
 
     public IEnumerable<(Decision Decision, HostInfo HostInfo)> Assess(IEnumerable<HostInfo> hosts)
     {
+        var candidates = new Dictionary<string, HostInfo>();
+        var loads = new List<HostLoad>();
+        var now = DateTime.UtcNow;
+
         foreach (var host in hosts)
         {
             if (host.Process is null || host.Process.HasExited)
+            {
                 yield return (Decision.None, host);
+                continue;
+            }
 
             if (host.Ready == false || host.Terminating)
+            {
                 yield return (Decision.None, host);
+                continue;
+            }
 
-            if (host.UsageData.CpuUsagePercentage.ExponentialMovingAverage(0.65) > _settings.CoordinatorMaxHostCpuUsagePercentage)
-                yield return(Decision.Terminate, host);
+            // Averages are updated by ResourcesUsageMeter with each sample, reading them is free
+            if (host.UsageData.CpuUsageAverage > _settings.CoordinatorMaxHostCpuUsagePercentage)
+            {
+                yield return (Decision.Terminate, host);
+                continue;
+            }
 
-            if (host.UsageData.MemoryUsagePercentage.ExponentialMovingAverage(0.75) > _settings.CoordinatorMaxHostMemoryUsagePercentage)
+            if (host.UsageData.MemoryUsageAverage > _settings.CoordinatorMaxHostMemoryUsagePercentage)
+            {
                 yield return (Decision.Terminate, host);
+                continue;
+            }
+
+            candidates.Add(host.Id, host);
+            loads.Add(new HostLoad(
+                host.Id,
+                host.Priority,
+                host.SuspensionState,
+                now - host.SuspensionStateChangeTime,
+                host.UsageData.CpuUsageAverage ?? 0,
+                host.UsageData.MemoryUsageAverage ?? 0,
+                MeasureActivity(host)));
         }
 
-        // TODO: check if the system is under heavy load and suspend hosts accordingly
-        // (oldest one first or by resource usage or by activity - if we can get that anywhere, maybe tracking messages)
+        if (!_control.IsEnabled)
+            yield break;
+
+        // Without cgroup v2 we do not know the load of the container, the sum of the hosts is a good approximation
+        var system = new SystemLoad(
+            _meter.Container.CpuUsageAverage ?? (loads.Count == 0 ? null : loads.Sum(x => x.CpuUsagePercentage)),
+            _meter.CpuPressure,
+            _meter.MemoryPressure);
+
+        var decision = _scheduler.Schedule(system, loads);
+        if (decision is not null)
+            yield return (decision.Value.Decision, candidates[decision.Value.HostId]);
     }
 
     private readonly Settings _settings = settings;
-}
\ No newline at end of file
+    private readonly ResourcesUsageMeter _meter = meter;
+    private readonly IMqttQueue _queue = queue;
+    private readonly HostProcessControl _control = control;
+    private readonly LoadScheduler _scheduler = new(settings, control.CanSuspend);
+    private readonly Dictionary<string, (long Count, long Timestamp)> _deliveredMessages = new();
+
+    // Messages per second exchanged with the host since the previous assessment
+    private double MeasureActivity(HostInfo host)
+    {
+        long count = _queue.GetDeliveredMessageCount(host.Id);
+        long timestamp = Stopwatch.GetTimestamp();
+
+        double rate = 0;
+        if (_deliveredMessages.TryGetValue(host.Id, out var previous))
+        {
+            var elapsed = Stopwatch.GetElapsedTime(previous.Timestamp, timestamp);
+            if (elapsed > TimeSpan.Zero && count >= previous.Count)
+                rate = (count - previous.Count) / elapsed.TotalSeconds;
+        }
+
+        _deliveredMessages[host.Id] = (count, timestamp);
+        return rate;
+    }
+}
@@ -1,10 +1,19 @@
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 
+// Messages are queued per host (see MqttHostQueue): a slow (or chatty) host does not delay the others.
 interface IMqttQueue
 {
-    void EnqueueOutgoingMessage(MqttMessage message);
+    void EnqueueOutgoingMessage(string hostId, MqttMessage message);
 
-    void EnqueueIncomingMessage(MqttMessage message);
+    void EnqueueIncomingMessage(string hostId, MqttMessage message);
 
-    Task<MqttMessageWithDirection> DequeueAsync(CancellationToken cancellationToken);
+    // Messages delivered to and from the host so far, used to estimate how active it is
+    long GetDeliveredMessageCount(string hostId);
+
+    // Returns the queue of a host when it's created (the first time a message is queued for it),
+    // each queue is returned only once.
+    ValueTask<MqttHostQueue> DequeueNewHostQueueAsync(CancellationToken cancellationToken);
+
+    // Called when the host exits, the next message for the same host ID (when it's restarted) creates a new queue
+    void RemoveHostQueue(string hostId);
 }
@@ -0,0 +1,91 @@
+using Microsoft.Extensions.Logging;
+using System.Diagnostics;
+using System.Threading.Channels;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+
+readonly record struct QueuedMqttMessage(MqttMessage Message, long Timestamp);
+
+// Messages to and from a single host. Queues are bounded: when a host (or the broker) cannot keep up
+// we drop messages (according to MqttHostQueueFullMode) instead of using more and more memory, and
+// only the firmlets in that host are affected.
+sealed class MqttHostQueue
+{
+    public MqttHostQueue(ILogger logger, MqttMetrics metrics, string hostId, int capacity, MqttQueueFullMode fullMode)
+    {
+        HostId = hostId;
+        _logger = logger;
+        _metrics = metrics;
+        _incoming = CreateChannel(MqttMessgeDirection.Incoming, capacity, fullMode);
+        _outgoing = CreateChannel(MqttMessgeDirection.Outgoing, capacity, fullMode);
+    }
+
+    public string HostId { get; }
+
+    public ChannelReader<QueuedMqttMessage> Incoming
+        => _incoming.Reader;
+
+    public ChannelReader<QueuedMqttMessage> Outgoing
+        => _outgoing.Reader;
+
+    public long DroppedCount
+        => Interlocked.Read(ref _droppedCount);
+
+    public long DeliveredCount
+        => Interlocked.Read(ref _deliveredCount);
+
+    public void EnqueueIncomingMessage(MqttMessage message)
+        => _incoming.Writer.TryWrite(new(message, Stopwatch.GetTimestamp()));
+
+    public void EnqueueOutgoingMessage(MqttMessage message)
+        => _outgoing.Writer.TryWrite(new(message, Stopwatch.GetTimestamp()));
+
+    // Nothing else can be queued, the pipelines of the host end when they have processed what's left
+    public void Complete()
+    {
+        _incoming.Writer.TryComplete();
+        _outgoing.Writer.TryComplete();
+    }
+
+    public void MessageDelivered(MqttMessgeDirection direction, QueuedMqttMessage item)
+    {
+        Interlocked.Increment(ref _deliveredCount);
+        _metrics.MessageDelivered(HostId, direction, item.Timestamp);
+    }
+
+    public override string ToString()
+        => $"{HostId}: {Incoming.Count} incoming, {Outgoing.Count} outgoing, {DroppedCount} dropped";
+
+    private const int DroppedMessagesLogInterval = 100;
+
+    private readonly ILogger _logger;
+    private readonly MqttMetrics _metrics;
+    private readonly Channel<QueuedMqttMessage> _incoming;
+    private readonly Channel<QueuedMqttMessage> _outgoing;
+    private long _droppedCount;
+    private long _deliveredCount;
+
+    private Channel<QueuedMqttMessage> CreateChannel(MqttMessgeDirection direction, int capacity, MqttQueueFullMode fullMode)
+    {
+        var options = new BoundedChannelOptions(capacity)
+        {
+            SingleReader = true,
+            FullMode = fullMode == MqttQueueFullMode.RejectNew ? BoundedChannelFullMode.DropWrite : BoundedChannelFullMode.DropOldest,
+        };
+
+        return Channel.CreateBounded<QueuedMqttMessage>(options, item => OnMessageDropped(direction, item));
+    }
+
+    private void OnMessageDropped(MqttMessgeDirection direction, QueuedMqttMessage item)
+    {
+        _metrics.MessageDropped(HostId, direction);
+
+        // Logging each message would make things even worse
+        long count = Interlocked.Increment(ref _droppedCount);
+        if (count == 1 || count % DroppedMessagesLogInterval == 0)
+        {
+            _logger.LogWarning("MQTT queue for {HostId} is full, {Direction} message {Topic} dropped ({Count} so far)",
+                HostId, direction, item.Message.Topic, count);
+        }
+    }
+}
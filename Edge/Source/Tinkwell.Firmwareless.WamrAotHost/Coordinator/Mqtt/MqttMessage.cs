@@ -1,9 +1,9 @@
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 
-record MqttMessage(string HostId, string Topic, string Payload)
+record MqttMessage(string FirmletId, string Topic, string Payload)
 {
     public override string ToString()
-        => $"{Topic} => {HostId}";
+        => $"{Topic} => {FirmletId}";
 }
 
 enum MqttMessgeDirection
@@ -11,9 +11,3 @@ enum MqttMessgeDirection
     Outgoing,
     Incoming
 }
-
-sealed record MqttMessageWithDirection(MqttMessgeDirection Direction, string HostId, string Topic, string Payload) : MqttMessage(HostId, Topic, Payload)
-{
-    public override string ToString()
-        => $"{Direction}: {Topic}";
-}
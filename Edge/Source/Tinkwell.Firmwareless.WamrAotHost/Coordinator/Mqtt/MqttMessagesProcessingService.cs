@@ -5,7 +5,6 @@ using MQTTnet.Packets;
 using MQTTnet.Protocol;
 using System.Diagnostics;
 using Tinkwell.Firmwareless.WamrAotHost.Ipc;
-using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 
@@ -31,23 +30,30 @@ sealed class MqttMessagesProcessingService(
         }
 
         _logger.LogDebug("MQTT message processing service started");
-        while (!stoppingToken.IsCancellationRequested)
+
+        // Each host has its own queues and its own pipeline: a slow host does not stall the others
+        using var publishCancellation = new CancellationTokenSource();
+        var pipelines = new List<Task>();
+        try
         {
-            var message = await _queue.DequeueAsync(stoppingToken);
-            try
-            {
-                if (message.Direction == MqttMessgeDirection.Incoming)
-                    await ProcessIncomingMessageAsync(message, stoppingToken);
-                else
-                    await ProcessOutgoingMessageAsync(message, stoppingToken);
-            }
-            catch (Exception ex)
+            while (!stoppingToken.IsCancellationRequested)
             {
-                _logger.LogError(ex, "Error processing MQTT message {MessageInfo}", message.ToString());
+                var hostQueue = await _queue.DequeueNewHostQueueAsync(stoppingToken);
+                _logger.LogDebug("Starting MQTT message pipeline for {HostId}", hostQueue.HostId);
+
+                // The pipelines of a host which exited end when its queue is removed
+                pipelines.RemoveAll(x => x.IsCompleted);
+                pipelines.Add(ProcessIncomingMessagesAsync(hostQueue, stoppingToken));
+                pipelines.Add(ProcessOutgoingMessagesAsync(hostQueue, stoppingToken, publishCancellation.Token));
             }
         }
+        catch (OperationCanceledException)
+        {
+        }
 
         _logger.LogDebug("MQTT message processing service stopping...");
+        await Task.WhenAll(pipelines);
+        await WaitPendingPublishesAsync(publishCancellation);
     }
 
     private readonly IMqttQueue _queue = queue;
@@ -56,29 +62,95 @@ sealed class MqttMessagesProcessingService(
     private readonly FirmletsRepository _repository = repository;
     private readonly Settings _settings = settings;
     private readonly CoordinatorServiceOptions _options = options;
+    private readonly SemaphoreSlim _inFlightPublishes = new(Math.Max(1, settings.MqttMaxInFlightPublishes));
     private IMqttClient? _mqttClient;
     private MqttClientOptions? _clientOptions;
 
-    private async Task ProcessIncomingMessageAsync(MqttMessage message, CancellationToken cancellationToken)
+    private async Task ProcessIncomingMessagesAsync(MqttHostQueue hostQueue, CancellationToken cancellationToken)
     {
-        if (_repository.TryGetByHostId(message.HostId, out _))
-            await _ipcServer.NotifyAsync(message.HostId, HostMethods.ReceiveMqttMessage, new MqttMessage(message.HostId, message.Topic, message.Payload));
-        else
-            _logger.LogWarning("Cannot find host {HostId} to deliver MQTT nessage {Topic}", message.HostId, message.Topic);
+        try
+        {
+            await foreach (var item in hostQueue.Incoming.ReadAllAsync(cancellationToken))
+            {
+                try
+                {
+                    await _ipcServer.SendMqttMessageAsync(hostQueue.HostId, item.Message);
+                    hostQueue.MessageDelivered(MqttMessgeDirection.Incoming, item);
+                }
+                catch (Exception ex)
+                {
+                    _logger.LogError(ex, "Error processing MQTT message {MessageInfo}", item.Message.ToString());
+                }
+            }
+        }
+        catch (OperationCanceledException)
+        {
+        }
     }
 
-    private async Task ProcessOutgoingMessageAsync(MqttMessage message, CancellationToken cancellationToken)
+    private async Task ProcessOutgoingMessagesAsync(MqttHostQueue hostQueue, CancellationToken cancellationToken, CancellationToken publishCancellationToken)
     {
-       if (!_repository.TryGetByHostId(message.HostId, out var host))
+        try
         {
-            _logger.LogError("A message with an unknown host {HostId} has been queued for delivery (this is an internal error!)", message.HostId);
-            return;
+            await foreach (var item in hostQueue.Outgoing.ReadAllAsync(cancellationToken))
+            {
+                if (!_repository.TryGetByFirmletId(item.Message.FirmletId, out var firmlet, out _))
+                {
+                    _logger.LogError("A message with an unknown firmlet {FirmletId} has been queued for delivery (this is an internal error!)", item.Message.FirmletId);
+                    continue;
+                }
+
+                string topic = MqttTopicTranslator.FromPlainToTinkwell(firmlet, item.Message.Topic);
+
+                // Publishing is pipelined: we do not wait for the broker to acknowledge a message before sending
+                // the next one, MqttMaxInFlightPublishes (shared by all the hosts) limits how many are pending.
+                await _inFlightPublishes.WaitAsync(cancellationToken);
+                _ = PublishAndReleaseAsync(hostQueue, item, topic, publishCancellationToken);
+            }
         }
+        catch (OperationCanceledException)
+        {
+        }
+    }
 
-        string topic = MqttTopicTranslator.FromPlainToTinkwell(host, message.Topic);
-        string payload = message.Payload;
+    private async Task PublishAndReleaseAsync(MqttHostQueue hostQueue, QueuedMqttMessage item, string topic, CancellationToken cancellationToken)
+    {
+        try
+        {
+            await PublishAsync(topic, item.Message.Payload, cancellationToken);
+            hostQueue.MessageDelivered(MqttMessgeDirection.Outgoing, item);
+        }
+        catch (Exception ex)
+        {
+            _logger.LogError(ex, "Error processing MQTT message {MessageInfo}", item.Message.ToString());
+        }
+        finally
+        {
+            _inFlightPublishes.Release();
+        }
+    }
+
+    // Publishes which have been started are not abandoned when the service stops: each one holds a slot
+    // of _inFlightPublishes until the broker answers, when we get all the slots back nothing is pending.
+    // What is still pending after MqttStopTimeoutMs is cancelled.
+    private async Task WaitPendingPublishesAsync(CancellationTokenSource publishCancellation)
+    {
+        int slots = Math.Max(1, _settings.MqttMaxInFlightPublishes);
+        int released = 0;
 
-        await PublishAsync(topic, payload, cancellationToken);
+        using var timeout = new CancellationTokenSource(_settings.MqttStopTimeoutMs);
+        try
+        {
+            for (; released < slots; ++released)
+                await _inFlightPublishes.WaitAsync(timeout.Token);
+        }
+        catch (OperationCanceledException)
+        {
+            _logger.LogWarning("{Count} MQTT message(s) not published within {Timeout} ms, they have been dropped",
+                slots - released, _settings.MqttStopTimeoutMs);
+
+            publishCancellation.Cancel();
+        }
     }
 
     private async Task CreateMqttClientAndConnectAsync(CancellationToken cancellationToken)
@@ -227,10 +299,10 @@ sealed class MqttMessagesProcessingService(
             return Task.CompletedTask;
         }
 
-        if (_repository.TryGetByExternalReferenceId(parsedTopic.Value.HostExternalReferenceId, out var host))
+        if (_repository.TryGetByExternalReferenceId(parsedTopic.Value.HostExternalReferenceId, out var firmlet, out var host))
         {
             var payload = arg.ApplicationMessage.ConvertPayloadToString();
-            _queue.EnqueueIncomingMessage(new MqttMessage(host.Id, parsedTopic.Value.Topic, payload));
+            _queue.EnqueueIncomingMessage(host.Id, new MqttMessage(firmlet.Id, parsedTopic.Value.Topic, payload));
         }
         else
         {
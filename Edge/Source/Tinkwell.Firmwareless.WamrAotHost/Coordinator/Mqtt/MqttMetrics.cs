@@ -0,0 +1,41 @@
+using System.Diagnostics;
+using System.Diagnostics.Metrics;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+
+// Metrics of the MQTT pipeline, tagged with the host and the direction of the messages. They can be
+// collected with the usual tools (for example "dotnet-counters monitor --counters Tinkwell.Firmwareless.Mqtt").
+sealed class MqttMetrics : IDisposable
+{
+    public const string MeterName = "Tinkwell.Firmwareless.Mqtt";
+
+    public MqttMetrics(Func<IEnumerable<MqttHostQueue>> getQueues)
+    {
+        _meter = new Meter(MeterName);
+        _dropped = _meter.CreateCounter<long>("tw.mqtt.dropped", "{message}", "Messages dropped because the queue of the host was full.");
+        _latency = _meter.CreateHistogram<double>("tw.mqtt.latency", "ms", "Time from when a message is queued to when it's delivered.");
+        _meter.CreateObservableGauge("tw.mqtt.queue_depth", () => Observe(getQueues()), "{message}", "Messages waiting in the queue of each host.");
+    }
+
+    public void MessageDropped(string hostId, MqttMessgeDirection direction)
+        => _dropped.Add(1, new("host", hostId), new("direction", direction));
+
+    public void MessageDelivered(string hostId, MqttMessgeDirection direction, long queuedTimestamp)
+        => _latency.Record(Stopwatch.GetElapsedTime(queuedTimestamp).TotalMilliseconds, new("host", hostId), new("direction", direction));
+
+    public void Dispose()
+        => _meter.Dispose();
+
+    private readonly Meter _meter;
+    private readonly Counter<long> _dropped;
+    private readonly Histogram<double> _latency;
+
+    private static IEnumerable<Measurement<int>> Observe(IEnumerable<MqttHostQueue> queues)
+    {
+        foreach (var queue in queues)
+        {
+            yield return new(queue.Incoming.Count, new("host", queue.HostId), new("direction", MqttMessgeDirection.Incoming));
+            yield return new(queue.Outgoing.Count, new("host", queue.HostId), new("direction", MqttMessgeDirection.Outgoing));
+        }
+    }
+}
@@ -1,30 +1,56 @@
+using Microsoft.Extensions.Logging;
 using System.Collections.Concurrent;
-using System.Diagnostics;
+using System.Threading.Channels;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 
-sealed class MqttQueue : IMqttQueue
+sealed class MqttQueue : IMqttQueue, IDisposable
 {
-    public void EnqueueIncomingMessage(MqttMessage message)
+    public MqttQueue(ILogger<MqttQueue> logger, Settings settings)
     {
-        _items.Enqueue(new(MqttMessgeDirection.Incoming, message.HostId, message.Topic, message.Payload));
-        _signal.Release();
+        _logger = logger;
+        _settings = settings;
+        _metrics = new MqttMetrics(() => _hosts.Values);
     }
 
-    public void EnqueueOutgoingMessage(MqttMessage message)
+    public void EnqueueIncomingMessage(string hostId, MqttMessage message)
+        => GetHostQueue(hostId).EnqueueIncomingMessage(message);
+
+    public void EnqueueOutgoingMessage(string hostId, MqttMessage message)
+        => GetHostQueue(hostId).EnqueueOutgoingMessage(message);
+
+    public long GetDeliveredMessageCount(string hostId)
+        => _hosts.TryGetValue(hostId, out var queue) ? queue.DeliveredCount : 0;
+
+    public ValueTask<MqttHostQueue> DequeueNewHostQueueAsync(CancellationToken cancellationToken)
+        => _newHosts.Reader.ReadAsync(cancellationToken);
+
+    public void RemoveHostQueue(string hostId)
     {
-        _items.Enqueue(new(MqttMessgeDirection.Outgoing, message.HostId, message.Topic, message.Payload));
-        _signal.Release();
+        if (_hosts.TryRemove(hostId, out var queue))
+            queue.Complete();
     }
 
-    public async Task<MqttMessageWithDirection> DequeueAsync(CancellationToken cancellationToken)
+    public void Dispose()
+        => _metrics.Dispose();
+
+    private readonly ILogger<MqttQueue> _logger;
+    private readonly Settings _settings;
+    private readonly MqttMetrics _metrics;
+    private readonly ConcurrentDictionary<string, MqttHostQueue> _hosts = new();
+    private readonly Channel<MqttHostQueue> _newHosts = Channel.CreateUnbounded<MqttHostQueue>();
+
+    private MqttHostQueue GetHostQueue(string hostId)
     {
-        await _signal.WaitAsync(cancellationToken);
-        bool success = _items.TryDequeue(out var message);
-        Debug.Assert(success && message is not null);
-        return message;
-    }
+        if (_hosts.TryGetValue(hostId, out var queue))
+            return queue;
 
-    private readonly ConcurrentQueue<MqttMessageWithDirection> _items = new();
-    private readonly SemaphoreSlim _signal = new(0);
+        // Two threads could race to create it, only the one which wins announces the new queue
+        var newQueue = new MqttHostQueue(_logger, _metrics, hostId, _settings.MqttHostQueueCapacity, _settings.MqttHostQueueFullMode);
+        queue = _hosts.GetOrAdd(hostId, newQueue);
+        if (ReferenceEquals(queue, newQueue))
+            _newHosts.Writer.TryWrite(queue);
+
+        return queue;
+    }
 }
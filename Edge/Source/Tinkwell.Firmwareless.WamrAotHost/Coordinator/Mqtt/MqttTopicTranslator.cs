@@ -1,4 +1,4 @@
-using System.Text.RegularExpressions;
+using System.Buffers;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 
@@ -6,21 +6,31 @@ namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 // messages to start with "tinkwell/<FIRMWARE ID>/*". Where <FIRMWARE ID> is stored here as "external reference ID".
 // We strip this prefix and send the message "naked" to the firmlet, the same way that a device won't receive
 // that prefix. It's used internally by Tinkwell to dispatch these messages to the correct destination.
-static partial class MqttTopicTranslator
+static class MqttTopicTranslator
 {
+    // This is called for every incoming message, we parse the prefix without allocating anything but the results:
+    // the ID is everything up to the next separator and it must contain only [A-Za-z0-9_-].
     public static (string HostExternalReferenceId, string Topic)? FromTinkwellToPlain(string topic)
     {
+        if (!topic.StartsWith(Prefix, StringComparison.Ordinal))
+            return null;
 
-        var match = ParseTopicRegex().Match(topic);
-        if (match.Success)
-            return (match.Groups[1].Value, match.Groups[2].Value);
+        var rest = topic.AsSpan(Prefix.Length);
+        int separatorIndex = rest.IndexOf('/');
+        var id = separatorIndex == -1 ? rest : rest[..separatorIndex];
 
-        return null;
+        if (id.IsEmpty || id.ContainsAnyExcept(ValidIdCharacters))
+            return null;
+
+        var plainTopic = separatorIndex == -1 ? "" : topic.Substring(Prefix.Length + separatorIndex + 1);
+        return (id.ToString(), plainTopic);
     }
 
-    public static string FromPlainToTinkwell(HostInfo host, string topic)
-        => $"tinkwell/{host.ExternalReferenceId}/{topic}";
+    public static string FromPlainToTinkwell(FirmletInfo firmlet, string topic)
+        => $"{Prefix}{firmlet.ExternalReferenceId}/{topic}";
+
+    private const string Prefix = "tinkwell/";
 
-    [GeneratedRegex(@"^tinkwell/([A-Za-z0-9_-]+)/?(.*)$")]
-    private static partial Regex ParseTopicRegex();
+    private static readonly SearchValues<char> ValidIdCharacters
+        = SearchValues.Create("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-");
 }
\ No newline at end of file
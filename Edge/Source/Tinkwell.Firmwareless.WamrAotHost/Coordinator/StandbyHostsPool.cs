@@ -0,0 +1,100 @@
+using Microsoft.Extensions.Logging;
+using System.Diagnostics;
+using System.Diagnostics.CodeAnalysis;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Coordinator;
+
+sealed class StandbyHost(string id, Process process)
+{
+    public string Id { get; } = id;
+    public Process Process { get; } = process;
+    public bool Ready { get; set; }
+}
+
+// Host processes started in advance, without any firmlet: they already paid for the .NET startup, the initialization
+// of the WAMR runtime and the registration of the native functions, and they're connected to the coordinator. When a
+// host has to be restarted we hand its firmlets to one of them instead of starting a new process from scratch.
+sealed class StandbyHostsPool(ILogger<StandbyHostsPool> logger, Settings settings) : IDisposable
+{
+    public bool HasReadyHost
+    {
+        get
+        {
+            lock (_hosts)
+                return _hosts.Any(x => x.Ready && !x.Process.HasExited);
+        }
+    }
+
+    // Replaces the hosts which have been taken (or died), new ones need some time before being ready
+    public void Fill(string pipeName)
+    {
+        lock (_hosts)
+        {
+            _hosts.RemoveAll(x => x.Process.HasExited);
+
+            while (_hosts.Count < _settings.CoordinatorStandbyHosts)
+            {
+                var id = IdHelpers.CreateId("standby", 12);
+                var process = HostProcessLauncher.Start(["host", "--standby", $"--id={id}", $"--pipe-name={pipeName}"]);
+                if (process is null)
+                {
+                    _logger.LogWarning("Failed to start the standby host {HostId}.", id);
+                    return;
+                }
+
+                _logger.LogDebug("Started standby host {HostId}, PID {PID}", id, process.Id);
+                _hosts.Add(new StandbyHost(id, process));
+            }
+        }
+    }
+
+    public bool MarkReady(string id)
+    {
+        lock (_hosts)
+        {
+            var host = _hosts.FirstOrDefault(x => x.Id == id);
+            if (host is null)
+                return false;
+
+            host.Ready = true;
+            return true;
+        }
+    }
+
+    public bool TryTake([NotNullWhen(true)] out StandbyHost? host)
+    {
+        lock (_hosts)
+        {
+            host = _hosts.FirstOrDefault(x => x.Ready && !x.Process.HasExited);
+            if (host is null)
+                return false;
+
+            _hosts.Remove(host);
+            return true;
+        }
+    }
+
+    // They do not run any firmlet, there is nothing to dispose gracefully
+    public void Dispose()
+    {
+        lock (_hosts)
+        {
+            foreach (var host in _hosts)
+            {
+                try
+                {
+                    host.Process.Kill(true);
+                }
+                catch (InvalidOperationException)
+                {
+                }
+            }
+
+            _hosts.Clear();
+        }
+    }
+
+    private readonly ILogger<StandbyHostsPool> _logger = logger;
+    private readonly Settings _settings = settings;
+    private readonly List<StandbyHost> _hosts = new();
+}
@@ -36,6 +36,8 @@ sealed class CoordinatorService(ILogger<CoordinatorService> logger, HostProcesse
     private readonly CoordinatorServiceOptions _options = options;
     private readonly HostProcessesCoordinator _coordinator = coordinator;
 
+    // Each line is <ID>="<PATH>" optionally followed by "trusted" (see HostingMode.PooledTrusted) and
+    // by "priority=<low|normal|critical>" (see HostPriority).
     private IEnumerable<FirmletEntry> FindFirmlets()
     {
         return File.ReadAllLines(Path.Combine(_options.Path, "firmlets"))
@@ -43,7 +45,37 @@ sealed class CoordinatorService(ILogger<CoordinatorService> logger, HostProcesse
             .Select(line =>
             {
                 var parts = line.Split('=', 2, StringSplitOptions.RemoveEmptyEntries | StringSplitOptions.TrimEntries);
-                return new FirmletEntry(parts[0], Path.Combine(_options.Path, parts[1].Trim('"')));
+                var value = parts[1];
+                bool trusted = false;
+                var priority = HostPriority.Normal;
+
+                int endOfPath = value.LastIndexOf('"');
+                if (endOfPath > 0)
+                {
+                    foreach (var option in value[(endOfPath + 1)..].Split(' ', StringSplitOptions.RemoveEmptyEntries))
+                    {
+                        if (option.Equals("trusted", StringComparison.OrdinalIgnoreCase))
+                            trusted = true;
+                        else if (option.StartsWith("priority=", StringComparison.OrdinalIgnoreCase))
+                            priority = ParsePriority(parts[0], option["priority=".Length..]);
+                    }
+
+                    value = value[..(endOfPath + 1)];
+                }
+
+                return new FirmletEntry(parts[0], Path.Combine(_options.Path, value.Trim('"')), trusted, priority);
             });
     }
+
+    // A typo in the list must not stop all the other firmlets: this one runs with the normal priority
+    private HostPriority ParsePriority(string firmletId, string value)
+    {
+        if (Enum.TryParse<HostPriority>(value, ignoreCase: true, out var priority) && Enum.IsDefined(priority))
+            return priority;
+
+        _logger.LogWarning("Invalid priority '{Priority}' for firmlet {FirmletId} (expected one of: {Values}), using {Default}.",
+            value, firmletId, string.Join(", ", Enum.GetNames<HostPriority>()).ToLowerInvariant(), HostPriority.Normal);
+
+        return HostPriority.Normal;
+    }
 }
@@ -8,52 +8,86 @@ using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost;
 
-sealed record HostServiceOptions(string Path, string Id, string PipeName, bool Transient);
+sealed record HostServiceOptions(IReadOnlyDictionary<string, string> Firmlets, string Id, string PipeName, string? DataChannel, bool Transient, bool Standby);
 
-sealed class HostService(IHost host, ILogger<HostService> logger, HostServiceOptions options, IpcClient ipcClient, IWamrHost wamrHost) : BackgroundService
+sealed class HostService(IHost host, ILogger<HostService> logger, HostServiceOptions options, IpcClient ipcClient, MqttPublishQueue publishQueue, IWamrHost wamrHost) : BackgroundService
 {
     [JsonRpcMethod(HostMethods.Shutdown)]
     public async void Shutdown()
     {
-        _logger.LogInformation("Shutting down {HostId} (coordinator requested)...", _options.Id);
+        _logger.LogInformation("Shutting down {HostId} (coordinator requested)...", _id);
         await _host.StopAsync();
     }
 
     [JsonRpcMethod(HostMethods.ReceiveMqttMessage)]
     public void ReceiveMqttMessage(MqttMessage message)
     {
-        _logger.LogTrace("Host {HostId} received MQTT message {Topic}", _ipcClient.HostId, message.Topic);
-        _wamrHost.Notify(message.Topic, message.Payload);
+        _logger.LogTrace("Host {HostId} received MQTT message {Topic} for {FirmletId}", _id, message.Topic, message.FirmletId);
+        _wamrHost.Notify(message.FirmletId, message.Topic, message.Payload);
+    }
+
+    [JsonRpcMethod(HostMethods.AssignFirmlets)]
+    public void AssignFirmlets(AssignFirmletsRequest request)
+    {
+        if (!_assignment.TrySetResult(request))
+            _logger.LogWarning("Host {HostId} has been assigned to {NewHostId} but it's already in use", _id, request.HostId);
     }
 
     protected override async Task ExecuteAsync(CancellationToken stoppingToken)
     {
-        _logger.LogInformation("Wamr host {Id}, channel {PipeName}, modules in {Path}.", _options.Id, _options.PipeName, _options.Path);
-        _wamrHost.Load(FindAllSourceFiles(_options.Path));
+        var firmlets = _options.Firmlets;
+        var dataChannel = _options.DataChannel;
+        if (_options.Standby)
+        {
+            // Everything we can do without knowing the firmlets, what's left is (mostly) loading the modules
+            _logger.LogInformation("Wamr host {Id} (standby), channel {PipeName}.", _id, _options.PipeName);
+            _wamrHost.Prepare();
+            await _ipcClient.StartStandbyClientAsync(_options.PipeName, _id, this, ReceiveMqttMessage, stoppingToken);
+
+            var assignment = await _assignment.Task.WaitAsync(stoppingToken);
+            _logger.LogInformation("Standby host {Id} is now {NewId}.", _id, assignment.HostId);
+            _id = assignment.HostId;
+            firmlets = assignment.Firmlets;
+            dataChannel = assignment.DataChannel;
+        }
 
-        _logger.LogDebug("Initializing host {HostId}...", _options.Id);
+        _logger.LogInformation("Wamr host {Id}, channel {PipeName}, {Count} firmlet(s).", _id, _options.PipeName, firmlets.Count);
+        var startTime = DateTime.UtcNow;
+        _wamrHost.Load(firmlets.ToDictionary(x => x.Key, x => FindAllSourceFiles(x.Value)));
+
+        _logger.LogDebug("Initializing host {HostId}...", _id);
         _wamrHost.InitializeModules();
 
         _logger.LogTrace("Registering as ready to the coordinator...");
-        await _ipcClient.StartClientAsync(_options.PipeName, _options.Id, this, stoppingToken);
+        if (_options.Standby)
+            await _ipcClient.AssumeIdentityAsync(_id, dataChannel);
+        else
+            await _ipcClient.StartClientAsync(_options.PipeName, _id, dataChannel, this, ReceiveMqttMessage, stoppingToken);
+
+        _publishQueue.Start();
 
-        _logger.LogDebug("Starting execution {HostId}...", _options.Id);
+        _logger.LogDebug("Starting execution {HostId}...", _id);
         _wamrHost.Start();
 
-        _logger.LogDebug("Host {HostId} started", _options.Id);
+        _logger.LogDebug("Host {HostId} started ({Time} ms)", _id, (DateTime.UtcNow - startTime).TotalMilliseconds);
 
         if (!_options.Transient)
             await stoppingToken.WaitCancellation();
 
-        await _ipcClient.DisconnectAsync();
+        // Firmlets first, what they published before stopping is still sent to the coordinator
         _wamrHost.Stop();
+        await _publishQueue.StopAsync();
+        await _ipcClient.DisconnectAsync();
     }
 
     private readonly IHost _host = host;
     private readonly ILogger<HostService> _logger = logger;
     private readonly HostServiceOptions _options = options;
     private readonly IpcClient _ipcClient = ipcClient;
+    private readonly MqttPublishQueue _publishQueue = publishQueue;
     private readonly IWamrHost _wamrHost = wamrHost;
+    private readonly TaskCompletionSource<AssignFirmletsRequest> _assignment = new(TaskCreationOptions.RunContinuationsAsynchronously);
+    private string _id = options.Id;
 
     private string[] FindAllSourceFiles(string path)
     {
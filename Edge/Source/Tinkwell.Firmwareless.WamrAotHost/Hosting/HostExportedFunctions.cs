@@ -1,81 +1,127 @@
 ﻿using Microsoft.Extensions.Logging;
+using System.Buffers.Binary;
 using System.Collections.Concurrent;
 using System.Diagnostics.CodeAnalysis;
 using Tinkwell.Firmwareless.Vfs;
 using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 using Tinkwell.Firmwareless.WamrAotHost.Ipc;
-using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
 
-sealed class HostExportedFunctions(ILogger<HostExportedFunctions> logger, IpcClient ipcClient, IVirtualFileSystem vfs) : IHostExportedFunctions
+sealed class HostExportedFunctions(ILogger<HostExportedFunctions> logger, MqttPublishQueue publishQueue, IVirtualFileSystem vfs) : IHostExportedFunctions
 {
     public void Abort(string message, string fileName, int lineNumber, int columnNumber)
     {
-        _logger.LogCritical("Fatal module error in {FileName} at {Line}:{Column}: {Message}", fileName, lineNumber, columnNumber, message);
+        // All the firmlets in this host are terminated, not only the one which failed
+        _logger.LogCritical("Fatal module error in {FirmletId}, {FileName} at {Line}:{Column}: {Message}",
+            HostedFirmlet.Current.Id, fileName, lineNumber, columnNumber, message);
         Environment.Exit(1);
     }
 
-    public void Log(int severity, string topic, string message)
+    public void Log(int severity, ReadOnlySpan<byte> topic, ReadOnlySpan<byte> message)
     {
-        switch (severity)
+        var level = severity switch
         {
-            case 0:
-                _logger.LogError(ShortConsoleLogFormatter.FirmwareEntry, "{Topic}: {Message}", topic, message);
-                break;
-            case 1:
-                _logger.LogWarning(ShortConsoleLogFormatter.FirmwareEntry, "{Topic}: {Message}", topic, message);
-                break;
-            case 2:
-                _logger.LogInformation(ShortConsoleLogFormatter.FirmwareEntry, "{Topic}: {Message}", topic, message);
-                break;
-            case 3:
-                _logger.LogDebug(ShortConsoleLogFormatter.FirmwareEntry, "{Topic}: {Message}", topic, message);
-                break;
-            default:
-                _logger.LogTrace(ShortConsoleLogFormatter.FirmwareEntry, "{Topic}: {Message}", topic, message);
-                break;
-        }
+            0 => LogLevel.Error,
+            1 => LogLevel.Warning,
+            2 => LogLevel.Information,
+            3 => LogLevel.Debug,
+            _ => LogLevel.Trace,
+        };
+
+        // Firmlets can be chatty, we decode the text only when the entry is going to be written
+        if (!_logger.IsEnabled(level))
+            return;
+
+        _logger.Log(level, ShortConsoleLogFormatter.FirmwareEntry, "{FirmletId} {Topic}: {Message}",
+            HostedFirmlet.Current.Id, NativeMemory.Utf8ToString(topic), NativeMemory.Utf8ToString(message));
     }
 
-    public void PublishMqttMessage(string topic, string payload)
+    public bool PublishMqttMessage(ReadOnlySpan<byte> topic, ReadOnlySpan<byte> payload)
     {
-        _ipcClient.NotifyAsync(CoordinatorMethods.PublishMqttMessage, new MqttMessage(_ipcClient.HostId, topic, payload))
-            .GetAwaiter().GetResult();
+        // The coordinator needs the text (to build the topic and for JSON-RPC), this is the first place where
+        // we decode it.
+        var message = new MqttMessage(HostedFirmlet.Current.Id, NativeMemory.Utf8ToString(topic), NativeMemory.Utf8ToString(payload));
+        return _publishQueue.TryEnqueue(message);
+    }
+
+    // The batch is a sequence of messages, each one is the length of the topic and the length of the payload
+    // (32 bit, little endian) followed by their UTF-8 text. The whole batch is validated before queuing anything,
+    // it returns how many messages have been queued (they're queued in order until the queue is full).
+    public int PublishMqttMessages(ReadOnlySpan<byte> batch)
+    {
+        int count = 0;
+        for (var entries = batch; !entries.IsEmpty; ++count)
+            entries = entries[ReadBatchEntry(entries, out _, out _)..];
+
+        var firmletId = HostedFirmlet.Current.Id;
+        for (int i = 0; i < count; ++i)
+        {
+            batch = batch[ReadBatchEntry(batch, out var topic, out var payload)..];
+
+            var message = new MqttMessage(firmletId, NativeMemory.Utf8ToString(topic), NativeMemory.Utf8ToString(payload));
+            if (!_publishQueue.TryEnqueue(message))
+                return i;
+        }
+
+        return count;
     }
 
     public int OpenFile(string path, OpenMode mode, OpenFlags flags)
     {
-        var file = _vfs.Open(Context.FromIdentity(_ipcClient.HostId), path, mode, flags);
-        return _handles.Add(file);
+        var firmlet = HostedFirmlet.Current;
+        var file = _vfs.Open(Context.FromIdentity(firmlet.Id), path, mode, flags);
+        return firmlet.Files.Add(file);
     }
 
     public void CloseFile(int handle)
     {
-        if (_handles.TryRemove(handle, out var file))
-            file.Close(Context.FromIdentity(_ipcClient.HostId));
+        var firmlet = HostedFirmlet.Current;
+        if (firmlet.Files.TryRemove(handle, out var file))
+            file.Close(Context.FromIdentity(firmlet.Id));
     }
 
     public int ReadFromFile(int handle, Span<byte> buffer, ReadFlags flags)
     {
-        if (!_handles.TryGet(handle, out var file))
+        var firmlet = HostedFirmlet.Current;
+        if (!firmlet.Files.TryGet(handle, out var file))
             throw new ArgumentException($"Invalid file handle {handle}");
 
-        return file.Read(Context.FromIdentity(_ipcClient.HostId), buffer, flags);
+        return file.Read(Context.FromIdentity(firmlet.Id), buffer, flags);
     }
 
     public int WriteToFile(int handle, Span<byte> buffer, WriteFlags flags)
     {
-        if (!_handles.TryGet(handle, out var file))
+        var firmlet = HostedFirmlet.Current;
+        if (!firmlet.Files.TryGet(handle, out var file))
             throw new ArgumentException($"Invalid file handle {handle}");
 
-        return file.Write(Context.FromIdentity(_ipcClient.HostId), buffer, flags);
+        return file.Write(Context.FromIdentity(firmlet.Id), buffer, flags);
     }
 
+    private const int BatchEntryHeaderSize = 8;
+
     private readonly ILogger<HostExportedFunctions> _logger = logger;
-    private readonly IpcClient _ipcClient = ipcClient;
+    private readonly MqttPublishQueue _publishQueue = publishQueue;
     private readonly IVirtualFileSystem _vfs = vfs;
-    private readonly VfsFileHandleCollection _handles = new();
+
+    // Returns the size of the entry at the beginning of the batch, the buffer comes from the module: lengths are
+    // checked before slicing it.
+    private static int ReadBatchEntry(ReadOnlySpan<byte> batch, out ReadOnlySpan<byte> topic, out ReadOnlySpan<byte> payload)
+    {
+        if (batch.Length < BatchEntryHeaderSize)
+            throw new FormatException("Invalid MQTT batch: the header of the message is truncated.");
+
+        uint topicLength = BinaryPrimitives.ReadUInt32LittleEndian(batch);
+        uint payloadLength = BinaryPrimitives.ReadUInt32LittleEndian(batch[4..]);
+        if ((ulong)topicLength + payloadLength > (ulong)(batch.Length - BatchEntryHeaderSize))
+            throw new FormatException("Invalid MQTT batch: the length of the message exceeds the size of the batch.");
+
+        topic = batch.Slice(BatchEntryHeaderSize, (int)topicLength);
+        payload = batch.Slice(BatchEntryHeaderSize + (int)topicLength, (int)payloadLength);
+
+        return BatchEntryHeaderSize + (int)topicLength + (int)payloadLength;
+    }
 }
 
 sealed class VfsFileHandleCollection
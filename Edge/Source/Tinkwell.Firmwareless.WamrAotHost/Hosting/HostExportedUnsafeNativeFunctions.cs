@@ -1,35 +1,19 @@
 ﻿using Microsoft.Extensions.Logging;
 using System.Diagnostics;
 using System.Diagnostics.CodeAnalysis;
+using System.Runtime.CompilerServices;
 using System.Runtime.InteropServices;
 using Tinkwell.Firmwareless.Vfs;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
 
-sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeFunctions> logger, IHostExportedFunctions hostExportedFunctions)
+// Native functions are exported as UnmanagedCallersOnly function pointers: there are no delegates
+// to keep alive and no marshalling stubs. Buffers are declared with the "*~" signature (pointer followed
+// by its length) then WAMR validates the range and passes a native pointer, we only wrap it in a span:
+// nothing is copied and the text is decoded only if it's needed.
+sealed unsafe class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeFunctions> logger, IHostExportedFunctions hostExportedFunctions)
     : IRegisterHostUnsafeNativeFunctions
 {
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate void NativeAbortDelegate(nint execEnv, nint messagePtr, nint fileNamePtr, int line, int column);
-
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate int NativeMqttPublishDelegate(nint execEnv, nint topicPtr, int topicLen, nint payloadPtr, int payloadLen);
-
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate int NativeLogDelegate(nint execEnv, int severity, nint topicPtr, int topicLen, nint payloadPtr, int payloadLen);
-
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate int NativeOpenDelegate(nint execEnv, nint pathPtr, int pathLen, uint mode, uint flags);
-
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate int NativeCloseDelegate(nint execEnv, int handle);
-
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate int NativeReadDelegate(nint execEnv, int handle, nint bufferPtr, uint bufferLen, int bytesToRead, uint flags);
-
-    [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
-    public delegate int NativeWriteDelegate(nint execEnv, int handle, nint bufferPtr, uint bufferLen, int bytesToWrite, uint flags);
-
     public void RegisterAll()
     {
         if (_instance is not null)
@@ -38,13 +22,22 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
         _instance = this;
 
         Wamr.RegisterNativeFunctions([
-            Wamr.MakeNativeSymbol(nameof(abort), new NativeAbortDelegate(abort)),
-            Wamr.MakeNativeSymbol(nameof(tw_log), new NativeLogDelegate(tw_log)),
-            Wamr.MakeNativeSymbol(nameof(tw_mqtt_publish), new NativeMqttPublishDelegate(tw_mqtt_publish)),
-            Wamr.MakeNativeSymbol(nameof(tw_open), new NativeOpenDelegate(tw_open)),
-            Wamr.MakeNativeSymbol(nameof(tw_close), new NativeCloseDelegate(tw_close)),
-            Wamr.MakeNativeSymbol(nameof(tw_read), new NativeReadDelegate(tw_read)),
-            Wamr.MakeNativeSymbol(nameof(tw_write), new NativeWriteDelegate(tw_write))
+            Wamr.MakeNativeSymbol(nameof(abort),
+                (nint)(delegate* unmanaged[Cdecl]<nint, nint, nint, int, int, void>)&abort, "(iiii)"),
+            Wamr.MakeNativeSymbol(nameof(tw_log),
+                (nint)(delegate* unmanaged[Cdecl]<nint, int, byte*, int, byte*, int, int>)&tw_log, "(i*~*~)i"),
+            Wamr.MakeNativeSymbol(nameof(tw_mqtt_publish),
+                (nint)(delegate* unmanaged[Cdecl]<nint, byte*, int, byte*, int, int>)&tw_mqtt_publish, "(*~*~)i"),
+            Wamr.MakeNativeSymbol(nameof(tw_mqtt_publish_batch),
+                (nint)(delegate* unmanaged[Cdecl]<nint, byte*, int, int>)&tw_mqtt_publish_batch, "(*~)i"),
+            Wamr.MakeNativeSymbol(nameof(tw_open),
+                (nint)(delegate* unmanaged[Cdecl]<nint, byte*, int, uint, uint, int>)&tw_open, "(*~ii)i"),
+            Wamr.MakeNativeSymbol(nameof(tw_close),
+                (nint)(delegate* unmanaged[Cdecl]<nint, int, int>)&tw_close, "(i)i"),
+            Wamr.MakeNativeSymbol(nameof(tw_read),
+                (nint)(delegate* unmanaged[Cdecl]<nint, int, byte*, uint, int, uint, int>)&tw_read, "(i*~ii)i"),
+            Wamr.MakeNativeSymbol(nameof(tw_write),
+                (nint)(delegate* unmanaged[Cdecl]<nint, int, byte*, uint, int, uint, int>)&tw_write, "(i*~ii)i")
         ]);
     }
 
@@ -52,6 +45,7 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
     private readonly ILogger<HostExportedUnsafeNativeFunctions> _logger = logger;
     private readonly IHostExportedFunctions _hostExportedFunctions = hostExportedFunctions;
 
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
     private static void abort(nint execEnv, nint messagePtr, nint fileNamePtr, int line, int column)
     {
@@ -61,6 +55,8 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
         // malformed call will print process' memory to the log and nothing else (512 bytes at most) and
         // it'll cause the process to terminate anyway.
         Debug.Assert(_instance is not null);
+        Wamr.SampleStackUsage();
+
         try
         {
             nint moduleInstance = Wamr.GetModuleInstanceFromExecEnvHandle(execEnv);
@@ -76,69 +72,122 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
         }
     }
 
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
-    private static int tw_log(nint execEnv, int severity, nint topicPtr, int topicLen, nint messagePtr, int messageLen)
+    private static int tw_log(nint execEnv, int severity, byte* topicPtr, int topicLen, byte* messagePtr, int messageLen)
     {
         Debug.Assert(_instance is not null);
-        return TryCallHostFunction(nameof(tw_log), () =>
+        Wamr.SampleStackUsage();
+
+        try
         {
-            nint moduleInstance = Wamr.GetModuleInstanceFromExecEnvHandle(execEnv);
-            string topic = WasmMemory.Utf8PtrToString(moduleInstance, topicPtr, topicLen);
-            string message = WasmMemory.Utf8PtrToString(moduleInstance, messagePtr, messageLen);
+            _instance._hostExportedFunctions.Log(
+                severity,
+                new ReadOnlySpan<byte>(topicPtr, topicLen),
+                new ReadOnlySpan<byte>(messagePtr, messageLen)
+            );
 
-            _instance._hostExportedFunctions.Log(severity, topic, message);
-            return 0;
-        });
+            return (int)WasmErrorCode.Ok;
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_log), e);
+        }
     }
 
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
-    private static int tw_mqtt_publish(nint execEnv, nint topicPtr, int topicLen, nint payloadPtr, int payloadLen)
+    private static int tw_mqtt_publish(nint execEnv, byte* topicPtr, int topicLen, byte* payloadPtr, int payloadLen)
     {
         Debug.Assert(_instance is not null);
-        return TryCallHostFunction(nameof(tw_mqtt_publish), () =>
+        Wamr.SampleStackUsage();
+
+        try
         {
-            nint moduleInstance = Wamr.GetModuleInstanceFromExecEnvHandle(execEnv);
-            string topic = WasmMemory.Utf8PtrToString(moduleInstance, topicPtr, topicLen);
-            string payload = WasmMemory.Utf8PtrToString(moduleInstance, payloadPtr, payloadLen);
+            // The queue is full: the firmlet is publishing faster than we can deliver, it's not an error on our side.
+            // When the host is stopping the queue throws and the firmlet gets Host instead.
+            bool queued = _instance._hostExportedFunctions.PublishMqttMessage(
+                new ReadOnlySpan<byte>(topicPtr, topicLen),
+                new ReadOnlySpan<byte>(payloadPtr, payloadLen)
+            );
 
-            _instance._hostExportedFunctions.PublishMqttMessage(topic, payload);
-            return 0;
-        });
+            return (int)(queued ? WasmErrorCode.Ok : WasmErrorCode.Busy);
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_mqtt_publish), e);
+        }
     }
 
+    // Returns the number of messages which have been queued, Busy if the queue is full and none of them has been queued
+    // (Host if the host is stopping).
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
-    private static int tw_open(nint execEnv, nint pathPtr, int pathLen, uint mode, uint flags)
+    private static int tw_mqtt_publish_batch(nint execEnv, byte* batchPtr, int batchLen)
     {
         Debug.Assert(_instance is not null);
-        return TryCallHostFunction(nameof(tw_open), () =>
+        Wamr.SampleStackUsage();
+
+        try
         {
-            nint moduleInstance = Wamr.GetModuleInstanceFromExecEnvHandle(execEnv);
-            string path = WasmMemory.Utf8PtrToString(moduleInstance, pathPtr, pathLen);
+            var batch = new ReadOnlySpan<byte>(batchPtr, batchLen);
+            int queued = _instance._hostExportedFunctions.PublishMqttMessages(batch);
+
+            return queued == 0 && !batch.IsEmpty ? (int)WasmErrorCode.Busy : queued;
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_mqtt_publish_batch), e);
+        }
+    }
+
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
+    [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
+    private static int tw_open(nint execEnv, byte* pathPtr, int pathLen, uint mode, uint flags)
+    {
+        Debug.Assert(_instance is not null);
+        Wamr.SampleStackUsage();
 
+        try
+        {
             return _instance._hostExportedFunctions.OpenFile(
-                path,
+                NativeMemory.Utf8ToString(new ReadOnlySpan<byte>(pathPtr, pathLen)),
                 CheckEnum((OpenMode)mode),
                 CheckEnum((OpenFlags)flags)
             );
-        });
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_open), e);
+        }
     }
 
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
     private static int tw_close(nint execEnv, int handle)
     {
         Debug.Assert(_instance is not null);
-        return TryCallHostFunction(nameof(tw_close), () =>
+        Wamr.SampleStackUsage();
+
+        try
         {
             _instance._hostExportedFunctions.CloseFile(handle);
             return (int)WasmErrorCode.Ok;
-        });
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_close), e);
+        }
     }
 
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
-    private static int tw_read(nint execEnv, int handle, nint bufferPtr, uint bufferLength, int bytesToRead, uint flags)
+    private static int tw_read(nint execEnv, int handle, byte* bufferPtr, uint bufferLength, int bytesToRead, uint flags)
     {
         Debug.Assert(_instance is not null);
-        return TryCallHostFunction(nameof(tw_read), () =>
+        Wamr.SampleStackUsage();
+
+        try
         {
             if (bytesToRead < 0)
                 throw new ArgumentOutOfRangeException(nameof(bytesToRead), bytesToRead, "Number of bytes cannot be less than zero.");
@@ -146,26 +195,26 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
             if (bytesToRead > bufferLength)
                 throw new ArgumentOutOfRangeException(nameof(bytesToRead), bytesToRead, "Source buffer is too small.");
 
-            unsafe
-            {                
-                nint moduleInstance = Wamr.GetModuleInstanceFromExecEnvHandle(execEnv);
-                var ptr = WasmMemory.MapAppAddressRangeToNative(moduleInstance, bufferPtr, bytesToRead);
-                var buffer = new Span<byte>(ptr.ToPointer(), bytesToRead);
-
-                return _instance._hostExportedFunctions.ReadFromFile(
-                    handle,
-                    buffer,
-                    CheckEnum((ReadFlags)flags)
-                );
-            }
-        });
+            return _instance._hostExportedFunctions.ReadFromFile(
+                handle,
+                new Span<byte>(bufferPtr, bytesToRead),
+                CheckEnum((ReadFlags)flags)
+            );
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_read), e);
+        }
     }
 
+    [UnmanagedCallersOnly(CallConvs = [typeof(CallConvCdecl)])]
     [SuppressMessage("Style", "IDE1006:Naming Styles", Justification = "Match exported name")]
-    private static int tw_write(nint execEnv, int handle, nint bufferPtr, uint bufferLength, int bytesToWrite, uint flags)
+    private static int tw_write(nint execEnv, int handle, byte* bufferPtr, uint bufferLength, int bytesToWrite, uint flags)
     {
         Debug.Assert(_instance is not null);
-        return TryCallHostFunction(nameof(tw_write), () =>
+        Wamr.SampleStackUsage();
+
+        try
         {
             if (bytesToWrite < 0)
                 throw new ArgumentOutOfRangeException(nameof(bytesToWrite), bytesToWrite, "Number of bytes cannot be less than zero.");
@@ -173,19 +222,16 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
             if (bytesToWrite > bufferLength)
                 throw new ArgumentOutOfRangeException(nameof(bytesToWrite), bytesToWrite, "Destination buffer is too small.");
 
-            unsafe
-            {
-                nint moduleInstance = Wamr.GetModuleInstanceFromExecEnvHandle(execEnv);
-                var ptr = WasmMemory.MapAppAddressRangeToNative(moduleInstance, bufferPtr, bytesToWrite);
-                var buffer = new Span<byte>(ptr.ToPointer(), bytesToWrite);
-
-                return _instance._hostExportedFunctions.WriteToFile(
-                    handle,
-                    buffer,
-                    CheckEnum((WriteFlags)flags)
-                );
-            }
-        });
+            return _instance._hostExportedFunctions.WriteToFile(
+                handle,
+                new Span<byte>(bufferPtr, bytesToWrite),
+                CheckEnum((WriteFlags)flags)
+            );
+        }
+        catch (Exception e)
+        {
+            return HandleException(nameof(tw_write), e);
+        }
     }
 
     private static T CheckEnum<T>(T value) where T : struct, Enum
@@ -196,77 +242,33 @@ sealed class HostExportedUnsafeNativeFunctions(ILogger<HostExportedUnsafeNativeF
         return value;
     }
 
-    private static int TryCallHostFunction(string functionName, Func<int> call)
+    // An exception must never cross the native boundary: the process would be terminated.
+    private static int HandleException(string functionName, Exception exception)
     {
-        try
-        {
-            return call();
-        }
-        catch (ArgumentOutOfRangeException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.ArgumentOutOfRange);
-        }
-        catch (ArgumentException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.InvalidArgument);
-        }
-        catch (FormatException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.ArgumentInvalidFormat);
-        }
-        catch (OutOfMemoryException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.OutOfMemory);
-        }
-        catch (IOException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.Io);
-        }
-        catch (UnauthorizedAccessException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.NoAccess);
-        }
-        catch (NotSupportedException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.NotSupported);
-        }
-        catch (NotImplementedException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.NotImplemented);
-        }
-        catch (HostException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.Host);
-        }
-        catch (VfsAccessException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.NoAccess);
-        }
-        catch (VfsAmbiguousPathException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.InvalidArgument);
-        }
-        catch (VfsNotFoundException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.NotFound);
-        }
-        catch (VfsOutOfResourcesException e)
-        {
-            return LogException(functionName, e, WasmErrorCode.OutOfMemory);
-        }
-        catch (Exception e)
-        {
-            return LogException(functionName, e, WasmErrorCode.Generic);
-        }
+        Debug.Assert(_instance is not null);
 
-        static int LogException(string functionName, Exception exception, WasmErrorCode error)
+        var error = exception switch
         {
-            Debug.Assert(_instance is not null);
-            _instance._logger.LogWarning(exception,
-                "Error {Error} ({ExceptionType}) when calling host function {Function}(): {Message}",
-                error, exception.GetType().Name, functionName, exception.Message);
-
-            return (int)error;
-        }
+            ArgumentOutOfRangeException => WasmErrorCode.ArgumentOutOfRange,
+            ArgumentException => WasmErrorCode.InvalidArgument,
+            FormatException => WasmErrorCode.ArgumentInvalidFormat,
+            OutOfMemoryException => WasmErrorCode.OutOfMemory,
+            IOException => WasmErrorCode.Io,
+            UnauthorizedAccessException => WasmErrorCode.NoAccess,
+            NotSupportedException => WasmErrorCode.NotSupported,
+            NotImplementedException => WasmErrorCode.NotImplemented,
+            HostException => WasmErrorCode.Host,
+            VfsAccessException => WasmErrorCode.NoAccess,
+            VfsAmbiguousPathException => WasmErrorCode.InvalidArgument,
+            VfsNotFoundException => WasmErrorCode.NotFound,
+            VfsOutOfResourcesException => WasmErrorCode.OutOfMemory,
+            _ => WasmErrorCode.Generic
+        };
+
+        _instance._logger.LogWarning(exception,
+            "Error {Error} ({ExceptionType}) when calling host function {Function}(): {Message}",
+            error, exception.GetType().Name, functionName, exception.Message);
+
+        return (int)error;
     }
 }
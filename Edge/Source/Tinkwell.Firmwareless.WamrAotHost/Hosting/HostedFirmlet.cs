@@ -0,0 +1,353 @@
+﻿using Microsoft.Extensions.Logging;
+using System.Diagnostics;
+using System.Threading.Channels;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+// A firmlet loaded in this host. Each firmlet has its own thread: its modules are instantiated there and all
+// the calls to them (then also the host functions they call) run on that thread. When multiple firmlets share
+// the same process a busy one does not delay the others and an execution environment is never used
+// by two threads. Each module has its own instance (with its own linear memory and heap), nothing is shared
+// between firmlets except the runtime and the native functions.
+// Requests from the coordinator (load, start, stop) are never dropped. MQTT messages wait in a bounded queue
+// (HostMessageQueueCapacity): when the firmlet cannot keep up they are dropped according to HostMessageQueueFullMode,
+// instead of growing the memory of the host.
+sealed class HostedFirmlet : IDisposable
+{
+    // The thread runs the AOT code of the modules on its stack: it has room for the deepest module (nativeStackSize)
+    // plus what the host needs for itself (runtime, host functions and everything they call).
+    public HostedFirmlet(ILogger logger, Settings settings, WasmWatchdog watchdog, string id, uint nativeStackSize)
+    {
+        Id = id;
+        _logger = logger;
+        _settings = settings;
+        _watchdog = watchdog;
+        _messages = Channel.CreateBounded<(string Topic, string Payload)>(new BoundedChannelOptions(Math.Max(1, settings.HostMessageQueueCapacity))
+        {
+            SingleReader = true,
+            FullMode = settings.HostMessageQueueFullMode == MqttQueueFullMode.RejectNew ? BoundedChannelFullMode.DropWrite : BoundedChannelFullMode.DropOldest,
+        }, OnMessageDropped);
+        _thread = new Thread(Run, ThreadStackReserve + (int)nativeStackSize)
+        {
+            Name = $"Firmlet {id}",
+            IsBackground = true,
+        };
+        _thread.Start();
+    }
+
+    public string Id { get; }
+
+    // Files opened by this firmlet, handles are not shared with the other firmlets in the same host.
+    public VfsFileHandleCollection Files { get; } = new();
+
+    // The firmlet which is running on the calling thread, host functions use it to know who is calling them.
+    public static HostedFirmlet Current
+        => _current ?? throw new HostException("Host functions must be called from the thread of a firmlet.");
+
+    // Modules are sized by the caller (see WasmInstanceSizing), their native stack must fit in the stack of this thread
+    public void LoadModules((string Path, WasmInstanceLimits Limits)[] modules)
+    {
+        Debug.Assert(_current == this);
+
+        for (int index = 0; index < modules.Length; ++index)
+        {
+            var (path, limits) = modules[index];
+            var id = $"_{index + 1}_{Path.GetFileNameWithoutExtension(path)}_";
+            _logger.LogInformation("Loading module {Index} of {Count} for {FirmletId}: {Path}", index + 1, modules.Length, Id, path);
+            _logger.LogDebug("Module {Path} has {NativeStackSize} bytes of native stack, {StackSize} bytes of WAMR stack and {HeapSize} bytes of heap",
+                path, limits.NativeStackSize, limits.StackSize, limits.HeapSize);
+
+            // This is faster when the module is already loaded (for another firmlet or instance), see WasmModuleCache
+            var stopwatch = Stopwatch.StartNew();
+            _modules[id] = (path, limits);
+            AddInstance(id);
+            _logger.LogDebug("Module {Path} loaded in {Time} ms", path, stopwatch.Elapsed.TotalMilliseconds);
+        }
+    }
+
+    public void InitializeModules()
+        => ForEachInstance(InitializeInstance);
+
+    // After _start() the calls have a shorter budget: callbacks should return quickly, the firmlet is not
+    // doing its (potentially long) initialization anymore.
+    public void StartModules()
+    {
+        _starting = true;
+        ForEachInstance(StartInstance);
+
+        _started = true;
+        foreach (var inst in _instances.Values)
+            inst.CallBudget = GetCallBudget();
+    }
+
+    // Instances terminated while we're stopping are not restarted
+    public void StopModules()
+    {
+        _stopping = true;
+
+        // The parameter for which we pass zero is the "reason", currently we do not support
+        // suspending firmlets then it's always 0.
+        ForEachInstance((_, inst) => Wamr.CallExportIV(inst, inst.OnDisposeFunc, arg: 0));
+    }
+
+    // Logs how much of the reserved resources each instance used, useful to tune the firmlet configuration. Each figure
+    // is compared with the limit it measures: the native stack (sampled, see Wamr.SampleStackUsage()) with native_stack_size
+    // and the linear memory with the heap. WAMR does not expose the usage of its own stack, only its size is logged.
+    public void LogResourcesUsage()
+    {
+        Debug.Assert(_current == this);
+
+        foreach (var (id, inst) in _instances)
+        {
+            _logger.LogInformation(
+                "Module {Name} ({FirmletId}) used at least {PeakNativeStackUsage} of {NativeStackSize} bytes of native stack (WAMR stack {StackSize} bytes), linear memory is {MemorySize} bytes (heap {HeapSize} bytes)",
+                id, Id, inst.PeakNativeStackUsage, inst.Limits.NativeStackSize, inst.Limits.StackSize, Wamr.GetLinearMemorySize(inst), inst.Limits.HeapSize);
+        }
+
+        foreach (var (id, count) in _overruns)
+            _logger.LogWarning("Module {Name} ({FirmletId}) exceeded its time budget {Count} time(s)", id, Id, count);
+    }
+
+    // Modules which exceed their time budget are restarted (see Recover()) after the action has been
+    // executed for all the others, disabled modules are skipped.
+    public void ForEachInstance(Action<string, WasmInstance> action)
+    {
+        Debug.Assert(_current == this);
+
+        List<string>? overrun = null;
+        foreach (var (id, inst) in _instances)
+        {
+            try
+            {
+                action(id, inst);
+            }
+            catch (WasmBudgetExceededException e)
+            {
+                CountOverrun(id, e);
+                (overrun ??= new()).Add(id);
+            }
+        }
+
+        if (overrun is not null)
+        {
+            foreach (var id in overrun)
+                Recover(id);
+        }
+    }
+
+    // Runs the action on the thread of this firmlet, the task completes when it has been executed.
+    public Task InvokeAsync(Action<HostedFirmlet> action)
+    {
+        var tcs = new TaskCompletionSource(TaskCreationOptions.RunContinuationsAsynchronously);
+        if (!TryEnqueue(() =>
+        {
+            try
+            {
+                action(this);
+                tcs.SetResult();
+            }
+            catch (Exception e)
+            {
+                tcs.SetException(e);
+            }
+        }))
+        {
+            tcs.SetException(new ObjectDisposedException(nameof(HostedFirmlet)));
+        }
+
+        return tcs.Task;
+    }
+
+    // Queues an MQTT message for the modules of this firmlet without waiting for it to be delivered, errors are logged.
+    public void PostMessage(string topic, string payload)
+    {
+        // With a full queue the write succeeds anyway, one message is dropped (see OnMessageDropped())
+        if (_messages.Writer.TryWrite((topic, payload)))
+            _pending.Set();
+        else
+            _logger.LogWarning("Firmlet {FirmletId} is shutting down, message {Topic} has been discarded", Id, topic);
+    }
+
+    public void Dispose()
+    {
+        if (_disposed)
+            return;
+
+        // Pending requests are executed (messages are not delivered after StopModules()), then the instances
+        // are released on the same thread which created them
+        _disposed = true;
+        _requests.Writer.TryComplete();
+        _messages.Writer.TryComplete();
+        _pending.Set();
+        _thread.Join();
+    }
+
+    private const int DroppedMessagesLogInterval = 100;
+    private const int MaxRecoveryAttempts = 3;
+
+    // Stack of the thread used by the host itself, the default stack size of a .NET thread on Linux
+    private const int ThreadStackReserve = 1536 * 1024;
+
+    [ThreadStatic]
+    private static HostedFirmlet? _current;
+
+    private readonly ILogger _logger;
+    private readonly Settings _settings;
+    private readonly WasmWatchdog _watchdog;
+    private readonly Thread _thread;
+    private readonly Channel<Action> _requests = Channel.CreateUnbounded<Action>(new UnboundedChannelOptions { SingleReader = true });
+    private readonly Channel<(string Topic, string Payload)> _messages;
+    private readonly AutoResetEvent _pending = new(false); // Not disposed, PostMessage() could still set it
+    private readonly Dictionary<string, WasmInstance> _instances = new();
+    private readonly Dictionary<string, (string Path, WasmInstanceLimits Limits)> _modules = new();
+    private readonly Dictionary<string, int> _overruns = new();
+    private bool _starting;
+    private bool _started;
+    private bool _stopping;
+    private volatile bool _disposed;
+    private long _droppedCount;
+
+    private TimeSpan GetCallBudget()
+        => TimeSpan.FromMilliseconds(Math.Max(0, _started ? _settings.HostCallbackBudgetMs : _settings.HostStartupBudgetMs));
+
+    private WasmInstance AddInstance(string id)
+    {
+        var (path, limits) = _modules[id];
+        var inst = Wamr.LoadInstance(id, path, limits);
+        inst.CallBudget = GetCallBudget();
+
+        _instances[id] = inst;
+        _watchdog.Add(inst);
+
+        return inst;
+    }
+
+    private void RemoveInstance(string id)
+    {
+        if (_instances.Remove(id, out var inst))
+        {
+            _watchdog.Remove(inst);
+            inst.Dispose();
+        }
+    }
+
+    private void CountOverrun(string id, WasmBudgetExceededException e)
+    {
+        int count = _overruns[id] = _overruns.GetValueOrDefault(id) + 1;
+        _logger.LogWarning("Module {Name} ({FirmletId}) exceeded its time budget ({Count} time(s)): {Message}", id, Id, count, e.Message);
+    }
+
+    // A terminated call could have stopped the module anywhere (for example in the middle of updating its own data)
+    // then we replace the instance with a new one, initialized (and started) again. A module which keeps exceeding
+    // its budget is disabled, the other modules (and firmlets) in this host keep running. Even when overruns are
+    // unlimited (HostMaxBudgetOverruns is -1) we give up if it fails to restart MaxRecoveryAttempts times in a row.
+    private void Recover(string id)
+    {
+        RemoveInstance(id);
+
+        if (_stopping)
+            return;
+
+        for (int attempt = 0; attempt < MaxRecoveryAttempts; ++attempt)
+        {
+            if (_settings.HostMaxBudgetOverruns != -1 && _overruns[id] >= _settings.HostMaxBudgetOverruns)
+                break;
+
+            var inst = AddInstance(id);
+
+            try
+            {
+                InitializeInstance(id, inst);
+                if (_starting)
+                    StartInstance(id, inst);
+
+                _logger.LogInformation("Module {Name} ({FirmletId}) has been restarted", id, Id);
+                return;
+            }
+            catch (WasmBudgetExceededException e)
+            {
+                CountOverrun(id, e);
+                RemoveInstance(id);
+            }
+        }
+
+        _logger.LogError("Module {Name} ({FirmletId}) exceeded its time budget {Count} times, it has been disabled", id, Id, _overruns[id]);
+    }
+
+    private void InitializeInstance(string id, WasmInstance inst)
+        => Wamr.CallExportSV(inst, inst.OnInitializeFunc, id);
+
+    private void StartInstance(string id, WasmInstance inst)
+    {
+        // The parameter for which we pass zero is the "reason", currently we do not support
+        // suspending firmlets then it's always 0.
+        _logger.LogTrace("Starting {Name} ({FirmletId})...", id, Id);
+        Wamr.CallExportIV(inst, inst.OnStartFunc, arg: 0, required: true);
+    }
+
+    private bool TryEnqueue(Action action)
+    {
+        if (!_requests.Writer.TryWrite(action))
+            return false; // Dispose() has been called
+
+        _pending.Set();
+        return true;
+    }
+
+    private void OnMessageDropped((string Topic, string Payload) message)
+    {
+        // Logging each message would make things even worse
+        long count = Interlocked.Increment(ref _droppedCount);
+        if (count == 1 || count % DroppedMessagesLogInterval == 0)
+            _logger.LogWarning("Message queue of firmlet {FirmletId} is full, message {Topic} dropped ({Count} so far)", Id, message.Topic, count);
+    }
+
+    private void DeliverMessage(string topic, string payload)
+    {
+        if (_stopping)
+            return;
+
+        try
+        {
+            ForEachInstance((_, inst) => Wamr.CallExportSSV(inst, inst.OnMessageFunc, topic, payload));
+        }
+        catch (Exception e)
+        {
+            _logger.LogError(e, "Firmlet {FirmletId} failed to process message {Topic}: {Message}", Id, topic, e.Message);
+        }
+    }
+
+    // Requests from the coordinator go before the messages, a message is delivered only when there are no requests
+    private void Run()
+    {
+        _current = this;
+        Wamr.InitializeThread();
+
+        try
+        {
+            while (true)
+            {
+                if (_requests.Reader.TryRead(out var action))
+                    action();
+                else if (_messages.Reader.TryRead(out var message))
+                    DeliverMessage(message.Topic, message.Payload);
+                else if (_requests.Reader.Completion.IsCompleted && _messages.Reader.Completion.IsCompleted)
+                    break;
+                else
+                    _pending.WaitOne();
+            }
+        }
+        finally
+        {
+            foreach (var inst in _instances.Values)
+            {
+                _watchdog.Remove(inst);
+                inst.Dispose();
+            }
+
+            _instances.Clear();
+            Wamr.ShutdownThread();
+            _current = null;
+        }
+    }
+}
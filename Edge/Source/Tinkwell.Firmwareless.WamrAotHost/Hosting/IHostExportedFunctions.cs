@@ -5,8 +5,9 @@ namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
 interface IHostExportedFunctions
 {
     void Abort(string message, string fileName, int lineNumber, int columnNumber);
-    void Log(int severity, string topic, string message);
-    void PublishMqttMessage(string topic, string payload);
+    void Log(int severity, ReadOnlySpan<byte> topic, ReadOnlySpan<byte> message);
+    bool PublishMqttMessage(ReadOnlySpan<byte> topic, ReadOnlySpan<byte> payload);
+    int PublishMqttMessages(ReadOnlySpan<byte> batch);
     int OpenFile(string path, OpenMode mode, OpenFlags flags);
     void CloseFile(int handle);
     int ReadFromFile(int handle, Span<byte> buffer, ReadFlags flags);
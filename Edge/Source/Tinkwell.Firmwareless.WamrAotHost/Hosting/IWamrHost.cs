@@ -2,9 +2,11 @@
 
 interface IWamrHost
 {
-    void Load(string[] paths);
+    // Initializes the runtime and registers the native functions, it's called by Load() if needed
+    void Prepare();
+    void Load(IReadOnlyDictionary<string, string[]> firmlets);
     void InitializeModules();
     void Start();
     void Stop();
-    void Notify(string topic, string payload);
+    void Notify(string firmletId, string topic, string payload);
 }
@@ -18,20 +18,33 @@ static class Libiwasm
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern IntPtr wasm_runtime_get_exception(IntPtr module_inst);
 
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void wasm_runtime_clear_exception(IntPtr module_inst);
+
+    // It can be called from any thread, the running code stops at the next check (see WasmWatchdog)
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void wasm_runtime_terminate(IntPtr module_inst);
+
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern bool wasm_runtime_init();
 
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern void wasm_runtime_destroy();
 
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern bool wasm_runtime_init_thread_env();
+
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void wasm_runtime_destroy_thread_env();
+
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern void wasm_runtime_set_log_level(WamrLogLevel level);
 
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
-    public static extern IntPtr wasm_runtime_load(byte[] buf, uint size, out IntPtr errorBuf, uint errorBufSize);
+    public static extern IntPtr wasm_runtime_load(IntPtr buf, uint size, [Out] byte[] errorBuf, uint errorBufSize);
 
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
-    public static extern IntPtr wasm_runtime_instantiate(IntPtr module, uint stackSize, uint heapSize, out IntPtr errorBuf, uint errorBufSize);
+    public static extern IntPtr wasm_runtime_instantiate(IntPtr module, uint stackSize, uint heapSize, [Out] byte[] errorBuf, uint errorBufSize);
 
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern void wasm_runtime_deinstantiate(IntPtr moduleInst);
@@ -42,6 +55,9 @@ static class Libiwasm
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern IntPtr wasm_runtime_create_exec_env(IntPtr moduleInst, uint stackSize);
 
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern void wasm_runtime_set_native_stack_boundary(IntPtr execEnv, IntPtr nativeStackBoundary);
+
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern void wasm_runtime_destroy_exec_env(IntPtr execEnv);
 
@@ -70,6 +86,15 @@ static class Libiwasm
 
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern uint wasm_runtime_get_memory_size(IntPtr moduleInst);
+
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern IntPtr wasm_runtime_get_default_memory(IntPtr moduleInst);
+
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern ulong wasm_memory_get_cur_page_count(IntPtr memoryInst);
+
+    [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
+    public static extern ulong wasm_memory_get_bytes_per_page(IntPtr memoryInst);
     
     [DllImport(Lib, CallingConvention = CallingConvention.Cdecl)]
     public static extern IntPtr wasm_runtime_module_malloc(IntPtr moduleInst, uint size, out IntPtr nativeAddr);
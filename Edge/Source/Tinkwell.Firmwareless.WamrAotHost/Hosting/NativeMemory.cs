@@ -11,14 +11,17 @@ static class NativeMemory
         if (ptr == nint.Zero || len <= 0)
             return "";
 
-        byte[] bytes = new byte[len];
-        Marshal.Copy(ptr, bytes, 0, len);
-
-        int realLen = Array.IndexOf<byte>(bytes, 0);
-        if (realLen < 0)
-            realLen = len;
+        unsafe
+        {
+            return Utf8ToString(new ReadOnlySpan<byte>(ptr.ToPointer(), len));
+        }
+    }
 
-        return Encoding.UTF8.GetString(bytes, 0, realLen);
+    // Strings coming from the modules could be NUL terminated (and the terminator included in their length)
+    public static string Utf8ToString(ReadOnlySpan<byte> text)
+    {
+        int length = text.IndexOf((byte)0);
+        return Encoding.UTF8.GetString(length < 0 ? text : text[..length]);
     }
 
     public static string AnsiPtrToString(nint ptr)
@@ -56,10 +59,5 @@ static class NativeMemory
         _toFree.Clear();
     }
 
-    public static void Pin(Delegate del)
-        => _pinnedDelegates.Add(del);
-
-    // Keep delegates alive so their thunks don't get GC'd
-    private static readonly List<Delegate> _pinnedDelegates = new();
     private static readonly List<IntPtr> _toFree = new();
 }
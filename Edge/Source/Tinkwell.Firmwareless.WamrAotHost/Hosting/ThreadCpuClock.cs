@@ -0,0 +1,51 @@
+﻿using System.Diagnostics;
+using System.Runtime.InteropServices;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+// CPU time consumed by a thread, readable from any other thread of the process. Time budgets are measured with it:
+// the time a host spends stopped (SIGSTOP, the cgroup freezer) or throttled (cpu.max) does not count.
+// Where it's not supported (everywhere but Linux) it falls back to the wall clock.
+static unsafe class ThreadCpuClock
+{
+    public const int WallClock = -1;
+
+    // The clock of the calling thread, to pass to GetNanoseconds()
+    public static int GetCurrentThreadClock()
+    {
+        if (!OperatingSystem.IsLinux())
+            return WallClock;
+
+        int clock;
+        return pthread_getcpuclockid(pthread_self(), &clock) == 0 ? clock : WallClock;
+    }
+
+    // Returns -1 if the clock cannot be read (for example because its thread exited)
+    public static long GetNanoseconds(int clock)
+    {
+        if (clock == WallClock)
+            return (long)(Stopwatch.GetTimestamp() * (1_000_000_000.0 / Stopwatch.Frequency));
+
+        Timespec time;
+        if (clock_gettime(clock, &time) != 0)
+            return -1;
+
+        return time.Seconds * 1_000_000_000L + time.Nanoseconds;
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    private struct Timespec
+    {
+        public nint Seconds;
+        public nint Nanoseconds;
+    }
+
+    [DllImport("libc")]
+    private static extern nint pthread_self();
+
+    [DllImport("libc")]
+    private static extern int pthread_getcpuclockid(nint thread, int* clock);
+
+    [DllImport("libc", SetLastError = true)]
+    private static extern int clock_gettime(int clock, Timespec* time);
+}
@@ -1,5 +1,5 @@
 ﻿using System.Diagnostics;
-using System.Runtime.InteropServices;
+using System.Text;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
 
@@ -26,7 +26,7 @@ static partial class Wamr
         if (IsCallable(inst, func, required) == false)
             return;
 
-        if (!Libiwasm.wasm_runtime_call_wasm(inst.ExecEnv, func, 0, nint.Zero))
+        if (!CallWasm(inst, func, 0, nint.Zero))
             throw new HostException($"Error calling (v)v WASM function: {GetLastError(inst)}");
     }
 
@@ -38,23 +38,14 @@ static partial class Wamr
             return;
 
         int argc = 1;
-        int size = sizeof(int);
-        nint argv = Marshal.AllocHGlobal(size);
-        try
+        unsafe
         {
-            unsafe
-            {
-                byte* p = (byte*)argv.ToPointer();
-                *(int*)p = arg;
-            }
-
-            if (!Libiwasm.wasm_runtime_call_wasm(inst.ExecEnv, func, (uint)argc, argv))
-                throw new HostException($"Error calling (i)v WASM function: {GetLastError(inst)}");
-        }
-        finally
-        {
-            Marshal.FreeHGlobal(argv);
+            byte* p = (byte*)inst.Argv.ToPointer();
+            *(int*)p = arg;
         }
+
+        if (!CallWasm(inst, func, (uint)argc, inst.Argv))
+            throw new HostException($"Error calling (i)v WASM function: {GetLastError(inst)}");
     }
 
     public static void CallExportSV(WasmInstance inst, nint func, string text, bool required = false)
@@ -64,35 +55,21 @@ static partial class Wamr
         if (IsCallable(inst, func, required) == false)
             return;
 
-        var (ptr, len) = WasmMemory.CopyStringIntoModuleMemoryAsUtf8(inst, text);
-        int ptrSize = inst.Wasm64 ? nint.Size : sizeof(int);
+        int len = Encoding.UTF8.GetByteCount(text);
+        nint ptr = inst.GetScratchBuffer(len);
+        WasmMemory.WriteUtf8(inst, ptr, text, len);
 
         int argc = 2;
-        int size = ptrSize + sizeof(int);
-        nint argv = Marshal.AllocHGlobal(size);
-        try
-        {
-            unsafe
-            {
-                byte* p = (byte*)argv.ToPointer();
-                if (inst.Wasm64)
-                    *(nint*)p = ptr;
-                else
-                    *(int*)p = (int)ptr;
-                *(int*)(p + ptrSize) = len;
-            }
-
-            if (!Libiwasm.wasm_runtime_call_wasm(inst.ExecEnv, func, (uint)argc, argv))
-                throw new HostException($"Error calling (pi)v WASM function: {GetLastError(inst)}");
-        }
-        finally
+        unsafe
         {
-            Marshal.FreeHGlobal(argv);
-            WasmMemory.Free(inst, ptr);
+            byte* p = (byte*)inst.Argv.ToPointer();
+            p = WritePointerArg(inst, p, ptr);
+            *(int*)p = len;
         }
-    }
-
 
+        if (!CallWasm(inst, func, (uint)argc, inst.Argv))
+            throw new HostException($"Error calling (pi)v WASM function: {GetLastError(inst)}");
+    }
 
     public static void CallExportSSV(WasmInstance inst, nint func, string text1, string text2, bool required = false)
     {
@@ -101,43 +78,110 @@ static partial class Wamr
         if (IsCallable(inst, func, required) == false)
             return;
 
-        // TODO: REUSE THIS MEMORY!!! This function is probably called MANY many times: keep a buffer
-        // around instead of allocating/freeing each time.
-        var (ptr1, len1) = WasmMemory.CopyStringIntoModuleMemoryAsUtf8(inst, text1);
-        var (ptr2, len2) = WasmMemory.CopyStringIntoModuleMemoryAsUtf8(inst, text1);
-        int ptrSize = inst.Wasm64 ? nint.Size : sizeof(int);
+        // This is called for every message delivered to the firmlet: both the strings are encoded directly
+        // into the scratch buffer of the instance, one after the other, without allocating anything.
+        int len1 = Encoding.UTF8.GetByteCount(text1);
+        int len2 = Encoding.UTF8.GetByteCount(text2);
+        nint ptr1 = inst.GetScratchBuffer(len1 + len2);
+        nint ptr2 = ptr1 + len1;
+        WasmMemory.WriteUtf8(inst, ptr1, text1, len1);
+        WasmMemory.WriteUtf8(inst, ptr2, text2, len2);
 
         int argc = 4;
-        int size = 2 * (ptrSize + sizeof(int));
-        nint argv = Marshal.AllocHGlobal(size);
+        unsafe
+        {
+            byte* p = (byte*)inst.Argv.ToPointer();
+            p = WritePointerArg(inst, p, ptr1);
+            *(int*)p = len1;
+            p = WritePointerArg(inst, p + sizeof(int), ptr2);
+            *(int*)p = len2;
+        }
+
+        if (!CallWasm(inst, func, (uint)argc, inst.Argv))
+            throw new HostException($"Error calling (pipi)v WASM function: {GetLastError(inst)}");
+    }
+
+    private static unsafe byte* WritePointerArg(WasmInstance inst, byte* p, nint ptr)
+    {
+        if (inst.Wasm64)
+        {
+            *(nint*)p = ptr;
+            return p + nint.Size;
+        }
+
+        *(int*)p = (int)ptr;
+        return p + sizeof(int);
+    }
+
+    // Samples the native stack of the calling thread, it must be called by host functions (then while the module
+    // is running). AOT code runs on the native stack and WAMR does not expose its peak usage: the distance from
+    // the frame which entered the module is the best approximation we have. It's measured from the same frame
+    // as the boundary set by CallWasm() (then it's comparable with NativeStackSize) and it includes the frames
+    // of the runtime and of the host function which sampled it.
+    public static unsafe void SampleStackUsage()
+    {
+        var inst = _runningInstance;
+        if (inst is null)
+            return;
+
+        byte marker = 0;
+        long used = (long)_stackBase - (long)&marker;
+        if (used > inst.PeakNativeStackUsage)
+            inst.PeakNativeStackUsage = used;
+    }
+
+    [ThreadStatic]
+    private static WasmInstance? _runningInstance;
+
+    [ThreadStatic]
+    private static nint _stackBase;
+
+    private static unsafe bool CallWasm(WasmInstance inst, nint func, uint argc, nint argv)
+    {
+        // A module could be re-entered (a host function which calls back into WASM) then we restore the previous state
+        var previousInstance = _runningInstance;
+        var previousStackBase = _stackBase;
+
+        byte marker = 0;
+        _runningInstance = inst;
+        _stackBase = (nint)(&marker);
+
+        // The module can use NativeStackSize bytes of the native stack below this frame. WAMR checks the boundary
+        // at each call between host and module and, when compiled with stack bounds checks, in each AOT function.
+        // A re-entrant call is part of the outermost one, it shares its boundary.
+        bool reentrant = ReferenceEquals(previousInstance, inst);
+        if (!reentrant)
+            Libiwasm.wasm_runtime_set_native_stack_boundary(inst.ExecEnv, _stackBase - (nint)inst.Limits.NativeStackSize);
+
+        // Only the outermost call is watched, a re-entrant call is part of it
+        bool watched = inst.CallBudget > TimeSpan.Zero && !reentrant;
+        if (watched)
+            inst.ArmWatchdog();
+
+        bool succeeded;
+        bool terminated = false;
         try
         {
-            unsafe
-            {
-                byte* p = (byte*)argv.ToPointer();
-
-                if (inst.Wasm64)
-                    *(nint*)p = ptr1;
-                else
-                    *(int*)p = (int)ptr1;
-                *(int*)(p + ptrSize) = len1;
-
-                if (inst.Wasm64)
-                    *(nint*)(p + ptrSize + sizeof(int)) = ptr2;
-                else
-                    *(int*)(p + ptrSize + sizeof(int)) = (int)ptr2;
-                *(int*)(p + ptrSize + sizeof(int) + ptrSize) = len2;
-            }
-
-            if (!Libiwasm.wasm_runtime_call_wasm(inst.ExecEnv, func, (uint)argc, argv))
-                throw new HostException($"Error calling (pipi)v WASM function: {GetLastError(inst)}");
+            succeeded = Libiwasm.wasm_runtime_call_wasm(inst.ExecEnv, func, argc, argv);
         }
         finally
         {
-            Marshal.FreeHGlobal(argv);
-            WasmMemory.Free(inst, ptr1);
-            WasmMemory.Free(inst, ptr2);
+            _runningInstance = previousInstance;
+            _stackBase = previousStackBase;
+
+            if (watched)
+                terminated = inst.DisarmWatchdog();
         }
+
+        if (terminated)
+        {
+            // The call could have returned just before being terminated, the exception must be cleared anyway
+            Libiwasm.wasm_runtime_clear_exception(inst.Instance);
+            if (!succeeded)
+                throw new WasmBudgetExceededException($"Module {inst.Id} has been terminated after running for more than {inst.CallBudget.TotalMilliseconds} ms.");
+        }
+
+        return succeeded;
     }
 
     private static char TypeChar(Type t)
@@ -1,5 +1,4 @@
 ﻿using System.Diagnostics;
-using System.Reflection;
 using System.Runtime.InteropServices;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
@@ -14,6 +13,17 @@ static partial class Wamr
         Libiwasm.wasm_runtime_set_log_level(Libiwasm.WamrLogLevel.Warning);
     }
 
+    // Each thread (not created by WAMR) which calls into the runtime must initialize its own environment
+    // (used for the stack boundaries and the signal handlers), the runtime itself is shared.
+    public static void InitializeThread()
+    {
+        if (!Libiwasm.wasm_runtime_init_thread_env())
+            throw new HostException("Failed to init the WAMR thread environment.");
+    }
+
+    public static void ShutdownThread()
+        => Libiwasm.wasm_runtime_destroy_thread_env();
+
     public static nint GetModuleInstanceFromExecEnvHandle(nint execEnv)
     {
         Debug.Assert(execEnv != nint.Zero);
@@ -25,26 +35,21 @@ static partial class Wamr
         return moduleInstance;
     }
 
-    public static NativeSymbol MakeNativeSymbol<T>(string name, T del, string signature) where T : notnull, Delegate
+    // The signature uses the WAMR notation (it does not include the execution environment, which is always
+    // the first parameter of the native function) and functionPtr is an UnmanagedCallersOnly function.
+    public static NativeSymbol MakeNativeSymbol(string name, nint functionPtr, string signature)
     {
-        NativeMemory.Pin(del);
+        Debug.Assert(functionPtr != nint.Zero);
+
         return new NativeSymbol
         {
             Symbol = NativeMemory.StringToHGlobalAnsi(name),
-            FuncPtr = Marshal.GetFunctionPointerForDelegate(del),
+            FuncPtr = functionPtr,
             Signature = NativeMemory.StringToHGlobalAnsi(signature),
             Attachment = IntPtr.Zero
         };
     }
 
-    public static NativeSymbol MakeNativeSymbol<T>(string name, T del) where T : notnull, Delegate
-    {
-        var returnType = del.GetMethodInfo().ReturnType;
-        var parameters = del.GetMethodInfo().GetParameters().Select(x => x.ParameterType);
-        var signature = Signature(returnType, parameters.ToArray());
-        return MakeNativeSymbol(name, del, signature);
-    }
-
     public static void RegisterNativeFunctions(params NativeSymbol[] syms)
     {
         if (_moduleNamePtr == IntPtr.Zero)
@@ -64,47 +69,47 @@ static partial class Wamr
             throw new HostException("Failed to register native functions.");
     }
 
-    public static WasmInstance LoadInstance(string id, string modulePath)
+    public static WasmInstance LoadInstance(string id, string modulePath, WasmInstanceLimits limits)
     {
         Debug.Assert(!string.IsNullOrWhiteSpace(id));
         Debug.Assert(!string.IsNullOrWhiteSpace(modulePath));
 
-        IntPtr errorMessage;
-        IntPtr moduleInstance;
-
-        // Extra check but wasm_runtime_load() already does this for us. We just want to be sure that these modules
-        // are exactly what we expect (including the extension).
+        bool aot;
         if (modulePath.EndsWith(".aot", StringComparison.OrdinalIgnoreCase))
-        {
-            if (WasmChecker.IsAot(modulePath) == false)
-               throw new HostException($"Module'{modulePath}' is not a valid .aot file.");
-        }
+            aot = true;
         else if (modulePath.EndsWith(".wasm", StringComparison.OrdinalIgnoreCase))
-        {
-            if (WasmChecker.IsWasm(modulePath) == false)
-                throw new HostException($"Module'{modulePath}' is not a valid .wasm file.");
-        }
+            aot = false;
         else
-        {
             throw new HostException($"Module'{modulePath}' is not a valid .wasm/.aot file.");
-        }
 
-        var bytes = File.ReadAllBytes(modulePath);
-        moduleInstance = Libiwasm.wasm_runtime_load(bytes, (uint)bytes.Length, out errorMessage, 512);
-        if (moduleInstance == nint.Zero)
-            throw new HostException($"Failed to load WASM module '{modulePath}': {NativeMemory.AnsiPtrToString(errorMessage)}");
+        // The module is shared with the other instances of the same module, each instance has its own memory
+        nint module = WasmModuleCache.Acquire(modulePath, aot);
+        nint inst = nint.Zero;
+        nint execEnv = nint.Zero;
 
-        var inst = Libiwasm.wasm_runtime_instantiate(moduleInstance, stackSize: 64 * 1024, heapSize: 64 * 1024, out errorMessage, 512);
-        if (inst == nint.Zero)
-            throw new HostException($"Failed to instantiate module '{modulePath}': {NativeMemory.AnsiPtrToString(errorMessage)}");
+        try
+        {
+            var errorBuffer = new byte[512];
+            inst = Libiwasm.wasm_runtime_instantiate(module, limits.StackSize, limits.HeapSize, errorBuffer, (uint)errorBuffer.Length);
+            if (inst == nint.Zero)
+                throw new HostException($"Failed to instantiate module '{modulePath}': {NativeMemory.Utf8ToString(errorBuffer)}");
+
+            execEnv = Libiwasm.wasm_runtime_create_exec_env(inst, limits.StackSize);
+            if (execEnv == nint.Zero)
+                throw new HostException("Failed to create execution environment.");
+        }
+        catch
+        {
+            if (inst != nint.Zero)
+                Libiwasm.wasm_runtime_deinstantiate(inst);
 
-        var execEnv = Libiwasm.wasm_runtime_create_exec_env(inst, 64 * 1024);
-        if (execEnv == nint.Zero)
-            throw new HostException("Failed to create execution environment.");
+            WasmModuleCache.Release(module);
+            throw;
+        }
 
         bool wasm64 = false; // TODO: we need to inspect the moduleInstance or use the manifest or a CLI parameter
 
-        return new WasmInstance(id, moduleInstance, inst, execEnv, wasm64)
+        return new WasmInstance(id, module, inst, execEnv, wasm64, limits)
         {
             OnInitializeFunc = Libiwasm.wasm_runtime_lookup_function(inst, "_initialize", Signature(typeof(void), typeof(nint), typeof(int))),
             OnStartFunc = Libiwasm.wasm_runtime_lookup_function(inst, "_start", Signature(typeof(void), typeof(void))),
@@ -113,6 +118,18 @@ static partial class Wamr
         };
     }
 
+    // Size of the linear memory, it never shrinks then it's also its high-water mark
+    public static long GetLinearMemorySize(WasmInstance inst)
+    {
+        Debug.Assert(inst.Instance != nint.Zero);
+
+        nint memory = Libiwasm.wasm_runtime_get_default_memory(inst.Instance);
+        if (memory == nint.Zero)
+            return 0;
+
+        return (long)(Libiwasm.wasm_memory_get_cur_page_count(memory) * Libiwasm.wasm_memory_get_bytes_per_page(memory));
+    }
+
     public static void Shutdown()
     {
         NativeMemory.FreeAll();
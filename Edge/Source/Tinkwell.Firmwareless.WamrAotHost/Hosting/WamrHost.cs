@@ -2,13 +2,40 @@
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
 
-sealed class WamrHost(ILogger<WamrHost> logger, IRegisterHostUnsafeNativeFunctions exportedFunctions) : IWamrHost, IDisposable
+// Hosts one or more firmlets (see HostedFirmlet) sharing the same WAMR runtime.
+sealed class WamrHost(ILogger<WamrHost> logger, Settings settings, IRegisterHostUnsafeNativeFunctions exportedFunctions) : IWamrHost, IDisposable
 {
-    public void Load(string[] paths)
+    public void Prepare()
     {
         ObjectDisposedException.ThrowIf(_disposed, this);
-        Initialize();
-        LoadModules(paths);
+
+        if (_prepared)
+            return;
+
+        _logger.LogDebug("Initializing WAMR runtime...");
+        Wamr.Initialize();
+
+        _logger.LogDebug("Registering native functions...");
+        _exportedFunctions.RegisterAll();
+
+        _prepared = true;
+    }
+
+    public void Load(IReadOnlyDictionary<string, string[]> firmlets)
+    {
+        ObjectDisposedException.ThrowIf(_disposed, this);
+        Prepare();
+
+        // Modules are sized before creating the thread of their firmlet, its stack must fit the deepest one
+        var modules = firmlets.ToDictionary(x => x.Key, x => x.Value.Select(path => (Path: path, Limits: _sizing.Calculate(path))).ToArray());
+        foreach (var (firmletId, firmletModules) in modules)
+        {
+            uint nativeStackSize = firmletModules.Select(x => x.Limits.NativeStackSize).DefaultIfEmpty().Max();
+            _firmlets[firmletId] = new HostedFirmlet(_logger, _settings, _watchdog, firmletId, nativeStackSize);
+        }
+
+        // Firmlets are loaded in parallel, each one on its own thread
+        InvokeOnAll(firmlet => firmlet.LoadModules(modules[firmlet.Id]));
     }
 
     public void InitializeModules()
@@ -16,8 +43,7 @@ sealed class WamrHost(ILogger<WamrHost> logger, IRegisterHostUnsafeNativeFunctio
         ObjectDisposedException.ThrowIf(_disposed, this);
 
         _logger.LogDebug("Initializing...");
-        foreach (var inst in _instances)
-            Wamr.CallExportSV(inst.Value, inst.Value.OnInitializeFunc, inst.Key);
+        InvokeOnAll(firmlet => firmlet.InitializeModules());
     }
 
     public void Start()
@@ -25,29 +51,28 @@ sealed class WamrHost(ILogger<WamrHost> logger, IRegisterHostUnsafeNativeFunctio
         ObjectDisposedException.ThrowIf(_disposed, this);
 
         _logger.LogDebug("Starting...");
-        foreach (var inst in _instances)
-        {
-            // The parameter for which we pass zero is the "reason", currently we do not support
-            // suspending firmlets then it's always 0.
-            _logger.LogTrace("Starting {Name}...", inst.Key);
-            Wamr.CallExportIV(inst.Value, inst.Value.OnStartFunc, arg: 0, required: true);
-        }
+        InvokeOnAll(firmlet => firmlet.StartModules());
     }
 
     public void Stop()
     {
         _logger.LogInformation("Terminating...");
 
-        // The parameter for which we pass zero is the "reason", currently we do not support
-        // suspending firmlets then it's always 0.
-        foreach (var inst in _instances)
-            Wamr.CallExportIV(inst.Value, inst.Value.OnDisposeFunc, arg: 0);
+        InvokeOnAll(firmlet =>
+        {
+            firmlet.StopModules();
+            firmlet.LogResourcesUsage();
+        });
     }
 
-    public void Notify(string topic, string payload)
+    public void Notify(string firmletId, string topic, string payload)
     {
-        foreach (var inst in _instances)
-            Wamr.CallExportSSV(inst.Value, inst.Value.OnMessageFunc, topic, payload);
+        // We do not wait for the firmlet to process the message: the caller is the IPC channel,
+        // shared by all the firmlets in this host.
+        if (_firmlets.TryGetValue(firmletId, out var firmlet))
+            firmlet.PostMessage(topic, payload);
+        else
+            _logger.LogWarning("Cannot find firmlet {FirmletId} to deliver a message", firmletId);
     }
 
     public void Dispose()
@@ -57,30 +82,16 @@ sealed class WamrHost(ILogger<WamrHost> logger, IRegisterHostUnsafeNativeFunctio
     }
 
     private readonly ILogger<WamrHost> _logger = logger;
+    private readonly Settings _settings = settings;
+    private readonly WasmInstanceSizing _sizing = new(settings);
+    private readonly WasmWatchdog _watchdog = new(logger, settings);
     private readonly IRegisterHostUnsafeNativeFunctions _exportedFunctions = exportedFunctions;
-    private readonly Dictionary<string, WasmInstance> _instances = new();
+    private readonly Dictionary<string, HostedFirmlet> _firmlets = new();
+    private bool _prepared;
     private bool _disposed;
 
-    private void Initialize()
-    {
-        _logger.LogDebug("Initializing WAMR runtime...");
-        Wamr.Initialize();
-
-        _logger.LogDebug("Registering native functions...");
-        _exportedFunctions.RegisterAll();
-    }
-
-    private void LoadModules(string[] paths)
-    {
-        for (int index=0; index < paths.Length; ++index)
-        {
-            string path = paths[index];
-            var id = $"_{index + 1}_{Path.GetFileNameWithoutExtension(path)}_";
-            _logger.LogInformation("Loading module {Index} of {Count}: {Path}", index + 1, paths.Length, path);
-            var inst = Wamr.LoadInstance(id, path);
-            _instances[id] = inst;
-        }
-    }
+    private void InvokeOnAll(Action<HostedFirmlet> action)
+        => Task.WhenAll(_firmlets.Values.Select(firmlet => firmlet.InvokeAsync(action))).GetAwaiter().GetResult();
 
     private void Dispose(bool disposing)
     {
@@ -89,9 +100,11 @@ sealed class WamrHost(ILogger<WamrHost> logger, IRegisterHostUnsafeNativeFunctio
 
         try
         {
-            foreach (var inst in _instances.Values)
-                inst.Dispose();
+            // Instances are released by the thread of each firmlet, the runtime must outlive them
+            foreach (var firmlet in _firmlets.Values)
+                firmlet.Dispose();
 
+            _watchdog.Dispose();
             Wamr.Shutdown();
             _logger.LogDebug("WASM runtime has been disposed");
         }
@@ -0,0 +1,4 @@
+﻿namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+// A call into a module has been terminated because it exceeded its time budget (see WasmWatchdog).
+sealed class WasmBudgetExceededException(string message) : Exception(message) { }
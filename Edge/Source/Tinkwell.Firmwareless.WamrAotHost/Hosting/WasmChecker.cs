@@ -2,26 +2,15 @@
 
 static class WasmChecker
 {
-    public static bool IsWasm(string path)
+    public static bool IsWasm(ReadOnlySpan<byte> image)
     {
         // WebAssembly files start with: 0x00 0x61 0x73 0x6D (i.e., "\0asm")
-        var buffer = ReadMagicNumbers(path);
-        return buffer[0] == 0x00 && buffer[1] == 0x61 && buffer[2] == 0x73 && buffer[3] == 0x6D;
+        return image.Length >= 4 && image[0] == 0x00 && image[1] == 0x61 && image[2] == 0x73 && image[3] == 0x6D;
     }
 
-    public static bool IsAot(string path)
+    public static bool IsAot(ReadOnlySpan<byte> image)
     {
         // WAMRC .aot files typically start with: 0x00 0x61 0x6f 0x74 (i.e., "\0aot")
-        var buffer = ReadMagicNumbers(path);
-        return buffer[0] == 0x00 && buffer[1] == 0x61 && buffer[2] == 0x6f && buffer[3] == 0x74;
-    }
-
-    private static byte[] ReadMagicNumbers(string path)
-    {
-        byte[] buffer = new byte[4];
-
-        using var fs = new FileStream(path, FileMode.Open, FileAccess.Read);
-        fs.ReadExactly(buffer, 0, buffer.Length);
-        return buffer;
+        return image.Length >= 4 && image[0] == 0x00 && image[1] == 0x61 && image[2] == 0x6f && image[3] == 0x74;
     }
 }
@@ -13,5 +13,6 @@ enum WasmErrorCode
     ArgumentOutOfRange = -21,
     ArgumentInvalidFormat = -22,
     NotFound = -31,
-    NoAccess = -32
+    NoAccess = -32,
+    Busy = -40
 }
\ No newline at end of file
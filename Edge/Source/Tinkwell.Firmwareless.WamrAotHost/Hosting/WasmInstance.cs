@@ -1,4 +1,8 @@
-﻿namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+﻿using System.Diagnostics;
+using System.Numerics;
+using System.Runtime.InteropServices;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
 
 sealed class WasmInstance : IDisposable
 {
@@ -12,17 +16,125 @@ sealed class WasmInstance : IDisposable
     public required nint OnDisposeFunc;
     public required nint OnMessageFunc;
 
-    public WasmInstance(string id, IntPtr module, nint instance, nint execEnv, bool wasm64)
+    // Size of the native block used to pass the arguments to an exported function, enough
+    // for the longest signature we call (two pointers and two integers, with 64 bit pointers).
+    public const int ArgvSize = 32;
+
+    public WasmInstance(string id, IntPtr module, nint instance, nint execEnv, bool wasm64, WasmInstanceLimits limits)
     {
         Id = id;
         Module = module;
         Instance = instance;
         ExecEnv = execEnv;
         Wasm64 = wasm64;
+        Limits = limits;
+        Argv = Marshal.AllocHGlobal(ArgvSize);
+    }
+
+    public WasmInstanceLimits Limits { get; }
+
+    // Deepest native stack observed while running this instance (to compare with Limits.NativeStackSize), it's
+    // sampled when the module calls a host function (see Wamr.SampleStackUsage()) then it's a lower bound of the real peak.
+    public long PeakNativeStackUsage { get; set; }
+
+    // Maximum CPU time of each call into this instance (see ThreadCpuClock), zero when unlimited. It's enforced by
+    // WasmWatchdog, a call which exceeds it is terminated.
+    public TimeSpan CallBudget
+    {
+        get => _callBudget;
+        set
+        {
+            _callBudget = value;
+            _callBudgetNs = (long)(value.TotalSeconds * 1_000_000_000);
+        }
+    }
+
+    // Calls to the same instance are never concurrent (the execution environment is not thread-safe)
+    // then the memory used to pass arguments is allocated once and reused by every call.
+    public nint Argv { get; }
+
+    // Returns a buffer (in the module heap) of at least the specified size, it's reused by all the calls
+    // and it only grows. Do not cache the native address: the memory of the module could be moved when it grows.
+    public nint GetScratchBuffer(int size)
+    {
+        if (_scratch != nint.Zero && size <= _scratchSize)
+            return _scratch;
+
+        if (_scratch != nint.Zero)
+            WasmMemory.Free(this, _scratch);
+
+        // Set to zero first: if the allocation fails we do not want to keep a dangling pointer
+        _scratch = nint.Zero;
+        _scratchSize = 0;
+
+        int newSize = (int)BitOperations.RoundUpToPowerOf2((uint)Math.Max(size, MinimumScratchSize));
+        _scratch = WasmMemory.Alloc(this, newSize);
+        _scratchSize = newSize;
+
+        return _scratch;
+    }
+
+    // Called (by Wamr) when a call into this instance begins, re-entrant calls share the budget of the outermost one.
+    public void ArmWatchdog()
+    {
+        int clock = ThreadCpuClock.GetCurrentThreadClock();
+        lock (_watchdogLock)
+        {
+            _clock = clock;
+            _deadline = ThreadCpuClock.GetNanoseconds(clock) + _callBudgetNs;
+            _terminated = false;
+        }
+    }
+
+    // Called (by Wamr) when the call returns, the result is true if it has been terminated by the watchdog.
+    public bool DisarmWatchdog()
+    {
+        lock (_watchdogLock)
+        {
+            _deadline = 0;
+            return _terminated;
+        }
+    }
+
+    // Called by WasmWatchdog, it terminates the running call when it's out of budget. We give it the same time again
+    // to stop: the result is false if it has been terminated already and it's still running (it's reported once,
+    // the call is not watched anymore).
+    public bool EnforceBudget()
+    {
+        lock (_watchdogLock)
+        {
+            if (_deadline == 0)
+                return true;
+
+            long now = ThreadCpuClock.GetNanoseconds(_clock);
+            if (now == -1 || now < _deadline)
+                return true;
+
+            if (_terminated)
+            {
+                _deadline = 0;
+                return false;
+            }
+
+            Libiwasm.wasm_runtime_terminate(Instance);
+            _terminated = true;
+            _deadline = now + _callBudgetNs;
+
+            return true;
+        }
     }
 
     public void Dispose()
     {
+        if (_scratch != nint.Zero)
+        {
+            WasmMemory.Free(this, _scratch);
+            _scratch = nint.Zero;
+        }
+
+        if (Argv != nint.Zero)
+            Marshal.FreeHGlobal(Argv);
+
         if (ExecEnv != nint.Zero)
             Libiwasm.wasm_runtime_destroy_exec_env(ExecEnv);
 
@@ -30,6 +142,17 @@ sealed class WasmInstance : IDisposable
             Libiwasm.wasm_runtime_deinstantiate(Instance);
 
         if (Module != nint.Zero)
-            Libiwasm.wasm_runtime_unload(Module);
+            WasmModuleCache.Release(Module);
     }
+
+    private const int MinimumScratchSize = 256;
+
+    private readonly object _watchdogLock = new();
+    private nint _scratch;
+    private int _scratchSize;
+    private TimeSpan _callBudget;
+    private long _callBudgetNs;
+    private int _clock;
+    private long _deadline;
+    private bool _terminated;
 }
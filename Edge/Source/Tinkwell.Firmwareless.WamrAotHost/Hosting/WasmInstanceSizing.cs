@@ -0,0 +1,111 @@
+﻿using System.Globalization;
+using System.Text.Json;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+// Stacks and heap reserved for a module instance, WAMR enforces all of them. StackSize is the WAMR stack of the
+// instance (operands and frames of the interpreter), NativeStackSize is how much of the native stack of the calling
+// thread the module can use (AOT code keeps its frames there, see Wamr.CallWasm()): going deeper raises a stack
+// overflow exception in the module. An allocation which does not fit in the heap fails.
+sealed record WasmInstanceLimits(uint StackSize, uint HeapSize, uint NativeStackSize);
+
+// Sizes each instance using, in order of priority:
+// - The firmlet configuration (optional file "firmlet.config"): "stack_size", "native_stack_size" and "heap_size"
+//   in the "runtime" block.
+// - For the native stack, the stack usage calculated by the compiler (saved in "package.json", these are the native
+//   frames of the AOT code): the sum of all the frames (the worst case when there is no recursion) but not more than
+//   the largest frame times HostEstimatedCallDepth.
+// - The defaults from the settings.
+// The result is always capped with HostMaxStackSize, HostMaxNativeStackSize and HostMaxHeapSize.
+sealed class WasmInstanceSizing(Settings settings)
+{
+    public WasmInstanceLimits Calculate(string modulePath)
+    {
+        var directory = Path.GetDirectoryName(modulePath) ?? "";
+        var moduleName = Path.GetFileName(modulePath);
+        var configuration = ReadConfiguration(directory);
+
+        long stackSize = GetConfiguredSize(configuration, "/runtime/stack_size")
+            ?? _settings.HostDefaultStackSize;
+
+        long nativeStackSize = GetConfiguredSize(configuration, "/runtime/native_stack_size")
+            ?? EstimateNativeStackSize(ReadPackageManifest(directory), moduleName)
+            ?? _settings.HostDefaultNativeStackSize;
+
+        long heapSize = GetConfiguredSize(configuration, "/runtime/heap_size")
+            ?? _settings.HostDefaultHeapSize;
+
+        return new(
+            (uint)Math.Clamp(RoundUp(stackSize), MinimumStackSize, _settings.HostMaxStackSize),
+            (uint)Math.Clamp(RoundUp(heapSize), 0, _settings.HostMaxHeapSize),
+            (uint)Math.Clamp(RoundUp(nativeStackSize), MinimumStackSize, _settings.HostMaxNativeStackSize)
+        );
+    }
+
+    private const string ConfigurationFileName = "firmlet.config";
+    private const string PackageManifestFileName = "package.json";
+
+    // Room for the frames of the runtime, between the call into the module and its first frame
+    private const int NativeStackReserve = 8 * 1024;
+    private const int MinimumStackSize = 16 * 1024;
+    private const int Granularity = 4 * 1024;
+
+    private readonly Settings _settings = settings;
+
+    private long? EstimateNativeStackSize(IReadOnlyDictionary<string, string> manifest, string moduleName)
+    {
+        if (!TryGetNumber(manifest, $"stack_frame_max:{moduleName}", out var maxFrameSize)
+            || !TryGetNumber(manifest, $"stack_frame_total:{moduleName}", out var totalFrameSize))
+        {
+            return null;
+        }
+
+        return Math.Min(totalFrameSize, maxFrameSize * _settings.HostEstimatedCallDepth) + NativeStackReserve;
+
+        static bool TryGetNumber(IReadOnlyDictionary<string, string> manifest, string key, out long value)
+        {
+            value = 0;
+            return manifest.TryGetValue(key, out var text)
+                && long.TryParse(text, NumberStyles.None, CultureInfo.InvariantCulture, out value);
+        }
+    }
+
+    private static long? GetConfiguredSize(FirmletConfiguration? configuration, string key)
+    {
+        if (configuration?.GetEntry(key) is not double value)
+            return null;
+
+        if (value < 0 || value > int.MaxValue)
+            throw new HostException($"Invalid value {value} for {key} in {ConfigurationFileName}.");
+
+        return (long)value;
+    }
+
+    private static long RoundUp(long size)
+        => (size + Granularity - 1) / Granularity * Granularity;
+
+    private static FirmletConfiguration? ReadConfiguration(string directory)
+    {
+        var path = Path.Combine(directory, ConfigurationFileName);
+        if (!File.Exists(path))
+            return null;
+
+        var reader = new FirmletConfigurationFileReader();
+        return reader.ReadAsync(path, new() { NoIncludes = true }, CancellationToken.None).GetAwaiter().GetResult();
+    }
+
+    // The manifest is a flat object with string values (written by the compilation server), we read it without
+    // a typed model: the host only needs a few entries.
+    private static IReadOnlyDictionary<string, string> ReadPackageManifest(string directory)
+    {
+        var path = Path.Combine(directory, PackageManifestFileName);
+        if (!File.Exists(path))
+            return new Dictionary<string, string>();
+
+        using var document = JsonDocument.Parse(File.ReadAllBytes(path));
+        return document.RootElement
+            .EnumerateObject()
+            .Where(x => x.Value.ValueKind == JsonValueKind.String)
+            .ToDictionary(x => x.Name, x => x.Value.GetString()!);
+    }
+}
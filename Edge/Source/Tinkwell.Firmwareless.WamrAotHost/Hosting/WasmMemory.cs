@@ -85,6 +85,21 @@ static class WasmMemory
         return (ptr, utf8.Length);
     }
 
+    public static void WriteUtf8(WasmInstance inst, nint ptr, string text, int length)
+    {
+        Debug.Assert(inst.Instance != nint.Zero);
+        Debug.Assert(length == Encoding.UTF8.GetByteCount(text));
+
+        if (length == 0)
+            return;
+
+        var dest = MapAppAddressRangeToNative(inst.Instance, ptr, length);
+        unsafe
+        {
+            Encoding.UTF8.GetBytes(text, new Span<byte>((void*)dest, length));
+        }
+    }
+
     public static nint Alloc(WasmInstance inst, int size)
     {
         Debug.Assert(inst.Instance != nint.Zero);
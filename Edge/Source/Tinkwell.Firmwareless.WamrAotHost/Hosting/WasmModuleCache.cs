@@ -0,0 +1,141 @@
+﻿using System.Diagnostics;
+using System.IO.MemoryMappedFiles;
+using System.Security.Cryptography;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+// WAMR needs the image of a module for as long as the module is loaded (and it could change its content), then
+// we map the file copy-on-write instead of copying it in the managed heap: pages are read from the file system
+// cache and only the ones WAMR changes become private to this process.
+// Modules are cached by content: all the instances of the same module (also when loaded from different paths)
+// share the same wasm_module_t, the image is validated and parsed only once.
+static class WasmModuleCache
+{
+    public static nint Acquire(string modulePath, bool aot)
+    {
+        Debug.Assert(!string.IsNullOrWhiteSpace(modulePath));
+
+        var image = ModuleImage.Map(modulePath);
+        try
+        {
+            var hash = Convert.ToHexString(SHA256.HashData(image.Span));
+
+            lock (_lock)
+            {
+                if (_modulesByHash.TryGetValue(hash, out var cached))
+                {
+                    ++cached.References;
+                    return cached.Module;
+                }
+
+                // Extra check but wasm_runtime_load() already does this for us. We just want to be sure that these modules
+                // are exactly what we expect (including the extension).
+                if (aot ? !WasmChecker.IsAot(image.Span) : !WasmChecker.IsWasm(image.Span))
+                    throw new HostException($"Module '{modulePath}' is not a valid {(aot ? ".aot" : ".wasm")} file.");
+
+                var errorBuffer = new byte[ErrorBufferSize];
+                nint module = Libiwasm.wasm_runtime_load(image.Pointer, (uint)image.Length, errorBuffer, (uint)errorBuffer.Length);
+                if (module == nint.Zero)
+                    throw new HostException($"Failed to load WASM module '{modulePath}': {NativeMemory.Utf8ToString(errorBuffer)}");
+
+                var entry = new CacheEntry(hash, module, image);
+                _modulesByHash.Add(hash, entry);
+                _modulesByHandle.Add(module, entry);
+                image = null; // Owned by the cache now
+
+                return module;
+            }
+        }
+        finally
+        {
+            image?.Dispose();
+        }
+    }
+
+    public static void Release(nint module)
+    {
+        lock (_lock)
+        {
+            if (!_modulesByHandle.TryGetValue(module, out var entry))
+            {
+                Debug.Fail($"Module {module} is not in the cache.");
+                return;
+            }
+
+            if (--entry.References > 0)
+                return;
+
+            _modulesByHash.Remove(entry.Hash);
+            _modulesByHandle.Remove(module);
+
+            // The image must outlive the module
+            Libiwasm.wasm_runtime_unload(module);
+            entry.Image.Dispose();
+        }
+    }
+
+    private const int ErrorBufferSize = 512;
+
+    private static readonly object _lock = new();
+    private static readonly Dictionary<string, CacheEntry> _modulesByHash = new();
+    private static readonly Dictionary<nint, CacheEntry> _modulesByHandle = new();
+
+    private sealed class CacheEntry(string hash, nint module, ModuleImage image)
+    {
+        public string Hash { get; } = hash;
+        public nint Module { get; } = module;
+        public ModuleImage Image { get; } = image;
+        public int References { get; set; } = 1;
+    }
+
+    private sealed unsafe class ModuleImage : IDisposable
+    {
+        public static ModuleImage Map(string path)
+        {
+            long length = new FileInfo(path).Length;
+            if (length == 0 || length > int.MaxValue)
+                throw new HostException($"Module '{path}' has an invalid size ({length} bytes).");
+
+            var file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null, 0, MemoryMappedFileAccess.CopyOnWrite);
+            try
+            {
+                var view = file.CreateViewAccessor(0, length, MemoryMappedFileAccess.CopyOnWrite);
+                return new ModuleImage(file, view, length);
+            }
+            catch
+            {
+                file.Dispose();
+                throw;
+            }
+        }
+
+        public nint Pointer => (nint)(_pointer + _view.PointerOffset);
+
+        public long Length { get; }
+
+        public ReadOnlySpan<byte> Span => new(_pointer + _view.PointerOffset, (int)Length);
+
+        public void Dispose()
+        {
+            if (_pointer == null)
+                return;
+
+            _view.SafeMemoryMappedViewHandle.ReleasePointer();
+            _pointer = null;
+            _view.Dispose();
+            _file.Dispose();
+        }
+
+        private ModuleImage(MemoryMappedFile file, MemoryMappedViewAccessor view, long length)
+        {
+            _file = file;
+            _view = view;
+            Length = length;
+            _view.SafeMemoryMappedViewHandle.AcquirePointer(ref _pointer);
+        }
+
+        private readonly MemoryMappedFile _file;
+        private readonly MemoryMappedViewAccessor _view;
+        private byte* _pointer;
+    }
+}
@@ -0,0 +1,89 @@
+﻿using Microsoft.Extensions.Logging;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Hosting;
+
+// Enforces the time budget of the calls into the modules (see WasmInstance.CallBudget): without it a firmlet which
+// loops forever blocks its thread (and burns a CPU) until the coordinator notices the CPU usage of the whole host.
+// A single thread checks all the instances of this host, a call which exceeds its budget is terminated with
+// wasm_runtime_terminate() and the caller gets a WasmBudgetExceededException (see HostedFirmlet for the recovery).
+// WAMR checks for termination in loops and calls: the interpreter always does it but AOT code only when it has been
+// compiled with --enable-multi-thread. A call which ignores the termination cannot be stopped without killing
+// its thread: by default we log it and leave it running (the other firmlets are not affected), with
+// HostRestartOnStuckModule we exit and let the coordinator restart this host (with all its firmlets).
+sealed class WasmWatchdog : IDisposable
+{
+    public WasmWatchdog(ILogger logger, Settings settings)
+    {
+        _logger = logger;
+        _restartOnStuckModule = settings.HostRestartOnStuckModule;
+
+        // Enforcement is not precise, a call could run up to its budget plus one period
+        var budgets = new[] { settings.HostStartupBudgetMs, settings.HostCallbackBudgetMs }.Where(x => x > 0).ToArray();
+        if (budgets.Length == 0)
+            return;
+
+        _period = TimeSpan.FromMilliseconds(Math.Clamp(budgets.Min() / 4, MinimumPeriodMs, MaximumPeriodMs));
+        _thread = new Thread(Run)
+        {
+            Name = "WASM watchdog",
+            IsBackground = true,
+        };
+        _thread.Start();
+    }
+
+    public void Add(WasmInstance inst)
+    {
+        lock (_instances)
+            _instances.Add(inst);
+    }
+
+    public void Remove(WasmInstance inst)
+    {
+        lock (_instances)
+            _instances.Remove(inst);
+    }
+
+    public void Dispose()
+    {
+        if (_stop.IsSet)
+            return;
+
+        _stop.Set();
+        _thread?.Join();
+        _stop.Dispose();
+    }
+
+    private const int MinimumPeriodMs = 10;
+    private const int MaximumPeriodMs = 250;
+
+    private readonly ILogger _logger;
+    private readonly bool _restartOnStuckModule;
+    private readonly Thread? _thread;
+    private readonly TimeSpan _period;
+    private readonly ManualResetEventSlim _stop = new();
+    private readonly List<WasmInstance> _instances = new();
+
+    private void Run()
+    {
+        while (!_stop.Wait(_period))
+        {
+            lock (_instances)
+            {
+                foreach (var inst in _instances)
+                {
+                    if (inst.EnforceBudget())
+                        continue;
+
+                    if (!_restartOnStuckModule)
+                    {
+                        _logger.LogCritical("Module {Name} did not stop after being terminated (was it compiled without --enable-multi-thread?), it's still running and its firmlet is not responding", inst.Id);
+                        continue;
+                    }
+
+                    _logger.LogCritical("Module {Name} did not stop after being terminated, the host is going to exit (HostRestartOnStuckModule) and all its firmlets are going to be restarted", inst.Id);
+                    Environment.FailFast($"Module {inst.Id} did not stop after being terminated.");
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,49 @@
+﻿using System.Runtime.InteropServices;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+// Minimal wrapper for the Linux futex syscall, used to wake up the reader of a SharedMemoryRing.
+// The futex word lives in a shared mapping then we must use the non-private operations: the waiter
+// and the waker are in different processes.
+static unsafe class Futex
+{
+    public static bool IsSupported
+        => OperatingSystem.IsLinux() && SyscallNumber != -1;
+
+    // Sleeps while *address == expectedValue, returns when woken (or spuriously) or after the timeout.
+    public static void Wait(int* address, int expectedValue, int timeoutMs)
+    {
+        var timeout = new Timespec
+        {
+            Seconds = timeoutMs / 1000,
+            Nanoseconds = (timeoutMs % 1000) * 1_000_000
+        };
+
+        // Errors (EAGAIN when the value already changed, EINTR, ETIMEDOUT) are all fine: the caller checks again
+        _ = syscall(SyscallNumber, address, FutexWait, expectedValue, &timeout, null, 0);
+    }
+
+    public static void Wake(int* address, int count)
+        => _ = syscall(SyscallNumber, address, FutexWake, count, null, null, 0);
+
+    private const int FutexWait = 0;
+    private const int FutexWake = 1;
+
+    private static readonly nint SyscallNumber = RuntimeInformation.ProcessArchitecture switch
+    {
+        Architecture.X64 => 202,
+        Architecture.Arm64 => 98,
+        Architecture.Arm => 240,
+        _ => -1
+    };
+
+    [StructLayout(LayoutKind.Sequential)]
+    private struct Timespec
+    {
+        public nint Seconds;
+        public nint Nanoseconds;
+    }
+
+    [DllImport("libc", SetLastError = true)]
+    private static extern nint syscall(nint number, int* address, int operation, int value, Timespec* timeout, int* address2, int value3);
+}
@@ -2,6 +2,7 @@
 using StreamJsonRpc;
 using System.Diagnostics;
 using System.IO.Pipes;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
@@ -10,14 +11,57 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
 {
     public string HostId => _id ?? "";
 
-    public Task StartClientAsync(string pipeName, string id, object clientCallbacks, CancellationToken cancellationToken)
+    // dataChannelPath is the shared memory channel created by the coordinator, if any (see IpcServer.OpenDataChannel())
+    public Task StartClientAsync(string pipeName, string id, string? dataChannelPath, object clientCallbacks, Action<MqttMessage> receiveMqttMessage, CancellationToken cancellationToken)
     {
         _pipeName = pipeName;
         _id = id;
+        _dataChannelPath = dataChannelPath;
         _clientCallbacks = clientCallbacks;
+        _receiveMqttMessage = receiveMqttMessage;
         return StartClientImplAsync(cancellationToken);
     }
 
+    // A standby host connects in advance, without a data channel (it's created only for the host it's going to be)
+    public Task StartStandbyClientAsync(string pipeName, string id, object clientCallbacks, Action<MqttMessage> receiveMqttMessage, CancellationToken cancellationToken)
+    {
+        _standby = true;
+        return StartClientAsync(pipeName, id, null, clientCallbacks, receiveMqttMessage, cancellationToken);
+    }
+
+    // The standby host has been assigned: from now on it's addressed (and it reconnects) with the new ID
+    public async Task AssumeIdentityAsync(string id, string? dataChannelPath)
+    {
+        Debug.Assert(_rpc is not null);
+        Debug.Assert(_standby);
+
+        _id = id;
+        _dataChannelPath = dataChannelPath;
+        _standby = false;
+        OpenDataChannel();
+        await RegisterAsync(_rpc);
+    }
+
+    public Task PublishMqttMessageAsync(MqttMessage message)
+    {
+        if (_dataChannel is not null)
+            return _dataChannel.SendAsync(message, x => InvokeAsync(CoordinatorMethods.PublishMqttMessage, x));
+
+        return NotifyAsync(CoordinatorMethods.PublishMqttMessage, message);
+    }
+
+    // Without the shared memory channel the messages are sent with a single JSON-RPC notification
+    public Task PublishMqttMessagesAsync(IReadOnlyList<MqttMessage> messages)
+    {
+        if (_dataChannel is not null)
+            return _dataChannel.SendAsync(messages, x => InvokeAsync(CoordinatorMethods.PublishMqttMessage, x));
+
+        if (messages.Count == 1)
+            return NotifyAsync(CoordinatorMethods.PublishMqttMessage, messages[0]);
+
+        return NotifyAsync(CoordinatorMethods.PublishMqttMessages, new PublishMqttMessagesRequest { Messages = messages.ToList() });
+    }
+
     public Task NotifyAsync(string notificationName, object argument)
     {
         Debug.Assert(_rpc is not null);
@@ -25,10 +69,19 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
         return _rpc.NotifyAsync(notificationName, argument);
     }
 
+    // Like NotifyAsync() but it completes when the coordinator processed the request
+    public Task InvokeAsync(string methodName, object argument)
+    {
+        Debug.Assert(_rpc is not null);
+        _logger.LogTrace("Host {HostId} sending request {Method}...", _id, methodName);
+        return _rpc.InvokeAsync(methodName, argument);
+    }
+
     public async Task DisconnectAsync()
     {
         _disconnecting = true;
         _rpc?.Dispose();
+        _dataChannel?.Dispose();
 
         if (_pipeClient is not null)
             await _pipeClient.DisposeAsync();
@@ -46,7 +99,11 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
     private NamedPipeClientStream? _pipeClient;
     private string? _pipeName;
     private string? _id;
+    private string? _dataChannelPath;
     private object? _clientCallbacks;
+    private Action<MqttMessage>? _receiveMqttMessage;
+    private SharedMemoryChannel? _dataChannel;
+    private bool _standby;
     private bool _disconnecting;
     private bool _disposed;
 
@@ -57,6 +114,9 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
         Debug.Assert(_clientCallbacks is not null);
 
         _disconnecting = false;
+        if (!_standby)
+            OpenDataChannel();
+
         for (int i=0; i < _settings.HostMaxConnectionAttempts; ++i)
         {
             try
@@ -71,8 +131,7 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
                 _rpc.Disconnected += OnDisconnected;
                 _rpc.StartListening();
 
-                _logger.LogDebug("Registering the host {HostId}", _id);
-                await _rpc.NotifyAsync(CoordinatorMethods.RegisterClient, new RegisterClientRequest { ClientName = _id });
+                await RegisterAsync(_rpc);
                 return;
             }
             catch (IOException e)
@@ -85,6 +144,34 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
         throw new HostException($"Host {_id} failed to connect to the coordination process.");
     }
 
+    private async Task RegisterAsync(JsonRpc rpc)
+    {
+        Debug.Assert(_id is not null);
+
+        _logger.LogDebug("Registering the host {HostId}", _id);
+        await rpc.NotifyAsync(IpcMethods.Attach, new RegisterClientRequest { ClientName = _id, SharedMemory = _dataChannel is not null });
+        await rpc.NotifyAsync(CoordinatorMethods.RegisterClient, new RegisterClientRequest { ClientName = _id, Standby = _standby });
+    }
+
+    // The channel is created by the coordinator, if we cannot open it then we simply keep using JSON-RPC.
+    // It survives reconnections: it does not depend on the pipe.
+    private void OpenDataChannel()
+    {
+        Debug.Assert(_receiveMqttMessage is not null);
+
+        if (_dataChannel is not null || _dataChannelPath is null || _settings.IpcTransport != IpcTransport.SharedMemory || !SharedMemoryChannel.IsSupported)
+            return;
+
+        try
+        {
+            _dataChannel = SharedMemoryChannel.Open(_logger, _dataChannelPath, _receiveMqttMessage);
+        }
+        catch (Exception e) when (e is IOException || e is UnauthorizedAccessException || e is HostException)
+        {
+            _logger.LogWarning(e, "Cannot open the shared memory channel {Path}, using JSON-RPC: {Message}", _dataChannelPath, e.Message);
+        }
+    }
+
     private void OnDisconnected(object? sender, EventArgs e)
     {
         if (_disconnecting)
@@ -105,6 +192,7 @@ sealed class IpcClient(ILogger<IpcClient> logger, Settings settings) : IpcBase,
         {
             _disconnecting = true;
             _rpc?.Dispose();
+            _dataChannel?.Dispose();
             _pipeClient?.Dispose();
         }
 
@@ -3,6 +3,8 @@ using StreamJsonRpc;
 using System.Collections.Concurrent;
 using System.Diagnostics;
 using System.IO.Pipes;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+using Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
 
@@ -24,9 +26,47 @@ sealed class IpcServer(ILogger<IpcServer> logger, Settings settings) : IpcBase,
                 PipeOptions.Asynchronous);
 
             await pipeServer.WaitForConnectionAsync(_cts.Token);
+            HandleClient(pipeServer);
+        }
+    }
+
+    // Creates the shared memory channel for a host which is going to be started, it's used only after the host
+    // attached itself and confirmed it could open it. Until then (and if it's not supported) we use JSON-RPC.
+    // Returns the path of the channel (to pass to the host) or null if there is not one.
+    public string? OpenDataChannel(string hostId, Action<MqttMessage> receive)
+    {
+        CloseDataChannel(hostId);
 
-            _ = Task.Run(() => HandleClientAsync(pipeServer), _cts.Token);
+        if (_settings.IpcTransport != IpcTransport.SharedMemory)
+            return null;
+
+        if (!SharedMemoryChannel.IsSupported)
+        {
+            _logger.LogWarning("Shared memory IPC is not supported on this platform, using JSON-RPC for {HostId}", hostId);
+            return null;
         }
+
+        var path = SharedMemoryChannel.CreatePath();
+        _pendingDataChannels[hostId] = SharedMemoryChannel.Create(_logger, path, _settings.IpcRingBufferSize, receive);
+        return path;
+    }
+
+    // Messages to the same host are delivered in order, the caller must not send the next one before this completed
+    public Task SendMqttMessageAsync(string hostId, MqttMessage message)
+    {
+        if (_dataChannels.TryGetValue(hostId, out var channel))
+            return channel.SendAsync(message, x => InvokeAsync(hostId, HostMethods.ReceiveMqttMessage, x));
+
+        return NotifyAsync(hostId, HostMethods.ReceiveMqttMessage, message);
+    }
+
+    // Like NotifyAsync() but it completes when the host processed the request
+    public Task InvokeAsync(string hostId, string methodName, object argument)
+    {
+        if (_clients.TryGetValue(hostId, out var rpc))
+            return rpc.InvokeAsync(methodName, argument);
+
+        return Task.FromException(new HostException($"Cannot find host {hostId} to send request '{methodName}'."));
     }
 
     public Task NotifyAsync(string hostId, string notificationName, object argument)
@@ -52,6 +92,8 @@ sealed class IpcServer(ILogger<IpcServer> logger, Settings settings) : IpcBase,
         _cts.Cancel();
         foreach (var rpc in _clients.Values)
             rpc.Dispose();
+        foreach (var channel in _pendingDataChannels.Values.Concat(_dataChannels.Values))
+            channel.Dispose();
         _cts.Dispose();
     }
 
@@ -61,32 +103,62 @@ sealed class IpcServer(ILogger<IpcServer> logger, Settings settings) : IpcBase,
     private object? _serverCallbacks;
     private readonly CancellationTokenSource _cts = new();
     private readonly ConcurrentDictionary<string, JsonRpc> _clients = new();
+    private readonly ConcurrentDictionary<string, SharedMemoryChannel> _pendingDataChannels = new();
+    private readonly ConcurrentDictionary<string, SharedMemoryChannel> _dataChannels = new();
 
-    private async Task HandleClientAsync(NamedPipeServerStream pipe)
+    private void HandleClient(NamedPipeServerStream pipe)
     {
         Debug.Assert(_serverCallbacks is not null);
 
         _logger.LogDebug("Client connected");
 
+        // Notifications are addressed by client name, we know it only when the client attaches itself
+        string? clientName = null;
         var rpc = CreateJsonRpc(pipe, _serverCallbacks);
+        rpc.AddLocalRpcMethod(IpcMethods.Attach, new Action<RegisterClientRequest>(request =>
+        {
+            _logger.LogDebug("Client {ClientName} attached (shared memory: {SharedMemory})", request.ClientName, request.SharedMemory);
+
+            // A standby host attaches again, with the ID of the host it replaces
+            if (clientName is not null && clientName != request.ClientName)
+                _clients.TryRemove(new KeyValuePair<string, JsonRpc>(clientName, rpc));
+
+            clientName = request.ClientName;
+            _clients[clientName] = rpc;
+
+            // When reconnecting the channel could be already in use
+            if (_pendingDataChannels.TryRemove(clientName, out var channel))
+            {
+                if (request.SharedMemory)
+                    _dataChannels[clientName] = channel;
+                else
+                    channel.Dispose();
+            }
+        }));
+
         rpc.Disconnected += (s, e) =>
         {
             if (e.Reason != DisconnectedReason.RemotePartyTerminated)
-                _logger.LogWarning("Client disconnected. {Reason}: {Message}", e.Reason, e.Exception?.Message);
+                _logger.LogWarning("Client {ClientName} disconnected. {Reason}: {Message}", clientName, e.Reason, e.Exception?.Message);
+
+            // A restarted client could have attached again (with a new connection) in the meantime
+            if (clientName is not null)
+                _clients.TryRemove(new KeyValuePair<string, JsonRpc>(clientName, rpc));
 
-            _clients.TryRemove(pipe.GetHashCode().ToString(), out _);
             rpc.Dispose();
             pipe.Dispose();
         };
 
-        _clients[pipe.GetHashCode().ToString()] = rpc;
+        // Requests are served by JsonRpc until the client disconnects, we do not need to wait here
         rpc.StartListening();
+    }
 
-        try
-        {
-            // Keep waiting and server all the client's requests
-            await Task.Delay(Timeout.Infinite, _cts.Token);
-        }
-        catch (TaskCanceledException) { }
+    private void CloseDataChannel(string hostId)
+    {
+        if (_pendingDataChannels.TryRemove(hostId, out var pending))
+            pending.Dispose();
+
+        if (_dataChannels.TryRemove(hostId, out var channel))
+            channel.Dispose();
     }
 }
@@ -0,0 +1,55 @@
+﻿using System.Buffers.Binary;
+using System.Text;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+// Binary representation of an MqttMessage in a SharedMemoryRing: the length (in bytes) of the firmlet ID,
+// topic and payload followed by their UTF-8 text. It's encoded directly in the shared memory.
+static class MqttMessageFraming
+{
+    public const int HeaderSize = 8;
+
+    // Returns -1 if the message cannot be represented (the firmlet ID and the topic are limited to 64 KB).
+    public static int GetSize(MqttMessage message)
+    {
+        int firmletIdLength = Encoding.UTF8.GetByteCount(message.FirmletId);
+        int topicLength = Encoding.UTF8.GetByteCount(message.Topic);
+        if (firmletIdLength > ushort.MaxValue || topicLength > ushort.MaxValue)
+            return -1;
+
+        return HeaderSize + firmletIdLength + topicLength + Encoding.UTF8.GetByteCount(message.Payload);
+    }
+
+    // The buffer must be exactly GetSize() bytes
+    public static void Write(MqttMessage message, Span<byte> buffer)
+    {
+        var text = buffer[HeaderSize..];
+        int firmletIdLength = Encoding.UTF8.GetBytes(message.FirmletId, text);
+        int topicLength = Encoding.UTF8.GetBytes(message.Topic, text[firmletIdLength..]);
+        int payloadLength = Encoding.UTF8.GetBytes(message.Payload, text[(firmletIdLength + topicLength)..]);
+
+        BinaryPrimitives.WriteUInt16LittleEndian(buffer, (ushort)firmletIdLength);
+        BinaryPrimitives.WriteUInt16LittleEndian(buffer[2..], (ushort)topicLength);
+        BinaryPrimitives.WriteInt32LittleEndian(buffer[4..], payloadLength);
+    }
+
+    public static MqttMessage Read(ReadOnlySpan<byte> buffer)
+    {
+        if (buffer.Length < HeaderSize)
+            throw new HostException("Invalid MQTT message frame: the header is truncated.");
+
+        int firmletIdLength = BinaryPrimitives.ReadUInt16LittleEndian(buffer);
+        int topicLength = BinaryPrimitives.ReadUInt16LittleEndian(buffer[2..]);
+        int payloadLength = BinaryPrimitives.ReadInt32LittleEndian(buffer[4..]);
+
+        if (payloadLength < 0 || HeaderSize + firmletIdLength + topicLength + payloadLength != buffer.Length)
+            throw new HostException("Invalid MQTT message frame: lengths do not match the size of the frame.");
+
+        var text = buffer[HeaderSize..];
+        return new MqttMessage(
+            Encoding.UTF8.GetString(text[..firmletIdLength]),
+            Encoding.UTF8.GetString(text.Slice(firmletIdLength, topicLength)),
+            Encoding.UTF8.GetString(text.Slice(firmletIdLength + topicLength, payloadLength)));
+    }
+}
@@ -0,0 +1,87 @@
+﻿using Microsoft.Extensions.Logging;
+using System.Diagnostics;
+using System.Threading.Channels;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+// Messages published by the firmlets of this host. Publishing only queues the message: the thread of the firmlet
+// does not wait for the IPC channel, a background task sends the messages to the coordinator in batches. The queue
+// is bounded (HostMqttPublishQueueCapacity, shared by all the firmlets in this host): when it's full the publish
+// fails and the firmlet can decide what to do (retry later, drop or coalesce its messages).
+sealed class MqttPublishQueue(ILogger<MqttPublishQueue> logger, Settings settings, IpcClient ipcClient)
+{
+    // Returns false when the queue is full, trying again later could succeed. Once the queue
+    // has been stopped it throws: nothing will be sent anymore.
+    public bool TryEnqueue(MqttMessage message)
+    {
+        if (_queue.Writer.TryWrite(message))
+            return true;
+
+        if (_closed)
+            throw new HostException($"The host is stopping, message {message.Topic} from {message.FirmletId} cannot be published.");
+
+        // Logging each message would make things even worse
+        long count = Interlocked.Increment(ref _rejectedCount);
+        if (count == 1 || count % RejectedMessagesLogInterval == 0)
+            _logger.LogWarning("MQTT publish queue is full, message {Topic} from {FirmletId} rejected ({Count} so far)", message.Topic, message.FirmletId, count);
+
+        return false;
+    }
+
+    // Messages are queued also before this, they're sent when we're connected to the coordinator
+    public void Start()
+    {
+        Debug.Assert(_sender is null);
+        _sender = Task.Run(SendAllAsync);
+    }
+
+    // Sends what's still in the queue, messages published after this are rejected
+    public async Task StopAsync()
+    {
+        // Set before completing the queue: a rejected message is never mistaken for a full queue
+        _closed = true;
+        _queue.Writer.TryComplete();
+
+        if (_sender is not null)
+            await _sender;
+    }
+
+    private const int RejectedMessagesLogInterval = 100;
+
+    private readonly ILogger<MqttPublishQueue> _logger = logger;
+    private readonly Settings _settings = settings;
+    private readonly IpcClient _ipcClient = ipcClient;
+    private readonly Channel<MqttMessage> _queue = Channel.CreateBounded<MqttMessage>(new BoundedChannelOptions(Math.Max(1, settings.HostMqttPublishQueueCapacity))
+    {
+        SingleReader = true,
+        FullMode = BoundedChannelFullMode.Wait,
+    });
+    private Task? _sender;
+    private volatile bool _closed;
+    private long _rejectedCount;
+
+    private async Task SendAllAsync()
+    {
+        int batchSize = Math.Max(1, _settings.HostMqttPublishBatchSize);
+        var batch = new List<MqttMessage>(batchSize);
+
+        // A burst is sent in batches (one IPC call each), a single message is sent as soon as it's queued
+        while (await _queue.Reader.WaitToReadAsync())
+        {
+            while (batch.Count < batchSize && _queue.Reader.TryRead(out var message))
+                batch.Add(message);
+
+            try
+            {
+                await _ipcClient.PublishMqttMessagesAsync(batch);
+            }
+            catch (Exception e)
+            {
+                _logger.LogError(e, "Cannot send {Count} MQTT message(s) to the coordinator, they have been dropped: {Message}", batch.Count, e.Message);
+            }
+
+            batch.Clear();
+        }
+    }
+}
@@ -1,20 +1,52 @@
 ﻿using Tinkwell.Firmwareless.WamrAotHost.Coordinator;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
 
 namespace Tinkwell.Firmwareless.WamrAotHost.Ipc.Requests;
 
 sealed class RegisterClientRequest
 {
     public required string ClientName { get; set; }
+
+    // Used only with Attach: the client opened its shared memory channel and MQTT messages can be sent there
+    public bool SharedMemory { get; set; }
+
+    // The client is a standby host, waiting for AssignFirmlets
+    public bool Standby { get; set; }
+}
+
+// Sent to a standby host: from now on it's the host HostId and it runs these firmlets (ID and path).
+sealed class AssignFirmletsRequest
+{
+    public required string HostId { get; set; }
+
+    public required Dictionary<string, string> Firmlets { get; set; }
+
+    // Path of the shared memory channel created for HostId, if any (see IpcServer.OpenDataChannel())
+    public string? DataChannel { get; set; }
+}
+
+// A batch of messages published by the firmlets of a host, in the same order they have been published.
+sealed class PublishMqttMessagesRequest
+{
+    public required List<MqttMessage> Messages { get; set; }
+}
+
+// Handled by IpcServer itself: it associates the connection with the client name, used to address notifications.
+static class IpcMethods
+{
+    public const string Attach = "Attach";
 }
 
 static class CoordinatorMethods
 {
     public const string RegisterClient = nameof(CoordinatorRpc.RegisterClient);
     public const string PublishMqttMessage = nameof(CoordinatorRpc.PublishMqttMessage);
+    public const string PublishMqttMessages = nameof(CoordinatorRpc.PublishMqttMessages);
 }
 
 static class HostMethods
 {
     public const string Shutdown = nameof(HostService.Shutdown);
     public const string ReceiveMqttMessage = nameof(HostService.ReceiveMqttMessage);
+    public const string AssignFirmlets = nameof(HostService.AssignFirmlets);
 }
\ No newline at end of file
@@ -6,7 +6,9 @@ namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
 
 [JsonSourceGenerationOptions(WriteIndented = true)]
 [JsonSerializable(typeof(RegisterClientRequest))]
+[JsonSerializable(typeof(AssignFirmletsRequest))]
 [JsonSerializable(typeof(MqttMessage))]
+[JsonSerializable(typeof(PublishMqttMessagesRequest))]
 partial class RpcJsonContext : JsonSerializerContext
 {
 }
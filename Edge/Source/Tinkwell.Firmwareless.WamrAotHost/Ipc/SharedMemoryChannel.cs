@@ -0,0 +1,276 @@
+﻿using Microsoft.Extensions.Logging;
+using System.Diagnostics;
+using System.IO.MemoryMappedFiles;
+using System.Numerics;
+using System.Security.Cryptography;
+using Tinkwell.Firmwareless.WamrAotHost.Coordinator.Mqtt;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+// Data plane between the coordinator and one host: MQTT messages are exchanged through two SharedMemoryRing
+// (one for each direction) stored in a file mapped by both processes. JSON-RPC is still used for everything
+// else (and for the messages which do not fit in the ring, see SendAsync()).
+// The coordinator creates (and deletes) the file before starting the host process, the host opens it. The file
+// has a random name and it's readable only by its owner: the messages are not visible to the other local users.
+// Each side has a thread which reads the incoming messages and passes them to the receive callback.
+sealed class SharedMemoryChannel : IDisposable
+{
+    public static bool IsSupported
+        => Futex.IsSupported;
+
+    public static string CreatePath()
+    {
+        // On Linux /dev/shm is a tmpfs: the file is never written to disk
+        var directory = Directory.Exists("/dev/shm") ? "/dev/shm" : Path.GetTempPath();
+        return Path.Combine(directory, $"tinkwell-{Convert.ToHexStringLower(RandomNumberGenerator.GetBytes(16))}.ipc");
+    }
+
+    public static SharedMemoryChannel Create(ILogger logger, string path, int capacity, Action<MqttMessage> receive)
+        => new(logger, path, capacity, owner: true, receive);
+
+    public static SharedMemoryChannel Open(ILogger logger, string path, Action<MqttMessage> receive)
+        => new(logger, path, capacity: 0, owner: false, receive);
+
+    // Sends the message with the ring, when it's full we wait for the other side to make room: the caller sees the
+    // backpressure (and its queue drops the messages if needed). A message which does not fit in the ring (or
+    // when the channel has been closed) is sent with fallback (JSON-RPC) but only after the other side received
+    // all the previous ones, meanwhile no other message is sent: the messages of a publisher are never reordered.
+    public async Task SendAsync(MqttMessage message, Func<MqttMessage, Task> fallback)
+    {
+        // The ring has a single producer but a host has one thread for each firmlet
+        await _sendLock.WaitAsync();
+        try
+        {
+            await SendImplAsync(message, fallback);
+        }
+        finally
+        {
+            _sendLock.Release();
+        }
+    }
+
+    // Sends the messages in order, see SendAsync(MqttMessage).
+    public async Task SendAsync(IReadOnlyList<MqttMessage> messages, Func<MqttMessage, Task> fallback)
+    {
+        await _sendLock.WaitAsync();
+        try
+        {
+            foreach (var message in messages)
+                await SendImplAsync(message, fallback);
+        }
+        finally
+        {
+            _sendLock.Release();
+        }
+    }
+
+    public void Dispose()
+    {
+        // After this nobody is writing (see TryWrite()) then we can safely unmap the memory
+        lock (_writeLock)
+        {
+            if (_disposed)
+                return;
+
+            _disposed = true;
+        }
+
+        _inbound.Interrupt();
+        _reader.Join();
+
+        _view.SafeMemoryMappedViewHandle.ReleasePointer();
+        _view.Dispose();
+        _file.Dispose();
+
+        if (_owner)
+            File.Delete(_path);
+    }
+
+    private const int Magic = 0x43504954; // "TIPC"
+    private const int FileHeaderSize = 64;
+    private const int FullRingPollingIntervalMs = 1;
+    private const int ReaderTimeoutMs = 1_000;
+
+    private readonly ILogger _logger;
+    private readonly string _path;
+    private readonly bool _owner;
+    private readonly Action<MqttMessage> _receive;
+    private readonly MemoryMappedFile _file;
+    private readonly MemoryMappedViewAccessor _view;
+    private readonly SharedMemoryRing _inbound;
+    private readonly SharedMemoryRing _outbound;
+    private readonly Thread _reader;
+    private readonly SemaphoreSlim _sendLock = new(1, 1);
+    private readonly object _writeLock = new();
+    private volatile bool _disposed;
+
+    private unsafe SharedMemoryChannel(ILogger logger, string path, int capacity, bool owner, Action<MqttMessage> receive)
+    {
+        _logger = logger;
+        _path = path;
+        _owner = owner;
+        _receive = receive;
+
+        if (owner)
+        {
+            // A new file is zero filled: both rings are empty. It must not exist: we do not want to reuse a file
+            // somebody else created (and could read).
+            var options = new FileStreamOptions { Mode = FileMode.CreateNew, Access = FileAccess.ReadWrite, Share = FileShare.ReadWrite };
+            if (!OperatingSystem.IsWindows())
+                options.UnixCreateMode = UnixFileMode.UserRead | UnixFileMode.UserWrite;
+
+            long size = FileHeaderSize + 2 * SharedMemoryRing.GetRequiredSize(capacity);
+            var stream = new FileStream(path, options);
+            try
+            {
+                _file = MemoryMappedFile.CreateFromFile(stream, null, size, MemoryMappedFileAccess.ReadWrite, HandleInheritability.None, leaveOpen: false);
+            }
+            catch
+            {
+                stream.Dispose();
+                File.Delete(path);
+                throw;
+            }
+        }
+        else
+        {
+            _file = MemoryMappedFile.CreateFromFile(path, FileMode.Open, null, 0, MemoryMappedFileAccess.ReadWrite);
+        }
+
+        _view = _file.CreateViewAccessor(0, 0, MemoryMappedFileAccess.ReadWrite);
+
+        byte* pointer = null;
+        _view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+        pointer += _view.PointerOffset;
+
+        if (owner)
+        {
+            ((int*)pointer)[1] = capacity;
+            Volatile.Write(ref *(int*)pointer, Magic);
+        }
+        else
+        {
+            capacity = ((int*)pointer)[1];
+            long expectedSize = FileHeaderSize + 2 * SharedMemoryRing.GetRequiredSize(capacity);
+            bool isValid = Volatile.Read(ref *(int*)pointer) == Magic
+                && capacity >= SharedMemoryRing.MinimumCapacity
+                && BitOperations.IsPow2(capacity)
+                && _view.Capacity >= expectedSize;
+
+            if (!isValid)
+            {
+                _view.SafeMemoryMappedViewHandle.ReleasePointer();
+                _view.Dispose();
+                _file.Dispose();
+                throw new HostException($"File {path} is not a valid shared memory channel.");
+            }
+        }
+
+        // The first ring goes from the coordinator (owner) to the host, the second one the other way around
+        var toHost = new SharedMemoryRing(pointer + FileHeaderSize, capacity);
+        var toCoordinator = new SharedMemoryRing(pointer + FileHeaderSize + SharedMemoryRing.GetRequiredSize(capacity), capacity);
+        _outbound = owner ? toHost : toCoordinator;
+        _inbound = owner ? toCoordinator : toHost;
+
+        _reader = new Thread(Run)
+        {
+            Name = $"IPC {Path.GetFileNameWithoutExtension(path)}",
+            IsBackground = true,
+        };
+        _reader.Start();
+    }
+
+    private async Task SendImplAsync(MqttMessage message, Func<MqttMessage, Task> fallback)
+    {
+        Debug.Assert(_sendLock.CurrentCount == 0);
+
+        int size = MqttMessageFraming.GetSize(message);
+        if (size == -1 || size > _outbound.MaximumMessageSize)
+        {
+            await WaitUntilDrainedAsync();
+            await fallback(message);
+            return;
+        }
+
+        var spinner = new SpinWait();
+        while (!TryWrite(message, size))
+        {
+            // The channel has been closed (the other side is gone), what's still in the ring is lost anyway
+            if (_disposed)
+            {
+                await fallback(message);
+                return;
+            }
+
+            // The ring is full: the other side is slow (or stuck). If it's just a burst then it's quickly drained.
+            if (spinner.NextSpinWillYield)
+                await Task.Delay(FullRingPollingIntervalMs);
+            else
+                spinner.SpinOnce();
+        }
+    }
+
+    private bool TryWrite(MqttMessage message, int size)
+    {
+        lock (_writeLock)
+        {
+            if (_disposed || !_outbound.TryBeginWrite(size, out var buffer))
+                return false;
+
+            MqttMessageFraming.Write(message, buffer);
+            _outbound.EndWrite();
+
+            return true;
+        }
+    }
+
+    // The reader passes a message to the receive callback before removing it from the ring (see Run()): when the
+    // ring is empty the other side received all the messages we sent.
+    private async Task WaitUntilDrainedAsync()
+    {
+        while (HasPendingMessages())
+            await Task.Delay(FullRingPollingIntervalMs);
+    }
+
+    private bool HasPendingMessages()
+    {
+        lock (_writeLock)
+            return !_disposed && _outbound.HasData;
+    }
+
+    private void Run()
+    {
+        while (!_disposed)
+        {
+            MqttMessage message;
+            try
+            {
+                if (!_inbound.TryBeginRead(out var buffer))
+                {
+                    _inbound.WaitForData(ReaderTimeoutMs);
+                    continue;
+                }
+
+                message = MqttMessageFraming.Read(buffer);
+            }
+            catch (HostException e)
+            {
+                // We cannot resynchronize a corrupted ring, messages from now on are lost
+                _logger.LogCritical(e, "Shared memory channel {Path} is not usable anymore: {Message}", _path, e.Message);
+                return;
+            }
+
+            try
+            {
+                _receive(message);
+            }
+            catch (Exception e)
+            {
+                _logger.LogError(e, "Error processing MQTT message {MessageInfo}: {Message}", message.ToString(), e.Message);
+            }
+
+            // Only now: the writer knows we received it (see WaitUntilDrainedAsync())
+            _inbound.EndRead();
+        }
+    }
+}
@@ -0,0 +1,162 @@
+﻿using System.Numerics;
+
+namespace Tinkwell.Firmwareless.WamrAotHost.Ipc;
+
+// Lock-free ring buffer with a single producer and a single consumer, stored in memory shared by two processes.
+// Each record is a 32 bit length followed by the message, aligned to 8 bytes. A record is never split: when it
+// does not fit at the end of the buffer we write a wrap marker and start again from the beginning, then the
+// consumer can always read a message as a single span (without copying it).
+// The producer and the consumer own their index (head and tail, in separate cache lines) and only read the other
+// one. The consumer sleeps on a futex when the ring is empty, the producer calls into the kernel only when
+// the consumer is actually sleeping.
+// The other process is not trusted (a host runs third party code): a corrupted ring must never make us read
+// or write outside the buffer.
+unsafe sealed class SharedMemoryRing
+{
+    public const int HeaderSize = 3 * CacheLineSize;
+    public const int MinimumCapacity = 4096;
+
+    public SharedMemoryRing(byte* region, int capacity)
+    {
+        if (capacity < MinimumCapacity || !BitOperations.IsPow2(capacity))
+            throw new ArgumentException($"Capacity must be a power of two and at least {MinimumCapacity} bytes.", nameof(capacity));
+
+        _head = (long*)region;
+        _tail = (long*)(region + CacheLineSize);
+        _signal = (int*)(region + 2 * CacheLineSize);
+        _waiting = _signal + 1;
+        _data = region + HeaderSize;
+        _capacity = capacity;
+    }
+
+    public static long GetRequiredSize(int capacity)
+        => HeaderSize + capacity;
+
+    // A message must leave enough room for the others, longer ones should go through a different channel
+    public int MaximumMessageSize
+        => _capacity / 4 - RecordHeaderSize;
+
+    public bool HasData
+        => Volatile.Read(ref *_head) != Volatile.Read(ref *_tail);
+
+    // Reserves the space for a message of the specified length, it fails if the ring is full. Write the message
+    // in the returned buffer then call EndWrite() to publish it.
+    public bool TryBeginWrite(int length, out Span<byte> buffer)
+    {
+        buffer = default;
+        if (length < 0 || length > MaximumMessageSize)
+            return false;
+
+        long head = *_head;
+        long tail = Volatile.Read(ref *_tail);
+
+        int recordSize = AlignRecordSize(length);
+        int offset = (int)(head & (_capacity - 1));
+        int padding = offset + recordSize > _capacity ? _capacity - offset : 0;
+
+        if (head + padding + recordSize - tail > _capacity)
+            return false;
+
+        if (padding > 0)
+        {
+            *(int*)(_data + offset) = WrapMarker;
+            head += padding;
+            offset = 0;
+        }
+
+        *(int*)(_data + offset) = length;
+        _pendingHead = head + recordSize;
+        buffer = new Span<byte>(_data + offset + RecordHeaderSize, length);
+
+        return true;
+    }
+
+    public void EndWrite()
+    {
+        Volatile.Write(ref *_head, _pendingHead);
+
+        // This is also a full barrier: the consumer sets _waiting before checking the head for the last time,
+        // we publish the head before checking _waiting. At least one of us sees the other's write.
+        Interlocked.Increment(ref *_signal);
+        if (Volatile.Read(ref *_waiting) != 0)
+            Futex.Wake(_signal, 1);
+    }
+
+    // Returns the next message without removing it, call EndRead() when done with the buffer.
+    public bool TryBeginRead(out ReadOnlySpan<byte> buffer)
+    {
+        buffer = default;
+
+        long tail = *_tail;
+        long head = Volatile.Read(ref *_head);
+        if (head == tail)
+            return false;
+
+        int offset = (int)(tail & (_capacity - 1));
+        int length = *(int*)(_data + offset);
+        if (length == WrapMarker)
+        {
+            tail += _capacity - offset;
+            offset = 0;
+            length = *(int*)_data;
+        }
+
+        if (length < 0 || length > MaximumMessageSize || offset + AlignRecordSize(length) > _capacity)
+            throw new HostException($"Shared memory ring is corrupted (record of {length} bytes at {offset}).");
+
+        _pendingTail = tail + AlignRecordSize(length);
+        buffer = new ReadOnlySpan<byte>(_data + offset + RecordHeaderSize, length);
+
+        return true;
+    }
+
+    public void EndRead()
+        => Volatile.Write(ref *_tail, _pendingTail);
+
+    // Blocks the consumer until there is something to read, the timeout is used to check whether
+    // the channel has been closed. It could also return spuriously.
+    public void WaitForData(int timeoutMs)
+    {
+        // Under load the next message is usually coming in a moment, spinning for a bit is cheaper than a syscall
+        for (int i = 0; i < SpinCount; ++i)
+        {
+            if (HasData)
+                return;
+
+            Thread.SpinWait(SpinIterations);
+        }
+
+        int observed = Volatile.Read(ref *_signal);
+        Interlocked.Exchange(ref *_waiting, 1);
+
+        if (!HasData)
+            Futex.Wait(_signal, observed, timeoutMs);
+
+        Volatile.Write(ref *_waiting, 0);
+    }
+
+    // Wakes up the consumer (if it's waiting) without writing anything, used when closing the channel.
+    public void Interrupt()
+    {
+        Interlocked.Increment(ref *_signal);
+        Futex.Wake(_signal, 1);
+    }
+
+    private const int CacheLineSize = 64;
+    private const int RecordHeaderSize = 8;
+    private const int WrapMarker = -1;
+    private const int SpinCount = 64;
+    private const int SpinIterations = 32;
+
+    private readonly long* _head;
+    private readonly long* _tail;
+    private readonly int* _signal;
+    private readonly int* _waiting;
+    private readonly byte* _data;
+    private readonly int _capacity;
+    private long _pendingHead;
+    private long _pendingTail;
+
+    private static int AlignRecordSize(int length)
+        => (RecordHeaderSize + length + 7) & ~7;
+}
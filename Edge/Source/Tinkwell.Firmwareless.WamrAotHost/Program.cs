@@ -31,12 +31,12 @@ builder.ConfigureServices((context, services) =>
     if (cli.RequiredService == RequiredService.Host)
     {
         services
-            .AddSingleton<IMqttQueue, MqttQueue>()
             .AddSingleton<IWamrHost, WamrHost>()
             .AddSingleton<IHostExportedFunctions, HostExportedFunctions>()
             .AddSingleton<IRegisterHostUnsafeNativeFunctions, HostExportedUnsafeNativeFunctions>()
             .AddSingleton(cli.GetHostServiceOptions())
             .AddSingleton<IpcClient>()
+            .AddSingleton<MqttPublishQueue>()
             .AddHostedService<HostService>();
     }
     else
@@ -46,8 +46,11 @@ builder.ConfigureServices((context, services) =>
             .AddHostedService<MqttMessagesProcessingService>()
             .AddSingleton(cli.GetCoordinatorServiceOptions())
             .AddSingleton<IpcServer>()
+            .AddSingleton<ResourcesUsageMeter>()
+            .AddSingleton<HostProcessControl>()
             .AddSingleton<SystemResourcesUsageArbiter>()
             .AddSingleton<FirmletsRepository>()
+            .AddSingleton<StandbyHostsPool>()
             .AddSingleton<CoordinatorRpc>()
             .AddSingleton<HostProcessesCoordinator>()
             .AddHostedService<CoordinatorService>();
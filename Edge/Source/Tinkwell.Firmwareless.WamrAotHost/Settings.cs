@@ -1,5 +1,44 @@
 ﻿namespace Tinkwell.Firmwareless.WamrAotHost;
 
+public enum HostingMode
+{
+    // Each firmlet runs in its own host process
+    Isolated,
+    // Firmlets marked as trusted in the firmlets file share their host processes, the others are isolated
+    PooledTrusted,
+    // All the firmlets share their host processes
+    Pooled,
+}
+
+public enum IpcTransport
+{
+    // MQTT messages are exchanged with JSON-RPC, like all the other requests
+    JsonRpc,
+    // MQTT messages are exchanged through a ring buffer in shared memory (Linux only), JSON-RPC is used for the rest
+    SharedMemory,
+}
+
+public enum MqttQueueFullMode
+{
+    // The oldest message in the queue is dropped to make room for the new one
+    DropOldest,
+    // The new message is dropped
+    RejectNew,
+}
+
+public enum HostSuspensionMode
+{
+    // Hosts are never throttled or suspended
+    Disabled,
+    // Hosts are throttled lowering the priority of their threads and suspended with SIGSTOP/SIGCONT (suspension is
+    // Linux only). A throttled host still gets the idle CPU time, to restore its priority the coordinator needs
+    // CAP_SYS_NICE (or RLIMIT_NICE): without it this is the same as Disabled.
+    Signals,
+    // Each host has its own cgroup (v2): hosts are throttled with cpu.max and suspended with the freezer. The
+    // coordinator moves itself to a child cgroup then the hierarchy must be writable (it falls back to Signals)
+    Cgroups,
+}
+
 public sealed class Settings
 {
     public int CoordinatorStartProcessTimeoutMs { get; set; } = 30_000;
@@ -9,11 +48,42 @@ public sealed class Settings
     public int CoordinatorMaxHostRestartsPerHour { get; set; } = 10;
     public int CoordinatorMaxHostCpuUsagePercentage { get; set; } = 70;
     public int CoordinatorMaxHostMemoryUsagePercentage { get; set; } = 30;
+    public HostingMode CoordinatorHostingMode { get; set; } = HostingMode.Isolated;
+    public int CoordinatorMaxFirmletsPerHost { get; set; } = 8;
+    public int CoordinatorStandbyHosts { get; set; } = 1;
+    public HostSuspensionMode CoordinatorHostSuspensionMode { get; set; } = HostSuspensionMode.Disabled;
+    public int CoordinatorSystemHighCpuUsagePercentage { get; set; } = 90;
+    public int CoordinatorSystemLowCpuUsagePercentage { get; set; } = 70;
+    public int CoordinatorSystemHighPressurePercentage { get; set; } = 40;
+    public int CoordinatorSystemLowPressurePercentage { get; set; } = 10;
+    public int CoordinatorThrottledHostCpuPercentage { get; set; } = 10;
 
     public int HostConnectionTimeout { get; set; } = 5_000;
     public int HostMaxConnectionAttempts { get; set; } = 5;
     public int HostDelayBetweenAttemptsMs { get; set; } = 1_000;
+    public int HostDefaultStackSize { get; set; } = 65_536;
+    public int HostDefaultHeapSize { get; set; } = 65_536;
+    public int HostMaxStackSize { get; set; } = 1_048_576;
+    public int HostMaxHeapSize { get; set; } = 4_194_304;
+    public int HostDefaultNativeStackSize { get; set; } = 131_072;
+    public int HostMaxNativeStackSize { get; set; } = 1_048_576;
+    public int HostEstimatedCallDepth { get; set; } = 32;
+    public int HostStartupBudgetMs { get; set; } = 10_000;
+    public int HostCallbackBudgetMs { get; set; } = 1_000;
+    public int HostMaxBudgetOverruns { get; set; } = 3;
+    public bool HostRestartOnStuckModule { get; set; } = false;
+    public int HostMqttPublishQueueCapacity { get; set; } = 1_024;
+    public int HostMqttPublishBatchSize { get; set; } = 64;
+    public int HostMessageQueueCapacity { get; set; } = 256;
+    public MqttQueueFullMode HostMessageQueueFullMode { get; set; } = MqttQueueFullMode.DropOldest;
+
+    public IpcTransport IpcTransport { get; set; } = IpcTransport.JsonRpc;
+    public int IpcRingBufferSize { get; set; } = 262_144;
 
     public int MqttMaxRetries { get; set; } = 3;
     public int MqttDelayBetweenRetriesMs { get; set; } = 1_000;
+    public int MqttHostQueueCapacity { get; set; } = 256;
+    public MqttQueueFullMode MqttHostQueueFullMode { get; set; } = MqttQueueFullMode.DropOldest;
+    public int MqttMaxInFlightPublishes { get; set; } = 16;
+    public int MqttStopTimeoutMs { get; set; } = 5_000;
 }
@@ -0,0 +1,57 @@
+;; Sample firmlet for the host functions (HostExportedUnsafeNativeFunctions), used by Tinkwell.Firmwareless.Tools.WamrBenchmark.
+;; Each export calls one host function $count times in a loop, with the same arguments. It traps (then the call fails)
+;; if the host function returns an error: a failed call takes another path and must not be measured.
+;; host_calls.wasm is built from this file with "wat2wasm host_calls.wat".
+(module
+  (import "env" "tw_log" (func $tw_log (param i32 i32 i32 i32 i32) (result i32)))
+  (import "env" "tw_mqtt_publish" (func $tw_mqtt_publish (param i32 i32 i32 i32) (result i32)))
+  (import "env" "tw_read" (func $tw_read (param i32 i32 i32 i32 i32) (result i32)))
+  (import "env" "tw_write" (func $tw_write (param i32 i32 i32 i32 i32) (result i32)))
+
+  (memory (export "memory") 1)
+
+  (data (i32.const 16) "benchmark/telemetry")
+  (data (i32.const 48) "{\"value\":42}")
+
+  ;; Buffer for tw_read and tw_write: 64 bytes at 1024
+
+  (func (export "call_log") (param $count i32)
+    (local $i i32)
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (local.get $count)))
+        (if (i32.lt_s (call $tw_log (i32.const 2) (i32.const 16) (i32.const 19) (i32.const 48) (i32.const 12)) (i32.const 0))
+          (then (unreachable)))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next))))
+
+  (func (export "call_mqtt_publish") (param $count i32)
+    (local $i i32)
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (local.get $count)))
+        (if (i32.lt_s (call $tw_mqtt_publish (i32.const 16) (i32.const 19) (i32.const 48) (i32.const 12)) (i32.const 0))
+          (then (unreachable)))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next))))
+
+  (func (export "call_read") (param $count i32)
+    (local $i i32)
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (local.get $count)))
+        (if (i32.lt_s (call $tw_read (i32.const 1) (i32.const 1024) (i32.const 64) (i32.const 64) (i32.const 0)) (i32.const 0))
+          (then (unreachable)))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next))))
+
+  (func (export "call_write") (param $count i32)
+    (local $i i32)
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (local.get $count)))
+        (if (i32.lt_s (call $tw_write (i32.const 1) (i32.const 1024) (i32.const 64) (i32.const 64) (i32.const 0)) (i32.const 0))
+          (then (unreachable)))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next))))
+)
@@ -0,0 +1,16 @@
+;; Test firmlet for the time budgets of the calls into the modules (see WasmWatchdog): it starts normally
+;; and then it never returns from _on_message_received. The host should terminate each call, restart the
+;; module and disable it after HostMaxBudgetOverruns, without affecting the other firmlets.
+;; infinite_loop.wasm is built from this file with "wat2wasm infinite_loop.wat".
+(module
+  (memory (export "memory") 1)
+
+  (func (export "_initialize") (param $id i32) (param $id_len i32))
+
+  (func (export "_start") (param $reason i32))
+
+  (func (export "_dispose") (param $reason i32))
+
+  (func (export "_on_message_received") (param $topic i32) (param $topic_len i32) (param $payload i32) (param $payload_len i32)
+    (loop $forever
+      (br $forever))))
@@ -0,0 +1,19 @@
+;; Sample firmlet for the delivery of MQTT messages (Wamr.CallExportSSV), used by Tinkwell.Firmwareless.Tools.WamrBenchmark.
+;; It does nothing with the messages but it traps (then the call fails) if the payload did not arrive: it must not be
+;; empty and it must start with "{" (the topic never does).
+;; message_sink.wasm is built from this file with "wat2wasm message_sink.wat".
+(module
+  (memory (export "memory") 1)
+
+  (func (export "_initialize") (param $id i32) (param $id_len i32))
+
+  (func (export "_start") (param $reason i32))
+
+  (func (export "_dispose") (param $reason i32))
+
+  (func (export "_on_message_received") (param $topic i32) (param $topic_len i32) (param $payload i32) (param $payload_len i32)
+    (if (i32.eqz (local.get $payload_len))
+      (then (unreachable)))
+    (if (i32.ne (i32.load8_u (local.get $payload)) (i32.const 123))
+      (then (unreachable))))
+)
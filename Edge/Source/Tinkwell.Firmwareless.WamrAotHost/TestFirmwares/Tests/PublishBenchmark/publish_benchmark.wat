@@ -0,0 +1,85 @@
+;; Sample firmlet for the MQTT publishing path (see MqttPublishQueue): for each message it receives it publishes
+;; a burst of 2048 messages, 1024 with tw_mqtt_publish and 1024 with tw_mqtt_publish_batch (64 batches of 16 messages).
+;; It does not retry: it logs how many messages have been rejected because the publish queue of the host was full.
+;; Tinkwell.Firmwareless.Tools.IpcBenchmark measures the same path without the runtime.
+;; publish_benchmark.wasm is built from this file with "wat2wasm publish_benchmark.wat".
+(module
+  (import "env" "tw_log" (func $tw_log (param i32 i32 i32 i32 i32) (result i32)))
+  (import "env" "tw_mqtt_publish" (func $tw_mqtt_publish (param i32 i32 i32 i32) (result i32)))
+  (import "env" "tw_mqtt_publish_batch" (func $tw_mqtt_publish_batch (param i32 i32) (result i32)))
+
+  (memory (export "memory") 1)
+
+  (data (i32.const 16) "benchmark/telemetry")
+  (data (i32.const 48) "{\"value\":42}")
+  (data (i32.const 64) "publish_benchmark")
+  (data (i32.const 128) "burst of 2048 messages published, rejected: ")
+
+  ;; 16 messages: topic length and payload length (32 bit, little endian) followed by their text
+  (data (i32.const 1024)
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}"
+    "\13\00\00\00\0c\00\00\00benchmark/telemetry{\"value\":42}")
+
+  (func (export "_initialize") (param $id i32) (param $id_len i32))
+
+  (func (export "_start") (param $reason i32))
+
+  (func (export "_dispose") (param $reason i32))
+
+  (func (export "_on_message_received") (param $topic i32) (param $topic_len i32) (param $payload i32) (param $payload_len i32)
+    (local $i i32)
+    (local $rejected i32)
+    (local $queued i32)
+    (local $digit i32)
+
+    (local.set $i (i32.const 0))
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (i32.const 1024)))
+        (if (call $tw_mqtt_publish (i32.const 16) (i32.const 19) (i32.const 48) (i32.const 12))
+          (then (local.set $rejected (i32.add (local.get $rejected) (i32.const 1)))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next)))
+
+    ;; The result is the number of messages queued or an error code (Busy when none of them has been queued)
+    (local.set $i (i32.const 0))
+    (block $done
+      (loop $next
+        (br_if $done (i32.ge_u (local.get $i) (i32.const 64)))
+        (local.set $queued (call $tw_mqtt_publish_batch (i32.const 1024) (i32.const 624)))
+        (local.set $rejected
+          (i32.add
+            (local.get $rejected)
+            (i32.sub
+              (i32.const 16)
+              (select (local.get $queued) (i32.const 0) (i32.gt_s (local.get $queued) (i32.const 0))))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $next)))
+
+    ;; Ten digits (zero padded) after the text of the message
+    (local.set $digit (i32.const 9))
+    (block $done
+      (loop $next
+        (i32.store8
+          (i32.add (i32.const 172) (local.get $digit))
+          (i32.add (i32.rem_u (local.get $rejected) (i32.const 10)) (i32.const 48)))
+        (local.set $rejected (i32.div_u (local.get $rejected) (i32.const 10)))
+        (br_if $done (i32.eqz (local.get $digit)))
+        (local.set $digit (i32.sub (local.get $digit) (i32.const 1)))
+        (br $next)))
+
+    (drop (call $tw_log (i32.const 2) (i32.const 64) (i32.const 17) (i32.const 128) (i32.const 54)))))
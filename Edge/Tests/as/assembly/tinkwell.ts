@@ -1,6 +1,6 @@
 // An higher level interface to interact with Tinkwell Firmwareless services
 
-import { tw_log, tw_mqtt_publish, tw_open, tw_close, tw_read, tw_write } from "../env";
+import { tw_log, tw_mqtt_publish, tw_mqtt_publish_batch, tw_open, tw_close, tw_read, tw_write } from "../env";
 
 export enum Reason { Lifecycle = 0 };
 
@@ -35,6 +35,8 @@ function handleErrorCode(errorCode: i32) {
       throw new errors.TinkwellError("Operation not supported by this resource.", errorCode);
     case errors.ERROR_NOT_FOUND:
       throw new errors.TinkwellError("Resource not found.", errorCode);
+    case errors.ERROR_BUSY:
+      throw new errors.TinkwellError("The host is busy, try again later.", errorCode);
     default:
       throw new errors.TinkwellError("Operation failed", errorCode);
   }
@@ -117,10 +119,59 @@ export namespace events {
 }
 
 export namespace mqtt {
-  export function publish(topic: string, payload: string): void {
+  export class Message {
+    constructor(public topic: string, public payload: string) {}
+  }
+
+  // Messages are queued by the host, it returns false when its queue is full: the message has not been
+  // published and the firmlet can try again later (or drop it, or merge it with the next one).
+  export function publish(topic: string, payload: string): bool {
     const topicBuf = String.UTF8.encode(topic, true);
     const payloadBuf = String.UTF8.encode(payload, true);
-    tw_mqtt_publish(changetype<usize>(topicBuf), topicBuf.byteLength, changetype<usize>(payloadBuf), payloadBuf.byteLength);
+    const result = tw_mqtt_publish(changetype<usize>(topicBuf), topicBuf.byteLength, changetype<usize>(payloadBuf), payloadBuf.byteLength);
+
+    if (result === errors.ERROR_BUSY)
+      return false;
+
+    if (result < 0)
+      handleErrorCode(result);
+
+    return true;
+  }
+
+  // Publishes all the messages with a single call, it returns how many of them (in order) have been queued:
+  // when the queue of the host is full the others have not been published.
+  export function publishBatch(messages: Message[]): i32 {
+    const buffers = new Array<ArrayBuffer>(messages.length * 2);
+    let size = 0;
+    for (let i = 0; i < messages.length; ++i) {
+      buffers[i * 2] = String.UTF8.encode(messages[i].topic);
+      buffers[i * 2 + 1] = String.UTF8.encode(messages[i].payload);
+      size += 8 + buffers[i * 2].byteLength + buffers[i * 2 + 1].byteLength;
+    }
+
+    // Each message is the length of the topic and of the payload followed by their text
+    const batch = new ArrayBuffer(size);
+    const view = new DataView(batch);
+    let offset = 0;
+    for (let i = 0; i < buffers.length; i += 2) {
+      const topicBuf = buffers[i];
+      const payloadBuf = buffers[i + 1];
+      view.setUint32(offset, topicBuf.byteLength, true);
+      view.setUint32(offset + 4, payloadBuf.byteLength, true);
+      memory.copy(changetype<usize>(batch) + offset + 8, changetype<usize>(topicBuf), topicBuf.byteLength);
+      memory.copy(changetype<usize>(batch) + offset + 8 + topicBuf.byteLength, changetype<usize>(payloadBuf), payloadBuf.byteLength);
+      offset += 8 + topicBuf.byteLength + payloadBuf.byteLength;
+    }
+
+    const result = tw_mqtt_publish_batch(changetype<usize>(batch), batch.byteLength);
+    if (result === errors.ERROR_BUSY)
+      return 0;
+
+    if (result < 0)
+      handleErrorCode(result);
+
+    return result;
   }
 }
 
@@ -177,6 +228,7 @@ export namespace errors {
   export const ERROR_ARGUMENT_INVALID_FORMAT: i32 = -22;
   export const ERROR_NOT_FOUND: i32 = -31;
   export const ERROR_NO_ACCESS: i32 = -32;
+  export const ERROR_BUSY: i32 = -40;
 
   export class TinkwellError extends Error {
     private readonly _code: i32;